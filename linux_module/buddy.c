@@ -279,12 +279,42 @@ int buddy_remove_pool(struct buddy_memzone * zone,
 
 
 
+/**
+ * Finds the first 2^order piece of a free block of size 2^block_order
+ * that starts at a physical address aligned to alignment, and that is
+ * also a buddy block (so that trimming can carve it out).  Blocks are
+ * aligned only relative to the base of their pool, so a pool whose base
+ * is not aligned may have large free blocks with no aligned piece.
+ *
+ * Returns nonzero and sets *piece if there is one.
+ */
+static int
+find_aligned_piece(uintptr_t block_pa, unsigned long block_order, 
+		   unsigned long order, unsigned long alignment, uintptr_t *piece)
+{
+    uintptr_t target = (block_pa + alignment - 1) & ~(alignment - 1);
+
+    if ((target - block_pa) & ((1UL << order) - 1)) {
+	return 0;
+    }
+
+    if (target + (1UL << order) > block_pa + (1UL << block_order)) {
+	return 0;
+    }
+
+    *piece = target;
+
+    return 1;
+}
+
+
 /**
  * Allocates a block of memory of the requested size (2^order bytes).
  *
  * Arguments:
  *       [IN] mp:    Buddy system memory allocator object.
  *       [IN] order: Block size to allocate (2^order bytes).
+ *       [IN] alignment: required alignment of the physical address (power of two)
  *       [IN] filter_func: returns nonzero if given paddr is OK to use
  *       [IN] filter_state: opaque argument to filter_func
  * Returns:
@@ -292,7 +322,7 @@ int buddy_remove_pool(struct buddy_memzone * zone,
  *       Failure: NULL
  */
 uintptr_t
-buddy_alloc(struct buddy_memzone *zone, unsigned long order, int (*filter_func)(void *paddr, void *filter_state), void *filter_state)
+buddy_alloc(struct buddy_memzone *zone, unsigned long order, unsigned long alignment, int (*filter_func)(void *paddr, void *filter_state), void *filter_state)
 {
     unsigned long j;
     struct buddy_mempool * mp = NULL;
@@ -300,16 +330,23 @@ buddy_alloc(struct buddy_memzone *zone, unsigned long order, int (*filter_func)(
     struct list_head * cur = NULL;
     struct block * block = NULL;
     struct block * buddy_block = NULL;
+    uintptr_t piece = 0;
     unsigned long flags = 0;
 
     BUG_ON(zone == NULL);
     BUG_ON(order > zone->max_order);
+    BUG_ON(alignment & (alignment - 1));
 
     /* Fixup requested order to be at least the minimum supported */
     if (order < zone->min_order) {
 	order = zone->min_order;
     }
 
+    /* Every block is aligned to the minimum block size */
+    if (alignment < (1UL << zone->min_order)) {
+	alignment = 1UL << zone->min_order;
+    }
+
     INFO("zone=%p, order=%lu\n", zone, order);
 
     palacios_spinlock_lock_irqsave(&(zone->lock), flags);
@@ -329,14 +366,18 @@ buddy_alloc(struct buddy_memzone *zone, unsigned long order, int (*filter_func)(
 	list_for_each(cur, list) {
 	    block = list_entry(cur, struct block, link);
 
+	    if (!find_aligned_piece(__pa(block), j, order, alignment, &piece)) {
+		// no suitably aligned piece in this block
+		block=NULL;
+		continue;
+	    }
+
 	    if (!filter_func) {
 		// without a filter, we just want the first one
 		break;
 	    } else {
 
-		void *block_pa = (void*)__pa(block);
-
-		if (filter_func(block_pa,filter_state)) { 
+		if (filter_func((void*)piece,filter_state)) { 
 		    // this block will work
 		    break;
 		} else {
@@ -363,16 +404,25 @@ buddy_alloc(struct buddy_memzone *zone, unsigned long order, int (*filter_func)(
 
 	INFO("pool=%p, block=%p, order=%lu, j=%lu\n", mp, block, order, j);
 
-	/* Trim if a higher order block than necessary was allocated */
+	/* Trim if a higher order block than necessary was allocated,
+	   keeping whichever half holds the aligned piece */
 	while (j > order) {
 	    --j;
-	    buddy_block = (struct block *)((unsigned long)block + (1UL << j));
+	    if (piece >= __pa(block) + (1UL << j)) {
+		buddy_block = block;
+		block = (struct block *)((unsigned long)block + (1UL << j));
+		block->mp = mp;
+	    } else {
+		buddy_block = (struct block *)((unsigned long)block + (1UL << j));
+	    }
 	    buddy_block->mp = mp;
 	    buddy_block->order = j;
 	    mark_available(mp, buddy_block);
 	    list_add(&(buddy_block->link), &(zone->avail[j]));
 	}
 
+	mark_allocated(mp, block);
+
 	mp->num_free_blocks -= (1UL << (order - zone->min_order));
 
 	palacios_spinlock_unlock_irqrestore(&(zone->lock), flags);
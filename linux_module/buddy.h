@@ -93,10 +93,11 @@ buddy_remove_pool(struct buddy_memzone * zone,
 
 
 
-/* Allocate pages, returns physical address */
+/* Allocate pages, returns physical address aligned to alignment (a power of two) */
 extern uintptr_t 
 buddy_alloc(struct buddy_memzone * zone,
 	    unsigned long order,
+	    unsigned long alignment,
 	    int (*filter_func)(void *paddr, void *filter_state),
 	    void *filter_state);
 
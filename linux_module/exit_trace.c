@@ -0,0 +1,154 @@
+#include <linux/errno.h>
+#include <linux/sched.h>
+#include <linux/uaccess.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/anon_inodes.h>
+#include <linux/file.h>
+
+#include "palacios.h"
+#include "exit_trace.h"
+#include "linux-exts.h"
+#include "vm.h"
+
+
+struct exit_trace_conn {
+    unsigned long ring_pa;
+    uint64_t size;
+    struct v3_exit_trace_buf * buf;
+};
+
+
+static int exit_trace_mmap(struct file * filp, struct vm_area_struct * vma) {
+    struct exit_trace_conn * conn = filp->private_data;
+    unsigned long len = vma->vm_end - vma->vm_start;
+
+    if ((vma->vm_pgoff != 0) || (len > conn->size)) {
+	ERROR("palacios: exit trace mapping must start at 0 and be at most %llu bytes\n", conn->size);
+	return -EINVAL;
+    }
+
+    // The ring has a single writer (the core), readers get to look only
+    if (vma->vm_flags & VM_WRITE) {
+	ERROR("palacios: exit trace ring can only be mapped read-only\n");
+	return -EPERM;
+    }
+
+    // and cannot be upgraded to writable later with mprotect
+    vma->vm_flags &= ~VM_MAYWRITE;
+
+    if (remap_pfn_range(vma, vma->vm_start, conn->ring_pa >> PAGE_SHIFT, len, vma->vm_page_prot)) {
+	ERROR("palacios: unable to map exit trace ring\n");
+	return -EAGAIN;
+    }
+
+    return 0;
+}
+
+
+static int exit_trace_release(struct inode * i, struct file * filp) {
+    struct exit_trace_conn * conn = filp->private_data;
+
+    // Mappings hold the file, so by now nothing can see the ring through us
+    v3_exit_trace_put_ring(conn->buf);
+    palacios_free(conn);
+
+    return 0;
+}
+
+
+static struct file_operations exit_trace_fops = {
+    .mmap     = exit_trace_mmap,
+    .release  = exit_trace_release,
+};
+
+
+/* 
+ * The connection holds a reference to the ring until the fd is released,
+ * which is after the last mapping of it is gone, so the ring can outlive
+ * the VM
+ */
+static int exit_trace_connect(struct v3_guest * guest,
+			      unsigned int ioctl,
+			      unsigned long arg,
+			      void * priv_data)
+{
+    struct exit_trace_conn * conn = NULL;
+    struct v3_exit_trace_buf * buf = NULL;
+    void * ring_pa = NULL;
+    uint64_t size = 0;
+    int fd = 0;
+
+    if (v3_exit_trace_get_ring(guest->v3_ctx, (int)arg, &ring_pa, &size, &buf)) {
+	ERROR("palacios: unable to find exit trace ring for core %lu\n", arg);
+	return -EFAULT;
+    }
+
+    conn = palacios_alloc(sizeof(struct exit_trace_conn));
+
+    if (!conn) {
+	ERROR("palacios: unable to allocate exit trace connection\n");
+	v3_exit_trace_put_ring(buf);
+	return -ENOMEM;
+    }
+
+    conn->ring_pa = (unsigned long)ring_pa;
+    conn->size = size;
+    conn->buf = buf;
+
+    fd = anon_inode_getfd("v3-exittrace", &exit_trace_fops, conn, O_RDONLY);
+
+    if (fd < 0) {
+	ERROR("palacios: error creating exit trace inode\n");
+	v3_exit_trace_put_ring(buf);
+	palacios_free(conn);
+	return fd;
+    }
+
+    return fd;
+}
+
+
+static int exit_trace_init( void ) {
+
+    // nothing yet
+    return 0;
+}
+
+
+static int exit_trace_deinit( void ) {
+
+    // nothing yet
+    return 0;
+}
+
+
+
+static int guest_exit_trace_init(struct v3_guest * guest, void ** vm_data) 
+{
+
+    add_guest_ctrl(guest, V3_VM_EXIT_TRACE_CONNECT, exit_trace_connect, guest);
+
+    return 0;
+}
+
+
+static int guest_exit_trace_deinit(struct v3_guest * guest, void * vm_data) {
+
+    remove_guest_ctrl(guest, V3_VM_EXIT_TRACE_CONNECT);
+
+    return 0;
+}
+
+
+
+static struct linux_ext exit_trace_ext = {
+    .name = "EXIT_TRACE_EXTENSION",
+    .init = exit_trace_init,
+    .deinit = exit_trace_deinit,
+    .guest_init = guest_exit_trace_init,
+    .guest_deinit = guest_exit_trace_deinit
+};
+
+
+register_extension(&exit_trace_ext);
@@ -0,0 +1,15 @@
+/*
+ * Palacios VM Exit Trace Userland Interface
+ */
+
+#ifndef __PALACIOS_EXIT_TRACE_H__
+#define __PALACIOS_EXIT_TRACE_H__
+
+#include <palacios/vmm_exit_trace.h>
+
+#define V3_VM_EXIT_TRACE_CONNECT 320
+
+// The argument is the vcore number
+// Returns an fd whose mmap (offset 0, read-only) is that core's struct v3_exit_trace_ring
+
+#endif
@@ -222,6 +222,10 @@ static void * palacios_file_open(const char * path, int mode, void * private_dat
 	pfile->mode |= O_CREAT;
     }
 
+    if (mode & FILE_OPEN_MODE_TRUNC) {
+	pfile->mode |= O_TRUNC;
+    }
+
 
     pfile->mode |= O_LARGEFILE;
 
@@ -17,6 +17,10 @@
 #define V3_KSTREAM_REQUEST_PULL_IOCTL  (11244+2)
 // push a response to the previously pulled request
 #define V3_KSTREAM_RESPONSE_PUSH_IOCTL (11244+3)
+// set up a shared request ring, then mmap the fd to reach it
+#define V3_KSTREAM_RING_SETUP_IOCTL    (11244+4)
+// tell the kernel that ring requests have been completed
+#define V3_KSTREAM_RING_KICK_IOCTL     (11244+5)
 
 #ifdef __KERNEL__
 #define USER __user
@@ -66,6 +70,56 @@ struct palacios_user_keyed_stream_op {
 };
 
 
+//
+// Shared request ring
+//
+// Instead of pulling each request with an ioctl, user space can ask for
+// a ring (V3_KSTREAM_RING_SETUP_IOCTL with the desired size, which is
+// rounded up and written back) and mmap the fd.  The mapping starts with
+// this structure, followed by the data area at data_off.
+//
+// The kernel posts requests in slots[head % num_slots] and advances head;
+// user space completes them in order and advances tail.  A request's 
+// buffer is the buf_len bytes at buf_pos in the data area, laid out as in
+// palacios_user_keyed_stream_op: the tag, then (from data_off) the data.
+// A read is answered by placing the data at the start of the buffer, 
+// over the tag, and setting xfer.  Write and close requests are not 
+// waited for, so several can be outstanding; a failed write is reported
+// to Palacios on a later request.
+//
+// poll/select on the fd reports pending requests.  After advancing tail,
+// user space must issue V3_KSTREAM_RING_KICK_IOCTL if host_waiting is set.
+// Requests too large for the data area still go through the ioctls above,
+// after the ring has drained.
+//
+#define PALACIOS_KSTREAM_RING_SLOTS    64
+#define PALACIOS_KSTREAM_RING_MIN      (64*1024)
+#define PALACIOS_KSTREAM_RING_MAX      (1024*1024*1024ULL)
+
+struct palacios_user_keyed_stream_slot {
+    int      type;      // as for palacios_user_keyed_stream_op
+    int      rsvd;
+    sint64_t xfer;      // request: data to read or write; response: data read or written, <0 on error
+    uint64_t user_key;  // user tag for an open key (response to open, request otherwise)
+    uint64_t buf_pos;   // offset of the buffer in the data area
+    uint64_t buf_len;
+    uint64_t data_off;
+};
+
+struct palacios_user_keyed_stream_ring {
+    uint64_t size;                   // of the whole mapping
+    uint64_t data_off;               // data area offset in the mapping
+    uint64_t data_len;
+    uint32_t num_slots;
+    volatile uint32_t host_waiting;  // kernel is asleep until tail moves
+
+    volatile uint64_t head;          // requests posted (kernel)
+    volatile uint64_t tail;          // requests completed (user)
+
+    struct palacios_user_keyed_stream_slot slots[PALACIOS_KSTREAM_RING_SLOTS];
+};
+
+
 
 
 
@@ -46,6 +46,8 @@
 #include <linux/socket.h>
 #include <linux/net.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
 
 
 /*
@@ -100,6 +102,18 @@
      read_key:  recv (same format as above)
      close_stream: close socket
 
+  "pnet:" Same URLs as "net:", with an optional in-flight window
+   ("pnet:c:<ip>:<port>:<window>"), but using a framed, pipelined
+   protocol.  Every unit is a frame  [header][tag][payload], see below.
+   The side holding the data (the writer) sends OPEN, DATA..., CLOSE for
+   each key without waiting for replies, and blocks only when <window>
+   frames are unacknowledged.  Large records are split into several
+   DATA frames.  The reader acknowledges cumulatively, and asks for each
+   key with a GET.  A Palacios writer normally ignores these, but one
+   that sends keys in the order the reader wants them (post-copy
+   migration) waits for them with next_request.  They also let a server
+   (misc/network_servers/v3_ks) know which key to send.
+
   "user:" Stream requests are bounced to user space to be 
    handled there.  A rendezvous approach similar to the host 
    device userland support is used
@@ -139,10 +153,17 @@ static uint32_t BOUNDARY_TAG=0xabcd0123;
 #define DEF_NUM_STREAMS 16
 #define DEF_NUM_KEYS    128
 #define DEF_SIZE        128
+#define MEM_CHUNK_SIZE  (2*1024*1024)
 
 /*
   A memory keyed stream is a pointer to the underlying hash table
-  while a memory stream contains an extensible buffer for the stream
+  while a memory stream contains a list of buffer chunks
+
+  Chunks are MEM_CHUNK_SIZE and are never moved once allocated, so 
+  a stream grows in linear time and never needs one large contiguous
+  buffer.  The exception is a stream with a single chunk, which starts
+  at DEF_SIZE and doubles up to MEM_CHUNK_SIZE, so that the many small 
+  keys stay small.  Offset o is always at chunk o/MEM_CHUNK_SIZE.
  */
 struct mem_keyed_stream {
     int stype;
@@ -152,12 +173,16 @@ struct mem_keyed_stream {
 
 struct mem_stream {
     int       stype;
-    char     *data;
-    uint32_t  size;
-    uint32_t  data_max;
-    uint32_t  ptr;
+    char    **chunks;
+    uint64_t  num_chunks;
+    uint64_t  max_chunks;   // capacity of the chunks array
+    uint64_t  size;         // bytes allocated
+    uint64_t  data_max;     // bytes written
+    uint64_t  ptr;
 };
 
+static int expand_mem_stream(struct mem_stream *m, uint64_t new_size);
+
 static struct mem_stream *create_mem_stream_internal(uint64_t size)
 {
     struct mem_stream *m = palacios_alloc(sizeof(struct mem_stream));
@@ -166,18 +191,14 @@ static struct mem_stream *create_mem_stream_internal(uint64_t size)
 	return 0;
     }
 
+    memset(m,0,sizeof(struct mem_stream));
 
-    m->data = palacios_valloc(size);
-    
-    if (!m->data) { 
+    m->stype = STREAM_MEM;
+
+    if (expand_mem_stream(m,size)) { 
 	palacios_free(m);
 	return 0;
     }
-
-    m->stype = STREAM_MEM;
-    m->size=size;
-    m->ptr=0;
-    m->data_max=0;
     
     return m;
 }
@@ -190,50 +211,130 @@ static struct mem_stream *create_mem_stream(void)
 
 static void destroy_mem_stream(struct mem_stream *m)
 {
+    uint64_t i;
+
     if (m) {
-	if (m->data) {
-	    palacios_vfree(m->data);
+	if (m->chunks) {
+	    for (i=0;i<m->num_chunks;i++) { 
+		palacios_vfree(m->chunks[i]);
+	    }
+	    palacios_free(m->chunks);
 	}
-	m->data=0;
+	m->chunks=0;
 	palacios_free(m);
     }
 }
-    
-static int expand_mem_stream(struct mem_stream *m, uint32_t new_size)
+
+// make room for at least new_size bytes; the stream never shrinks
+static int expand_mem_stream(struct mem_stream *m, uint64_t new_size)
 {
-    void *data = palacios_valloc(new_size);
-    uint32_t nc;
+    if (new_size<=m->size) { 
+	return 0;
+    }
 
-    if (!data) { 
-	return -1;
+    if (m->num_chunks<=1 && new_size<=MEM_CHUNK_SIZE) { 
+	// a small stream, grow its only chunk
+	uint64_t chunk_size = m->size ? m->size : DEF_SIZE;
+	char *data;
+
+	while (chunk_size<new_size) { 
+	    chunk_size*=2;
+	}
+
+	if (chunk_size>MEM_CHUNK_SIZE) { 
+	    chunk_size=MEM_CHUNK_SIZE;
+	}
+
+	data = palacios_valloc(chunk_size);
+
+	if (!data) { 
+	    return -1;
+	}
+
+	if (!m->chunks) { 
+	    m->chunks = palacios_alloc(sizeof(char*));
+	    if (!m->chunks) { 
+		palacios_vfree(data);
+		return -1;
+	    }
+	    m->max_chunks=1;
+	}
+
+	if (m->num_chunks) { 
+	    memcpy(data,m->chunks[0],m->data_max);
+	    palacios_vfree(m->chunks[0]);
+	}
+
+	m->chunks[0]=data;
+	m->num_chunks=1;
+	m->size=chunk_size;
+
+	return 0;
     }
-    
-    nc = (new_size<m->data_max) ? new_size : m->data_max;
 
-    memcpy(data,m->data,nc);
+    // a small first chunk must reach full size before others are added
+    if (m->num_chunks==1 && m->size<MEM_CHUNK_SIZE) { 
+	if (expand_mem_stream(m,MEM_CHUNK_SIZE)) { 
+	    return -1;
+	}
+    }
+
+    while (m->size<new_size) { 
+	if (m->num_chunks==m->max_chunks) { 
+	    uint64_t max = m->max_chunks ? m->max_chunks*2 : 16;
+	    char **chunks = palacios_alloc(max*sizeof(char*));
+
+	    if (!chunks) { 
+		return -1;
+	    }
+
+	    if (m->chunks) { 
+		memcpy(chunks,m->chunks,m->num_chunks*sizeof(char*));
+		palacios_free(m->chunks);
+	    }
+
+	    m->chunks=chunks;
+	    m->max_chunks=max;
+	}
+
+	m->chunks[m->num_chunks] = palacios_valloc(MEM_CHUNK_SIZE);
 
-    palacios_vfree(m->data);
+	if (!m->chunks[m->num_chunks]) { 
+	    return -1;
+	}
 
-    m->data=data;
-    m->size=new_size;
-    if (m->size<m->data_max) { 
-	m->data_max=m->size;
+	m->num_chunks++;
+	m->size+=MEM_CHUNK_SIZE;
     }
    
     return 0;
 }
 
-static uint32_t write_mem_stream(struct mem_stream *m,
+static uint64_t write_mem_stream(struct mem_stream *m,
 				 void *data,
-				 uint32_t len)
+				 uint64_t len)
 {
+    uint64_t done=0;
+
     if ((m->ptr + len) > m->size) { 
 	if (expand_mem_stream(m,m->ptr + len)) { 
 	    return 0;
 	}
     }
-    memcpy(m->data+m->ptr,data,len);
-    m->ptr+=len;
+
+    while (done<len) { 
+	uint64_t off = m->ptr % MEM_CHUNK_SIZE;
+	uint64_t n = MEM_CHUNK_SIZE - off;
+
+	if (n>len-done) { 
+	    n=len-done;
+	}
+
+	memcpy(m->chunks[m->ptr / MEM_CHUNK_SIZE]+off,data+done,n);
+	m->ptr+=n;
+	done+=n;
+    }
+
     m->data_max=m->ptr;
     
     return len;
@@ -242,15 +343,28 @@ static uint32_t write_mem_stream(struct mem_stream *m,
 
 
 
-static uint32_t read_mem_stream(struct mem_stream *m,
+static uint64_t read_mem_stream(struct mem_stream *m,
 				void *data,
-				uint32_t len)
+				uint64_t len)
 {
+    uint64_t done=0;
+
     if ((m->ptr + len) > m->data_max) { 
 	return 0;
     }
-    memcpy(data,m->data+m->ptr,len);
-    m->ptr+=len;
+
+    while (done<len) { 
+	uint64_t off = m->ptr % MEM_CHUNK_SIZE;
+	uint64_t n = MEM_CHUNK_SIZE - off;
+
+	if (n>len-done) { 
+	    n=len-done;
+	}
+
+	memcpy(data+done,m->chunks[m->ptr / MEM_CHUNK_SIZE]+off,n);
+	m->ptr+=n;
+	done+=n;
+    }
     
     return len;
 
@@ -446,11 +560,9 @@ static void preallocate_hint_key_mem(v3_keyed_stream_t stream,
 	    return;
 	}
     } else {
-	if (m->data_max < size) { 
-	    if (expand_mem_stream(m,size)) { 
-		ERROR("cannot expand key for preallocation for key %s\n",key);
-		return;
-	    }
+	if (expand_mem_stream(m,size)) { 
+	    ERROR("cannot expand key for preallocation for key %s\n",key);
+	    return;
 	}
     }
 
@@ -458,11 +570,11 @@ static void preallocate_hint_key_mem(v3_keyed_stream_t stream,
 
 }
 
-static void close_key_mem(v3_keyed_stream_t stream, 
-			  v3_keyed_stream_key_t key)
+static int close_key_mem(v3_keyed_stream_t stream, 
+			 v3_keyed_stream_key_t key)
 {
     // nothing to do
-    return;
+    return 0;
 }
 
 static sint64_t write_key_mem(v3_keyed_stream_t stream, 
@@ -474,8 +586,8 @@ static sint64_t write_key_mem(v3_keyed_stream_t stream,
 {
   struct mem_keyed_stream *mks = (struct mem_keyed_stream *) stream;
   struct mem_stream *m = (struct mem_stream *) key;
-  uint32_t mylen;
-  uint32_t writelen;
+  uint64_t mylen;
+  uint64_t writelen;
   
   if (mks->ot!=V3_KS_WR_ONLY) {
     return -1;
@@ -486,11 +598,6 @@ static sint64_t write_key_mem(v3_keyed_stream_t stream,
     return -1;
   }
   
-  if (taglen>0xffffffffULL || len>0xffffffffULL) { 
-    ERROR("taglen or data len is too large\n");
-    return -1;
-  }
-      
   writelen=write_mem_stream(m,&BOUNDARY_TAG,sizeof(BOUNDARY_TAG));
   
   if (writelen!=sizeof(BOUNDARY_TAG)) { 
@@ -505,7 +612,7 @@ static sint64_t write_key_mem(v3_keyed_stream_t stream,
     return -1;
   }
   
-  mylen = (uint32_t) taglen;
+  mylen = (uint64_t) taglen;
   
   writelen=write_mem_stream(m,tag,mylen);
   
@@ -521,7 +628,7 @@ static sint64_t write_key_mem(v3_keyed_stream_t stream,
     return -1;
   }
   
-  mylen = (uint32_t) len;
+  mylen = (uint64_t) len;
 
   writelen=write_mem_stream(m,buf,mylen);
 
@@ -542,8 +649,8 @@ static sint64_t read_key_mem(v3_keyed_stream_t stream,
 {
   struct mem_keyed_stream *mks = (struct mem_keyed_stream *) stream;
   struct mem_stream *m = (struct mem_stream *) key;
-  uint32_t mylen;
-  uint32_t readlen;
+  uint64_t mylen;
+  uint64_t readlen;
   void *temptag;
   uint32_t tempbt;
   sint64_t templen;
@@ -558,11 +665,6 @@ static sint64_t read_key_mem(v3_keyed_stream_t stream,
     return -1;
   }
 
-  if (len>0xffffffffULL || taglen>0xffffffffULL) { 
-    ERROR("taglen or data len is too large\n");
-    return -1;
-  }
-  
   readlen=read_mem_stream(m,&tempbt,sizeof(tempbt));
   
   if (readlen!=sizeof(tempbt)) { 
@@ -594,7 +696,7 @@ static sint64_t read_key_mem(v3_keyed_stream_t stream,
     return -1;
   }
 
-  mylen = (uint32_t) len;
+  mylen = (uint64_t) taglen;
     
   readlen=read_mem_stream(m,temptag,mylen);
     
@@ -624,7 +726,7 @@ static sint64_t read_key_mem(v3_keyed_stream_t stream,
     return -1;
   }
 
-  mylen = (uint32_t) len;
+  mylen = (uint64_t) len;
   
   readlen=read_mem_stream(m,buf,mylen);
   
@@ -650,11 +752,14 @@ struct file_keyed_stream {
     int   stype;
     v3_keyed_stream_open_t ot;
     char  *path;
+    int   async;      // "afile:", see below
 };
 
 struct file_stream {
     int   stype;
     struct file *f;   // the opened file
+    struct file_async     *async;  // writing an "afile:" key
+    struct file_readahead *ra;     // reading an "afile:" key
 };
 
 /* lookup directory, see if it is writeable, and if so, create it if asked*/
@@ -804,10 +909,373 @@ static int lookup_check_mkdir(const char *path, int need_write, int create, unsi
 #endif
 
 
+/*
+  Asynchronous large-block mode  ("afile:")
+
+  Same on-disk format as "file:".  Writes are staged in FILE_ASYNC_EXTENT
+  buffers, which a writer thread per key writes at extent-aligned offsets
+  while the caller fills the next one, with up to FILE_ASYNC_BUFS extents
+  queued.  The writer has one write in flight at a time, so more than
+  one write per device only happens when several keys are written at
+  once (parallel checkpoint memory).  Reads fetch whole extents, and bulk
+  data goes straight to the caller.  Either way, each extent is written
+  back and dropped from the page cache as soon as it is done with, so
+  that checkpoints do not push out the host's cached data.  (O_DIRECT
+  itself cannot be used, as we write from kernel buffers.)
+
+  Write failures seen by the writer thread are reported on the next write 
+  to the key, or by close_key, which waits for the last extent.  Keys that
+  fit in a single extent are written synchronously at close and left cached.
+*/
+
+#define FILE_ASYNC_EXTENT (4*1024*1024)
+#define FILE_ASYNC_BUFS   4
+
+struct file_async {
+    struct task_struct *thread;
+    wait_queue_head_t   wq;         // waits in both directions
+    spinlock_t          lock;
+
+    char    *buf[FILE_ASYNC_BUFS];
+    uint64_t len[FILE_ASYNC_BUFS];
+    loff_t   off[FILE_ASYNC_BUFS];
+
+    uint64_t filled;                // extents handed to the writer
+    uint64_t written;               // extents the writer has finished
+    uint64_t cur_len;               // bytes in buf[filled % FILE_ASYNC_BUFS]
+    loff_t   next_off;              // file offset of that buffer
+    int      error;
+};
+
+struct file_readahead {
+    char    *buf;
+    uint64_t len;
+    uint64_t pos;
+    loff_t   next_off;
+};
+
+
+static int file_write_at(struct file *f, char *buf, uint64_t len, loff_t off)
+{
+    ssize_t done;
+    mm_segment_t old_fs;
+
+    while (len>0) {
+        old_fs = get_fs();
+        set_fs(get_ds());
+	done = f->f_op->write(f, buf, len, &off);
+        set_fs(old_fs);
+	if (done<=0) {
+	    return -1;
+	} else {
+	    buf += done;
+	    len -= done;
+	}
+    }
+
+    return 0;
+}
+
+static sint64_t file_read_at(struct file *f, char *buf, uint64_t len, loff_t off)
+{
+    ssize_t done;
+    uint64_t total = 0;
+    mm_segment_t old_fs;
+
+    while (total<len) {
+        old_fs = get_fs();
+        set_fs(get_ds());
+	done = f->f_op->read(f, buf+total, len-total, &off);
+        set_fs(old_fs);
+	if (done<0) {
+	    return -1;
+	} else if (done==0) { 
+	    break; // end of file
+	} else {
+	    total += done;
+	}
+    }
+
+    return total;
+}
+
+// write back and forget a range of the file
+static void file_drop_cache(struct file *f, loff_t off, uint64_t len)
+{
+    if (!len) { 
+	return;
+    }
+
+    filemap_write_and_wait_range(f->f_mapping, off, off+len-1);
+    invalidate_mapping_pages(f->f_mapping, off >> PAGE_SHIFT, (off+len-1) >> PAGE_SHIFT);
+}
+
+static int file_async_thread(void *arg)
+{
+    struct file_stream *fs = (struct file_stream *) arg;
+    struct file_async *a = fs->async;
+    unsigned long flags;
+    int i;
+
+    while (1) { 
+	wait_event_interruptible(a->wq, (a->written < a->filled) || kthread_should_stop());
+
+	if (a->written == a->filled) { 
+	    if (kthread_should_stop()) { 
+		break;
+	    }
+	    continue;
+	}
+
+	i = a->written % FILE_ASYNC_BUFS;
+
+	if (file_write_at(fs->f, a->buf[i], a->len[i], a->off[i])) { 
+	    ERROR("failed to write %llu bytes at offset %llu of keyed stream file\n",a->len[i],(uint64_t)(a->off[i]));
+	    a->error = 1;
+	} else {
+	    file_drop_cache(fs->f, a->off[i], a->len[i]);
+	}
+
+	palacios_spinlock_lock_irqsave(&(a->lock),flags);
+	a->written++;
+	palacios_spinlock_unlock_irqrestore(&(a->lock),flags);
+
+	wake_up_interruptible(&(a->wq));
+    }
+
+    return 0;
+}
+
+static void file_async_free(struct file_async *a)
+{
+    int i;
+
+    for (i=0;i<FILE_ASYNC_BUFS;i++) { 
+	if (a->buf[i]) { 
+	    palacios_vfree(a->buf[i]);
+	}
+    }
+
+    palacios_free(a);
+}
+
+static struct file_async *file_async_create(void)
+{
+    struct file_async *a = palacios_alloc(sizeof(struct file_async));
+
+    if (!a) { 
+	return 0;
+    }
+
+    memset(a,0,sizeof(struct file_async));
+
+    init_waitqueue_head(&(a->wq));
+    palacios_spinlock_init(&(a->lock));
+
+    a->buf[0] = palacios_valloc(FILE_ASYNC_EXTENT);
+
+    if (!a->buf[0]) { 
+	palacios_free(a);
+	return 0;
+    }
+
+    return a;
+}
+
+// hand the current extent to the writer, and get the next one ready
+static int file_async_submit(struct file_stream *fs)
+{
+    struct file_async *a = fs->async;
+    unsigned long flags;
+    int i = a->filled % FILE_ASYNC_BUFS;
+
+    if (!a->thread) { 
+	a->thread = kthread_run(file_async_thread, fs, "v3-kstream-wr");
+	if (IS_ERR(a->thread)) { 
+	    a->thread = 0;
+	    ERROR("cannot start keyed stream writer thread\n");
+	    return -1;
+	}
+    }
+
+    a->off[i] = a->next_off;
+    a->len[i] = a->cur_len;
+    a->next_off += a->cur_len;
+    a->cur_len = 0;
+
+    palacios_spinlock_lock_irqsave(&(a->lock),flags);
+    a->filled++;
+    palacios_spinlock_unlock_irqrestore(&(a->lock),flags);
+
+    wake_up_interruptible(&(a->wq));
+
+    // the buffer we fill next must be written out first
+    if (wait_event_killable(a->wq, (a->filled - a->written) < FILE_ASYNC_BUFS)) { 
+	ERROR("killed while waiting for keyed stream writer\n");
+	a->error = 1;
+	return -1;
+    }
+
+    i = a->filled % FILE_ASYNC_BUFS;
+
+    if (!a->buf[i]) { 
+	a->buf[i] = palacios_valloc(FILE_ASYNC_EXTENT);
+	if (!a->buf[i]) { 
+	    ERROR("cannot allocate keyed stream write extent\n");
+	    return -1;
+	}
+    }
+
+    return a->error ? -1 : 0;
+}
+
+static sint64_t file_async_write(struct file_stream *fs, void *buf, sint64_t len)
+{
+    struct file_async *a = fs->async;
+    sint64_t left = len;
+
+    if (a->error) { 
+	return -1;
+    }
+
+    while (left>0) { 
+	uint64_t n = FILE_ASYNC_EXTENT - a->cur_len;
+
+	if (n>left) { 
+	    n=left;
+	}
+
+	memcpy(a->buf[a->filled % FILE_ASYNC_BUFS] + a->cur_len, buf + (len-left), n);
+
+	a->cur_len += n;
+	left -= n;
+
+	if (a->cur_len == FILE_ASYNC_EXTENT) { 
+	    if (file_async_submit(fs)) { 
+		return -1;
+	    }
+	}
+    }
+
+    return len;
+}
+
+// flush everything and stop the writer
+static int file_async_finish(struct file_stream *fs)
+{
+    struct file_async *a = fs->async;
+    int rc = 0;
+
+    if (!a->thread) { 
+	// it all fit in one extent
+	if (a->cur_len && file_write_at(fs->f, a->buf[0], a->cur_len, a->next_off)) { 
+	    a->error = 1;
+	}
+    } else {
+	if (a->cur_len && !a->error) { 
+	    file_async_submit(fs);
+	}
+
+	// the writer only exits once every submitted extent is written
+	kthread_stop(a->thread);
+    }
+
+    if (a->error) { 
+	rc = -1;
+    }
+
+    file_async_free(a);
+    fs->async = 0;
+
+    return rc;
+}
+
+static sint64_t file_readahead_read(struct file_stream *fs, void *buf, sint64_t len)
+{
+    struct file_readahead *ra = fs->ra;
+    sint64_t left = len;
+    sint64_t n;
+
+    while (left>0) { 
+	if (ra->pos == ra->len) { 
+	    if (left >= FILE_ASYNC_EXTENT) { 
+		// bulk data skips the buffer
+		n = (left / FILE_ASYNC_EXTENT) * FILE_ASYNC_EXTENT;
+
+		if (file_read_at(fs->f, buf + (len-left), n, ra->next_off) != n) { 
+		    return -1;
+		}
+
+		file_drop_cache(fs->f, ra->next_off, n);
+		ra->next_off += n;
+		left -= n;
+		continue;
+	    }
+
+	    n = file_read_at(fs->f, ra->buf, FILE_ASYNC_EXTENT, ra->next_off);
+
+	    if (n<=0) { 
+		return -1;
+	    }
+
+	    file_drop_cache(fs->f, ra->next_off, n);
+	    ra->next_off += n;
+	    ra->len = n;
+	    ra->pos = 0;
+	}
+
+	n = ra->len - ra->pos;
+
+	if (n>left) { 
+	    n=left;
+	}
+
+	memcpy(buf + (len-left), ra->buf + ra->pos, n);
+
+	ra->pos += n;
+	left -= n;
+    }
+
+    return len;
+}
+
+static struct file_readahead *file_readahead_create(void)
+{
+    struct file_readahead *ra = palacios_alloc(sizeof(struct file_readahead));
+
+    if (!ra) { 
+	return 0;
+    }
+
+    memset(ra,0,sizeof(struct file_readahead));
+
+    ra->buf = palacios_valloc(FILE_ASYNC_EXTENT);
+
+    if (!ra->buf) { 
+	palacios_free(ra);
+	return 0;
+    }
+
+    return ra;
+}
+
+static void file_readahead_free(struct file_readahead *ra)
+{
+    palacios_vfree(ra->buf);
+    palacios_free(ra);
+}
+
+
 static v3_keyed_stream_t open_stream_file(char *url,
 					  v3_keyed_stream_open_t ot)
 {
     struct file_keyed_stream *fks;
+    int async = 0;
+
+    if (!strncasecmp(url,"afile:",6)) { 
+	async = 1;
+	url++;
+    }
 
     if (strncasecmp(url,"file:",5)) { 
 	WARNING("illegitimate attempt to open file stream \"%s\"\n",url);
@@ -832,6 +1300,7 @@ static v3_keyed_stream_t open_stream_file(char *url,
     strcpy(fks->path,url+5); // will fit
     
     fks->stype=STREAM_FILE;
+    fks->async=async;
 
     fks->ot= ot==V3_KS_WR_ONLY_CREATE ? V3_KS_WR_ONLY : ot;
 
@@ -892,6 +1361,8 @@ static v3_keyed_stream_key_t open_key_file(v3_keyed_stream_t stream,
 	return 0;
     }
 
+    memset(fs,0,sizeof(struct file_stream));
+
     fs->stype=STREAM_FILE;
 
     fs->f = filp_open(path,O_RDWR|O_CREAT|O_LARGEFILE,0600);
@@ -905,18 +1376,47 @@ static v3_keyed_stream_key_t open_key_file(v3_keyed_stream_t stream,
 
     palacios_free(path);
 
+    if (fks->async) { 
+	if (fks->ot==V3_KS_WR_ONLY) { 
+	    fs->async = file_async_create();
+	} else {
+	    fs->ra = file_readahead_create();
+	}
+
+	if (!fs->async && !fs->ra) { 
+	    ERROR("cannot allocate asynchronous state for key %s\n",key);
+	    filp_close(fs->f,NULL);
+	    palacios_free(fs);
+	    return 0;
+	}
+    }
+
     return fs;
 }
 
 
-static void close_key_file(v3_keyed_stream_t stream, 
-			   v3_keyed_stream_key_t key)
+static int close_key_file(v3_keyed_stream_t stream, 
+			  v3_keyed_stream_key_t key)
 {
     struct file_stream *fs = (struct file_stream *) key;
+    int rc = 0;
+
+    if (fs->async) { 
+	if (file_async_finish(fs)) { 
+	    ERROR("keyed stream key was not completely written\n");
+	    rc = -1;
+	}
+    }
+
+    if (fs->ra) { 
+	file_readahead_free(fs->ra);
+    }
 
     filp_close(fs->f,NULL);
 
     palacios_free(fs);
+
+    return rc;
 }
 
 
@@ -943,6 +1443,11 @@ static sint64_t write_file(struct file_stream *fs, void *buf, sint64_t len)
     return len;
 }
 
+static sint64_t write_key_bytes(struct file_stream *fs, void *buf, sint64_t len)
+{
+    return fs->async ? file_async_write(fs,buf,len) : write_file(fs,buf,len);
+}
+
 static sint64_t write_key_file(v3_keyed_stream_t stream, 
 			       v3_keyed_stream_key_t key,
 			       void *tag,
@@ -963,33 +1468,33 @@ static sint64_t write_key_file(v3_keyed_stream_t stream,
     return -1;
   }
   
-  writelen=write_file(fs,&BOUNDARY_TAG,sizeof(BOUNDARY_TAG));
+  writelen=write_key_bytes(fs,&BOUNDARY_TAG,sizeof(BOUNDARY_TAG));
   
   if (writelen!=sizeof(BOUNDARY_TAG)) { 
     ERROR("failed to write all data for boundary tag\n");
     return -1;
   }
   
-  writelen=write_file(fs,&taglen,sizeof(taglen));
+  writelen=write_key_bytes(fs,&taglen,sizeof(taglen));
   
   if (writelen!=sizeof(taglen)) { 
     ERROR("failed to write taglen\n");
     return -1;
   }
   
-  if (write_file(fs,tag,taglen)!=taglen) { 
+  if (write_key_bytes(fs,tag,taglen)!=taglen) { 
     ERROR("failed to write tag\n");
     return -1;
   }
 
-  writelen=write_file(fs,&len,sizeof(len));
+  writelen=write_key_bytes(fs,&len,sizeof(len));
   
   if (writelen!=sizeof(len)) { 
     ERROR("failed to write data len\n");
     return -1;
   }
   
-  return write_file(fs,buf,len);
+  return write_key_bytes(fs,buf,len);
 }
 
 static sint64_t read_file(struct file_stream *fs, void *buf, sint64_t len)
@@ -1017,6 +1522,11 @@ static sint64_t read_file(struct file_stream *fs, void *buf, sint64_t len)
 }
 
 
+static sint64_t read_key_bytes(struct file_stream *fs, void *buf, sint64_t len)
+{
+    return fs->ra ? file_readahead_read(fs,buf,len) : read_file(fs,buf,len);
+}
+
 static sint64_t read_key_file(v3_keyed_stream_t stream, 
 			      v3_keyed_stream_key_t key,
 			      void *tag,
@@ -1040,7 +1550,7 @@ static sint64_t read_key_file(v3_keyed_stream_t stream,
     return -1;
   }
 
-  readlen=read_file(fs,&tempbt,sizeof(tempbt));
+  readlen=read_key_bytes(fs,&tempbt,sizeof(tempbt));
   
   if (readlen!=sizeof(tempbt)) { 
     ERROR("failed to read all data for boundary tag\n");
@@ -1052,7 +1562,7 @@ static sint64_t read_key_file(v3_keyed_stream_t stream,
     return -1;
   }
 
-  readlen=read_file(fs,&templen,sizeof(templen));
+  readlen=read_key_bytes(fs,&templen,sizeof(templen));
   
   if (readlen!=sizeof(templen)) { 
     ERROR("failed to read all data for tag len\n");
@@ -1071,7 +1581,7 @@ static sint64_t read_key_file(v3_keyed_stream_t stream,
     return -1;
   }
   
-  if (read_file(fs,temptag,taglen)!=taglen) { 
+  if (read_key_bytes(fs,temptag,taglen)!=taglen) { 
     ERROR("Cannot read tag\n");
     palacios_free(temptag);
     return -1;
@@ -1085,7 +1595,7 @@ static sint64_t read_key_file(v3_keyed_stream_t stream,
   
   palacios_free(temptag);
 
-  readlen=read_file(fs,&templen,sizeof(templen));
+  readlen=read_key_bytes(fs,&templen,sizeof(templen));
   
   if (readlen!=sizeof(templen)) { 
     ERROR("failed to read all data for data len\n");
@@ -1097,7 +1607,7 @@ static sint64_t read_key_file(v3_keyed_stream_t stream,
     return -1;
   }
 
-  return read_file(fs,buf,len);
+  return read_key_bytes(fs,buf,len);
 
 }
 
@@ -1574,19 +2084,21 @@ static v3_keyed_stream_key_t open_key_textfile(v3_keyed_stream_t stream,
 
 
 
-static void close_key_textfile(v3_keyed_stream_t stream, 
-			       v3_keyed_stream_key_t key)
+static int close_key_textfile(v3_keyed_stream_t stream, 
+			      v3_keyed_stream_key_t key)
 {
   textfile_keyed_stream *mks = stream;
   textfile_stream *ms=key;
+  int rc;
 
   mks->stype=STREAM_FILE;
   ms->stype=STREAM_FILE;
 
-  close_key_file(mks,ms);
+  rc = close_key_file(mks,ms);
 
   mks->stype=STREAM_TEXTFILE;
 
+  return rc;
 }
 
 
@@ -1737,6 +2249,20 @@ struct user_keyed_stream {
 
     struct palacios_user_keyed_stream_op *op;
 
+    // shared request ring, if user space has set one up
+    struct palacios_user_keyed_stream_ring *ring;
+    char     *ring_data;
+    uint64_t  ring_data_len;
+    uint64_t  ring_data_head;   // next free byte of the data area (not wrapped)
+    uint64_t  ring_head;        // requests posted
+    uint64_t  ring_reaped;      // requests whose results have been checked
+    int       ring_error;       // an unreported write failed
+    struct ring_req {
+	int      type;
+	uint64_t pos;
+	sint64_t xfer;
+    } ring_reqs[PALACIOS_KSTREAM_RING_SLOTS];
+
     struct list_head node;
 };
 
@@ -1832,6 +2358,347 @@ static int do_response_to_request(struct user_keyed_stream *s, unsigned long *fl
 
 
 
+/*
+  Shared request ring (see iface-keyed-stream-user.h)
+
+  The palacios side of a stream is driven by one thread at a time, so
+  the producer state needs no lock.  Everything we rely on is kept
+  here rather than read back from the shared mapping, except for the
+  user-advanced tail, which is clamped.
+*/
+
+static uint64_t ring_round(uint64_t len)
+{
+    return (len + 7) & ~7ULL;
+}
+
+static uint64_t ring_tail(struct user_keyed_stream *s)
+{
+    uint64_t tail = s->ring->tail;
+
+    smp_rmb();
+
+    return (tail > s->ring_head) ? s->ring_head : tail;
+}
+
+static int ring_has_room(struct user_keyed_stream *s, uint64_t pos, uint64_t len)
+{
+    uint64_t tail = ring_tail(s);
+    uint64_t oldest;
+
+    if ((s->ring_head - tail) >= PALACIOS_KSTREAM_RING_SLOTS) { 
+	return 0;
+    }
+
+    // start of the oldest buffer still in use
+    oldest = (tail < s->ring_head) ? s->ring_reqs[tail % PALACIOS_KSTREAM_RING_SLOTS].pos : pos;
+
+    return (pos + len - oldest) <= s->ring_data_len;
+}
+
+// both waits fail only on a fatal signal, which also fails the stream
+static int ring_wait_room(struct user_keyed_stream *s, uint64_t pos, uint64_t len)
+{
+    while (!ring_has_room(s,pos,len)) { 
+	s->ring->host_waiting = 1;
+	smp_mb();
+	if (wait_event_killable(s->host_wait_queue, ring_has_room(s,pos,len))) { 
+	    s->ring->host_waiting = 0;
+	    ERROR("killed while waiting for room on user keyed stream %s\n",s->url);
+	    s->ring_error = 1;
+	    return -1;
+	}
+	s->ring->host_waiting = 0;
+    }
+
+    return 0;
+}
+
+static int ring_wait_tail(struct user_keyed_stream *s, uint64_t target)
+{
+    while (ring_tail(s) < target) { 
+	s->ring->host_waiting = 1;
+	smp_mb();
+	if (wait_event_killable(s->host_wait_queue, ring_tail(s) >= target)) { 
+	    s->ring->host_waiting = 0;
+	    ERROR("killed while waiting for user keyed stream %s\n",s->url);
+	    s->ring_error = 1;
+	    return -1;
+	}
+	s->ring->host_waiting = 0;
+    }
+
+    return 0;
+}
+
+// collect the results of completed writes
+static void ring_reap(struct user_keyed_stream *s)
+{
+    uint64_t tail = ring_tail(s);
+
+    for (; s->ring_reaped < tail; s->ring_reaped++) { 
+	struct ring_req *r = &(s->ring_reqs[s->ring_reaped % PALACIOS_KSTREAM_RING_SLOTS]);
+	struct palacios_user_keyed_stream_slot *slot = &(s->ring->slots[s->ring_reaped % PALACIOS_KSTREAM_RING_SLOTS]);
+
+	if (r->type == PALACIOS_KSTREAM_WRITE_KEY && slot->xfer != r->xfer) { 
+	    ERROR("user keyed stream write failed on %s (wrote %lld of %lld)\n",s->url,slot->xfer,r->xfer);
+	    s->ring_error = 1;
+	}
+    }
+}
+
+// report (once) a failure of an earlier write
+static int ring_check_error(struct user_keyed_stream *s)
+{
+    ring_reap(s);
+
+    if (s->ring_error) { 
+	s->ring_error = 0;
+	return -1;
+    }
+
+    return 0;
+}
+
+static int ring_fits(struct user_keyed_stream *s, uint64_t len)
+{
+    return ring_round(len) <= s->ring_data_len;
+}
+
+// wait until user space has completed everything
+static int ring_drain(struct user_keyed_stream *s)
+{
+    if (ring_wait_tail(s,s->ring_head)) { 
+	return -1;
+    }
+
+    ring_reap(s);
+
+    return 0;
+}
+
+// reserve a contiguous buffer, waiting for space if needed
+static int ring_alloc(struct user_keyed_stream *s, uint64_t len, uint64_t *pos)
+{
+    uint64_t p = s->ring_data_head;
+
+    len = ring_round(len);
+
+    if ((p % s->ring_data_len) + len > s->ring_data_len) { 
+	// skip to the start of the data area
+	p += s->ring_data_len - (p % s->ring_data_len);
+    }
+
+    if (ring_wait_room(s,p,len)) { 
+	return -1;
+    }
+
+    s->ring_data_head = p + len;
+
+    *pos = p;
+
+    return 0;
+}
+
+static void *ring_buf(struct user_keyed_stream *s, uint64_t pos)
+{
+    return s->ring_data + (pos % s->ring_data_len);
+}
+
+static uint64_t ring_post(struct user_keyed_stream *s, int type, void *user_key,
+			  uint64_t pos, uint64_t buf_len, uint64_t data_off, sint64_t xfer)
+{
+    uint64_t n = s->ring_head;
+    struct ring_req *r = &(s->ring_reqs[n % PALACIOS_KSTREAM_RING_SLOTS]);
+    struct palacios_user_keyed_stream_slot *slot = &(s->ring->slots[n % PALACIOS_KSTREAM_RING_SLOTS]);
+
+    r->type = type;
+    r->pos = pos;
+    r->xfer = xfer;
+
+    slot->type = type;
+    slot->xfer = xfer;
+    slot->user_key = (uint64_t)user_key;
+    slot->buf_pos = pos % s->ring_data_len;
+    slot->buf_len = buf_len;
+    slot->data_off = data_off;
+
+    // the slot must be visible before the new head
+    smp_wmb();
+
+    s->ring_head = n + 1;
+    s->ring->head = n + 1;
+
+    wake_up_interruptible(&(s->user_wait_queue));
+
+    return n;
+}
+
+static int ring_setup(struct user_keyed_stream *s, uint64_t *size)
+{
+    struct palacios_user_keyed_stream_ring *ring;
+    uint64_t hdr = PAGE_ALIGN(sizeof(struct palacios_user_keyed_stream_ring));
+    unsigned long flags;
+
+    if (*size < PALACIOS_KSTREAM_RING_MIN) { 
+	*size = PALACIOS_KSTREAM_RING_MIN;
+    }
+
+    if (*size > PALACIOS_KSTREAM_RING_MAX) { 
+	*size = PALACIOS_KSTREAM_RING_MAX;
+    }
+
+    *size = PAGE_ALIGN(*size);
+
+    ring = vmalloc_user(*size);
+
+    if (!ring) { 
+	ERROR("cannot allocate %llu byte ring for user keyed stream %s\n",*size,s->url);
+	return -1;
+    }
+
+    // vmalloc_user memory is already zeroed
+    ring->size = *size;
+    ring->data_off = hdr;
+    ring->data_len = *size - hdr;
+    ring->num_slots = PALACIOS_KSTREAM_RING_SLOTS;
+
+    palacios_spinlock_lock_irqsave(&(s->lock), flags);
+
+    if (s->ring || s->waiting) { 
+	palacios_spinlock_unlock_irqrestore(&(s->lock), flags);
+	vfree(ring);
+	ERROR("cannot set up ring on user keyed stream %s as it is in use\n",s->url);
+	return -1;
+    }
+
+    s->ring_data = (char *)ring + hdr;
+    s->ring_data_len = *size - hdr;
+    s->ring_head = 0;
+    s->ring_reaped = 0;
+    s->ring_data_head = 0;
+    s->ring_error = 0;
+    s->ring = ring;
+
+    palacios_spinlock_unlock_irqrestore(&(s->lock), flags);
+
+    INFO("user keyed stream %s now uses a %llu byte shared ring\n",s->url,*size);
+
+    return 0;
+}
+
+static v3_keyed_stream_key_t open_key_ring(struct user_keyed_stream *s, char *key)
+{
+    uint64_t len = strlen(key)+1;
+    uint64_t pos;
+    uint64_t n;
+
+    if (ring_check_error(s)) { 
+	ERROR("cannot open key %s as an earlier write on %s failed\n",key,s->url);
+	return NULL;
+    }
+
+    if (ring_alloc(s,len,&pos)) { 
+	return NULL;
+    }
+
+    memcpy(ring_buf(s,pos),key,len);
+
+    n = ring_post(s,PALACIOS_KSTREAM_OPEN_KEY,0,pos,len,len,0);
+
+    if (ring_wait_tail(s,n+1)) { 
+	return NULL;
+    }
+    ring_reap(s);
+
+    return (v3_keyed_stream_key_t) s->ring->slots[n % PALACIOS_KSTREAM_RING_SLOTS].user_key;
+}
+
+static int close_key_ring(struct user_keyed_stream *s, v3_keyed_stream_key_t key)
+{
+    uint64_t pos;
+    int rc = 0;
+
+    // the key's writes are only known to be stored once user space has done them all
+    if (ring_drain(s) || ring_check_error(s)) { 
+	ERROR("writes to a key on user keyed stream %s failed\n",s->url);
+	rc = -1;
+    }
+
+    if (ring_alloc(s,0,&pos)) { 
+	return -1;
+    }
+
+    ring_post(s,PALACIOS_KSTREAM_CLOSE_KEY,key,pos,0,0,0);
+
+    return rc;
+}
+
+static sint64_t read_key_ring(struct user_keyed_stream *s, v3_keyed_stream_key_t key,
+			      void *tag, sint64_t taglen, void *buf, sint64_t rlen)
+{
+    uint64_t pos;
+    uint64_t n;
+    sint64_t xfer;
+
+    if (ring_check_error(s)) { 
+	ERROR("cannot read key as an earlier write on %s failed\n",s->url);
+	return -1;
+    }
+
+    // the data comes back over the tag
+    if (ring_alloc(s,(taglen > rlen) ? taglen : rlen,&pos)) { 
+	return -1;
+    }
+
+    memcpy(ring_buf(s,pos),tag,taglen);
+
+    n = ring_post(s,PALACIOS_KSTREAM_READ_KEY,key,pos,taglen,taglen,rlen);
+
+    if (ring_wait_tail(s,n+1)) { 
+	return -1;
+    }
+    ring_reap(s);
+
+    xfer = s->ring->slots[n % PALACIOS_KSTREAM_RING_SLOTS].xfer;
+
+    if (xfer > rlen) { 
+	ERROR("user keyed stream %s returned too much data (%lld > %lld)\n",s->url,xfer,rlen);
+	return -1;
+    }
+
+    if (xfer > 0) { 
+	memcpy(buf,ring_buf(s,pos),xfer);
+    }
+
+    return xfer;
+}
+
+static sint64_t write_key_ring(struct user_keyed_stream *s, v3_keyed_stream_key_t key,
+			       void *tag, sint64_t taglen, void *buf, sint64_t wlen)
+{
+    uint64_t pos;
+
+    if (ring_check_error(s)) { 
+	ERROR("cannot write key as an earlier write on %s failed\n",s->url);
+	return -1;
+    }
+
+    if (ring_alloc(s,taglen+wlen,&pos)) { 
+	return -1;
+    }
+
+    memcpy(ring_buf(s,pos),tag,taglen);
+    memcpy(ring_buf(s,pos)+taglen,buf,wlen);
+
+    // not waited for, failures show up on a later request
+    ring_post(s,PALACIOS_KSTREAM_WRITE_KEY,key,pos,taglen+wlen,taglen,wlen);
+
+    return wlen;
+}
+
+
+
 static unsigned int keyed_stream_poll_user(struct file *filp, poll_table *wait)
 {
     struct user_keyed_stream *s = (struct user_keyed_stream *) (filp->private_data);
@@ -1845,7 +2712,7 @@ static unsigned int keyed_stream_poll_user(struct file *filp, poll_table *wait)
 
     poll_wait(filp, &(s->user_wait_queue), wait);
 
-    if (s->waiting) {
+    if (s->waiting || (s->ring && (s->ring->tail != s->ring->head))) {
 	palacios_spinlock_unlock_irqrestore(&(s->lock), flags);
 	return POLLIN | POLLRDNORM;
     }
@@ -1954,6 +2821,34 @@ static long keyed_stream_ioctl_user(struct file * filp, unsigned int ioctl, unsi
         return 1;
 
         break;
+
+    case V3_KSTREAM_RING_SETUP_IOCTL:
+
+	if (copy_from_user(&size, (void __user *) argp, sizeof(uint64_t))) {
+	    ERROR("palacios user key ring setup failed to copy size\n");
+	    return -EFAULT;
+	}
+
+	if (ring_setup(s,&size)) { 
+	    return -EFAULT;
+	}
+
+	if (copy_to_user((void __user *) argp, &size, sizeof(uint64_t))) {
+	    ERROR("palacios user key ring setup failed to copy size\n");
+	    return -EFAULT;
+	}
+
+	return 1;
+
+	break;
+
+    case V3_KSTREAM_RING_KICK_IOCTL:
+
+	wake_up_interruptible(&(s->host_wait_queue));
+
+	return 1;
+
+	break;
 	
     default:
 	ERROR("unknown ioctl in user keyed stream\n");
@@ -1979,14 +2874,36 @@ static int keyed_stream_release_user(struct inode *inode, struct file *filp)
     palacios_spinlock_unlock_irqrestore(&(s->lock), f2);
     palacios_spinlock_unlock_irqrestore(&(user_streams->lock), f1);
     
+    if (s->ring) { 
+	vfree(s->ring);
+    }
+
     palacios_free(s->url);
     palacios_free(s);
 
     return 0;
 }
 
+static int keyed_stream_mmap_user(struct file *filp, struct vm_area_struct *vma)
+{
+    struct user_keyed_stream *s = filp->private_data;
+
+    if (!s->ring) { 
+	ERROR("attempt to map user keyed stream %s before setting up its ring\n",s->url);
+	return -EINVAL;
+    }
+
+    if ((vma->vm_pgoff << PAGE_SHIFT) + (vma->vm_end - vma->vm_start) > s->ring->size) { 
+	ERROR("attempt to map beyond the ring of user keyed stream %s\n",s->url);
+	return -EINVAL;
+    }
+
+    return remap_vmalloc_range(vma, s->ring, vma->vm_pgoff);
+}
+
 static struct file_operations user_keyed_stream_fops = {
     .poll = keyed_stream_poll_user,
+    .mmap = keyed_stream_mmap_user,
     .compat_ioctl = keyed_stream_ioctl_user,
     .unlocked_ioctl = keyed_stream_ioctl_user,
     .release = keyed_stream_release_user,
@@ -2157,6 +3074,15 @@ static v3_keyed_stream_key_t open_key_user(v3_keyed_stream_t stream, char *key)
     uint64_t   len = strlen(key)+1;
     void *user_key;
 
+    if (s->ring) { 
+	if (ring_fits(s,len)) { 
+	    return open_key_ring(s,key);
+	}
+	if (ring_drain(s)) { 
+	    return NULL;
+	}
+    }
+
     palacios_spinlock_lock_irqsave(&(s->lock), flags);
 
 
@@ -2185,18 +3111,22 @@ static v3_keyed_stream_key_t open_key_user(v3_keyed_stream_t stream, char *key)
     return user_key;
 }
 
-static void close_key_user(v3_keyed_stream_t stream, v3_keyed_stream_key_t key)
+static int close_key_user(v3_keyed_stream_t stream, v3_keyed_stream_key_t key)
 {
     struct user_keyed_stream *s = (struct user_keyed_stream *) stream;
     uint64_t   len = 0;
     unsigned long flags;
+
+    if (s->ring) { 
+	return close_key_ring(s,key);
+    }
     
     palacios_spinlock_lock_irqsave(&(s->lock), flags);
 
     if (resize_op(&(s->op),len)) {
 	palacios_spinlock_unlock_irqrestore(&(s->lock),flags);
 	ERROR("cannot resize op in closing key 0x%p on user keyed stream %s\n",key,s->url);
-	return;
+	return -1;
     }
 
     s->op->type = PALACIOS_KSTREAM_CLOSE_KEY;
@@ -2207,13 +3137,13 @@ static void close_key_user(v3_keyed_stream_t stream, v3_keyed_stream_key_t key)
     if (do_request_to_response(s,&flags)) { 
 	palacios_spinlock_unlock_irqrestore(&(s->lock),flags);
 	ERROR("request/response handling failed\n");
-	return;
+	return -1;
     }
     // return with it locked
 
     palacios_spinlock_unlock_irqrestore(&(s->lock),flags);
 
-    return;
+    return 0;
 }
 
 
@@ -2229,6 +3159,17 @@ static sint64_t read_key_user(v3_keyed_stream_t stream, v3_keyed_stream_key_t ke
     sint64_t   xfer;
     unsigned long flags;
 
+    if (s->ring) { 
+	if (ring_fits(s,(taglen > rlen) ? taglen : rlen)) { 
+	    return read_key_ring(s,key,tag,taglen,buf,rlen);
+	}
+	ring_drain(s);
+	if (ring_check_error(s)) { 
+	    ERROR("cannot read key as an earlier write on %s failed\n",s->url);
+	    return -1;
+	}
+    }
+
     palacios_spinlock_lock_irqsave(&(s->lock), flags);
 
     if (s->otype != V3_KS_RD_ONLY) { 
@@ -2284,6 +3225,16 @@ static sint64_t write_key_user(v3_keyed_stream_t stream, v3_keyed_stream_key_t k
     sint64_t   xfer;
     unsigned long flags;
 
+    if (s->ring) { 
+	if (ring_fits(s,len)) { 
+	    return write_key_ring(s,key,tag,taglen,buf,wlen);
+	}
+	ring_drain(s);
+	if (ring_check_error(s)) { 
+	    ERROR("cannot write key as an earlier write on %s failed\n",s->url);
+	    return -1;
+	}
+    }
 
     palacios_spinlock_lock_irqsave(&(s->lock), flags);
 
@@ -2333,10 +3284,13 @@ static sint64_t write_key_user(v3_keyed_stream_t stream, v3_keyed_stream_key_t k
 
 #define NET_MAX_KEY_LEN 128
 
+struct pnet_state;
+
 struct net_keyed_stream {
     int stype;
     int ot;
     struct net_stream * ns;
+    struct pnet_state * pnet;   // "pnet:" only
 };
 
 struct net_stream {
@@ -2372,18 +3326,28 @@ static void close_socket(v3_keyed_stream_t stream)
 	struct net_stream *ns = nks->ns;
 
 	if (ns) {
-	    ns->sock->ops->release(ns->sock);
+	    if (ns->sock) { 
+		ns->sock->ops->release(ns->sock);
+	    }
 	    palacios_free(ns);
 	    ERROR("Close Socket\n");
 	}
 	
-	palacios_free(ns);
+	palacios_free(nks);
     }
 }
 
 
+static void close_stream_pnet(struct net_keyed_stream *nks);
+
 static void close_stream_net(v3_keyed_stream_t stream)
 {
+	struct net_keyed_stream *nks = (struct net_keyed_stream *) stream;
+
+	if (nks && nks->pnet) { 
+	    close_stream_pnet(nks);
+	}
+
 	close_socket(stream);
 }
 
@@ -2456,7 +3420,7 @@ static int send_msg(struct net_stream *ns,  char * buf, int len)
 	    ERROR("Send msg error %d\n",err);
 	    return err;
 	} else {
-	    left-=len;
+	    left-=err;
 	}
     }
 
@@ -2512,6 +3476,9 @@ static int recv_msg(struct net_stream *ns, char * buf, int len)
 	
 	if (err<0) { 
 	    return err;
+	} else if (err==0) { 
+	    ERROR("Connection closed during receive\n");
+	    return -1;
 	} else {
 	    left -= err;
 	}
@@ -2576,17 +3543,526 @@ static struct net_stream * accept_once(struct net_stream * ns, const int port)
     return ns;
 }
 
+/*
+  Pipelined protocol  ("pnet:")
+
+  All fields are in host order, as with "net:".  The frame header is
+  followed by taglen bytes of tag (the key, for OPEN, CLOSE, GET and
+  ERROR) and len bytes of payload.  ACK carries no tag or payload; its
+  id is the last frame the reader has consumed, and its len is a status
+  (0 = ok).  Ids start at 1 and count every OPEN, DATA and CLOSE frame
+  a writer sends; GET and ERROR use id 0 and do not count.
+
+  The reader acks only CLOSE frames and frames flagged PNET_ACKREQ.  The
+  writer flags the frame that fills its window, so it never waits on an
+  ack that is not coming, and the one at half the window, so that acks
+  normally arrive before it has to wait.  The window is thus entirely
+  the writer's business, and the two ends need not agree on it.
+
+  A record of more than PNET_SEGMENT bytes is sent as several DATA
+  frames, the first carrying the tag and all but the last flagged with
+  PNET_MORE, so a big record does not hold up the window any more than
+  the same data in smaller records would.
+*/
 
-static struct v3_keyed_stream_t * open_stream_net(char * url,v3_keyed_stream_open_t ot)
-{
-    struct net_keyed_stream * nks;
-    int url_len;
-    int i;
-    int delimit[3];
-    int k;
-    char mode;
-    int ip_len;
-    int port_len;
+#define PNET_MAGIC        0x504e4554   // "PNET"
+
+#define PNET_OPEN         1
+#define PNET_DATA         2
+#define PNET_CLOSE        3
+#define PNET_ACK          4
+#define PNET_GET          5
+#define PNET_ERROR        6
+
+#define PNET_MORE         0x1
+#define PNET_ACKREQ       0x2
+
+#define PNET_SEGMENT      (1024*1024)
+#define PNET_DEF_WINDOW   32
+#define PNET_MAX_WINDOW   1024
+#define PNET_MAX_TAG      1024
+#define PNET_SCRATCH      (16*1024)   // header, tag, and small payloads go out in one send
+
+struct pnet_frame {
+    uint32_t magic;
+    uint16_t type;
+    uint16_t flags;
+    uint32_t id;
+    uint32_t taglen;
+    uint64_t len;
+} __attribute__((packed));
+
+struct pnet_state {
+    uint32_t window;      // frames a writer may have unacknowledged
+
+    uint32_t next_id;     // writer: id of the next frame to send
+    uint32_t acked;       // writer: last id acked; reader: last id we acked
+    uint32_t consumed;    // reader: last id consumed
+    int      error;       // a write failed, or the peer reported one
+
+    int      have_request;            // writer: request holds a key the reader asked for
+    char     request[PNET_MAX_TAG+1];
+
+    char     scratch[PNET_SCRATCH];
+};
+
+
+static int pnet_send_frame(struct net_keyed_stream *nks, uint16_t type, uint16_t flags, uint32_t id,
+			   void *tag, uint32_t taglen, void *buf, uint64_t len)
+{
+    struct pnet_state *p = nks->pnet;
+    struct pnet_frame *f = (struct pnet_frame *) p->scratch;
+    uint64_t hlen = sizeof(struct pnet_frame) + taglen;
+
+    if (hlen > PNET_SCRATCH) { 
+	ERROR("Tag too long for pnet frame\n");
+	return -1;
+    }
+
+    f->magic = PNET_MAGIC;
+    f->type = type;
+    f->flags = flags;
+    f->id = id;
+    f->taglen = taglen;
+    f->len = len;
+
+    if (taglen) { 
+	memcpy(p->scratch + sizeof(struct pnet_frame), tag, taglen);
+    }
+
+    // small frames are sent whole, to keep Nagle from splitting them
+    if (hlen + len <= PNET_SCRATCH) { 
+	if (len) { 
+	    memcpy(p->scratch + hlen, buf, len);
+	}
+	hlen += len;
+	len = 0;
+    }
+
+    if (send_msg(nks->ns, p->scratch, hlen) != hlen) { 
+	ERROR("Cannot send pnet frame header\n");
+	return -1;
+    }
+
+    if (len && send_msg(nks->ns, buf, len) != len) { 
+	ERROR("Cannot send pnet frame payload\n");
+	return -1;
+    }
+
+    return 0;
+}
+
+static int pnet_recv_frame(struct net_keyed_stream *nks, struct pnet_frame *f)
+{
+    if (recv_msg(nks->ns, (char *)f, sizeof(*f)) != sizeof(*f)) { 
+	ERROR("Cannot receive pnet frame header\n");
+	return -1;
+    }
+
+    if (f->magic != PNET_MAGIC) { 
+	ERROR("Bad pnet frame magic 0x%x\n", f->magic);
+	return -1;
+    }
+
+    return 0;
+}
+
+// discard bytes of a frame we are not interested in
+static int pnet_skip(struct net_keyed_stream *nks, uint64_t len)
+{
+    struct pnet_state *p = nks->pnet;
+
+    while (len>0) { 
+	int n = len > PNET_SCRATCH ? PNET_SCRATCH : len;
+
+	if (recv_msg(nks->ns, p->scratch, n) != n) { 
+	    return -1;
+	}
+	len -= n;
+    }
+
+    return 0;
+}
+
+// writer: handle one frame coming back from the reader
+static int pnet_recv_ack(struct net_keyed_stream *nks)
+{
+    struct pnet_state *p = nks->pnet;
+    struct pnet_frame f;
+
+    if (pnet_recv_frame(nks, &f)) { 
+	return -1;
+    }
+
+    switch (f.type) { 
+	case PNET_ACK:
+	    if (f.len) { 
+		ERROR("Peer reported error %llu at pnet frame %u\n", f.len, f.id);
+		p->error = 1;
+		return -1;
+	    }
+	    if ((int32_t)(f.id - p->acked) > 0) { 
+		p->acked = f.id;
+	    }
+	    return 0;
+	case PNET_GET:
+	    // kept for next_request_pnet, any earlier one is out of date
+	    if (f.taglen > PNET_MAX_TAG || f.len) { 
+		return pnet_skip(nks, f.taglen + f.len);
+	    }
+	    if (recv_msg(nks->ns, p->request, f.taglen) != f.taglen) { 
+		ERROR("Cannot receive key in pnet GET\n");
+		return -1;
+	    }
+	    p->request[f.taglen] = 0;
+	    p->have_request = 1;
+	    return 0;
+	default:
+	    ERROR("Unexpected pnet frame type %u from reader\n", f.type);
+	    return -1;
+    }
+}
+
+static int pnet_send_counted(struct net_keyed_stream *nks, uint16_t type, uint16_t flags,
+			     void *tag, uint32_t taglen, void *buf, uint64_t len)
+{
+    struct pnet_state *p = nks->pnet;
+
+    if (p->error) { 
+	return -1;
+    }
+
+    while ((p->next_id - 1 - p->acked) >= p->window) { 
+	if (pnet_recv_ack(nks)) { 
+	    p->error = 1;
+	    return -1;
+	}
+    }
+
+    // frames in flight once this one is sent
+    if ((p->next_id - p->acked) == p->window || 
+	(p->next_id - p->acked) == (p->window+1)/2) { 
+	flags |= PNET_ACKREQ;
+    }
+
+    if (pnet_send_frame(nks, type, flags, p->next_id, tag, taglen, buf, len)) { 
+	p->error = 1;
+	return -1;
+    }
+
+    p->next_id++;
+
+    return 0;
+}
+
+// reader: note a consumed frame and ack it if asked to
+static int pnet_consume(struct net_keyed_stream *nks, uint32_t id, int ack)
+{
+    struct pnet_state *p = nks->pnet;
+
+    p->consumed = id;
+
+    if (ack) { 
+	if (pnet_send_frame(nks, PNET_ACK, 0, p->consumed, 0, 0, 0, 0)) { 
+	    return -1;
+	}
+	p->acked = p->consumed;
+    }
+
+    return 0;
+}
+
+// reader: receive an OPEN or CLOSE for key
+static int pnet_recv_key_frame(struct net_keyed_stream *nks, uint16_t type, char *key)
+{
+    struct pnet_state *p = nks->pnet;
+    uint32_t keylen = strlen(key);
+    struct pnet_frame f;
+
+    if (pnet_recv_frame(nks, &f)) { 
+	return -1;
+    }
+
+    if (f.type == PNET_ERROR) { 
+	ERROR("Peer cannot supply key %s\n", key);
+	pnet_skip(nks, f.taglen + f.len);
+	return -1;
+    }
+
+    if (f.type != type || f.taglen != keylen || f.len != 0) {
+	ERROR("Unexpected pnet frame (type %u) for key %s\n", f.type, key);
+	return -1;
+    }
+
+    if (recv_msg(nks->ns, p->scratch, keylen) != keylen) { 
+	ERROR("Cannot receive key in pnet frame\n");
+	return -1;
+    }
+
+    if (memcmp(p->scratch, key, keylen)) {
+	ERROR("Key mismatch in pnet frame - expected %s\n", key);
+	return -1;
+    }
+
+    return pnet_consume(nks, f.id, (type == PNET_CLOSE) || (f.flags & PNET_ACKREQ));
+}
+
+
+static int open_stream_pnet(struct net_keyed_stream *nks, uint32_t window)
+{
+    struct pnet_state *p = palacios_alloc(sizeof(struct pnet_state));
+
+    if (!p) { 
+	ERROR("Cannot allocate pnet state\n");
+	return -1;
+    }
+
+    memset(p, 0, sizeof(struct pnet_state));
+
+    if (window == 0) { 
+	window = PNET_DEF_WINDOW;
+    } else if (window > PNET_MAX_WINDOW) { 
+	window = PNET_MAX_WINDOW;
+    }
+
+    p->window = window;
+    p->next_id = 1;
+
+    nks->pnet = p;
+
+    return 0;
+}
+
+// writer: wait until the reader has confirmed every frame sent so far
+static int pnet_wait_acked(struct net_keyed_stream *nks)
+{
+    struct pnet_state *p = nks->pnet;
+
+    while (!p->error && p->acked != p->next_id - 1) { 
+	if (pnet_recv_ack(nks)) { 
+	    ERROR("Lost pnet acknowledgements - %u frames unconfirmed\n",
+		  p->next_id - 1 - p->acked);
+	    p->error = 1;
+	}
+    }
+
+    return p->error ? -1 : 0;
+}
+
+static void close_stream_pnet(struct net_keyed_stream *nks)
+{
+    struct pnet_state *p = nks->pnet;
+
+    if (nks->ot == V3_KS_WR_ONLY) { 
+	// everything must be delivered before we hang up
+	pnet_wait_acked(nks);
+    } else if (p->consumed != p->acked) { 
+	pnet_consume(nks, p->consumed, 1);
+    }
+
+    palacios_free(p);
+    nks->pnet = 0;
+}
+
+static v3_keyed_stream_key_t open_key_pnet(struct net_keyed_stream *nks, char *key)
+{
+    uint32_t keylen = strlen(key);
+
+    if (keylen > PNET_MAX_TAG) { 
+	ERROR("Key is too long\n");
+	return NULL;
+    }
+
+    if (nks->ot == V3_KS_WR_ONLY) { 
+	if (pnet_send_counted(nks, PNET_OPEN, 0, key, keylen, 0, 0)) { 
+	    ERROR("Unable to open key %s for writing on pnet stream\n", key);
+	    return NULL;
+	}
+    } else {
+	if (pnet_send_frame(nks, PNET_GET, 0, 0, key, keylen, 0, 0) ||
+	    pnet_recv_key_frame(nks, PNET_OPEN, key)) { 
+	    ERROR("Unable to open key %s for reading on pnet stream\n", key);
+	    return NULL;
+	}
+    }
+
+    return (v3_keyed_stream_key_t)key;
+}
+
+static int close_key_pnet(struct net_keyed_stream *nks, char *key)
+{
+    uint32_t keylen = strlen(key);
+
+    if (nks->ot == V3_KS_WR_ONLY) { 
+	if (pnet_send_counted(nks, PNET_CLOSE, 0, key, keylen, 0, 0)) { 
+	    ERROR("Cannot close key %s on pnet stream\n", key);
+	    return -1;
+	}
+	// the reader acknowledges every CLOSE, so this tells us the key was stored
+	if (pnet_wait_acked(nks)) { 
+	    ERROR("Reader did not confirm key %s on pnet stream\n", key);
+	    return -1;
+	}
+    } else {
+	if (pnet_recv_key_frame(nks, PNET_CLOSE, key)) { 
+	    ERROR("Cannot close key %s on pnet stream\n", key);
+	    return -1;
+	}
+    }
+
+    return 0;
+}
+
+static sint64_t write_key_pnet(struct net_keyed_stream *nks, void *tag, sint64_t taglen,
+			       void *buf, sint64_t len)
+{
+    sint64_t done = 0;
+
+    if (taglen > PNET_MAX_TAG) { 
+	ERROR("Tag too long in write_key_pnet\n");
+	return -1;
+    }
+
+    do { 
+	uint64_t seg = (len - done) > PNET_SEGMENT ? PNET_SEGMENT : (len - done);
+	uint16_t flags = (done + seg < len) ? PNET_MORE : 0;
+
+	if (pnet_send_counted(nks, PNET_DATA, flags,
+			      done ? 0 : tag, done ? 0 : taglen,
+			      (char *)buf + done, seg)) { 
+	    ERROR("Could not send data in write_key_pnet\n");
+	    return -1;
+	}
+
+	done += seg;
+
+    } while (done < len);
+
+    return len;
+}
+
+// writer: wait for the reader to ask for a key
+static sint64_t next_request_pnet(struct net_keyed_stream *nks, char *key, sint64_t len)
+{
+    struct pnet_state *p = nks->pnet;
+    sint64_t keylen;
+
+    if (nks->ot != V3_KS_WR_ONLY) { 
+	return -1;
+    }
+
+    if (len == 0) { 
+	return 0;
+    }
+
+    while (!p->have_request) { 
+	if (p->error || pnet_recv_ack(nks)) { 
+	    ERROR("Lost the reader while waiting for its next request\n");
+	    p->error = 1;
+	    return -1;
+	}
+    }
+
+    p->have_request = 0;
+
+    keylen = strlen(p->request);
+
+    if (keylen >= len) { 
+	ERROR("Requested key %s is too long\n", p->request);
+	return -1;
+    }
+
+    memcpy(key, p->request, keylen + 1);
+
+    return keylen;
+}
+
+static sint64_t read_key_pnet(struct net_keyed_stream *nks, void *tag, sint64_t taglen,
+			      void *buf, sint64_t len)
+{
+    struct pnet_state *p = nks->pnet;
+    struct pnet_frame f;
+    sint64_t done = 0;
+    int first = 1;
+
+    if (taglen > PNET_MAX_TAG) { 
+	ERROR("Tag too long in read_key_pnet\n");
+	return -1;
+    }
+
+    do {
+	if (pnet_recv_frame(nks, &f)) { 
+	    return -1;
+	}
+
+	if (f.type != PNET_DATA) { 
+	    ERROR("Expected data but got pnet frame type %u in read_key_pnet\n", f.type);
+	    return -1;
+	}
+
+	if (first) { 
+	    if (f.taglen != taglen) { 
+		ERROR("Tag len expected does not match tag len decoded in read_key_pnet\n");
+		return -1;
+	    }
+	    if (recv_msg(nks->ns, p->scratch, taglen) != taglen) { 
+		ERROR("Cannot receive tag in read_key_pnet\n");
+		return -1;
+	    }
+	    if (memcmp(p->scratch, tag, taglen)) { 
+		ERROR("Tag mismatch in read_key_pnet\n");
+		return -1;
+	    }
+	    first = 0;
+	} else if (f.taglen) { 
+	    ERROR("Unexpected tag on continued record in read_key_pnet\n");
+	    return -1;
+	}
+
+	if (f.len > len - done || f.len > PNET_SEGMENT) { 
+	    ERROR("Data len expected does not match data len decoded in read_key_pnet\n");
+	    return -1;
+	}
+
+	if (recv_msg(nks->ns, (char *)buf + done, f.len) != f.len) { 
+	    ERROR("Cannot receive data in read_key_pnet\n");
+	    return -1;
+	}
+
+	done += f.len;
+
+	if (pnet_consume(nks, f.id, f.flags & PNET_ACKREQ)) { 
+	    return -1;
+	}
+
+    } while (f.flags & PNET_MORE);
+
+    if (done != len) { 
+	ERROR("Data len expected does not match data len decoded in read_key_pnet\n");
+	return -1;
+    }
+
+    return len;
+}
+
+
+static struct v3_keyed_stream_t * open_stream_net(char * url,v3_keyed_stream_open_t ot)
+{
+    struct net_keyed_stream * nks;
+    int url_len;
+    int i;
+    int delimit[4];
+    int k;
+    char mode;
+    int ip_len;
+    int port_len;
+    int pipelined = 0;
+    uint32_t window = 0;
+
+    if (!strncasecmp(url,"pnet:",5)) { 
+	pipelined = 1;
+	url++;
+    }
 
     nks = palacios_alloc(sizeof(struct net_keyed_stream)); 
 
@@ -2598,6 +4074,7 @@ static struct v3_keyed_stream_t * open_stream_net(char * url,v3_keyed_stream_ope
     nks->ot = ot == V3_KS_WR_ONLY_CREATE ? V3_KS_WR_ONLY : ot;
 
     nks->stype = STREAM_NETWORK; 
+    nks->pnet = 0;
 
     nks->ns = create_net_stream();
     
@@ -2611,13 +4088,26 @@ static struct v3_keyed_stream_t * open_stream_net(char * url,v3_keyed_stream_ope
     k=0;
 
 
-    for(i = 0; i < url_len;i++){
+    for(i = 0; i < url_len && k < 4;i++){
 	if(url[i] == ':'){
 	    delimit[k] = i;
 	    k++;	
 	}
     }
 
+    if (k < 3) { 
+	ERROR("Malformed network stream url\n");
+	palacios_free(nks->ns);
+	palacios_free(nks);
+	return NULL;
+    }
+
+    if (k == 4) { 
+	// trailing window, for pnet
+	window = simple_strtoul(url + delimit[3] + 1, NULL, 10);
+	url_len = delimit[3];
+    }
+
     mode = url[delimit[0] + 1];
     ip_len = delimit[2] - delimit[1];
     port_len = url_len - delimit[2];
@@ -2657,6 +4147,17 @@ static struct v3_keyed_stream_t * open_stream_net(char * url,v3_keyed_stream_ope
 	    palacios_free(nks);
 	    return NULL;
 	}
+
+	if (!nks->ns) { 
+	    ERROR("Could not establish network stream\n");
+	    palacios_free(nks);
+	    return NULL;
+	}
+
+	if (pipelined && open_stream_pnet(nks, window)) { 
+	    close_socket(nks);
+	    return NULL;
+	}
 	
 	return (v3_keyed_stream_t)nks;
     }
@@ -2667,10 +4168,34 @@ static void preallocate_hint_key_net(v3_keyed_stream_t stream, char *key,uint64_
     //do nothing
 }
 
+static sint64_t next_request_net(v3_keyed_stream_t stream, char *key, sint64_t len)
+{
+    struct net_keyed_stream * nks = (struct net_keyed_stream *)stream;
+
+    // only the pipelined protocol carries requests back
+    if (!nks->pnet) { 
+	return -1;
+    }
+
+    return next_request_pnet(nks, key, len);
+}
+
+static void abort_net(v3_keyed_stream_t stream)
+{
+    struct net_keyed_stream * nks = (struct net_keyed_stream *)stream;
+
+    // wakes up anyone blocked in send_msg or recv_msg, the socket is released at close
+    kernel_sock_shutdown(nks->ns->sock, SHUT_RDWR);
+}
+
 static v3_keyed_stream_key_t open_key_net(v3_keyed_stream_t stream,char *key)
 {
    struct net_keyed_stream * nks = (struct net_keyed_stream *)stream;
 
+   if (nks->pnet) { 
+       return open_key_pnet(nks, key);
+   }
+
    // reciever of the key name 
    if (nks->ot==V3_KS_WR_ONLY)
    {
@@ -2753,18 +4278,21 @@ static v3_keyed_stream_key_t open_key_net(v3_keyed_stream_t stream,char *key)
    return (v3_keyed_stream_key_t)key;
 }
 
-static void close_key_net(v3_keyed_stream_t stream, v3_keyed_stream_key_t input_key)
+static int close_key_net(v3_keyed_stream_t stream, v3_keyed_stream_key_t input_key)
 {
     char * key = (char*)input_key;
     struct net_keyed_stream * nks = (struct net_keyed_stream *)stream;
 
+    if (nks->pnet) { 
+	return close_key_pnet(nks, key);
+    }
     
     if (nks->ot==V3_KS_WR_ONLY) {
 	unsigned short keylen = strlen(key);
 
 	if (keylen > NET_MAX_KEY_LEN || keylen>=32768) {
 	    ERROR("Key length too long in close_key_net\n");
-	    return;
+	    return -1;
 	}
 
 	{
@@ -2779,7 +4307,7 @@ static void close_key_net(v3_keyed_stream_t stream, v3_keyed_stream_key_t input_
 	    msg[keylen+2]=0;
 	    if (send_msg(nks->ns,msg,keylen+2)!=keylen+2) { 
 		ERROR("Cannot send key on close_key_net\n");
-		return;
+		return -1;
 	    }
 	}
     }
@@ -2791,7 +4319,7 @@ static void close_key_net(v3_keyed_stream_t stream, v3_keyed_stream_key_t input_
 	
 	if (recv_msg(nks->ns,msg_info,2) != 2) { 
 	    ERROR("Cannot recv key length on close_key_net\n");
-	    return;
+	    return -1;
 	}
 	
 	next = 0;
@@ -2801,7 +4329,7 @@ static void close_key_net(v3_keyed_stream_t stream, v3_keyed_stream_key_t input_
 	
 	if ((msg_info[next] & 0x80) != 0x80) {
 	    ERROR("Missing flag in close_key_net receive\n");
-	    return;
+	    return -1;
 	} 
 	
 	msg_info[next] &= 0x7F; // flip the msb back to zero
@@ -2813,17 +4341,19 @@ static void close_key_net(v3_keyed_stream_t stream, v3_keyed_stream_key_t input_
 	    
 	    if (recv_msg(nks->ns,msg,keylen)!=keylen) { 
 		ERROR("Did not receive all of key in close_key_net receive\n");
-		return;
+		return -1;
 	    }
 	    
 	    msg[keylen]=0;
 	    
 	    if (strncmp(key,msg,keylen)!=0)  {
 		ERROR("Key mismatch in close_key_net - expect %s but got %s\n",key,msg);
-		return;
+		return -1;
 	    }
 	}
     }
+
+    return 0;
 }
 
 static sint64_t write_key_net(v3_keyed_stream_t stream, v3_keyed_stream_key_t key, 
@@ -2864,6 +4394,10 @@ static sint64_t write_key_net(v3_keyed_stream_t stream, v3_keyed_stream_key_t ke
 	return -1;
     }
     
+    if (nks->pnet && nks->ot==V3_KS_WR_ONLY) { 
+	return write_key_pnet(nks,tag,taglen,buf,len);
+    }
+
     if (nks->ot==V3_KS_WR_ONLY) {
         if (send_msg(nks->ns,(char*)(&BOUNDARY_TAG),sizeof(BOUNDARY_TAG))!=sizeof(BOUNDARY_TAG)) { 
    	    ERROR("Could not send boundary tag in write_key_net\n");
@@ -2928,6 +4462,10 @@ static sint64_t read_key_net(v3_keyed_stream_t stream, v3_keyed_stream_key_t key
     }
 
 
+    if (nks->pnet && nks->ot==V3_KS_RD_ONLY) { 
+	return read_key_pnet(nks,tag,taglen,buf,len);
+    }
+
     if (nks->ot==V3_KS_RD_ONLY) {
         
         sint64_t slen;
@@ -3012,11 +4550,11 @@ static v3_keyed_stream_t open_stream(char *url,
 {
     if (!strncasecmp(url,"mem:",4)) { 
 	return open_stream_mem(url,ot);
-    } else if (!strncasecmp(url,"file:",5)) { 
+    } else if (!strncasecmp(url,"file:",5) || !strncasecmp(url,"afile:",6)) { 
 	return open_stream_file(url,ot);
     } else if (!strncasecmp(url,"user:",5)) { 
 	return open_stream_user(url,ot);
-    } else if (!strncasecmp(url,"net:",4)){
+    } else if (!strncasecmp(url,"net:",4) || !strncasecmp(url,"pnet:",5)){
 	return open_stream_net(url,ot);
     } else if (!strncasecmp(url,"textfile:",9)) { 
         return open_stream_textfile(url,ot);
@@ -3108,8 +4646,8 @@ static v3_keyed_stream_key_t open_key(v3_keyed_stream_t stream,
 }
 
 
-static void close_key(v3_keyed_stream_t stream, 
-		      v3_keyed_stream_key_t key)
+static int close_key(v3_keyed_stream_t stream, 
+		     v3_keyed_stream_key_t key)
 {
     struct generic_keyed_stream *gks = (struct generic_keyed_stream *) stream;
     switch (gks->stype){ 
@@ -3132,8 +4670,7 @@ static void close_key(v3_keyed_stream_t stream,
 	    ERROR("unknown stream type %d in close_key\n",gks->stype);
 	    break;
     }
-    // nothing to do
-    return;
+    return -1;
 }
 
 static sint64_t write_key(v3_keyed_stream_t stream, 
@@ -3203,6 +4740,36 @@ static sint64_t read_key(v3_keyed_stream_t stream,
 
 
 
+static sint64_t next_request(v3_keyed_stream_t stream,
+			     char *key,
+			     sint64_t len)
+{
+    struct generic_keyed_stream *gks = (struct generic_keyed_stream *) stream;
+    switch (gks->stype){ 
+	case STREAM_NETWORK:
+	    return next_request_net(stream,key,len);
+	    break;
+	default:
+	    // the other streams have no reader at the other end to ask
+	    return -1;
+	    break;
+    }
+    return -1;
+}
+
+static void abort_stream(v3_keyed_stream_t stream)
+{
+    struct generic_keyed_stream *gks = (struct generic_keyed_stream *) stream;
+    switch (gks->stype){ 
+	case STREAM_NETWORK:
+	    abort_net(stream);
+	    break;
+	default:
+	    // only network streams wait on a remote peer
+	    break;
+    }
+}
+
 
 /***************************************************************************************************
   Hooks to palacios and inititialization
@@ -3216,7 +4783,9 @@ static struct v3_keyed_stream_hooks hooks = {
     .open_key = open_key,
     .close_key = close_key,
     .read_key = read_key,
-    .write_key = write_key
+    .write_key = write_key,
+    .next_request = next_request,
+    .abort = abort_stream
 };
 
 
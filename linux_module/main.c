@@ -385,15 +385,27 @@ static int read_guests_details(struct seq_file *s, void *v)
 			       core->vcore[j].vcore_type==V3_VCORE_GENERAL ? "" :
 			       core->vcore[j].vcore_type==V3_VCORE_ROS ? "ros" :
 			       core->vcore[j].vcore_type==V3_VCORE_HRT ? "hrt" : "UNKNOWN");
+		    if (core->vcore[j].num_4k_maps || core->vcore[j].num_2m_maps || core->vcore[j].num_1g_maps) { 
+			seq_printf(s,"      direct map: %llu 4KB, %llu 2MB, %llu 1GB pages\n",
+				   core->vcore[j].num_4k_maps, core->vcore[j].num_2m_maps, core->vcore[j].num_1g_maps);
+		    }
 		}
 
 
+		if (mem->swap_ins || mem->swap_pool_size) { 
+		    seq_printf(s, "\nSwapping: %llu swap ins, %llu from pool (%llu%%), pool %llu of %llu bytes used\n",
+			       mem->swap_ins, mem->swap_pool_ins, 
+			       mem->swap_ins ? (mem->swap_pool_ins*100)/mem->swap_ins : 0,
+			       mem->swap_pool_used, mem->swap_pool_size);
+		}
+
 		seq_printf(s, "\nMemory Regions\n");
 		for (j=0;j<mem->num_regions;j++) { 
-		    seq_printf(s,"   region %u has HPAs 0x%016llx-0x%016llx (node %d) GPA 0x%016llx %s %s\n",
+		    seq_printf(s,"   region %u has HPAs 0x%016llx-0x%016llx (node %d) GPA 0x%016llx hotness %u %s %s\n",
 			       j, (uint64_t)mem->region[j].host_paddr, (uint64_t)mem->region[j].host_paddr+mem->region[j].size,
 			       numa_addr_to_node((uintptr_t)(mem->region[j].host_paddr)),
 			       (uint64_t)mem->region[j].guest_paddr,
+			       mem->region[j].hotness,
 			       mem->region[j].swapped ? "swapped" : "",
 			       mem->region[j].pinned ? "pinned" : "");
 		}
@@ -24,6 +24,20 @@ static uintptr_t * seed_addrs = NULL;
 uintptr_t alloc_palacios_pgs(u64 num_pages, u32 alignment, int node_id, int (*filter_func)(void *paddr, void *filter_state), void *filter_state) {
     uintptr_t addr = 0; 
     int any = node_id==-1; // can allocate on any
+    unsigned long order = get_order(num_pages * PAGE_SIZE) + PAGE_SHIFT;
+
+    if (alignment & (alignment - 1)) { 
+	ERROR("Requesting memory with an alignment that is not a power of two (%u)\n", alignment);
+	return 0;
+    }
+
+    // Alignment beyond the size of the allocation cannot help map it with
+    // larger pages, and would strand the rest of the aligned block, so
+    // resource controls that request it for every allocation get the 
+    // allocation's natural alignment instead
+    if (alignment > (1UL << order)) { 
+	alignment = 1UL << order;
+    }
 
     if (node_id == -1) {
 	int cpu_id = get_cpu();
@@ -39,14 +53,14 @@ uintptr_t alloc_palacios_pgs(u64 num_pages, u32 alignment, int node_id, int (*fi
 	return 0;
     }
 
-    addr = buddy_alloc(memzones[node_id], get_order(num_pages * PAGE_SIZE) + PAGE_SHIFT, filter_func, filter_state);
+    addr = buddy_alloc(memzones[node_id], order, alignment, filter_func, filter_state);
 
     if (!addr && any) { 
 	int i;
 	// do a scan to see if we can satisfy request on any node
 	for (i=0; i< numa_num_nodes(); i++) { 
 	    if (i!=node_id) { 
-		addr = buddy_alloc(memzones[i], get_order(num_pages * PAGE_SIZE) + PAGE_SHIFT, filter_func, filter_state);
+		addr = buddy_alloc(memzones[i], order, alignment, filter_func, filter_state);
 		if (addr) {
 		    break;
 		}
@@ -169,6 +183,12 @@ int add_palacios_memory(struct v3_mem_region *r) {
 
     pool_order = get_order(r->num_pages * PAGE_SIZE) + PAGE_SHIFT;
 
+    // Blocks are aligned relative to the pool base, so a misaligned pool 
+    // can supply fewer blocks aligned for 2MB/1GB mappings
+    if (r->base_addr & ((1ULL << (pool_order < 30 ? pool_order : 30)) - 1)) { 
+	WARNING("Memory pool at 0x%llx is not aligned to its size - large page aligned allocations from it will be limited\n", r->base_addr);
+    }
+
     if (buddy_add_pool(memzones[node_id], r->base_addr, pool_order, keep)) {
 	ERROR("ALERT ALERT ALERT Unable to add pool to buddy allocator...\n");
 	if (r->type==REQUESTED || r->type==REQUESTED32) { 
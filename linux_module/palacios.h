@@ -112,6 +112,14 @@ struct v3_chkpt_info {
 #define V3_CHKPT_OPT_SKIP_DEVS    2  // don't write devices to store
 #define V3_CHKPT_OPT_SKIP_CORES   4  // don't write core arch ind data to store
 #define V3_CHKPT_OPT_SKIP_ARCHDEP 8  // don't write core arch dep data to store
+#define V3_CHKPT_OPT_COMPRESS_ZRLE 16 // compress large blobs with zero/run-length encoding
+#define V3_CHKPT_OPT_COMPRESS_LZ   32 // compress large blobs with LZ (either flag is enough to load)
+#define V3_CHKPT_OPT_PARALLEL_MEM  64 // save/load memory regions with multiple worker threads
+#define V3_CHKPT_OPT_POSTCOPY      128 // migrate state first, then memory while the VM runs
+#define V3_CHKPT_OPT_ELIDE_PAGES   256 // send zero and duplicate pages as short references
+#define V3_CHKPT_OPT_XBZRLE        512 // send re-dirtied pages as deltas (migration only)
+#define V3_CHKPT_OPT_LAZY_MEM      1024 // memory in separately loadable chunks, loaded on demand
+#define V3_CHKPT_OPT_INCREMENTAL   2048 // save only pages dirtied since the last save, chained to it
 } __attribute__((packed));
 
 
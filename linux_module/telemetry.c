@@ -0,0 +1,124 @@
+#include <linux/errno.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/uaccess.h>
+#include <linux/fs.h>
+
+#include <palacios/vmm.h>
+
+#include "palacios.h"
+#include "telemetry.h"
+#include "linux-exts.h"
+#include "vm.h"
+
+
+#define MIN(x,y) ( (x) < (y) ? (x) : (y) )
+
+
+static int telemetry_size(struct v3_guest *guest,
+			  unsigned int ioctl,
+			  unsigned long arg,
+			  void *priv_data)
+{
+    struct v3_telemetry_sizes size;
+    unsigned long long num_vcores, num_regions;
+
+    if (v3_get_state_sizes_vm(guest->v3_ctx, &num_vcores, &num_regions)) { 
+	ERROR("palacios: unable to get VM sizes\n");
+	return -EFAULT;
+    }
+
+    size.num_cores = num_vcores;
+    size.snapshot_size = sizeof(v3_telemetry_snapshot) + num_vcores * sizeof(struct v3_telemetry_core_snap);
+
+    if (copy_to_user((void __user *)arg, &size, sizeof(struct v3_telemetry_sizes))) {
+	ERROR("palacios: unable to copy telemetry sizes to user\n");
+	return -EFAULT;
+    }
+
+    return 0;
+}
+
+
+static int telemetry_snap(struct v3_guest *guest,
+			  unsigned int ioctl,
+			  unsigned long arg,
+			  void *priv_data)
+{
+    v3_telemetry_snapshot *sys_snap;
+    uint32_t num_cores;
+
+    if (copy_from_user(&num_cores, (void __user *)arg, sizeof(num_cores))) { 
+	ERROR("palacios: cannot copy number of cores from user\n");
+	return -EFAULT;
+    }
+
+    if (!(sys_snap = v3_telemetry_take_snapshot(guest->v3_ctx))) { 
+	ERROR("palacios: unable to get telemetry snapshot\n");
+	return -EFAULT;
+    }
+
+    num_cores = MIN(num_cores, sys_snap->num_cores);
+
+    if (copy_to_user((void __user *)arg, &num_cores, sizeof(num_cores)) ||
+	copy_to_user((void __user *)(arg + sizeof(v3_telemetry_snapshot)),
+		     sys_snap->core,
+		     num_cores * sizeof(struct v3_telemetry_core_snap))) {
+	ERROR("palacios: unable to copy telemetry snapshot to user\n");
+	v3_telemetry_free_snapshot(sys_snap);
+	return -EFAULT;
+    }
+
+    v3_telemetry_free_snapshot(sys_snap);
+
+    return 0;
+}
+
+
+
+
+static int telemetry_init( void ) 
+{
+    // nothing yet
+    return 0;
+}
+
+
+static int telemetry_deinit( void ) {
+
+    // nothing yet
+    return 0;
+}
+
+
+
+static int guest_telemetry_init(struct v3_guest * guest, void ** vm_data) 
+{
+
+    add_guest_ctrl(guest, V3_VM_TELEMETRY_SIZE, telemetry_size, guest);
+    add_guest_ctrl(guest, V3_VM_TELEMETRY_SNAP, telemetry_snap, guest);
+
+    return 0;
+}
+
+
+static int guest_telemetry_deinit(struct v3_guest * guest, void * vm_data) {
+
+    remove_guest_ctrl(guest, V3_VM_TELEMETRY_SNAP);
+    remove_guest_ctrl(guest, V3_VM_TELEMETRY_SIZE);
+
+    return 0;
+}
+
+
+
+static struct linux_ext telemetry_ext = {
+    .name = "TELEMETRY_EXTENSION",
+    .init = telemetry_init,
+    .deinit = telemetry_deinit,
+    .guest_init = guest_telemetry_init,
+    .guest_deinit = guest_telemetry_deinit
+};
+
+
+register_extension(&telemetry_ext);
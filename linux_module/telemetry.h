@@ -0,0 +1,23 @@
+/*
+ * Palacios Exit Telemetry Userland Interface
+ */
+
+#ifndef __PALACIOS_TELEMETRY_H__
+#define __PALACIOS_TELEMETRY_H__
+
+#include <palacios/vmm_telemetry.h>
+
+#define V3_VM_TELEMETRY_SIZE 310
+#define V3_VM_TELEMETRY_SNAP 311
+
+
+// Used to size the snapshot buffer
+struct v3_telemetry_sizes {
+    uint64_t num_cores;
+    uint64_t snapshot_size;   // in bytes, for num_cores
+};
+
+// A snapshot request passes a v3_telemetry_snapshot with num_cores filled in
+// The kernel fills in at most that many cores and updates num_cores
+
+#endif
@@ -0,0 +1,129 @@
+#!/usr/bin/perl -w
+
+#
+# Merges a chain of incremental checkpoints (v3_save option 2048) into
+# one full checkpoint. Takes the newest checkpoint of the chain, follows
+# the parents back to the base, applies the deltas to the base memory
+# image, and writes the result with the non-memory state of the newest.
+# The result is generation 0 of a new chain.
+#
+# Works on binary checkpoint directories (KEYED_STREAM store, file: url)
+# saved without compression, page elision, or lazy memory.
+#
+
+use v3_checkpoint_file;
+
+$#ARGV==1 or die "v3_checkpoint_compact_chain.pl newest_binary_checkpoint_dir output_binary_dir\n";
+
+$dir = shift;
+$outdir = shift;
+
+$pagesize=4096;
+$maxrun=1024;
+
+# newest first
+@chain=();
+
+while (1) { 
+  my $hr = v3_read_checkpoint_from_binary_dir($dir);
+  my $gen;
+  my $parent;
+
+  defined($hr->{chain}) or die "$dir has no chain, it was not saved incrementally\n";
+
+  $gen = unpack("Q",$hr->{chain}{generation});
+
+  push @chain, { dir=>$dir, gen=>$gen, hr=>$hr };
+
+  last if ($gen==0);
+
+  $#chain<$gen+1 or die "$dir is generation $gen, but the chain is already longer\n";
+
+  $parent = $hr->{chain}{parent};
+  $parent =~ s/\0.*$//s;
+  $parent =~ s/^file://;
+
+  $dir = $parent;
+}
+
+$#chain==$chain[0]{gen} or die "chain is broken, the base is not generation 0\n";
+
+print "Merging ".($#chain)." deltas into base $chain[$#chain]{dir}\n";
+
+
+# The base memory image, as one string
+$base = $chain[$#chain]{hr}{memory_img};
+
+defined($base) or die "base has no memory image\n";
+
+$regionsize = unpack("Q",$base->{region_size});
+$numregions = unpack("L",$base->{num_regions});
+
+$mem="";
+
+for ($i=0;$i<$numregions;$i++) { 
+  defined($base->{"memory_img$i"}) or die "base is missing region $i\n";
+  length($base->{"memory_img$i"})==$regionsize or die "region $i has the wrong size, was the base compressed?\n";
+  $mem.=$base->{"memory_img$i"};
+}
+
+
+# Deltas, oldest first
+for ($c=$#chain-1;$c>=0;$c--) { 
+  my $inc = $chain[$c]{hr}{memory_inc0};
+  my $bitmap;
+  my $tag;
+  my $count=0;
+
+  defined($inc) or die "$chain[$c]{dir} has no memory delta\n";
+
+  unpack("L",$inc->{version})==2 or die "$chain[$c]{dir} has an unsupported delta version\n";
+
+  $bitmap = $inc->{memory_bitmap_bits};
+
+  foreach $tag (@{$inc->{tags}}) { 
+    my ($page, $len, $p);
+
+    next if ($tag eq "version" || $tag eq "memory_bitmap_bits");
+
+    $tag=~/^run(\d+)$/ or die "$chain[$c]{dir} has unsupported delta record $tag (page elision or delta encoding?)\n";
+
+    $page = $1;
+    $len = length($inc->{$tag});
+
+    ($len % $pagesize)==0 && $len>0 && $len<=$maxrun*$pagesize or die "$chain[$c]{dir} has a bad run at page $page (compressed?)\n";
+
+    for ($p=$page;$p<$page+$len/$pagesize;$p++) { 
+      vec($bitmap,$p,1) or die "$chain[$c]{dir} sends page $p, which is not dirty\n";
+    }
+
+    ($page*$pagesize+$len)<=length($mem) or die "$chain[$c]{dir} has a run past the end of memory\n";
+
+    substr($mem,$page*$pagesize,$len)=$inc->{$tag};
+    $count+=$len/$pagesize;
+  }
+
+  print "Applied $count pages from $chain[$c]{dir} (generation $chain[$c]{gen})\n";
+}
+
+
+# Everything else comes from the newest
+$out = $chain[0]{hr};
+
+for ($i=0;$i<$numregions;$i++) { 
+  $base->{"memory_img$i"}=substr($mem,$i*$regionsize,$regionsize);
+}
+
+$out->{memory_img}=$base;
+$out->{chain}={ tags=>["generation","parent_len","parent"],
+		generation=>pack("Q",0),
+		parent_len=>pack("L",1),
+		parent=>"\0" };
+
+@keys = grep { $_ ne "memory_inc0" && $_ ne "memory_img" } @{$out->{keys}};
+push @keys, "memory_img";
+$out->{keys}=\@keys;
+
+v3_write_checkpoint_as_binary_dir($out,$outdir);
+
+print "Wrote $outdir\n";
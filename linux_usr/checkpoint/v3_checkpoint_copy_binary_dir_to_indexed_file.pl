@@ -0,0 +1,21 @@
+#!/usr/bin/perl -w
+
+use Getopt::Long;
+use v3_checkpoint_file;
+
+$skipmem=0;
+
+&GetOptions("skipmem"=>\$skipmem);
+
+if ($skipmem) { 
+  @skiplist=("memory_img");
+}
+
+$#ARGV==1 or die "v3_checkpoint_copy_binary_dir_to_indexed_file.pl [--skipmem] binary_checkpoint_dir indexed_file\n";
+
+$dir = shift;
+$file = shift;
+
+my $hr = v3_read_checkpoint_from_binary_dir($dir,@skiplist);
+
+v3_write_checkpoint_as_indexed_file($hr,$file);
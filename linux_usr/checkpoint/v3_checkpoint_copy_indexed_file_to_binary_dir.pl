@@ -0,0 +1,21 @@
+#!/usr/bin/perl -w
+
+use Getopt::Long;
+use v3_checkpoint_file;
+
+$skipmem=0;
+
+&GetOptions("skipmem"=>\$skipmem);
+
+if ($skipmem) { 
+  @skiplist=("memory_img");
+}
+
+$#ARGV==1 or die "v3_checkpoint_copy_indexed_file_to_binary_dir.pl [--skipmem] indexed_file binary_checkpoint_dir\n";
+
+$file = shift;
+$dir = shift;
+
+my $hr = v3_read_checkpoint_from_indexed_file($file,@skiplist);
+
+v3_write_checkpoint_as_binary_dir($hr,$dir);
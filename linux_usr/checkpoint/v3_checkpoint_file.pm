@@ -9,10 +9,23 @@ require Exporter;
 	     v3_read_checkpoint_from_ini_dir
              v3_write_checkpoint_as_ini_file
              v3_write_checkpoint_as_ini_dir
-             v3_write_checkpoint_as_binary_dir);
+             v3_write_checkpoint_as_binary_dir
+	     v3_read_checkpoint_from_indexed_file
+	     v3_write_checkpoint_as_indexed_file);
+
+use Compress::Zlib qw(crc32);
 
 my $boundary=0xabcd0123;
 
+# indexed container (INDEXED store), see vmm_chkpt_stores.h
+my $idx_magic="V3CHKIDX";
+my $idx_version=1;
+my $idx_hdr_size=4096;
+my $idx_hdr_fmt="a8 L L L L Q Q L L";
+my $idx_hdr_len=48;
+my $idx_ctx_len=16;
+my $idx_entry_len=24;
+
 
 #
 # Takes: filename
@@ -281,3 +294,126 @@ sub v3_write_checkpoint_as_binary_dir {
   }
 }
 
+#
+# Takes: filename [optional list of keys/contexts to skip]
+# Returns: the same hashref as v3_read_checkpoint_from_binary_dir
+#
+# dies if it doesn't work, including on checksum mismatches
+#
+sub v3_read_checkpoint_from_indexed_file {
+  my ($file,@skiplist)=@_;
+  my %h;
+  my $buf;
+  my $index;
+  my ($magic,$version,$numctxs,$numentries,$strtablen,$indexoffset,$indexlen,$indexcrc,$hdrcrc);
+  my ($ctxrecs,$entryrecs,$strtab);
+  my $i;
+
+  $h{keys}=[];
+
+  open(FILE,$file) or die "cannot open $file\n";
+  binmode(FILE);
+
+  sysread(FILE,$buf,$idx_hdr_len)==$idx_hdr_len or die "cannot read header\n";
+  ($magic,$version,$numctxs,$numentries,$strtablen,$indexoffset,$indexlen,$indexcrc,$hdrcrc) = unpack($idx_hdr_fmt,$buf);
+  $magic eq $idx_magic or die "$file is not an indexed checkpoint\n";
+  crc32(substr($buf,0,$idx_hdr_len-4).pack("L",0))==$hdrcrc or die "header checksum mismatch\n";
+  $version==$idx_version or die "unsupported version $version\n";
+
+  sysseek(FILE,$indexoffset,0) or die "cannot seek to index\n";
+  sysread(FILE,$index,$indexlen)==$indexlen or die "cannot read index\n";
+  crc32($index)==$indexcrc or die "index checksum mismatch\n";
+
+  $ctxrecs=substr($index,0,$numctxs*$idx_ctx_len);
+  $entryrecs=substr($index,$numctxs*$idx_ctx_len,$numentries*$idx_entry_len);
+  $strtab=substr($index,$numctxs*$idx_ctx_len+$numentries*$idx_entry_len,$strtablen);
+
+  for ($i=0;$i<$numctxs;$i++) { 
+    my ($name,$first,$count)=unpack("L L L L",substr($ctxrecs,$i*$idx_ctx_len,$idx_ctx_len));
+    my $key=unpack("Z*",substr($strtab,$name));
+    my %k;
+    my $e;
+
+    next if inlist($key,@skiplist);
+
+    $k{tags}=[];
+
+    for ($e=$first;$e<$first+$count;$e++) { 
+      my ($offset,$len,$tagoff,$crc)=unpack("Q Q L L",substr($entryrecs,$e*$idx_entry_len,$idx_entry_len));
+      my $tag=unpack("Z*",substr($strtab,$tagoff));
+
+      undef $buf;
+      sysseek(FILE,$offset,0) or die "cannot seek to $key/$tag\n";
+      sysread(FILE,$buf,$len)==$len or die "cannot read $key/$tag\n";
+      crc32($buf)==$crc or die "checksum mismatch on $key/$tag\n";
+      push @{$k{tags}},$tag;
+      $k{$tag}=$buf;
+    }
+
+    $h{$key}=\%k;
+    push @{$h{keys}}, $key;
+  }
+
+  close(FILE);
+
+  return \%h;
+}
+
+#
+# input: href for a group of keys
+#        file to write
+#
+sub v3_write_checkpoint_as_indexed_file {
+  my ($hr,$file)=@_;
+  my $offset=$idx_hdr_size;
+  my $ctxrecs="";
+  my $entryrecs="";
+  my $strtab="";
+  my $numentries=0;
+  my $index;
+  my $hdr;
+  my $key;
+  my $tag;
+
+  defined($hr->{keys}) or die "cannot write indexed file without key list\n";
+
+  open(FILE,">$file") or die "cannot open $file\n";
+  binmode(FILE);
+
+  syswrite(FILE,"\0" x $idx_hdr_size)==$idx_hdr_size or die "cannot write header\n";
+
+  foreach $key (@{$hr->{keys}}) { 
+    $ctxrecs.=pack("L L L L",length($strtab),$numentries,scalar(@{$hr->{$key}{tags}}),0);
+    $strtab.=$key."\0";
+
+    foreach $tag (@{$hr->{$key}{tags}}) { 
+      my $data=$hr->{$key}{$tag};
+      my $len=length($data);
+      my $align=($len>=4096) ? 4096 : 8;
+
+      $offset=int(($offset+$align-1)/$align)*$align;
+      sysseek(FILE,$offset,0) or die "cannot seek\n";
+      syswrite(FILE,$data,$len)==$len or die "cannot write data\n";
+
+      $entryrecs.=pack("Q Q L L",$offset,$len,length($strtab),crc32($data));
+      $strtab.=$tag."\0";
+      $offset+=$len;
+      $numentries++;
+    }
+  }
+
+  $strtab="\0" if ($strtab eq "");
+  $index=$ctxrecs.$entryrecs.$strtab;
+  $offset=int(($offset+7)/8)*8;
+  sysseek(FILE,$offset,0) or die "cannot seek\n";
+  syswrite(FILE,$index,length($index))==length($index) or die "cannot write index\n";
+
+  $hdr=pack($idx_hdr_fmt,$idx_magic,$idx_version,scalar(@{$hr->{keys}}),$numentries,length($strtab),
+	    $offset,length($index),crc32($index),0);
+  $hdr=pack($idx_hdr_fmt,$idx_magic,$idx_version,scalar(@{$hr->{keys}}),$numentries,length($strtab),
+	    $offset,length($index),crc32($index),crc32($hdr));
+  sysseek(FILE,0,0) or die "cannot seek\n";
+  syswrite(FILE,$hdr,$idx_hdr_len)==$idx_hdr_len or die "cannot write header\n";
+
+  close(FILE);
+}
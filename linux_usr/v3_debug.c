@@ -30,6 +30,8 @@ int main(int argc, char* argv[]) {
 	printf(" 3   arch state\n");
 	printf(" 4   stack\n");
 	printf(" 5   backtrace\n");
+	printf(" 10  io port lookup benchmark (whole VM)\n");
+	printf(" 11  nested/passthrough 1GB invalidation benchmark\n");
 	printf(" 100 everything\n");
 	printf(" 101 telemetry+core state+arch state\n");
 	return -1;
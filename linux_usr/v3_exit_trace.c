@@ -0,0 +1,228 @@
+/*
+ * V3 VM exit trace utility
+ *
+ * Maps a core's exit trace ring and drains it continuously,
+ * writing records as text or in binary (struct v3_exit_trace_rec)
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+
+#include "v3_ctrl.h"
+#include "exit_trace.h"
+
+
+#define BATCH 256
+
+static volatile int done = 0;
+
+
+void usage() 
+{
+    fprintf(stderr,"usage: v3_exit_trace /dev/v3-vmN core bin|text file|_\n");
+    fprintf(stderr,"    drains the exit trace of the core until interrupted\n");
+    fprintf(stderr,"    text prints one exit per line\n");
+    fprintf(stderr,"    bin writes raw records (v3_exit_trace_rec)\n");
+}
+
+
+static void handle_sig(int sig)
+{
+  done = 1;
+}
+
+
+struct v3_exit_trace_ring *map_ring(char *vm, int core, uint64_t *size)
+{
+  int fd;
+  long pagesize = sysconf(_SC_PAGESIZE);
+  struct v3_exit_trace_ring *r;
+  uint32_t num_recs;
+
+  fd = v3_vm_ioctl(vm,V3_VM_EXIT_TRACE_CONNECT,(void*)(unsigned long)core);
+
+  if (fd<0) { 
+    fprintf(stderr,"Cannot connect to exit trace of core %d\n",core);
+    return 0;
+  }
+
+  // Map the header first to learn how big the ring is
+  r = mmap(0,pagesize,PROT_READ,MAP_SHARED,fd,0);
+
+  if (r==MAP_FAILED) { 
+    fprintf(stderr,"Cannot map exit trace header\n");
+    close(fd);
+    return 0;
+  }
+
+  num_recs = r->num_recs;
+  munmap(r,pagesize);
+
+  *size = sizeof(struct v3_exit_trace_ring) + num_recs*sizeof(struct v3_exit_trace_rec);
+  *size = (*size + pagesize - 1) & ~(pagesize - 1);
+
+  r = mmap(0,*size,PROT_READ,MAP_SHARED,fd,0);
+
+  close(fd);
+
+  if (r==MAP_FAILED) { 
+    fprintf(stderr,"Cannot map exit trace ring\n");
+    return 0;
+  }
+
+  return r;
+}
+
+
+void text_rec(FILE *fd, struct v3_exit_trace_rec *rec)
+{
+  fprintf(fd,"%lu\t0x%x\t0x%lx\t0x%lx\t%lu\t%lu\t",
+	  rec->exit_tsc, rec->exit_code, rec->rip, rec->exit_qual,
+	  rec->exit_tsc - rec->entry_tsc,
+	  rec->done_tsc - rec->exit_tsc);
+
+  if (rec->inject_vector==V3_EXIT_TRACE_NO_INJECT) { 
+    fprintf(fd,"-\n");
+  } else {
+    fprintf(fd,"%u\n",rec->inject_vector);
+  }
+}
+
+
+int drain(struct v3_exit_trace_ring *r, FILE *fd, int bin)
+{
+  uint64_t tail, head, lost=0, count=0;
+  struct v3_exit_trace_rec batch[BATCH];
+  uint64_t n, i;
+
+  // Start with what is currently in the ring
+  head = r->head;
+  tail = head > r->num_recs ? head - r->num_recs : 0;
+
+  if (!bin) { 
+    fprintf(fd,"Exit Trace (core %u, %u records)\n\n",r->vcore,r->num_recs);
+    fprintf(fd,"exit_tsc\texit_code\trip\tqual\tguest_cycles\thandler_cycles\tinjected\n");
+  }
+
+  while (!done) { 
+    head = r->head;
+    __sync_synchronize();
+
+    if (head==tail) { 
+      usleep(1000);
+      continue;
+    }
+
+    if (head - tail > r->num_recs) { 
+      lost += head - tail - r->num_recs;
+      tail = head - r->num_recs;
+    }
+
+    n = head - tail;
+    if (n>BATCH) { 
+      n = BATCH;
+    }
+
+    for (i=0;i<n;i++) { 
+      batch[i] = r->recs[(tail+i) & (r->num_recs-1)];
+    }
+
+    __sync_synchronize();
+
+    // Anything the core overwrote while we were copying is discarded
+    head = r->head;
+    if (head - tail > r->num_recs) { 
+      uint64_t over = head - tail - r->num_recs;
+      if (over>n) { 
+	over = n;
+      }
+      lost += over;
+      tail += over;
+      n -= over;
+      memmove(batch,batch+over,n*sizeof(batch[0]));
+    }
+
+    if (bin) { 
+      if (fwrite(batch,sizeof(batch[0]),n,fd)!=n) { 
+	fprintf(stderr,"Failed to write records\n");
+	return -1;
+      }
+    } else {
+      for (i=0;i<n;i++) { 
+	text_rec(fd,&batch[i]);
+      }
+    }
+
+    tail += n;
+    count += n;
+  }
+
+  fprintf(stderr,"%lu records written, %lu lost\n",count,lost);
+
+  return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+  char *vm;
+  int core;
+  int bin;
+  char *target;
+  FILE *fd;
+  struct v3_exit_trace_ring *r;
+  uint64_t size;
+  int rc;
+
+  if (argc!=5) { 
+    usage();
+    return -1;
+  }
+
+  vm=argv[1];
+  core=atoi(argv[2]);
+  target=argv[4];
+
+  if (!strcasecmp(argv[3],"bin")) { 
+    bin=1;
+  } else if (!strcasecmp(argv[3],"text")) { 
+    bin=0;
+  } else {
+    usage();
+    return -1;
+  }
+
+  if (!(r=map_ring(vm,core,&size))) { 
+    return -1;
+  }
+
+  if (!strcasecmp(target,"_")) { 
+    fd = stdout;
+  } else {
+    if (!(fd=fopen(target,"w"))) { 
+      fprintf(stderr,"Cannot open %s for write\n",target);
+      munmap(r,size);
+      return -1;
+    }
+  }
+
+  signal(SIGINT,handle_sig);
+  signal(SIGTERM,handle_sig);
+
+  rc = drain(r,fd,bin);
+
+  if (fd!=stdout) { 
+    fclose(fd);
+  }
+
+  munmap(r,size);
+
+  return rc;
+}
@@ -39,6 +39,12 @@ int main(int argc, char* argv[]) {
 	printf(" 2    skip devices\n");
 	printf(" 4    skip cores\n");
 	printf(" 8    skip architecture-specific core state\n");
+	printf(" 16   memory was compressed (zero/run-length)\n");
+	printf(" 32   memory was compressed (LZ)\n");
+	printf(" 64   memory was saved with parallel workers\n");
+	printf(" 256  memory was saved with zero/duplicate page elision\n");
+	printf(" 1024 load memory lazily while the VM runs (memory saved with 1024, store must allow it)\n");
+	printf(" 2048 load an incremental checkpoint, following its chain back to the base\n");
 	return -1;
     }
 
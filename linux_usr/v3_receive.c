@@ -39,6 +39,11 @@ int main(int argc, char* argv[]) {
 	printf(" 2    skip devices\n");
 	printf(" 4    skip cores\n");
 	printf(" 8    skip architecture-specific core state\n");
+	printf(" 16   memory was compressed (zero/run-length)\n");
+	printf(" 32   memory was compressed (LZ)\n");
+	printf(" 128  post-copy: VM can run as soon as state arrives (pnet: url)\n");
+	printf(" 256  memory is sent with zero/duplicate page elision\n");
+	printf(" 512  memory is sent with delta encoding\n");
 	return -1;
     }
 
@@ -41,6 +41,12 @@ int main(int argc, char* argv[]) {
 	printf(" 2    skip devices\n");
 	printf(" 4    skip cores\n");
 	printf(" 8    skip architecture-specific core state\n");
+	printf(" 16   compress memory with zero/run-length encoding\n");
+	printf(" 32   compress memory with LZ\n");
+	printf(" 64   save memory with parallel workers (store must allow it)\n");
+	printf(" 256  save zero and duplicate pages as short references\n");
+	printf(" 1024 save memory in chunks that can be loaded lazily\n");
+	printf(" 2048 save only the pages dirtied since the last incremental save of this VM\n");
 	return -1;
     }
 
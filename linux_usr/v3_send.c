@@ -39,6 +39,11 @@ int main(int argc, char* argv[]) {
 	printf(" 2    skip devices\n");
 	printf(" 4    skip cores\n");
 	printf(" 8    skip architecture-specific core state\n");
+	printf(" 16   compress memory with zero/run-length encoding\n");
+	printf(" 32   compress memory with LZ\n");
+	printf(" 128  post-copy: send state first, then memory as the VM asks for it (pnet: url)\n");
+	printf(" 256  send zero and duplicate pages as short references (pre-copy only)\n");
+	printf(" 512  send re-dirtied pages as deltas against what was sent before (pre-copy only)\n");
 	return -1;
     }
 
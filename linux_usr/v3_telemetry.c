@@ -0,0 +1,164 @@
+/*
+ * V3 exit telemetry snapshot utility
+ *
+ * Pulls the per-core, per-exit statistics out of the VMM
+ * in binary form via the telemetry ioctls
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+
+#include "v3_ctrl.h"
+#include "telemetry.h"
+
+
+void usage() 
+{
+    fprintf(stderr,"usage: v3_telemetry /dev/v3-vmN bin|text file|_\n");
+    fprintf(stderr,"    text prints a summary of every exit reason seen\n");
+    fprintf(stderr,"    bin writes the raw snapshot (v3_telemetry_snapshot)\n");
+}
+
+
+v3_telemetry_snapshot *take_snapshot(char *vm, uint64_t *size)
+{
+  struct v3_telemetry_sizes sizes;
+  v3_telemetry_snapshot *s;
+
+  if (v3_vm_ioctl(vm,V3_VM_TELEMETRY_SIZE,&sizes)<0) { 
+    fprintf(stderr,"Cannot get telemetry sizes\n");
+    return 0;
+  }
+
+  if (!(s=malloc(sizes.snapshot_size))) { 
+    fprintf(stderr,"Cannot allocate snapshot\n");
+    return 0;
+  }
+
+  memset(s,0,sizes.snapshot_size);
+  s->num_cores=sizes.num_cores;
+
+  if (v3_vm_ioctl(vm,V3_VM_TELEMETRY_SNAP,s)<0) { 
+    fprintf(stderr,"Cannot get telemetry snapshot\n");
+    free(s);
+    return 0;
+  }
+
+  *size = sizeof(v3_telemetry_snapshot) + s->num_cores*sizeof(struct v3_telemetry_core_snap);
+
+  return s;
+}
+
+
+int text_out(char *vm, char *target, v3_telemetry_snapshot *s)
+{
+  FILE *fd;
+  int close=0;
+  uint32_t i,j;
+
+  if (!strcasecmp(target,"_")) { 
+    fd = stdout;
+  } else {
+    if (!(fd=fopen(target,"w"))) { 
+      fprintf(stderr,"Cannot open %s for write\n",target);
+      return -1;
+    }
+    close=1;
+  }
+
+  fprintf(fd,"Exit Telemetry Snapshot\n\n");
+  fprintf(fd,"VM:\t%s\n",vm);
+  fprintf(fd,"Cores:\t%u\n\n",s->num_cores);
+
+  for (i=0;i<s->num_cores;i++) { 
+    fprintf(fd,"Core %u (%lu exits)\n", s->core[i].vcore, s->core[i].exit_cnt);
+    fprintf(fd,"  exit\tcount\tavg\tmin\tp50\tp99\tp999\tmax\t(cycles)\n");
+    for (j=0;j<V3_TELEMETRY_NUM_EXITS;j++) { 
+      struct v3_telemetry_exit_snap *e = &(s->core[i].exits[j]);
+      if (!e->cnt) { 
+	continue;
+      }
+      fprintf(fd,"  0x%x\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\n",
+	      e->exit_code, e->cnt, e->total_cycles/e->cnt,
+	      e->min_cycles, e->p50_cycles, e->p99_cycles, e->p999_cycles, e->max_cycles);
+    }
+    fprintf(fd,"\n");
+  }
+
+  if (close) { 
+    fclose(fd);
+  }
+  
+  return 0;
+}
+
+
+int bin_out(char *target, v3_telemetry_snapshot *s, uint64_t size)
+{
+  int fd;
+  int doclose=0;
+  char *buf = (char*)s;
+  int rc;
+
+  if (!strcasecmp(target,"_")) { 
+    fd = fileno(stdout);
+  } else {
+    if ((fd=open(target,O_WRONLY | O_CREAT | O_TRUNC, 0600))<0) { 
+      fprintf(stderr,"Cannot open %s for write\n",target);
+      return -1;
+    }
+    doclose=1;
+  }
+
+  while (size) { 
+    rc=write(fd,buf,size);
+    if (rc<=0) { 
+      fprintf(stderr,"Cannot write snapshot\n");
+      break;
+    } 
+    buf+=rc;
+    size-=rc;
+  }
+
+  if (doclose) { 
+    close(fd);
+  }
+  
+  return size ? -1 : 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+  v3_telemetry_snapshot *s;
+  uint64_t size;
+  int rc;
+
+  if (argc!=4) { 
+    usage();
+    return -1;
+  }
+
+  if (!(s=take_snapshot(argv[1],&size))) { 
+    return -1;
+  }
+
+  if (!strcasecmp(argv[2],"bin")) { 
+    rc = bin_out(argv[3],s,size);
+  } else if (!strcasecmp(argv[2],"text")) { 
+    rc = text_out(argv[1],argv[3],s);
+  } else {
+    usage();
+    rc = -1;
+  }
+
+  free(s);
+
+  return rc;
+}
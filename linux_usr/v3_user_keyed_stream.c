@@ -4,6 +4,8 @@
 #include <malloc.h>
 #include <string.h>
 #include <stdio.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 
 #include "v3_user_keyed_stream.h"
 
@@ -100,5 +102,61 @@ int v3_user_keyed_stream_push_response(int devfd, struct palacios_user_keyed_str
 		
 
 
+int v3_user_keyed_stream_ring_attach(int devfd, uint64_t size, struct palacios_user_keyed_stream_ring **ring)
+{
+    void *r;
+
+    // the kernel rounds the size and tells us what it used
+    if (ioctl(devfd,V3_KSTREAM_RING_SETUP_IOCTL,&size)<=0) { 
+	return -1;
+    }
+
+    r = mmap(0,size,PROT_READ|PROT_WRITE,MAP_SHARED,devfd,0);
+
+    if (r==MAP_FAILED) { 
+	return -1;
+    }
 
+    *ring = (struct palacios_user_keyed_stream_ring *) r;
 
+    return 0;
+}
+
+int v3_user_keyed_stream_ring_detach(struct palacios_user_keyed_stream_ring *ring)
+{
+    return munmap(ring,ring->size);
+}
+
+struct palacios_user_keyed_stream_slot *v3_user_keyed_stream_ring_next(struct palacios_user_keyed_stream_ring *ring)
+{
+    if (ring->tail==ring->head) { 
+	return 0;
+    }
+
+    // read the slot only after seeing the head that covers it
+    __sync_synchronize();
+
+    return &(ring->slots[ring->tail % ring->num_slots]);
+}
+
+char *v3_user_keyed_stream_ring_buf(struct palacios_user_keyed_stream_ring *ring, struct palacios_user_keyed_stream_slot *slot)
+{
+    return ((char *)ring) + ring->data_off + slot->buf_pos;
+}
+
+int v3_user_keyed_stream_ring_complete(int devfd, struct palacios_user_keyed_stream_ring *ring)
+{
+    // the response must be visible before the new tail, and the 
+    // tail before we look at whether the kernel is asleep
+    __sync_synchronize();
+    ring->tail++;
+    __sync_synchronize();
+
+    if (ring->host_waiting) { 
+	if (ioctl(devfd,V3_KSTREAM_RING_KICK_IOCTL,0)<=0) { 
+	    return -1;
+	}
+    }
+
+    return 0;
+}
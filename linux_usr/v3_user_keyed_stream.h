@@ -14,5 +14,17 @@ int v3_user_keyed_stream_have_request(int devfd);
 int v3_user_keyed_stream_pull_request(int devfd, struct palacios_user_keyed_stream_op **req);
 int v3_user_keyed_stream_push_response(int devfd, struct palacios_user_keyed_stream_op *resp);
 
+// Shared request ring (see iface-keyed-stream-user.h)
+// Requests too large for the ring still arrive through pull_request
+int v3_user_keyed_stream_ring_attach(int devfd, uint64_t size, struct palacios_user_keyed_stream_ring **ring);
+int v3_user_keyed_stream_ring_detach(struct palacios_user_keyed_stream_ring *ring);
+
+// the oldest pending request, or NULL
+struct palacios_user_keyed_stream_slot *v3_user_keyed_stream_ring_next(struct palacios_user_keyed_stream_ring *ring);
+// the request's buffer, in place
+char *v3_user_keyed_stream_ring_buf(struct palacios_user_keyed_stream_ring *ring, struct palacios_user_keyed_stream_slot *slot);
+// finish the oldest pending request, whose slot now holds the response
+int v3_user_keyed_stream_ring_complete(int devfd, struct palacios_user_keyed_stream_ring *ring);
+
 
 #endif
@@ -17,7 +17,7 @@
 
 void usage()
 {
-    fprintf(stderr,"v3_user_keyed_stream_file /dev/v3-vm0 user:file:stream\n");
+    fprintf(stderr,"v3_user_keyed_stream_file /dev/v3-vm0 user:file:stream [ring_size_in_MB]\n");
 }
 
 char *dir;
@@ -303,10 +303,98 @@ int handle_request(struct palacios_user_keyed_stream_op *req,
 }
 
 
-int run(int devfd, char *dir) 
+//
+// Ring requests are handled in place: the tag and data are written 
+// straight from the shared buffer, and read data lands in it
+//
+int handle_ring_request(struct palacios_user_keyed_stream_slot *slot, 
+			char *buf,
+			char *dir)
+{
+    int fd = (int) slot->user_key;
+    sint64_t taglen = slot->data_off;
+    int rc;
+
+    switch (slot->type) { 
+	case PALACIOS_KSTREAM_OPEN_KEY: {
+	    char fn[strlen(dir)+slot->buf_len+2];
+
+	    strcpy(fn,dir);
+	    strcat(fn,"/");
+	    strncat(fn,buf,slot->buf_len);
+
+	    fd = open(fn,O_RDWR | O_CREAT,0600);
+
+	    slot->user_key = (uint64_t) fd;
+	    slot->xfer = 0;
+
+	    return fd<0 ? -1 : 0;
+	}
+	    break;
+
+	case PALACIOS_KSTREAM_CLOSE_KEY:
+	    slot->xfer = close(fd);
+	    return 0;
+	    break;
+
+	case PALACIOS_KSTREAM_WRITE_KEY:
+	    rc = write_all(fd,buf,taglen);
+	    
+	    if (rc!=taglen) { 
+		fprintf(stderr,"Failed to write tag (taglen=%ld, rc=%d)\n",taglen,rc);
+		slot->xfer = -1;
+		return -1;
+	    }
+
+	    rc = write_all(fd,buf+taglen,slot->xfer);
+
+	    if (rc!=slot->xfer) {
+		fprintf(stderr,"Failed to write data (datalen=%ld, rc=%d)\n",slot->xfer,rc);
+		slot->xfer = -1;
+		return -1;
+	    }
+
+	    return 0;
+	    break;
+
+	case PALACIOS_KSTREAM_READ_KEY: {
+	    char temptag[taglen];
+
+	    rc = read_all(fd,temptag,taglen);
+
+	    if (rc!=taglen) { 
+		fprintf(stderr,"Failed to read tag (taglen=%ld, rc=%d)\n",taglen,rc);
+		slot->xfer = -1;
+		return -1;
+	    } 
+
+	    if (memcmp(temptag,buf,taglen)) { 
+		fprintf(stderr,"Tag mismatch in read tag\n");
+		slot->xfer = -1;
+		return -1;
+	    }
+
+	    // the data replaces the tag
+	    slot->xfer = read_all(fd,buf,slot->xfer);
+
+	    return slot->xfer<0 ? -1 : 0;
+	}
+	    break;
+
+	default:
+	    fprintf(stderr,"unknown request type\n");
+	    slot->xfer = -1;
+	    return -1;
+	    break;
+    }
+}
+
+
+int run(int devfd, struct palacios_user_keyed_stream_ring *ring, char *dir) 
 { 
     struct palacios_user_keyed_stream_op *req;
     struct palacios_user_keyed_stream_op *resp;
+    struct palacios_user_keyed_stream_slot *slot;
     fd_set   readset;
     int rc;
     
@@ -321,6 +409,23 @@ int run(int devfd, char *dir)
 
 		int err;
 
+		if (ring) { 
+		    while ((slot = v3_user_keyed_stream_ring_next(ring))) { 
+			if (handle_ring_request(slot, v3_user_keyed_stream_ring_buf(ring,slot), dir)) { 
+			    fprintf(stderr, "request handling resulted in an error, continuing\n");
+			}
+			if (v3_user_keyed_stream_ring_complete(devfd, ring)) { 
+			    fprintf(stderr,"could not complete ring request\n");
+			    return -1;
+			}
+		    }
+
+		    // requests too large for the ring still come this way
+		    if (!v3_user_keyed_stream_have_request(devfd)) { 
+			continue;
+		    }
+		}
+
 		if (v3_user_keyed_stream_pull_request(devfd, &req)) { 
 		    fprintf(stderr, "could not get request\n");
 		    free(req);
@@ -356,11 +461,17 @@ int main(int argc, char *argv[])
     int devfd;
     char *vm, *url;
     char *dir;
+    uint64_t ring_size=0;
+    struct palacios_user_keyed_stream_ring *ring=0;
 
-    if (argc!=3) { 
+    if (argc!=3 && argc!=4) { 
 	usage();
 	exit(-1);
     }
+
+    if (argc==4) { 
+	ring_size = atoll(argv[3])*1024*1024;
+    }
     
     vm=argv[1];
     url=argv[2];
@@ -384,9 +495,21 @@ int main(int argc, char *argv[])
 	exit(-1);
     }
     
+    if (ring_size) { 
+	if (v3_user_keyed_stream_ring_attach(devfd,ring_size,&ring)) { 
+	    perror("failed to set up ring");
+	    exit(-1);
+	}
+	fprintf(stderr,"Using a %llu byte shared ring\n",(unsigned long long)(ring->size));
+    }
+    
     fprintf(stderr,"Attached and running\n");
 
-    run(devfd,dir);
+    run(devfd,ring,dir);
+
+    if (ring) { 
+	v3_user_keyed_stream_ring_detach(ring);
+    }
 
     v3_user_keyed_stream_detach(devfd);
     
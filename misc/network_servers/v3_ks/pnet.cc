@@ -0,0 +1,217 @@
+/* 
+ * This file is part of the Palacios Virtual Machine Monitor developed
+ * by the V3VEE Project with funding from the United States National 
+ * Science Foundation and the Department of Energy.  
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  You can find out more at 
+ * http://www.v3vee.org
+ *
+ * Copyright (c) 2026, The V3VEE Project <http://www.v3vee.org> 
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "V3VEE_LICENSE".
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "pnet.h"
+
+using namespace std;
+
+
+static int write_all(int fd, const char * buf, uint64_t len) {
+    while (len > 0) {
+	ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+
+	if (n < 0 && errno == EINTR) {
+	    continue;
+	} else if (n <= 0) {
+	    return -1;
+	}
+
+	buf += n;
+	len -= n;
+    }
+
+    return 0;
+}
+
+
+pnet_conn::pnet_conn(int fd, uint32_t window) {
+    this->fd = fd;
+    this->window = window ? window : PNET_DEF_WINDOW;
+    this->next_id = 1;
+    this->acked = 0;
+}
+
+
+int pnet_conn::recv_bytes(char * buf, uint64_t len) {
+    while (len > 0) {
+	ssize_t n = recv(fd, buf, len, 0);
+
+	if (n < 0 && errno == EINTR) {
+	    continue;
+	} else if (n <= 0) {
+	    return -1;
+	}
+
+	buf += n;
+	len -= n;
+    }
+
+    return 0;
+}
+
+
+int pnet_conn::recv_frame(pnet_frame & f) {
+    if (recv_bytes((char *)&f, sizeof(f)) == -1) {
+	return -1;
+    }
+
+    if (f.magic != PNET_MAGIC) {
+	fprintf(stderr, "Bad frame magic 0x%x\n", f.magic);
+	return -1;
+    }
+
+    if (f.taglen > PNET_MAX_TAG) {
+	fprintf(stderr, "Frame tag too long (%u)\n", f.taglen);
+	return -1;
+    }
+
+    return 0;
+}
+
+
+int pnet_conn::send_frame(uint16_t type, uint16_t flags, uint32_t id, const string & tag, const char * buf, uint64_t len) {
+    pnet_frame f;
+    string hdr;
+
+    f.magic = PNET_MAGIC;
+    f.type = type;
+    f.flags = flags;
+    f.id = id;
+    f.taglen = tag.size();
+    f.len = len;
+
+    // header and tag in one send, so Nagle does not hold either back
+    hdr.assign((char *)&f, sizeof(f));
+    hdr += tag;
+
+    if (write_all(fd, hdr.data(), hdr.size()) == -1) {
+	return -1;
+    }
+
+    if ((len > 0) && (write_all(fd, buf, len) == -1)) {
+	return -1;
+    }
+
+    return 0;
+}
+
+
+int pnet_conn::handle_ack(const pnet_frame & f) {
+    if (f.len != 0) {
+	fprintf(stderr, "Peer reported error %llu at frame %u\n", (unsigned long long)f.len, f.id);
+	return -1;
+    }
+
+    if ((int32_t)(f.id - acked) > 0) {
+	acked = f.id;
+    }
+
+    return 0;
+}
+
+
+int pnet_conn::wait_ack() {
+    pnet_frame f;
+
+    if (recv_frame(f) == -1) {
+	return -1;
+    }
+
+    if (f.type == PNET_ACK) {
+	return handle_ack(f);
+    }
+
+    fprintf(stderr, "Unexpected frame type %u while waiting for ack\n", f.type);
+    return -1;
+}
+
+
+int pnet_conn::send_counted(uint16_t type, uint16_t flags, const string & tag, const char * buf, uint64_t len) {
+
+    while ((next_id - 1 - acked) >= window) {
+	if (wait_ack() == -1) {
+	    return -1;
+	}
+    }
+
+    if (((next_id - acked) == window) || 
+	((next_id - acked) == (window + 1) / 2)) {
+	flags |= PNET_ACKREQ;
+    }
+
+    if (send_frame(type, flags, next_id, tag, buf, len) == -1) {
+	return -1;
+    }
+
+    next_id++;
+
+    return 0;
+}
+
+
+int pnet_conn::send_record(const string & tag, const char * buf, uint64_t len) {
+    uint64_t done = 0;
+
+    do {
+	uint64_t seg = ((len - done) > PNET_SEGMENT) ? PNET_SEGMENT : (len - done);
+	uint16_t flags = (done + seg < len) ? PNET_MORE : 0;
+
+	if (send_counted(PNET_DATA, flags, done ? string() : tag, buf + done, seg) == -1) {
+	    return -1;
+	}
+
+	done += seg;
+    } while (done < len);
+
+    return 0;
+}
+
+
+int pnet_conn::drain() {
+    while (acked != next_id - 1) {
+	if (wait_ack() == -1) {
+	    return -1;
+	}
+    }
+
+    return 0;
+}
+
+
+int pnet_conn::send_get(const string & key) {
+    return send_frame(PNET_GET, 0, 0, key, NULL, 0);
+}
+
+
+int pnet_conn::send_error(const string & key) {
+    return send_frame(PNET_ERROR, 0, 0, key, NULL, 0);
+}
+
+
+int pnet_conn::consumed(const pnet_frame & f) {
+    if ((f.type == PNET_CLOSE) || (f.flags & PNET_ACKREQ)) {
+	return send_frame(PNET_ACK, 0, f.id, string(), NULL, 0);
+    }
+
+    return 0;
+}
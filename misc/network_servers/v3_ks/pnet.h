@@ -0,0 +1,92 @@
+/* 
+ * This file is part of the Palacios Virtual Machine Monitor developed
+ * by the V3VEE Project with funding from the United States National 
+ * Science Foundation and the Department of Energy.  
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  You can find out more at 
+ * http://www.v3vee.org
+ *
+ * Copyright (c) 2026, The V3VEE Project <http://www.v3vee.org> 
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "V3VEE_LICENSE".
+ */
+
+/*
+  The "pnet:" keyed stream protocol, as implemented by 
+  linux_module/iface-keyed-stream.c.  The two must be kept in sync.
+
+  Frames are [header][tag][payload], in host order.  A writer sends
+  OPEN(key), DATA(tag,data)..., CLOSE(key) for each key, numbering them
+  from 1, and may have up to its window of them unacknowledged.  Records
+  longer than PNET_SEGMENT are split over DATA frames flagged PNET_MORE.
+  The reader sends GET(key) before each key, and a cumulative ACK for
+  each CLOSE and each frame flagged PNET_ACKREQ.
+*/
+
+#ifndef __PNET_H__
+#define __PNET_H__
+
+#include <stdint.h>
+#include <string>
+
+#define PNET_MAGIC        0x504e4554   // "PNET"
+
+#define PNET_OPEN         1
+#define PNET_DATA         2
+#define PNET_CLOSE        3
+#define PNET_ACK          4
+#define PNET_GET          5
+#define PNET_ERROR        6
+
+#define PNET_MORE         0x1
+#define PNET_ACKREQ       0x2
+
+#define PNET_SEGMENT      (1024*1024)
+#define PNET_DEF_WINDOW   32
+#define PNET_MAX_TAG      1024
+
+struct pnet_frame {
+    uint32_t magic;
+    uint16_t type;
+    uint16_t flags;
+    uint32_t id;
+    uint32_t taglen;
+    uint64_t len;
+} __attribute__((packed));
+
+
+class pnet_conn {
+ public:
+    pnet_conn(int fd, uint32_t window);
+
+    // writer side
+    int send_counted(uint16_t type, uint16_t flags, const std::string & tag, const char * buf, uint64_t len);
+    int send_record(const std::string & tag, const char * buf, uint64_t len);
+    int drain();
+
+    // reader side
+    int send_get(const std::string & key);
+    int send_error(const std::string & key);
+    int consumed(const pnet_frame & f);
+
+    // either side
+    int recv_frame(pnet_frame & f);
+    int recv_bytes(char * buf, uint64_t len);
+    int send_frame(uint16_t type, uint16_t flags, uint32_t id, const std::string & tag, const char * buf, uint64_t len);
+
+    // writer: handle an ACK that recv_frame returned
+    int handle_ack(const pnet_frame & f);
+
+    int fd;
+    uint32_t window;
+    uint32_t next_id;
+    uint32_t acked;
+
+ private:
+    int wait_ack();
+};
+
+#endif
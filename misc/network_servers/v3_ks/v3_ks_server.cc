@@ -0,0 +1,247 @@
+/* 
+ * This file is part of the Palacios Virtual Machine Monitor developed
+ * by the V3VEE Project with funding from the United States National 
+ * Science Foundation and the Department of Energy.  
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  You can find out more at 
+ * http://www.v3vee.org
+ *
+ * Copyright (c) 2026, The V3VEE Project <http://www.v3vee.org> 
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "V3VEE_LICENSE".
+ */
+
+/*
+  Reference server for "pnet:" keyed streams.  Keys are held in memory
+  for the life of the server, so a VM can be checkpointed to it with
+  
+      pnet:c:127.0.0.1:9600
+
+  and later restored from it with the same url.  Connections are served
+  one at a time.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <string>
+#include <list>
+#include <map>
+
+#include "pnet.h"
+
+#define DEFAULT_PORT 9600
+
+using namespace std;
+
+struct record {
+    string tag;
+    string data;
+};
+
+typedef list<record> key_data;
+
+static map<string, key_data> keys;
+
+static int verbose = 0;
+
+
+static void usage() {
+    fprintf(stderr, "usage: v3_ks_server [-p port] [-w window] [-v]\n");
+    exit(-1);
+}
+
+
+static int recv_string(pnet_conn & conn, uint64_t len, string & s) {
+    s.resize(len);
+
+    if (len == 0) {
+	return 0;
+    }
+
+    return conn.recv_bytes(&s[0], len);
+}
+
+
+static int push_key(pnet_conn & conn, const string & key) {
+    map<string, key_data>::iterator k = keys.find(key);
+    key_data::iterator r;
+
+    if (k == keys.end()) {
+	if (verbose) {
+	    fprintf(stderr, "GET %s: no such key\n", key.c_str());
+	}
+	return conn.send_error(key);
+    }
+
+    if (conn.send_counted(PNET_OPEN, 0, key, NULL, 0) == -1) {
+	return -1;
+    }
+
+    for (r = k->second.begin(); r != k->second.end(); r++) {
+	if (conn.send_record(r->tag, r->data.data(), r->data.size()) == -1) {
+	    return -1;
+	}
+    }
+
+    if (verbose) {
+	fprintf(stderr, "GET %s: %lu records\n", key.c_str(), (unsigned long)k->second.size());
+    }
+
+    return conn.send_counted(PNET_CLOSE, 0, key, NULL, 0);
+}
+
+
+static int serve(int fd, uint32_t window) {
+    pnet_conn conn(fd, window);
+    string cur_key;
+    key_data * cur = NULL;
+    int more = 0;
+    pnet_frame f;
+
+    while (conn.recv_frame(f) == 0) {
+	string tag;
+
+	if (recv_string(conn, f.taglen, tag) == -1) {
+	    return -1;
+	}
+
+	switch (f.type) {
+	    case PNET_OPEN:
+		cur_key = tag;
+		cur = &keys[tag];
+		cur->clear();
+		more = 0;
+		break;
+
+	    case PNET_DATA: {
+		string data;
+
+		if (!cur || (f.len > PNET_SEGMENT)) {
+		    fprintf(stderr, "Bad data frame %u\n", f.id);
+		    return -1;
+		}
+
+		if (recv_string(conn, f.len, data) == -1) {
+		    return -1;
+		}
+
+		if (more) {
+		    cur->back().data += data;
+		} else {
+		    record r;
+		    r.tag = tag;
+		    r.data = data;
+		    cur->push_back(r);
+		}
+
+		more = f.flags & PNET_MORE;
+		break;
+	    }
+
+	    case PNET_CLOSE:
+		if (!cur || (tag != cur_key)) {
+		    fprintf(stderr, "Close of key %s that is not open\n", tag.c_str());
+		    return -1;
+		}
+
+		if (verbose) {
+		    fprintf(stderr, "PUT %s: %lu records\n", tag.c_str(), (unsigned long)cur->size());
+		}
+
+		cur = NULL;
+		break;
+
+	    case PNET_GET:
+		if (push_key(conn, tag) == -1) {
+		    return -1;
+		}
+		continue;
+
+	    case PNET_ACK:
+		if (conn.handle_ack(f) == -1) {
+		    return -1;
+		}
+		continue;
+
+	    default:
+		fprintf(stderr, "Unknown frame type %u\n", f.type);
+		return -1;
+	}
+
+	if (conn.consumed(f) == -1) {
+	    return -1;
+	}
+    }
+
+    return 0;
+}
+
+
+int main(int argc, char ** argv) {
+    int port = DEFAULT_PORT;
+    uint32_t window = PNET_DEF_WINDOW;
+    struct sockaddr_in addr;
+    int serv_sock;
+    int one = 1;
+    int c;
+
+    while ((c = getopt(argc, argv, "p:w:v")) != -1) {
+	switch (c) {
+	    case 'p': port = atoi(optarg); break;
+	    case 'w': window = atoi(optarg); break;
+	    case 'v': verbose = 1; break;
+	    default: usage();
+	}
+    }
+
+    serv_sock = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (serv_sock == -1) {
+	perror("socket");
+	return -1;
+    }
+
+    setsockopt(serv_sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if ((bind(serv_sock, (struct sockaddr *)&addr, sizeof(addr)) == -1) ||
+	(listen(serv_sock, 1) == -1)) {
+	perror("bind/listen");
+	return -1;
+    }
+
+    fprintf(stderr, "Serving pnet keyed streams on port %d (window %u)\n", port, window);
+
+    while (1) {
+	int fd = accept(serv_sock, NULL, NULL);
+
+	if (fd == -1) {
+	    perror("accept");
+	    continue;
+	}
+
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	if (serve(fd, window) == -1) {
+	    fprintf(stderr, "Connection dropped on error\n");
+	}
+
+	close(fd);
+    }
+
+    return 0;
+}
@@ -0,0 +1,246 @@
+/* 
+ * This file is part of the Palacios Virtual Machine Monitor developed
+ * by the V3VEE Project with funding from the United States National 
+ * Science Foundation and the Department of Energy.  
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  You can find out more at 
+ * http://www.v3vee.org
+ *
+ * Copyright (c) 2026, The V3VEE Project <http://www.v3vee.org> 
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "V3VEE_LICENSE".
+ */
+
+/*
+  Exercises v3_ks_server the way a "pnet:" stream would: writes some
+  keys of mixed record sizes over one connection, then reads them back
+  over another and checks them.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <string>
+#include <vector>
+
+#include "pnet.h"
+
+using namespace std;
+
+#define NUM_KEYS 8
+
+static const uint64_t sizes[] = {0, 1, 100, 4096, PNET_SEGMENT, PNET_SEGMENT + 1, 5 * PNET_SEGMENT + 17};
+#define NUM_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+
+static int connect_to(const char * ip, int port) {
+    struct sockaddr_in addr;
+    int one = 1;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr(ip);
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+	perror("connect");
+	exit(-1);
+    }
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    return fd;
+}
+
+
+static void fill(vector<char> & buf, int key, int rec) {
+    for (uint64_t i = 0; i < buf.size(); i++) {
+	buf[i] = (char)(i * 7 + key * 13 + rec);
+    }
+}
+
+
+static string key_name(int k) {
+    char name[32];
+    snprintf(name, sizeof(name), "key-%d", k);
+    return name;
+}
+
+
+static string tag_name(int r) {
+    char name[32];
+    snprintf(name, sizeof(name), "tag-%d", r);
+    return name;
+}
+
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+static int expect(pnet_conn & conn, uint16_t type, const string & tag, pnet_frame & f) {
+    string got(f.taglen, 0);
+
+    if (conn.recv_frame(f) == -1) {
+	return -1;
+    }
+
+    got.resize(f.taglen);
+
+    if ((f.taglen > 0) && (conn.recv_bytes(&got[0], f.taglen) == -1)) {
+	return -1;
+    }
+
+    if ((f.type != type) || (got != tag)) {
+	fprintf(stderr, "Expected frame type %u (%s), got %u (%s)\n", 
+		type, tag.c_str(), f.type, got.c_str());
+	return -1;
+    }
+
+    return 0;
+}
+
+
+static int write_keys(const char * ip, int port, uint32_t window, uint64_t * bytes) {
+    pnet_conn conn(connect_to(ip, port), window);
+
+    for (int k = 0; k < NUM_KEYS; k++) {
+	if (conn.send_counted(PNET_OPEN, 0, key_name(k), NULL, 0) == -1) {
+	    return -1;
+	}
+
+	for (unsigned r = 0; r < NUM_SIZES; r++) {
+	    vector<char> buf(sizes[r]);
+	    fill(buf, k, r);
+
+	    if (conn.send_record(tag_name(r), buf.empty() ? NULL : &buf[0], buf.size()) == -1) {
+		return -1;
+	    }
+
+	    *bytes += buf.size();
+	}
+
+	if (conn.send_counted(PNET_CLOSE, 0, key_name(k), NULL, 0) == -1) {
+	    return -1;
+	}
+    }
+
+    if (conn.drain() == -1) {
+	return -1;
+    }
+
+    close(conn.fd);
+    return 0;
+}
+
+
+static int read_keys(const char * ip, int port, uint64_t * bytes) {
+    pnet_conn conn(connect_to(ip, port), 0);
+    pnet_frame f;
+
+    for (int k = 0; k < NUM_KEYS; k++) {
+	if ((conn.send_get(key_name(k)) == -1) ||
+	    (expect(conn, PNET_OPEN, key_name(k), f) == -1) ||
+	    (conn.consumed(f) == -1)) {
+	    return -1;
+	}
+
+	for (unsigned r = 0; r < NUM_SIZES; r++) {
+	    vector<char> want(sizes[r]);
+	    vector<char> got;
+	    string tag = tag_name(r);
+
+	    fill(want, k, r);
+
+	    do {
+		uint64_t off = got.size();
+
+		if (expect(conn, PNET_DATA, tag, f) == -1) {
+		    return -1;
+		}
+
+		tag.clear();   // only on the first segment
+		got.resize(off + f.len);
+
+		if ((f.len > 0) && (conn.recv_bytes(&got[off], f.len) == -1)) {
+		    return -1;
+		}
+
+		if (conn.consumed(f) == -1) {
+		    return -1;
+		}
+	    } while (f.flags & PNET_MORE);
+
+	    if (got != want) {
+		fprintf(stderr, "Data mismatch in %s/%s\n", key_name(k).c_str(), tag_name(r).c_str());
+		return -1;
+	    }
+
+	    *bytes += got.size();
+	}
+
+	if ((expect(conn, PNET_CLOSE, key_name(k), f) == -1) || 
+	    (conn.consumed(f) == -1)) {
+	    return -1;
+	}
+    }
+
+    // a missing key is refused rather than hanging the reader
+    if ((conn.send_get("no-such-key") == -1) ||
+	(expect(conn, PNET_ERROR, "no-such-key", f) == -1)) {
+	return -1;
+    }
+
+    close(conn.fd);
+    return 0;
+}
+
+
+int main(int argc, char ** argv) {
+    const char * ip = "127.0.0.1";
+    int port = 9600;
+    uint32_t window = 4;
+    uint64_t bytes = 0;
+    double start;
+
+    if (argc > 1) { ip = argv[1]; }
+    if (argc > 2) { port = atoi(argv[2]); }
+    if (argc > 3) { window = atoi(argv[3]); }
+
+    start = now();
+
+    if (write_keys(ip, port, window, &bytes) == -1) {
+	fprintf(stderr, "FAILED writing keys\n");
+	return -1;
+    }
+
+    printf("wrote %llu bytes in %.3f s (window %u)\n", (unsigned long long)bytes, now() - start, window);
+
+    bytes = 0;
+    start = now();
+
+    if (read_keys(ip, port, &bytes) == -1) {
+	fprintf(stderr, "FAILED reading keys\n");
+	return -1;
+    }
+
+    printf("read %llu bytes in %.3f s\n", (unsigned long long)bytes, now() - start);
+    printf("PASSED\n");
+
+    return 0;
+}
@@ -47,6 +47,7 @@ uint64_t v3_file_write(v3_file_t file, uint8_t * buf, uint64_t len, uint64_t off
 #define FILE_OPEN_MODE_READ	(1 << 0)
 #define FILE_OPEN_MODE_WRITE	(1 << 1)
 #define FILE_OPEN_MODE_CREATE        (1 << 2)
+#define FILE_OPEN_MODE_TRUNC         (1 << 3)
 
 struct v3_file_hooks {
     int (*mkdir)(const char * path, unsigned short perms, int recursive);
@@ -39,6 +39,10 @@
 
   You cannot both read and write. 
 
+  Some streams (currently network ones using the "pnet:" protocol) 
+  also tell the writer which key the reader is asking for next, so 
+  that the writer can send keys in the order they are wanted.
+
 */
 
 /* A keyed stream and its components are opaque to palacios */
@@ -54,7 +58,8 @@ v3_keyed_stream_t     v3_keyed_stream_open(char *url, v3_keyed_stream_open_t ope
 void                  v3_keyed_stream_close(v3_keyed_stream_t stream);
 void                  v3_keyed_stream_preallocate_hint_key(v3_keyed_stream_t stream, char *key, uint64_t size);
 v3_keyed_stream_key_t v3_keyed_stream_open_key(v3_keyed_stream_t stream, char *key);
-void                  v3_keyed_stream_close_key(v3_keyed_stream_t stream,  char *key);
+// Returns -1 if data written to the key may not have been stored
+int                   v3_keyed_stream_close_key(v3_keyed_stream_t stream,  char *key);
 sint64_t              v3_keyed_stream_write_key(v3_keyed_stream_t stream,  
 						v3_keyed_stream_key_t key,
 						void *tag,
@@ -67,6 +72,15 @@ sint64_t              v3_keyed_stream_read_key(v3_keyed_stream_t stream,
 					       sint64_t taglen,
 					       void *buf, 
 					       sint64_t len);
+// Writer only: wait for the reader to ask for a key and copy its name (NUL terminated)
+// into key. Returns the name's length, or -1 on error or if the stream cannot do this.
+// With len 0, returns right away, 0 if the stream can do this, -1 if not.
+sint64_t              v3_keyed_stream_next_request(v3_keyed_stream_t stream,
+						   char *key,
+						   sint64_t len);
+// Make reads and writes blocked on the stream, and any later ones, fail.
+// The stream must still be closed. May be called from another thread.
+void                  v3_keyed_stream_abort(v3_keyed_stream_t stream);
 
 
 
@@ -191,8 +205,8 @@ struct v3_keyed_stream_hooks {
     v3_keyed_stream_key_t (*open_key)(v3_keyed_stream_t stream,
 				      char *key);
 
-    void (*close_key)(v3_keyed_stream_t stream, 
-		      v3_keyed_stream_key_t key);
+    int (*close_key)(v3_keyed_stream_t stream, 
+		     v3_keyed_stream_key_t key);
     
 
     sint64_t (*write_key)(v3_keyed_stream_t stream,
@@ -208,6 +222,14 @@ struct v3_keyed_stream_hooks {
 			 sint64_t taglen,
 			 void *buf, 
 			 sint64_t len);
+
+    // optional
+    sint64_t (*next_request)(v3_keyed_stream_t stream,
+			     char *key,
+			     sint64_t len);
+
+    // optional
+    void (*abort)(v3_keyed_stream_t stream);
     
 };
 
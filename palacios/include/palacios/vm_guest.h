@@ -53,6 +53,10 @@
 #include <palacios/vmm_telemetry.h>
 #endif
 
+#ifdef V3_CONFIG_EXIT_TRACE
+#include <palacios/vmm_exit_trace.h>
+#endif
+
 #ifdef V3_CONFIG_PMU_TELEMETRY
 #include <palacios/vmm_pmu_telemetry.h>
 #endif
@@ -70,6 +74,10 @@ struct v3_sym_core_state;
 #include <palacios/vmm_mem_track.h>
 #endif
 
+#ifdef V3_CONFIG_CHECKPOINT
+#include <palacios/vmm_postcopy.h>
+#endif
+
 #ifdef V3_CONFIG_MULTIBOOT
 #include <palacios/vmm_multiboot.h>
 #endif
@@ -109,6 +117,10 @@ struct guest_info {
     struct v3_shdw_pg_state shdw_pg_state;
     // arch-indepedent state of the passthrough pager
     addr_t direct_map_pt;
+    struct v3_direct_map_stats direct_map_stats;
+    struct v3_direct_map_flush direct_map_flush;
+    // per-core cache of memory region lookups
+    struct v3_mem_cache mem_cache;
     // arch-independent state of the nested pager (currently none)
     // struct v3_nested_pg_state nested_pg_state;
     // per-core state of the swapper (currently none)
@@ -122,7 +134,9 @@ struct guest_info {
 	struct {
 	    uint8_t use_large_pages        : 1;    /* Enable virtual page tables to use large pages */
 	    uint8_t use_giant_pages        : 1;    /* Enable virtual page tables to use giant (1GB) pages */
-	    uint32_t rsvd                  : 30;
+	    uint8_t prepopulate_direct_map : 1;    /* Build the nested page tables at launch */
+	    uint8_t direct_map_populated   : 1;    /* ... and this has been done */
+	    uint32_t rsvd                  : 28;
 	} __attribute__((packed));
     } __attribute__((packed));
 
@@ -157,6 +171,10 @@ struct guest_info {
     struct v3_core_telemetry core_telem;
 #endif
 
+#ifdef V3_CONFIG_EXIT_TRACE
+    struct v3_core_exit_trace exit_trace;
+#endif
+
 #ifdef V3_CONFIG_PMU_TELEMETRY
     struct v3_core_pmu_telemetry pmu_telem;
 #endif
@@ -169,6 +187,10 @@ struct guest_info {
     struct v3_core_mem_track memtrack_state;
 #endif
 
+#ifdef V3_CONFIG_LIVE_MIGRATION
+    uint64_t migrate_throttle_tsc;   // when this core last gave up its throttled share
+#endif
+
 #ifdef V3_CONFIG_HVM
     struct v3_core_hvm  hvm_state;
 #endif
@@ -279,6 +301,15 @@ struct v3_vm_info {
     struct v3_vm_mem_track memtrack_state;
 #endif
 
+#ifdef V3_CONFIG_CHECKPOINT
+    struct v3_postcopy_state postcopy;
+#endif
+
+#ifdef V3_CONFIG_LIVE_MIGRATION
+    volatile uint32_t migrate_throttle_pct;   // percent of each vcore's time to give up during pre-copy
+    void * chkpt_chain;                       // incremental checkpoint state, see vmm_checkpoint.c
+#endif
+
 #ifdef V3_CONFIG_MULTIBOOT
     struct v3_vm_multiboot  mb_state;
 #endif
@@ -457,6 +457,9 @@ struct v3_vm_vcore_state {
   unsigned long pcore;
   void *   last_rip;
   unsigned long long num_exits;
+  unsigned long long num_4k_maps;   // mappings of each size in the passthrough/nested tables
+  unsigned long long num_2m_maps;
+  unsigned long long num_1g_maps;
 };
 
 struct v3_vm_core_state {
@@ -470,11 +473,16 @@ struct v3_vm_mem_region {
     unsigned long long  size;
     int                 swapped:1;
     int                 pinned:1;
+    unsigned int        hotness;   // working set score, 0..1024, if swapping
 };
 
 struct v3_vm_mem_state {
     unsigned long long      mem_size;
     unsigned long long      ros_mem_size;
+    unsigned long long      swap_ins;          // if swapping
+    unsigned long long      swap_pool_ins;     // ... of which were pool hits
+    unsigned long long      swap_pool_size;
+    unsigned long long      swap_pool_used;
     unsigned long long      num_regions;
     struct v3_vm_mem_region region[]; 
 };
@@ -116,9 +116,13 @@ failout:
 struct v3_chkpt;
 
 
+struct v3_chkpt_codec_state;
+
 struct v3_chkpt_ctx {
   struct v3_chkpt * chkpt;
   void *store_ctx;
+  struct v3_chkpt_codec_state * codec;  // codec for large blobs, if any
+  int sub;   // opened by a memory worker, can be used alongside the current context
 };
 
 
@@ -164,6 +168,14 @@ typedef uint64_t v3_chkpt_options_t;
 #define V3_CHKPT_OPT_SKIP_DEVS    2  // don't write devices to store
 #define V3_CHKPT_OPT_SKIP_CORES   4  // don't write core arch ind data to store
 #define V3_CHKPT_OPT_SKIP_ARCHDEP 8  // don't write core arch dep data to store
+#define V3_CHKPT_OPT_COMPRESS_ZRLE 16 // compress large blobs with zero/run-length encoding
+#define V3_CHKPT_OPT_COMPRESS_LZ   32 // compress large blobs with LZ (either flag is enough to load)
+#define V3_CHKPT_OPT_PARALLEL_MEM  64 // save/load memory regions with multiple worker threads
+#define V3_CHKPT_OPT_POSTCOPY      128 // migrate state first, then memory while the VM runs
+#define V3_CHKPT_OPT_ELIDE_PAGES   256 // send zero and duplicate pages as short references
+#define V3_CHKPT_OPT_XBZRLE        512 // send re-dirtied pages as deltas (migration only)
+#define V3_CHKPT_OPT_LAZY_MEM      1024 // memory in separately loadable chunks, loaded on demand
+#define V3_CHKPT_OPT_INCREMENTAL   2048 // save only pages dirtied since the last save, chained to it
 
 int v3_chkpt_save_vm(struct v3_vm_info * vm, char * store, char * url, v3_chkpt_options_t opts);
 int v3_chkpt_load_vm(struct v3_vm_info * vm, char * store, char * url, v3_chkpt_options_t opts);
@@ -171,6 +183,12 @@ int v3_chkpt_load_vm(struct v3_vm_info * vm, char * store, char * url, v3_chkpt_
 #ifdef V3_CONFIG_LIVE_MIGRATION
 int v3_chkpt_send_vm(struct v3_vm_info * vm, char * store, char * url, v3_chkpt_options_t opts);
 int v3_chkpt_receive_vm(struct v3_vm_info * vm, char * store, char * url, v3_chkpt_options_t opts);
+
+// Called on exit while a send is throttling the VM (migrate_throttle_pct != 0)
+void v3_chkpt_throttle_core(struct guest_info * core);
+
+// Ends the VM's chain of incremental checkpoints
+void v3_chkpt_free_chain(struct v3_vm_info * vm);
 #endif
 
 int V3_init_checkpoint();
@@ -0,0 +1,93 @@
+/*
+ * This file is part of the Palacios Virtual Machine Monitor developed
+ * by the V3VEE Project with funding from the United States National 
+ * Science Foundation and the Department of Energy.  
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  You can find out more at 
+ * http://www.v3vee.org
+ *
+ * Copyright (c) 2026, The V3VEE Project <http://www.v3vee.org> 
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "V3VEE_LICENSE".
+ */
+
+#ifndef __VMM_CHKPT_CODEC_H__
+#define __VMM_CHKPT_CODEC_H__
+
+#ifdef __V3VEE__
+
+#include <palacios/vmm_types.h>
+
+/*
+  Codecs sit between v3_chkpt_save/load and the checkpoint store.
+
+  Blobs of at least V3_CHKPT_CODEC_MIN_LEN bytes are cut into chunks
+  of V3_CHKPT_CODEC_CHUNK bytes. Each chunk is written to the store as
+  a fixed size struct v3_chkpt_codec_hdr followed by the encoded chunk,
+  both under the blob's tag. A chunk that does not shrink is written
+  raw (codec V3_CHKPT_CODEC_NONE). Smaller blobs are always raw, so
+  device and core state look the same with or without a codec.
+
+  The codec is recorded per chunk, so a reader only needs to know that
+  the checkpoint was written with some codec.
+*/
+
+#define V3_CHKPT_CODEC_NONE  0
+#define V3_CHKPT_CODEC_ZRLE  1   // zero/repeated byte run-length
+#define V3_CHKPT_CODEC_LZ    2   // LZ77, LZ4-style sequences
+#define V3_CHKPT_CODEC_MAX   3
+
+#define V3_CHKPT_CODEC_CHUNK    (64 * 1024)
+#define V3_CHKPT_CODEC_MIN_LEN  4096
+
+
+struct v3_chkpt_codec_hdr {
+    uint32_t codec;
+    uint32_t enc_len;
+} __attribute__((packed));
+
+
+struct v3_chkpt_codec_stats {
+    uint64_t raw_bytes;       // bytes handed to the codec
+    uint64_t enc_bytes;       // bytes that went to the store, excluding headers
+    uint64_t encode_cycles;
+    uint64_t decode_cycles;
+    uint64_t chunks;
+    uint64_t raw_chunks;      // chunks stored uncompressed
+};
+
+
+struct v3_chkpt_codec_state {
+    uint32_t codec;           // codec used for saves
+
+    uint8_t  * scratch;       // one encoded chunk
+    uint32_t * lz_table;      // LZ match finder
+
+    struct v3_chkpt_codec_stats stats;
+};
+
+
+struct v3_chkpt_codec_state * v3_chkpt_codec_init(uint32_t codec);
+void v3_chkpt_codec_deinit(struct v3_chkpt_codec_state * state);
+
+// Returns the encoded length, and sets *codec_used to the codec that produced it
+// When the data does not shrink, returns len with *codec_used = V3_CHKPT_CODEC_NONE
+// and leaves the data in place (out is not written)
+int v3_chkpt_codec_encode(struct v3_chkpt_codec_state * state, 
+			  uint8_t * in, uint32_t len, 
+			  uint8_t * out, uint32_t * codec_used);
+
+// Decodes exactly out_len bytes, returns 0 on success and -1 on corrupt input
+int v3_chkpt_codec_decode(struct v3_chkpt_codec_state * state, uint32_t codec,
+			  uint8_t * in, uint32_t in_len,
+			  uint8_t * out, uint32_t out_len);
+
+void v3_chkpt_codec_merge_stats(struct v3_chkpt_codec_state * dst, struct v3_chkpt_codec_state * src);
+void v3_chkpt_codec_print_stats(struct v3_chkpt_codec_state * state);
+
+#endif
+
+#endif
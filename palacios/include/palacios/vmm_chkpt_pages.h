@@ -0,0 +1,88 @@
+/*
+ * This file is part of the Palacios Virtual Machine Monitor developed
+ * by the V3VEE Project with funding from the United States National 
+ * Science Foundation and the Department of Energy.  
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  You can find out more at 
+ * http://www.v3vee.org
+ *
+ * Copyright (c) 2026, The V3VEE Project <http://www.v3vee.org> 
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "V3VEE_LICENSE".
+ */
+
+#ifndef __VMM_CHKPT_PAGES_H__
+#define __VMM_CHKPT_PAGES_H__
+
+#ifdef __V3VEE__
+
+#include <palacios/vmm_types.h>
+
+/*
+  Zero and duplicate page elision for guest memory in checkpoints.
+
+  A range of guest pages saved under a tag becomes:
+
+     <tag>.map      one uint32_t per page: V3_CHKPT_PAGE_DATA,
+                    V3_CHKPT_PAGE_ZERO, or the guest page number of
+                    an earlier page with the same contents
+     <tag>.<n>      the contents of the run of data pages starting 
+                    at the nth page of the range, for each such run
+
+  References only point at pages saved earlier through the same 
+  scope, so a scope must be loaded in the order it was saved. Every
+  data blob still goes through v3_chkpt_save, and so through a codec.
+
+  Duplicates are only safe to reference while the guest is stopped, as
+  the referenced page must still hold what was sent for it. Scopes
+  used while the guest runs should turn them off.
+*/
+
+#define V3_CHKPT_PAGE_DATA  0xffffffff
+#define V3_CHKPT_PAGE_ZERO  0xfffffffe
+
+struct v3_vm_info;
+struct v3_chkpt_ctx;
+
+struct v3_chkpt_page_stats {
+    uint64_t pages;
+    uint64_t zero_pages;
+    uint64_t dup_pages;
+    uint64_t classify_cycles;
+};
+
+
+struct v3_chkpt_page_scope {
+    struct v3_vm_info * vm;
+
+    int allow_dups;
+
+    uint32_t * map;           // map of the current range
+    uint64_t map_pages;       // capacity of map
+
+    struct v3_chkpt_page_ent * table;   // content hash -> earlier page
+
+    struct v3_chkpt_page_stats stats;
+};
+
+
+struct v3_chkpt_page_scope * v3_chkpt_pages_init(struct v3_vm_info * vm, int allow_dups);
+void v3_chkpt_pages_deinit(struct v3_chkpt_page_scope * scope);
+
+// Forget earlier pages, so later ranges can be loaded on their own
+void v3_chkpt_pages_reset(struct v3_chkpt_page_scope * scope);
+
+int v3_chkpt_pages_save(struct v3_chkpt_ctx * ctx, struct v3_chkpt_page_scope * scope, char * tag,
+			uint64_t first_page, uint64_t num_pages, void * host_addr);
+int v3_chkpt_pages_load(struct v3_chkpt_ctx * ctx, struct v3_chkpt_page_scope * scope, char * tag,
+			uint64_t first_page, uint64_t num_pages, void * host_addr);
+
+void v3_chkpt_pages_merge_stats(struct v3_chkpt_page_scope * dst, struct v3_chkpt_page_scope * src);
+void v3_chkpt_pages_print_stats(struct v3_chkpt_page_scope * scope);
+
+#endif
+
+#endif
@@ -0,0 +1,90 @@
+/*
+ * This file is part of the Palacios Virtual Machine Monitor developed
+ * by the V3VEE Project with funding from the United States National 
+ * Science Foundation and the Department of Energy.  
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  You can find out more at 
+ * http://www.v3vee.org
+ *
+ * Copyright (c) 2026, The V3VEE Project <http://www.v3vee.org> 
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "V3VEE_LICENSE".
+ */
+
+#ifndef __VMM_CHKPT_XBZRLE_H__
+#define __VMM_CHKPT_XBZRLE_H__
+
+#ifdef __V3VEE__
+
+#include <palacios/vmm_types.h>
+
+/*
+  Delta encoding of pages re-sent during a pre-copy migration.
+
+  The sender keeps a direct mapped cache of what it last sent for each
+  page. A run of pages is encoded as one record per page:
+
+     XBZRLE_RAW    [4096 bytes]     page not in the cache
+     XBZRLE_ZERO                    page is all zeros
+     XBZRLE_SAME                    page equals what was sent last time
+     XBZRLE_DELTA  [len:2] [delta]  XOR of the page against what was
+                                    sent last time, as a sequence of
+                                    (equal bytes, differing bytes,
+                                    XORed bytes) with LEB128 lengths
+
+  Pages are snapshotted before they are encoded, so the cache always
+  holds exactly what the receiver has, even if the guest is writing
+  to them. The receiver needs no cache, as the previous contents of 
+  each page are already in guest memory.
+*/
+
+#define V3_XBZRLE_RAW    0
+#define V3_XBZRLE_ZERO   1
+#define V3_XBZRLE_SAME   2
+#define V3_XBZRLE_DELTA  3
+
+struct v3_vm_info;
+
+struct v3_chkpt_xbzrle_stats {
+    uint64_t pages;
+    uint64_t raw_pages;
+    uint64_t zero_pages;
+    uint64_t same_pages;
+    uint64_t delta_pages;
+    uint64_t misses;          // raw pages that were not in the cache
+    uint64_t enc_bytes;
+};
+
+
+struct v3_chkpt_xbzrle {
+    struct v3_vm_info * vm;
+
+    uint64_t num_slots;       // zero on the receiver
+    uint64_t * tags;          // guest page + 1 held in each slot
+    uint8_t * cache;
+
+    uint8_t * buf;            // encoding of one run
+    uint64_t buf_len;
+    uint8_t * snap;           // the page being encoded
+
+    struct v3_chkpt_xbzrle_stats stats;
+};
+
+
+struct v3_chkpt_xbzrle * v3_chkpt_xbzrle_init(struct v3_vm_info * vm, uint64_t cache_bytes, uint64_t max_run_pages);
+void v3_chkpt_xbzrle_deinit(struct v3_chkpt_xbzrle * x);
+
+// Encodes the run into x->buf, returns the encoded length or -1
+sint64_t v3_chkpt_xbzrle_encode(struct v3_chkpt_xbzrle * x, uint64_t first_page, uint64_t num_pages, void * host_addr);
+
+// Applies len bytes of x->buf to the run, returns 0 or -1 on corrupt input
+int v3_chkpt_xbzrle_decode(struct v3_chkpt_xbzrle * x, uint64_t num_pages, void * host_addr, uint64_t len);
+
+void v3_chkpt_xbzrle_print_stats(struct v3_chkpt_xbzrle * x);
+
+#endif
+
+#endif
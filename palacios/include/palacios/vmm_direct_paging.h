@@ -34,6 +34,25 @@
  **********************************/
 
 
+// Mappings of each size currently in a core's passthrough or nested page tables
+struct v3_direct_map_stats {
+    uint64_t num_4k;
+    uint64_t num_2m;
+    uint64_t num_1g;
+};
+
+
+// Flush owed by a core after entries were cleared from its direct map.
+// Table pages cut out of the map are kept here until the flush is done,
+// since the core may still have them cached
+struct v3_direct_map_flush {
+    v3_lock_t lock;
+    int       pending;      // flush before the next entry
+    addr_t    orphans;      // table pages to free after it, linked through their first word
+    uint64_t  num_orphans;
+};
+
+
 struct v3_passthrough_impl_state {
     // currently there is only a single implementation
     // that internally includes SVM and VMX support
@@ -54,6 +73,23 @@ int v3_free_passthrough_pts(struct guest_info * core);
 
 int v3_reset_passthrough_pts(struct guest_info * guest_info);
 
+int v3_init_direct_map_flush(struct guest_info * core);
+int v3_deinit_direct_map_flush(struct guest_info * core);
+
+// Called by the core itself before entering the guest when a flush is pending
+int v3_flush_direct_map(struct guest_info * core);
+
+// Times page-by-page against whole-range invalidation of 1GB (VM must be held at a barrier).
+// Refused for a shadow paging core once its guest has paging on.
+int v3_bench_direct_map_invalidation(struct guest_info * core);
+
+// Map all directly backed guest memory in the core's nested page tables,
+// as the fault handlers would, instead of waiting for faults. The tables
+// must not yet map any of it. Shadow paging cores are refused, as their
+// passthrough tables only index the first 4GB and are dropped once the
+// guest turns on paging.
+int v3_populate_direct_map(struct guest_info * core);
+
 // actual_start/end may be null if you don't want this info
 // If non-null, these return the actual affected GPA range
 int v3_handle_passthrough_pagefault(struct guest_info * info, addr_t fault_addr, pf_error_t error_code,
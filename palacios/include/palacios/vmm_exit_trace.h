@@ -0,0 +1,125 @@
+/*
+ * This file is part of the Palacios Virtual Machine Monitor developed
+ * by the V3VEE Project with funding from the United States National 
+ * Science Foundation and the Department of Energy.  
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  You can find out more at 
+ * http://www.v3vee.org
+ *
+ * Copyright (c) 2026, The V3VEE Project <http://www.v3vee.org> 
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "V3VEE_LICENSE".
+ */
+
+#ifndef __VMM_EXIT_TRACE_H__
+#define __VMM_EXIT_TRACE_H__
+
+
+#define V3_EXIT_TRACE_NO_INJECT 0xffffffff
+
+/* One record per VM exit, written when the exit has been handled */
+struct v3_exit_trace_rec {
+    uint64_t entry_tsc;       // VM entry that preceded the exit
+    uint64_t exit_tsc;        // VM exit
+    uint64_t done_tsc;        // exit handler finished
+    uint64_t rip;             // guest RIP at the exit
+    uint64_t exit_qual;       // exit_info1 on SVM, exit qualification on VMX
+    uint32_t exit_code;
+    uint32_t inject_vector;   // vector injected on the entry, or V3_EXIT_TRACE_NO_INJECT
+} __attribute__((packed));
+
+
+/* Layout of the shared ring, page aligned and mapped read-only by the host
+ *
+ * The core is the only writer. It fills recs[head % num_recs] and then
+ * advances head, so a reader that has consumed up to index "tail" can
+ * read [tail, head). If head - tail exceeds num_recs the reader has been
+ * lapped and the oldest records are gone.
+ */
+struct v3_exit_trace_ring {
+    volatile uint64_t head;
+    uint32_t num_recs;        // always a power of 2
+    uint32_t vcore;
+    uint64_t rsvd[6];         // pad the header out to a cache line
+
+    struct v3_exit_trace_rec recs[0];
+} __attribute__((packed));
+
+
+struct v3_vm_info;
+struct v3_exit_trace_buf;
+
+// Host-visible, returns the host physical address and size (in bytes) of a core's ring
+// along with a reference to it.  The ring stays allocated, even past the VM being freed, 
+// until the reference is dropped with v3_exit_trace_put_ring
+int v3_exit_trace_get_ring(struct v3_vm_info * vm, int vcore, void ** ring_pa, uint64_t * size,
+			   struct v3_exit_trace_buf ** buf);
+void v3_exit_trace_put_ring(struct v3_exit_trace_buf * buf);
+
+
+#ifdef __V3VEE__
+
+#ifdef V3_CONFIG_EXIT_TRACE
+
+#include <palacios/vmm_types.h>
+
+struct guest_info;
+
+struct v3_core_exit_trace {
+    struct v3_exit_trace_ring * ring;
+    struct v3_exit_trace_buf * buf;   // refcounted owner of the ring pages
+    uint32_t num_pages;
+
+    uint32_t inject_vector;
+};
+
+
+int v3_init_core_exit_trace(struct guest_info * core);
+int v3_deinit_core_exit_trace(struct guest_info * core);
+
+
+static inline void v3_exit_trace_inject(struct v3_core_exit_trace * trace, uint32_t vector) {
+    trace->inject_vector = vector;
+}
+
+
+/* Exit path, must stay cheap: one rdtsc, one record store, one index update */
+static inline void v3_exit_trace_record(struct v3_core_exit_trace * trace, uint32_t exit_code, 
+					uint64_t exit_qual, uint64_t rip, 
+					uint64_t entry_tsc, uint64_t exit_tsc) {
+    struct v3_exit_trace_ring * ring = trace->ring;
+    struct v3_exit_trace_rec * rec = NULL;
+    uint64_t done_tsc = 0;
+
+    if (!ring) {
+	return;
+    }
+
+    rdtscll(done_tsc);
+
+    rec = &(ring->recs[ring->head & (ring->num_recs - 1)]);
+
+    rec->entry_tsc = entry_tsc;
+    rec->exit_tsc = exit_tsc;
+    rec->done_tsc = done_tsc;
+    rec->rip = rip;
+    rec->exit_qual = exit_qual;
+    rec->exit_code = exit_code;
+    rec->inject_vector = trace->inject_vector;
+
+    trace->inject_vector = V3_EXIT_TRACE_NO_INJECT;
+
+    // x86 does not reorder stores, we only need to stop the compiler from doing it
+    __asm__ __volatile__ ("" : : : "memory");
+
+    ring->head++;
+}
+
+#endif
+
+#endif
+
+#endif
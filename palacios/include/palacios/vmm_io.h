@@ -64,9 +64,19 @@ struct v3_io_hook {
     struct rb_node tree_node;
 };
 
+// The port space is split into 256 blocks of 256 ports each
+#define V3_IO_BLOCK_SHIFT   8
+#define V3_IO_BLOCK_PORTS   (1 << V3_IO_BLOCK_SHIFT)
+#define V3_IO_NUM_BLOCKS    (0x10000 >> V3_IO_BLOCK_SHIFT)
+
 struct v3_io_map {
+    // Ordered view of the hooks, used for iteration
     struct rb_root map;
 
+    // Direct lookup table used on the exit path
+    // Blocks are allocated the first time a port in them is hooked
+    struct v3_io_hook ** port_table[V3_IO_NUM_BLOCKS];
+
     int (*update_map)(struct v3_vm_info * vm, uint16_t port, int hook_read, int hook_write);
 
     void * arch_data;
@@ -79,6 +89,8 @@ void v3_print_io_map(struct v3_vm_info * vm);
 
 void v3_refresh_io_map(struct v3_vm_info * vm);
 
+void v3_bench_io_map(struct v3_vm_info * vm);
+
 
 void v3_outb(uint16_t port, uint8_t value);
 uint8_t v3_inb(uint16_t port);
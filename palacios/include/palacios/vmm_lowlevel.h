@@ -22,6 +22,7 @@
 
 #define CPUID_FEATURE_IDS 0x00000001
 #define CPUID_EXT_FEATURE_IDS 0x80000001
+#define CPUID_EXT_FEATURE_IDS_edx_page1gb 0x04000000
 
 struct seg_selector {
     union {
@@ -98,6 +98,32 @@ struct v3_mem_map {
     
     uint32_t num_base_regions;
     struct v3_mem_region * base_regions;
+
+    // Bumped whenever the region tree changes, invalidates the per-core lookup caches
+    uint64_t generation;
+};
+
+
+/* Per-core cache of v3_get_mem_region() lookups
+ * Entries are keyed by guest physical page. A NULL region means that no
+ * sub region covers the page, so the lookup falls through to the base region
+ */
+#define V3_MEM_CACHE_ENTRIES 64  // must be a power of 2
+
+struct v3_mem_cache_entry {
+    addr_t page_addr;
+    struct v3_mem_region * reg;
+    uint8_t valid;
+};
+
+struct v3_mem_cache {
+    uint64_t generation;
+
+    struct v3_mem_cache_entry last;
+    struct v3_mem_cache_entry entries[V3_MEM_CACHE_ENTRIES];
+
+    uint64_t hits;
+    uint64_t misses;
 };
 
 
@@ -73,10 +73,28 @@ struct v3_msr_hook {
 
 struct v3_msr_hook;
 
+
+/* The architectural MSR ranges that the SVM/VMX MSR bitmaps cover
+ * Hooks in these ranges are looked up by direct index
+ */
+#define V3_MSR_RANGE_SIZE   0x2000
+#define V3_MSR_NUM_RANGES   3
+
+#define V3_MSR_RANGE_0_START 0x00000000
+#define V3_MSR_RANGE_1_START 0xc0000000
+#define V3_MSR_RANGE_2_START 0xc0010000
+
+
 struct v3_msr_map {
     uint_t num_hooks;
     struct list_head hook_list;
 
+    // Allocated the first time an MSR in the range is hooked
+    struct v3_msr_hook ** range_hooks[V3_MSR_NUM_RANGES];
+
+    // MSRs whose hardware bitmap entries have not been updated yet
+    uint8_t range_dirty[V3_MSR_NUM_RANGES][V3_MSR_RANGE_SIZE / 8];
+
     int (*update_map)(struct v3_vm_info * vm, uint32_t msr, int hook_read, int hook_write);
     void * arch_data;
 
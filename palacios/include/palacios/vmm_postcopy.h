@@ -0,0 +1,77 @@
+/*
+ * This file is part of the Palacios Virtual Machine Monitor developed
+ * by the V3VEE Project with funding from the United States National 
+ * Science Foundation and the Department of Energy.  
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  You can find out more at 
+ * http://www.v3vee.org
+ *
+ * Copyright (c) 2026, The V3VEE Project <http://www.v3vee.org> 
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "V3VEE_LICENSE".
+ */
+
+#ifndef __VMM_POSTCOPY_H__
+#define __VMM_POSTCOPY_H__
+
+#ifdef __V3VEE__
+
+#include <palacios/vmm_types.h>
+#include <palacios/vmm_lock.h>
+
+/* 
+ * Receiver side of a post-copy migration or a lazy checkpoint load
+ *
+ * The VM may run while its memory is still arriving. Memory is
+ * tracked in chunks, and any lookup of a base region for a chunk that
+ * has not arrived yet posts it as wanted and waits for it.
+ */
+
+#define V3_POSTCOPY_CHUNK_SIZE (2 * 1024 * 1024)
+
+struct v3_vm_info;
+struct v3_chkpt;
+
+struct v3_postcopy_state {
+    volatile uint32_t active;     // chunks are still arriving
+    volatile uint32_t failed;     // the stream broke, missing chunks will never arrive
+    volatile uint32_t abort;      // VM is going away, receiver should stop
+    volatile uint32_t done;       // receiver thread has exited
+    uint32_t migration;           // chunks come from a post-copy sender, not a lazy checkpoint
+
+    v3_lock_t lock;               // guards chkpt against the receiver closing it
+    struct v3_chkpt * chkpt;      // receiver's checkpoint, until it closes it
+    volatile uint32_t aborting;   // v3_deinit_postcopy is breaking chkpt's store
+
+    uint64_t chunk_size;
+    uint64_t num_chunks;
+    volatile uint8_t * present;   // one byte per chunk
+    volatile sint64_t wanted;     // chunk a lookup is waiting for, or -1
+
+    uint64_t chunks_received;
+    uint64_t demand_loads;        // chunks loaded out of order because they were wanted
+    uint64_t fault_waits;         // lookups that had to wait for a chunk
+    uint64_t fault_wait_cycles;
+};
+
+
+int v3_init_postcopy(struct v3_vm_info * vm);
+void v3_deinit_postcopy(struct v3_vm_info * vm);
+int v3_postcopy_wait(struct v3_vm_info * vm, addr_t gpa);
+
+
+// Returns 0 once the chunk holding gpa is present, -1 if it never will be
+static inline int v3_postcopy_check(struct v3_postcopy_state * pc, struct v3_vm_info * vm, addr_t gpa) {
+    if (!pc->active || pc->present[gpa / pc->chunk_size]) {
+	return 0;
+    }
+
+    return v3_postcopy_wait(vm, gpa);
+}
+
+#endif
+
+#endif
@@ -34,8 +34,11 @@ typedef enum {
     V3_SWAP_NEXT_FIT, 
     V3_SWAP_RANDOM,
     V3_SWAP_LRU,     // this is not the droid you're looking for
+    V3_SWAP_WORKING_SET, // CLOCK over memory tracking access bits
 } v3_swapping_strategy_t;
 
+struct v3_chkpt_codec_state;
+
 // for inclusion in the vm struct
 struct v3_swap_impl_state {
     // per-VM lock should be held when changing
@@ -46,16 +49,58 @@ struct v3_swap_impl_state {
     uint64_t host_mem_size; // allocated space in bytes
     uint64_t swap_count; 
     uint64_t last_region_used; // for use by V3_SWAP_NEXT_FIT
+    uint64_t clock_hand;       // for use by V3_SWAP_WORKING_SET
     // This is the swap file on disk 
     v3_file_t swapfd; 
+
+    // Compressed RAM tier in front of the swap file
+    uint64_t pool_size;        // bytes of compressed data we may hold (0 = no pool)
+    uint64_t pool_used;
+    struct v3_chkpt_codec_state *codec;  // codec choice, and stats
+
+    uint64_t pool_outs;        // regions swapped out to the pool
+    uint64_t file_outs;        // ... to the file
+    uint64_t pool_ins;         // regions swapped in from the pool
+    uint64_t file_ins;         // ... from the file
+
+    // Page-granular swap in from the file (granularity 0 = whole regions)
+    uint64_t granularity;      // bytes per chunk, 4KB or 2MB
+    void *worker;              // host thread that reads chunks in
+    volatile uint32_t worker_abort;
+    volatile uint32_t worker_done;
+    volatile uint32_t worker_failed;  // a read failed, waiters give up
+
+    struct v3_mem_region *wanted_region;  // chunk a lookup is waiting for
+    uint64_t wanted_chunk;
+
+    struct v3_mem_region *ra_region;      // sequential read-ahead
+    uint64_t ra_last;          // last chunk read on demand there
+    uint64_t ra_next;          // next chunk to read ahead
+    uint64_t ra_end;           // end of the current window
+    uint64_t ra_window;        // current window, doubles on sequential faults
+
+    uint64_t demand_fetches;   // chunks read because a lookup wanted them
+    uint64_t ahead_fetches;    // chunks read ahead
+    uint64_t fault_waits;      // lookups that had to wait for a chunk
+    uint64_t fault_wait_cycles;
 };
 
 
 // for inclusion in the region 
+struct v3_swap_zregion;
+
 struct v3_swap_region_state {
     uint64_t last_accessed;  // timestamp
+    struct v3_swap_zregion *zregion;  // compressed copy in the pool, if swapped there
+    uint32_t referenced;     // pages seen accessed since the clock hand last passed
+    uint32_t hotness;        // decayed fraction of the region in use, 0..V3_SWAP_HOT_MAX
+    uint8_t *present;        // chunk bitmap, allocated on first page-granular swap in
+    volatile uint32_t absent;  // chunks not yet read in since the last swap in
+    uint32_t busy;           // a chunk is being read into the region
 };
 
+#define V3_SWAP_HOT_MAX 1024
+
 
 struct v3_mem_region;
 
@@ -82,6 +127,20 @@ int v3_swap_out_region(struct v3_vm_info *vm, struct v3_mem_region *region);
 // drive LRU
 void v3_touch_region(struct v3_vm_info *vm, struct v3_mem_region *region);
 
+// Waits for the chunk holding gpa to be read in - returns -1 if it never will be
+// Only needed while region->swap_state.absent is nonzero
+int v3_swap_wait(struct v3_vm_info *vm, struct v3_mem_region *region, addr_t gpa);
+
+// Can the region be mapped with pages this large? (not while partially present)
+int v3_swap_page_size_ok(struct v3_vm_info *vm, struct v3_mem_region *region, uint32_t page_size);
+
+#ifdef V3_CONFIG_MEM_TRACK
+struct guest_info;
+
+// drive the working set - folds in the core's memory tracking access bitmap
+void v3_swap_sample_access(struct guest_info *core);
+#endif
+
 #endif /* ! __V3VEE__ */
 
 
@@ -20,15 +20,66 @@
 #ifndef __VMM_TELEMETRY_H__
 #define __VMM_TELEMETRY_H__
 
+
+// Exit codes below V3_TELEMETRY_NPF_SLOT are counted in their own slot.
+// SVM_EXIT_NPF (0x400) gets the next-to-last slot, and any other code
+// past the table shares the last one.
+#define V3_TELEMETRY_NUM_EXITS     256
+#define V3_TELEMETRY_NPF_SLOT      (V3_TELEMETRY_NUM_EXITS - 2)
+
+// Handler latencies are bucketed in half powers of two (2,3,4,6,8,12,...)
+// Anything above 2^24 cycles lands in the last bucket
+#define V3_TELEMETRY_HIST_BUCKETS  48
+
+
+/* Binary snapshot of the exit statistics, shared with the host */
+struct v3_telemetry_exit_snap {
+    uint32_t exit_code;
+    uint64_t cnt;
+    uint64_t total_cycles;
+    uint64_t min_cycles;
+    uint64_t max_cycles;
+    uint64_t p50_cycles;
+    uint64_t p99_cycles;
+    uint64_t p999_cycles;
+    uint64_t hist[V3_TELEMETRY_HIST_BUCKETS];
+} __attribute__((packed));
+
+struct v3_telemetry_core_snap {
+    uint32_t vcore;
+    uint64_t exit_cnt;
+    struct v3_telemetry_exit_snap exits[V3_TELEMETRY_NUM_EXITS];
+} __attribute__((packed));
+
+typedef struct v3_telemetry_snapshot {
+    uint32_t num_cores;
+    struct v3_telemetry_core_snap core[0];
+} __attribute__((packed)) v3_telemetry_snapshot;
+
+
+struct v3_vm_info;
+
+// Host-visible, take and free a snapshot of all cores
+v3_telemetry_snapshot * v3_telemetry_take_snapshot(struct v3_vm_info * vm);
+void v3_telemetry_free_snapshot(v3_telemetry_snapshot * snap);
+
+// Lower bound (in cycles) of a histogram bucket
+static inline uint64_t v3_telemetry_bucket_start(uint32_t bucket) {
+    if (bucket < 2) {
+	return bucket;
+    }
+
+    return ((uint64_t)(2 | (bucket & 0x1))) << ((bucket / 2) - 1);
+}
+
+
 #ifdef __V3VEE__
 
 #ifdef V3_CONFIG_TELEMETRY
 
-#include <palacios/vmm_rbtree.h>
 #include <palacios/vmm_list.h>
 
 struct guest_info;
-struct v3_vm_info;
 
 struct v3_telemetry_state {
     uint32_t invoke_cnt;
@@ -40,9 +91,21 @@ struct v3_telemetry_state {
 };
 
 
+struct v3_exit_stats {
+    uint32_t exit_code;
+    uint64_t cnt;
+    uint64_t handler_time;
+    uint64_t min_time;
+    uint64_t max_time;
+    uint64_t hist[V3_TELEMETRY_HIST_BUCKETS];
+};
+
+
 struct v3_core_telemetry {
     uint_t exit_cnt;
-    struct rb_root exit_root;
+
+    // Indexed by exit code, allocated when the core is initialized
+    struct v3_exit_stats * exit_stats;
 
     uint64_t vmm_start_tsc;
 
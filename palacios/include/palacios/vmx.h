@@ -239,6 +239,7 @@ struct vmx_data {
 };
 
 int v3_is_vmx_capable();
+int v3_vmx_ept_1GB_ok();
 
 void v3_init_vmx_cpu(int cpu_id);
 void v3_deinit_vmx_cpu(int cpu_id);
@@ -46,6 +46,7 @@
 #define VMWRITE_OPCODE  ".byte 0x0f,0x79;"
 #define VMXOFF_OPCODE   ".byte 0x0f,0x01,0xc4;"
 #define VMXON_OPCODE    ".byte 0xf3,0x0f,0xc7;" /* reg=/6 */
+#define INVEPT_OPCODE   ".byte 0x66,0x0f,0x38,0x80;"
 
 
 /* Mod/rm definitions for intel registers/memory */
@@ -54,6 +55,11 @@
 #define EAX_06_MODRM    ".byte 0x30;"
 // %eax with /7 reg
 #define EAX_07_MODRM    ".byte 0x38;"
+// %ecx with (%eax)
+#define ECX_MEM_EAX_MODRM ".byte 0x08;"
+
+#define VMX_INVEPT_SINGLE_CONTEXT 1
+#define VMX_INVEPT_ALL_CONTEXT    2
 
 
 
@@ -165,6 +171,29 @@ static inline int vmcs_write(vmcs_field_t vmcs_field, addr_t value) {
 }
 
 
+static inline int vmx_invept(uint64_t type, uint64_t eptp) {
+    struct {
+	uint64_t eptp;
+	uint64_t rsvd;
+    } __attribute__((packed, aligned(16))) desc = {eptp, 0};
+    uint8_t ret_valid = 0;
+    uint8_t ret_invalid = 0;
+
+    __asm__ __volatile__ (
+                INVEPT_OPCODE
+                ECX_MEM_EAX_MODRM
+                "seteb %0;" // fail valid (ZF=1)
+                "setnaeb %1;" // fail invalid (CF=1)
+                : "=q"(ret_valid), "=q"(ret_invalid)
+                : "a"(&desc), "c"(type), "0"(ret_valid), "1"(ret_invalid)
+                : "memory");
+
+    CHECK_VMXFAIL(ret_valid, ret_invalid);
+
+    return VMX_SUCCESS;
+}
+
+
 static inline int vmx_on(addr_t vmxon_ptr) {
     uint64_t vmxon_ptr_64 __attribute__((aligned(8))) = (uint64_t)vmxon_ptr;
     uint8_t ret_invalid = 0;
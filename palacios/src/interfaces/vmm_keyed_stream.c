@@ -63,7 +63,7 @@ v3_keyed_stream_key_t v3_keyed_stream_open_key(v3_keyed_stream_t stream, char *k
 }
 
 
-void                  v3_keyed_stream_close_key(v3_keyed_stream_t stream,  char *key)
+int                   v3_keyed_stream_close_key(v3_keyed_stream_t stream,  char *key)
 {
     V3_ASSERT(VM_NONE, VCORE_NONE, keyed_stream_hooks != NULL);
     V3_ASSERT(VM_NONE, VCORE_NONE, keyed_stream_hooks->close_key != NULL);
@@ -98,6 +98,28 @@ sint64_t              v3_keyed_stream_read_key(v3_keyed_stream_t stream,
     return keyed_stream_hooks->read_key(stream,key,tag,taglen,buf,len);
 }
 
+sint64_t              v3_keyed_stream_next_request(v3_keyed_stream_t stream,
+						   char *key,
+						   sint64_t len)
+{
+    V3_ASSERT(VM_NONE, VCORE_NONE, keyed_stream_hooks != NULL);
+
+    if (!keyed_stream_hooks->next_request) { 
+	return -1;
+    }
+
+    return keyed_stream_hooks->next_request(stream,key,len);
+}
+
+void                  v3_keyed_stream_abort(v3_keyed_stream_t stream)
+{
+    V3_ASSERT(VM_NONE, VCORE_NONE, keyed_stream_hooks != NULL);
+
+    if (keyed_stream_hooks->abort) { 
+	keyed_stream_hooks->abort(stream);
+    }
+}
+
 
 
 void V3_Init_Keyed_Streams(struct v3_keyed_stream_hooks * hooks) {
@@ -790,6 +790,8 @@ int v3_svm_enter(struct guest_info * info) {
     vmcb_saved_state_t * guest_state = GET_VMCB_SAVE_STATE_AREA((vmcb_t*)(info->vmm_data)); 
     addr_t exit_code = 0, exit_info1 = 0, exit_info2 = 0;
     uint64_t guest_cycles = 0;
+    uint64_t entry_tsc = 0;
+    uint64_t exit_tsc = 0;
 
 
     // Conditionally yield the CPU if the timeslice has expired
@@ -811,6 +813,11 @@ int v3_svm_enter(struct guest_info * info) {
 
     v3_update_timers(info);
 
+    // Entries were cleared from the direct map since the last entry
+    if (info->direct_map_flush.pending) {
+	v3_flush_direct_map(info);
+    }
+
 
     // disable global interrupts for vm state transition
     v3_clgi();
@@ -889,9 +896,6 @@ int v3_svm_enter(struct guest_info * info) {
 
     //V3_Print(info->vm_info, info, "Calling v3_svm_launch\n");
     {	
-	uint64_t entry_tsc = 0;
-	uint64_t exit_tsc = 0;
-	
 #ifdef V3_CONFIG_PWRSTAT_TELEMETRY
 	v3_pwrstat_telemetry_enter(info);
 #endif
@@ -907,6 +911,14 @@ int v3_svm_enter(struct guest_info * info) {
 #endif
 	}
 
+#ifdef V3_CONFIG_EXIT_TRACE
+	if (guest_ctrl->EVENTINJ.valid) {
+	    v3_exit_trace_inject(&(info->exit_trace), guest_ctrl->EVENTINJ.vector);
+	} else if (guest_ctrl->guest_ctrl.V_IRQ) {
+	    v3_exit_trace_inject(&(info->exit_trace), guest_ctrl->guest_ctrl.V_INTR_VECTOR);
+	}
+#endif
+
 	rdtscll(entry_tsc);
 
 	v3_svm_launch((vmcb_t *)V3_PAddr(info->vmm_data), &(info->vm_regs), (vmcb_t *)host_vmcbs[V3_Get_CPU()]);
@@ -986,6 +998,13 @@ int v3_svm_enter(struct guest_info * info) {
     // Conditionally yield the CPU if the timeslice has expired
     v3_schedule(info);
 
+#ifdef V3_CONFIG_LIVE_MIGRATION
+    // Give up part of our time if a migration is waiting for us to converge
+    if (info->vm_info->migrate_throttle_pct) {
+	v3_chkpt_throttle_core(info);
+    }
+#endif
+
     // This update timers is for time-dependent handlers
     // if we're slaved to host time
     v3_advance_time(info, NULL);
@@ -993,6 +1012,9 @@ int v3_svm_enter(struct guest_info * info) {
 
 
     {
+#ifdef V3_CONFIG_EXIT_TRACE
+	addr_t exit_rip = info->rip;
+#endif
 	int ret = v3_handle_svm_exit(info, exit_code, exit_info1, exit_info2);
 	
 	if (ret != 0) {
@@ -1001,6 +1023,10 @@ int v3_svm_enter(struct guest_info * info) {
 
 	    return -1;
 	}
+
+#ifdef V3_CONFIG_EXIT_TRACE
+	v3_exit_trace_record(&(info->exit_trace), exit_code, exit_info1, exit_rip, entry_tsc, exit_tsc);
+#endif
     }
 
 
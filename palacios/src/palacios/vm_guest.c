@@ -39,6 +39,9 @@
 #ifdef V3_CONFIG_CACHEPART
 #include <palacios/vmm_cachepart.h>
 #endif
+#ifdef V3_CONFIG_LIVE_MIGRATION
+#include <palacios/vmm_checkpoint.h>
+#endif
 
 
 v3_cpu_mode_t v3_get_vm_cpu_mode(struct guest_info * info) {
@@ -244,6 +247,10 @@ int v3_init_vm(struct v3_vm_info * vm) {
 
     v3_init_barrier(vm);
 
+#ifdef V3_CONFIG_CHECKPOINT
+    v3_init_postcopy(vm);
+#endif
+
     // Initialize the memory map
     if (v3_init_mem_map(vm) == -1) {
         PrintError(vm, VCORE_NONE, "Could not initialize shadow map\n");
@@ -366,6 +373,14 @@ int v3_free_vm_internal(struct v3_vm_info * vm) {
     v3_deinit_swapping_vm(vm);
 #endif
 
+#ifdef V3_CONFIG_CHECKPOINT
+    v3_deinit_postcopy(vm);
+#endif
+
+#ifdef V3_CONFIG_LIVE_MIGRATION
+    v3_chkpt_free_chain(vm);
+#endif
+
     v3_delete_mem_map(vm);
     v3_deinit_shdw_impl(vm);
     v3_deinit_passthrough_paging(vm);
@@ -415,6 +430,9 @@ int v3_init_core(struct guest_info * core) {
      * Initialize the subsystem data strutures
      */
 
+    if (v3_init_direct_map_flush(core) == -1) {
+	return -1;
+    }
 
 #ifdef V3_CONFIG_CACHEPART
     v3_init_cachepart_core(core);
@@ -424,6 +442,12 @@ int v3_init_core(struct guest_info * core) {
     v3_init_core_telemetry(core);
 #endif
 
+#ifdef V3_CONFIG_EXIT_TRACE
+    if (v3_init_core_exit_trace(core) == -1) {
+	PrintError(vm, core, "Could not initialize exit trace, continuing without it\n");
+    }
+#endif
+
     if (core->shdw_pg_mode == SHADOW_PAGING) {
         v3_init_passthrough_paging_core(core);
 	v3_init_shdw_pg_state(core);
@@ -509,10 +533,16 @@ int v3_free_core(struct guest_info * core) {
 
     v3_free_passthrough_pts(core);
 
+    v3_deinit_direct_map_flush(core);
+
 #ifdef V3_CONFIG_TELEMETRY
     v3_deinit_core_telemetry(core);
 #endif
 
+#ifdef V3_CONFIG_EXIT_TRACE
+    v3_deinit_core_exit_trace(core);
+#endif
+
 
 
     switch (v3_mach_type) {
@@ -390,6 +390,55 @@ struct v3_vm_info * v3_create_vm(void * cfg, void * priv_data, char * name, unsi
     return vm;
 }
 
+// Build the nested page tables of cores configured for it
+// before their first entry, so the guest does not fault its memory in
+static int populate_direct_maps(struct v3_vm_info * vm) {
+    uint64_t start = 0;
+    uint64_t end = 0;
+    uint32_t num_populated = 0;
+    int i;
+
+#ifdef V3_CONFIG_CHECKPOINT
+    if (vm->postcopy.active) { 
+	// touching all memory now would wait for all of it to arrive
+	V3_Print(vm, VCORE_NONE, "Not populating direct maps during a deferred memory load\n");
+	return 0;
+    }
+#endif
+
+    rdtscll(start);
+
+    for (i = 0; i < vm->num_cores; i++) {
+	struct guest_info * core = &(vm->cores[i]);
+
+	if (!core->prepopulate_direct_map || core->direct_map_populated) {
+	    continue;
+	}
+
+	if (v3_populate_direct_map(core) == -1) {
+	    PrintError(vm, core, "Cannot populate direct map of core %d\n", i);
+	    return -1;
+	}
+
+	core->direct_map_populated = 1;
+	num_populated++;
+
+	V3_Print(vm, core, "Direct map: %llu 4KB, %llu 2MB, %llu 1GB pages\n",
+		 core->direct_map_stats.num_4k, core->direct_map_stats.num_2m, 
+		 core->direct_map_stats.num_1g);
+    }
+
+    rdtscll(end);
+
+    if (num_populated) { 
+	V3_Print(vm, VCORE_NONE, "Populated direct maps of %u cores in %llu cycles (%llu us)\n",
+		 num_populated, end - start, ((end - start) * 1000) / V3_CPU_KHZ());
+    }
+
+    return 0;
+}
+
+
 int v3_start_vm(struct v3_vm_info * vm, unsigned int cpu_mask) {
 
     uint32_t i;
@@ -446,6 +495,11 @@ int v3_start_vm(struct v3_vm_info * vm, unsigned int cpu_mask) {
        PrintError(vm, VCORE_NONE,"Error admitting VM %s for scheduling", vm->name);
     }
 
+    if (populate_direct_maps(vm)) { 
+	PrintError(vm, VCORE_NONE, "Cannot populate nested/passthrough page tables\n");
+	return -1;
+    }
+
     vm->run_state = VM_RUNNING;
 
     for (vcore_id = 0; vcore_id < vm->num_cores; vcore_id++) {
@@ -1069,6 +1123,9 @@ int v3_get_state_vm(struct v3_vm_info        *vm,
 	
 	core->vcore[i].pcore=vm->cores[i].pcpu_id;
 	core->vcore[i].last_rip=(void*)(vm->cores[i].rip);
+	core->vcore[i].num_4k_maps=vm->cores[i].direct_map_stats.num_4k;
+	core->vcore[i].num_2m_maps=vm->cores[i].direct_map_stats.num_2m;
+	core->vcore[i].num_1g_maps=vm->cores[i].direct_map_stats.num_1g;
 	core->vcore[i].num_exits=vm->cores[i].num_exits;
     }
     
@@ -1083,9 +1140,11 @@ int v3_get_state_vm(struct v3_vm_info        *vm,
 #ifdef V3_CONFIG_SWAPPING
 	mem->region[i].swapped = vm->mem_map.base_regions[i].flags.swapped;
 	mem->region[i].pinned = vm->mem_map.base_regions[i].flags.pinned;
+	mem->region[i].hotness = vm->mem_map.base_regions[i].swap_state.hotness;
 #else
 	mem->region[i].swapped = 0;
 	mem->region[i].pinned = 0;
+	mem->region[i].hotness = 0;
 #endif
 
 	cur_gpa += mem->region[i].size;
@@ -1097,6 +1156,18 @@ int v3_get_state_vm(struct v3_vm_info        *vm,
     mem->mem_size=vm->mem_size;
     mem->ros_mem_size=vm->mem_size;
 
+#ifdef V3_CONFIG_SWAPPING
+    mem->swap_ins=vm->swap_state.pool_ins+vm->swap_state.file_ins;
+    mem->swap_pool_ins=vm->swap_state.pool_ins;
+    mem->swap_pool_size=vm->swap_state.pool_size;
+    mem->swap_pool_used=vm->swap_state.pool_used;
+#else
+    mem->swap_ins=0;
+    mem->swap_pool_ins=0;
+    mem->swap_pool_size=0;
+    mem->swap_pool_used=0;
+#endif
+
 #ifdef V3_CONFIG_HVM
     if (vm->hvm_state.is_hvm) { 
 	mem->ros_mem_size=v3_get_hvm_ros_memsize(vm);
@@ -29,8 +29,14 @@
 #include <palacios/vmm_hashtable.h>
 #include <palacios/vmm_direct_paging.h>
 #include <palacios/vmm_debug.h>
+#include <palacios/vmm_chkpt_codec.h>
+#include <palacios/vmm_chkpt_pages.h>
+#ifdef V3_CONFIG_LIVE_MIGRATION
+#include <palacios/vmm_chkpt_xbzrle.h>
+#endif
 
 #include <palacios/vmm_dev_mgr.h>
+#include <interfaces/vmm_numa.h>
 
 #ifdef V3_CONFIG_LIVE_MIGRATION
 #include <palacios/vmm_time.h>
@@ -44,6 +50,26 @@
 #endif
 
 
+/*
+ * Incremental memory format (version 2)
+ *
+ * Each round is a single context ("memory_inc<round>") holding the
+ * format version, the dirty bitmap, and then one save per run of 
+ * contiguous dirty pages ("run<first page>"). Runs never span a base 
+ * region and are capped at INC_MAX_RUN_PAGES so that streaming stores
+ * do not need huge buffers. Both sides derive the runs from the bitmap,
+ * so they need not be described separately. An empty bitmap ends the
+ * transfer.
+ *
+ * With V3_CHKPT_OPT_XBZRLE, a run is instead its encoded length 
+ * ("run<first page>.len") followed by the delta encoding of its pages
+ * (see vmm_chkpt_xbzrle.h).
+ */
+#define INC_MEM_VERSION    2
+#define INC_MAX_RUN_PAGES  1024  // 4 MB
+
+
+
 static struct hashtable * store_table = NULL;
 
 struct v3_chkpt;
@@ -73,6 +99,21 @@ struct chkpt_interface {
   // 
   int (*save)(void * store_data, void * ctx, char * tag, uint64_t len, void * buf);
   int (*load)(void * store_data, void * ctx, char * tag, uint64_t len, void * buf);
+
+  // Optional.  A hint, before a context is opened for saving, that it will
+  // hold about size bytes, so the store can allocate it up front
+  void (*preallocate_hint)(void * store_data, char * name, uint64_t size);
+
+  // Optional.  When saving, wait for the reader at the other end to ask for
+  // a context, and copy its name into name.  Return -1 on failure or if the
+  // store cannot do this, 0 on success.  With len 0, return right away,
+  // saying only whether the store can do it.
+  int (*next_request)(void * store_data, char * name, int len);
+
+  // Optional.  Make saves and loads blocked in the store, and any later
+  // ones, fail.  Called from another thread than the one using the store,
+  // which still closes it.
+  void (*abort)(void * store_data);
 };
 
 
@@ -84,6 +125,20 @@ struct v3_chkpt {
   struct chkpt_interface * interface;
   
   void * store_data;
+
+  // non-NULL if large blobs go through a codec
+  struct v3_chkpt_codec_state * codec;
+
+  // non-NULL if guest memory is saved with zero/duplicate page elision
+  struct v3_chkpt_page_scope * pages;
+
+#ifdef V3_CONFIG_LIVE_MIGRATION
+  // non-NULL if incremental memory is delta encoded
+  struct v3_chkpt_xbzrle * xbzrle;
+#endif
+
+  // a context failed to close, so it may not all have been stored
+  int ctx_error;
 };
 
 
@@ -148,6 +203,28 @@ static int chkpt_close(struct v3_chkpt * chkpt) {
 
     rc = chkpt->interface->close_chkpt(chkpt->store_data);
 
+    if (chkpt->ctx_error) {
+      PrintError(VM_NONE, VCORE_NONE, "Some checkpoint contexts were not completely stored\n");
+      rc = -1;
+    }
+
+    if (chkpt->codec) {
+	v3_chkpt_codec_print_stats(chkpt->codec);
+	v3_chkpt_codec_deinit(chkpt->codec);
+    }
+
+    if (chkpt->pages) {
+	v3_chkpt_pages_print_stats(chkpt->pages);
+	v3_chkpt_pages_deinit(chkpt->pages);
+    }
+
+#ifdef V3_CONFIG_LIVE_MIGRATION
+    if (chkpt->xbzrle) {
+	v3_chkpt_xbzrle_print_stats(chkpt->xbzrle);
+	v3_chkpt_xbzrle_deinit(chkpt->xbzrle);
+    }
+#endif
+
     V3_Free(chkpt);
 
     if (rc!=0) { 
@@ -163,7 +240,7 @@ static int chkpt_close(struct v3_chkpt * chkpt) {
 }
 
 
-static struct v3_chkpt * chkpt_open(struct v3_vm_info * vm, char * store, char * url, chkpt_mode_t mode) {
+static struct v3_chkpt * chkpt_open(struct v3_vm_info * vm, char * store, char * url, chkpt_mode_t mode, v3_chkpt_options_t opts) {
     struct chkpt_interface * iface = NULL;
     struct v3_chkpt * chkpt = NULL;
     void * store_data = NULL;
@@ -197,6 +274,49 @@ static struct v3_chkpt * chkpt_open(struct v3_vm_info * vm, char * store, char *
     chkpt->vm = vm;
     chkpt->store_data = store_data;
     chkpt->current_ctx = NULL;
+
+    if (opts & (V3_CHKPT_OPT_COMPRESS_ZRLE | V3_CHKPT_OPT_COMPRESS_LZ)) {
+	// on a load, the codec of each chunk comes from the checkpoint
+	uint32_t codec = (opts & V3_CHKPT_OPT_COMPRESS_LZ) ? V3_CHKPT_CODEC_LZ : V3_CHKPT_CODEC_ZRLE;
+
+	chkpt->codec = v3_chkpt_codec_init(codec);
+
+	if (!chkpt->codec) {
+	    PrintError(vm, VCORE_NONE, "Could not initialize checkpoint codec, closing checkpoint\n");
+	    iface->close_chkpt(store_data);
+	    V3_Free(chkpt);
+	    return NULL;
+	}
+    }
+
+    if (opts & V3_CHKPT_OPT_ELIDE_PAGES) {
+	chkpt->pages = v3_chkpt_pages_init(vm, 1);
+
+	if (!chkpt->pages) {
+	    PrintError(vm, VCORE_NONE, "Could not initialize page elision, closing checkpoint\n");
+	    iface->close_chkpt(store_data);
+	    if (chkpt->codec) {
+		v3_chkpt_codec_deinit(chkpt->codec);
+	    }
+	    V3_Free(chkpt);
+	    return NULL;
+	}
+    }
+
+#ifdef V3_CONFIG_LIVE_MIGRATION
+    if (opts & V3_CHKPT_OPT_XBZRLE) {
+	// only the sender needs the cache, the receiver has the old pages in guest memory
+	uint64_t cache_bytes = (mode == SAVE) ? (V3_CONFIG_LIVE_MIGRATION_XBZRLE_CACHE * 1024ULL * 1024ULL) : 0;
+
+	chkpt->xbzrle = v3_chkpt_xbzrle_init(vm, cache_bytes, INC_MAX_RUN_PAGES);
+
+	if (!chkpt->xbzrle) {
+	    PrintError(vm, VCORE_NONE, "Could not initialize delta encoding, closing checkpoint\n");
+	    chkpt_close(chkpt);
+	    return NULL;
+	}
+    }
+#endif
     
     return chkpt;
 }
@@ -219,6 +339,7 @@ struct v3_chkpt_ctx * v3_chkpt_open_ctx(struct v3_chkpt * chkpt, char * name) {
   memset(ctx, 0, sizeof(struct v3_chkpt_ctx));
   
   ctx->chkpt = chkpt;
+  ctx->codec = chkpt->codec;
   ctx->store_ctx = chkpt->interface->open_ctx(chkpt->store_data, name);
 
   if (!(ctx->store_ctx)) {
@@ -245,6 +366,7 @@ int v3_chkpt_close_ctx(struct v3_chkpt_ctx * ctx) {
 
     if (ret) { 
       PrintError(VM_NONE, VCORE_NONE, "Failed to close context on store, closing device-independent context anyway - bad\n");
+      chkpt->ctx_error = 1;
       ret = -1;
     }
 
@@ -259,6 +381,72 @@ int v3_chkpt_close_ctx(struct v3_chkpt_ctx * ctx) {
 
 
 
+static int codec_save(struct v3_chkpt * chkpt, struct v3_chkpt_ctx * ctx, char * tag, uint64_t len, void * buf) {
+    struct v3_chkpt_codec_hdr hdr;
+    uint64_t offset = 0;
+
+    for (offset = 0; offset < len; offset += V3_CHKPT_CODEC_CHUNK) {
+	uint32_t chunk_len = ((len - offset) < V3_CHKPT_CODEC_CHUNK) ? (len - offset) : V3_CHKPT_CODEC_CHUNK;
+	uint8_t * chunk = (uint8_t *)buf + offset;
+	uint32_t codec = 0;
+
+	// hdr is packed, so the codec cannot be written through a pointer into it
+	hdr.enc_len = v3_chkpt_codec_encode(ctx->codec, chunk, chunk_len, ctx->codec->scratch, &codec);
+	hdr.codec = codec;
+
+	if (hdr.codec != V3_CHKPT_CODEC_NONE) {
+	    chunk = ctx->codec->scratch;
+	}
+
+	if (chkpt->interface->save(chkpt->store_data, ctx->store_ctx, tag, sizeof(hdr), &hdr) ||
+	    chkpt->interface->save(chkpt->store_data, ctx->store_ctx, tag, hdr.enc_len, chunk)) {
+	    return -1;
+	}
+    }
+
+    return 0;
+}
+
+
+static int codec_load(struct v3_chkpt * chkpt, struct v3_chkpt_ctx * ctx, char * tag, uint64_t len, void * buf) {
+    struct v3_chkpt_codec_hdr hdr;
+    uint64_t offset = 0;
+
+    for (offset = 0; offset < len; offset += V3_CHKPT_CODEC_CHUNK) {
+	uint32_t chunk_len = ((len - offset) < V3_CHKPT_CODEC_CHUNK) ? (len - offset) : V3_CHKPT_CODEC_CHUNK;
+	uint8_t * chunk = (uint8_t *)buf + offset;
+
+	if (chkpt->interface->load(chkpt->store_data, ctx->store_ctx, tag, sizeof(hdr), &hdr)) {
+	    return -1;
+	}
+
+	if (hdr.codec == V3_CHKPT_CODEC_NONE) {
+	    if (hdr.enc_len != chunk_len) {
+		PrintError(VM_NONE, VCORE_NONE, "Raw chunk of tag %s has the wrong length (%u, expected %u)\n", 
+			   tag, hdr.enc_len, chunk_len);
+		return -1;
+	    }
+
+	    if (chkpt->interface->load(chkpt->store_data, ctx->store_ctx, tag, chunk_len, chunk)) {
+		return -1;
+	    }
+	} else {
+	    if (hdr.enc_len >= chunk_len) {
+		PrintError(VM_NONE, VCORE_NONE, "Encoded chunk of tag %s is too long (%u)\n", tag, hdr.enc_len);
+		return -1;
+	    }
+
+	    if (chkpt->interface->load(chkpt->store_data, ctx->store_ctx, tag, hdr.enc_len, ctx->codec->scratch) ||
+		v3_chkpt_codec_decode(ctx->codec, hdr.codec, ctx->codec->scratch, hdr.enc_len, chunk, chunk_len)) {
+		return -1;
+	    }
+	}
+    }
+
+    return 0;
+}
+
+
 int v3_chkpt_save(struct v3_chkpt_ctx * ctx, char * tag, uint64_t len, void * buf) {
     struct v3_chkpt * chkpt;
     int rc;
@@ -270,12 +458,16 @@ int v3_chkpt_save(struct v3_chkpt_ctx * ctx, char * tag, uint64_t len, void * bu
 
     chkpt = ctx->chkpt;    
 
-    if (chkpt->current_ctx != ctx) { 
+    if (!ctx->sub && (chkpt->current_ctx != ctx)) { 
       PrintError(VM_NONE, VCORE_NONE, "Attempt to save on context that is not the current context for the store\n");
       return -1;
     }
 
-    rc = chkpt->interface->save(chkpt->store_data, ctx->store_ctx, tag , len, buf);
+    if (ctx->codec && (len >= V3_CHKPT_CODEC_MIN_LEN)) {
+	rc = codec_save(chkpt, ctx, tag, len, buf);
+    } else {
+	rc = chkpt->interface->save(chkpt->store_data, ctx->store_ctx, tag , len, buf);
+    }
 
     if (rc) { 
       PrintError(VM_NONE, VCORE_NONE, "Underlying store failed to save tag %s on valid context\n",tag);
@@ -297,12 +489,16 @@ int v3_chkpt_load(struct v3_chkpt_ctx * ctx, char * tag, uint64_t len, void * bu
 
     chkpt = ctx->chkpt;    
     
-    if (chkpt->current_ctx != ctx) { 
+    if (!ctx->sub && (chkpt->current_ctx != ctx)) { 
       PrintError(VM_NONE, VCORE_NONE, "Attempt to load from context that is not the current context for the store\n");
       return -1;
     }
 
-    rc = chkpt->interface->load(chkpt->store_data, ctx->store_ctx, tag, len, buf);
+    if (ctx->codec && (len >= V3_CHKPT_CODEC_MIN_LEN)) {
+	rc = codec_load(chkpt, ctx, tag, len, buf);
+    } else {
+	rc = chkpt->interface->load(chkpt->store_data, ctx->store_ctx, tag, len, buf);
+    }
 
     if (rc) { 
       PrintError(VM_NONE, VCORE_NONE, "Underlying store failed to load tag %s from valid context\n",tag);
@@ -355,7 +551,13 @@ static int load_memory(struct v3_vm_info * vm, struct v3_chkpt * chkpt) {
     for (i=0;i<vm->mem_map.num_base_regions;i++) {
 	guest_mem_base = V3_VAddr((void *)vm->mem_map.base_regions[i].host_addr);
 	sprintf(buf,"memory_img%d",i);
-	if (v3_chkpt_load(ctx, buf, v3_mem_block_size, guest_mem_base)) {
+	if (chkpt->pages) {
+	    ret = v3_chkpt_pages_load(ctx, chkpt->pages, buf, vm->mem_map.base_regions[i].guest_start >> 12,
+				      v3_mem_block_size >> 12, guest_mem_base);
+	} else {
+	    ret = v3_chkpt_load(ctx, buf, v3_mem_block_size, guest_mem_base);
+	}
+	if (ret) {
 	    PrintError(vm, VCORE_NONE, "Unable to load all of memory (region %d) (requested=%llu bytes, result=%llu bytes\n",i,(uint64_t)(vm->mem_size),ret);
 	    v3_chkpt_close_ctx(ctx);
 	    return -1;
@@ -376,6 +578,13 @@ static int save_memory(struct v3_vm_info * vm, struct v3_chkpt * chkpt) {
     extern uint64_t v3_mem_block_size;
     int i;
 
+    // the size is only known up front if each region is saved verbatim
+    // (allowing 64 bytes per save for tags and framing)
+    if (!chkpt->codec && !chkpt->pages && chkpt->interface->preallocate_hint) {
+	chkpt->interface->preallocate_hint(chkpt->store_data, "memory_img", 
+					   (vm->mem_map.num_base_regions + 2) * 64 +
+					   vm->mem_map.num_base_regions * v3_mem_block_size);
+    }
 
     ctx = v3_chkpt_open_ctx(chkpt, "memory_img");
 
@@ -397,7 +606,13 @@ static int save_memory(struct v3_vm_info * vm, struct v3_chkpt * chkpt) {
     for (i=0;i<vm->mem_map.num_base_regions;i++) {
 	guest_mem_base = V3_VAddr((void *)vm->mem_map.base_regions[i].host_addr);
 	sprintf(buf,"memory_img%d",i);
-	if (v3_chkpt_save(ctx, buf, v3_mem_block_size, guest_mem_base)) {
+	if (chkpt->pages) {
+	    ret = v3_chkpt_pages_save(ctx, chkpt->pages, buf, vm->mem_map.base_regions[i].guest_start >> 12,
+				      v3_mem_block_size >> 12, guest_mem_base);
+	} else {
+	    ret = v3_chkpt_save(ctx, buf, v3_mem_block_size, guest_mem_base);
+	}
+	if (ret) {
 	    PrintError(vm, VCORE_NONE, "Unable to save all of memory (region %d) (requested=%llu, received=%llu)\n",i,(uint64_t)(vm->mem_size),ret);
 	    v3_chkpt_close_ctx(ctx);  
 	    return -1;
@@ -409,191 +624,1132 @@ static int save_memory(struct v3_vm_info * vm, struct v3_chkpt * chkpt) {
     return 0;
 }
 
-#ifdef V3_CONFIG_LIVE_MIGRATION
 
-struct mem_migration_state {
-    struct v3_vm_info *vm;
-    struct v3_bitmap  modified_pages; 
+/*
+ * Parallel memory save/load (V3_CHKPT_OPT_PARALLEL_MEM)
+ *
+ * The "memory_img" context holds the region size, the number of regions,
+ * the number of workers, and which worker each region belongs to. Each
+ * worker then has its own context ("memory_img_worker<n>") holding its
+ * regions in ascending order, tagged as in save_memory. Regions are
+ * grouped by NUMA node so that a worker can run on a CPU local to the
+ * memory it copies. The load reads the assignment back and mirrors it,
+ * whatever the number of threads it was built with: at most
+ * CHKPT_MAX_THREADS workers run at once, and any beyond that run in
+ * later batches.
+ *
+ * Worker contexts are open at the same time, so this needs a store that
+ * allows that. With any other store, the workers run one after another
+ * on the calling thread.
+ */
+
+#ifdef V3_CONFIG_CHECKPOINT_THREADS
+#define CHKPT_MAX_THREADS V3_CONFIG_CHECKPOINT_THREADS
+#else
+#define CHKPT_MAX_THREADS 1
+#endif
+
+struct mem_worker_group;
+
+struct mem_worker {
+    struct mem_worker_group * group;
+    uint32_t id;
+    int cpu;
+
+    struct v3_chkpt_ctx ctx;
+    struct v3_chkpt_page_scope * pages;
+
+    volatile int done;
+    int rc;
 };
 
-static int shadow_paging_callback(struct guest_info *core, 
-				  struct v3_shdw_pg_event *event,
-				  void      *priv_data)
-{
-    struct mem_migration_state *m = (struct mem_migration_state *)priv_data;
-    
-    if (event->event_type==SHADOW_PAGEFAULT &&
-	event->event_order==SHADOW_PREIMPL &&
-	event->error_code.write) { // Note, assumes VTLB behavior where we will see the write even if preceded by a read
-	addr_t gpa;
-	if (!v3_gva_to_gpa(core,event->gva,&gpa)) {
-	    // write to this page
-	    v3_bitmap_set(&(m->modified_pages),gpa>>12);
-	} else {
-	    // no worries, this isn't physical memory
-	}
-    } else {
-	// we don't care about other events
+struct mem_worker_group {
+    struct v3_vm_info * vm;
+    struct v3_chkpt * chkpt;
+    chkpt_mode_t mode;
+
+    uint32_t num_workers;
+    uint32_t * assignment;      // worker for each base region
+
+    struct mem_worker * workers;
+};
+
+
+static int store_allows_parallel(char * store, char * url) {
+    if ((strcasecmp(store, "DIR") == 0) || (strcasecmp(store, "INDEXED") == 0)) {
+	return 1;
     }
-    
+
+    // file and mem keyed streams keep each key separately
+    if ((strcasecmp(store, "KEYED_STREAM") == 0) && 
+	((strncasecmp(url, "file:", 5) == 0) || (strncasecmp(url, "afile:", 6) == 0) ||
+	 (strncasecmp(url, "mem:", 4) == 0))) {
+	return 1;
+    }
+
     return 0;
 }
 
 
-/*
-static int nested_paging_callback(struct guest_info *core, 
-				  struct v3_nested_pg_event *event,
-				  void      *priv_data)
-{
-    struct mem_migration_state *m = (struct mem_migration_state *)priv_data;
-    
-    if (event->event_type==NESTED_PAGEFAULT &&
-	event->event_order==NESTED_PREIMPL &&
-	event->error_code.write) { // Assumes we will see a write after reads
-	if (event->gpa<core->vm_info->mem_size) { 
-	  v3_bitmap_set(&(m->modified_pages),(event->gpa)>>12);
-	} else {
-	  // no worries, this isn't physical memory
+// The nth CPU on the node, or the nth of all CPUs if the node has none
+static int pick_cpu(int node, int nth) {
+    extern v3_cpu_arch_t v3_cpu_types[];
+    int pass = 0;
+    int i = 0;
+
+    for (pass = 0; pass < 2; pass++) {
+	int count = 0;
+
+	for (i = 0; i < V3_CONFIG_MAX_CPUS; i++) {
+	    if ((v3_cpu_types[i] != V3_INVALID_CPU) && 
+		((pass == 1) || (node < 0) || (v3_numa_cpu_to_node(i) == node))) {
+		count++;
+	    }
+	}
+
+	if (count == 0) {
+	    continue;
+	}
+
+	nth %= count;
+
+	for (i = 0; i < V3_CONFIG_MAX_CPUS; i++) {
+	    if ((v3_cpu_types[i] != V3_INVALID_CPU) && 
+		((pass == 1) || (node < 0) || (v3_numa_cpu_to_node(i) == node))) {
+		if (nth-- == 0) {
+		    return i;
+		}
+	    }
 	}
-    } else {
-      // we don't care about other events
     }
-    
+
     return 0;
 }
-*/	
-
-
-static struct mem_migration_state *start_page_tracking(struct v3_vm_info *vm)
-{
-    struct mem_migration_state *m;
-    int i;
 
-    m = (struct mem_migration_state *)V3_Malloc(sizeof(struct mem_migration_state));
 
-    if (!m) { 
-	PrintError(vm, VCORE_NONE, "Cannot allocate\n");
-	return NULL;
-    }
+// Split the regions into contiguous groups after ordering them by NUMA node
+static void assign_regions(struct v3_vm_info * vm, uint32_t num_workers, uint32_t * assignment) {
+    struct v3_mem_region * regions = vm->mem_map.base_regions;
+    uint32_t num_regions = vm->mem_map.num_base_regions;
+    uint32_t n = 0;
+    uint32_t i = 0;
 
-    m->vm=vm;
-    
-    if (v3_bitmap_init(&(m->modified_pages),vm->mem_size >> 12) == -1) { 
-	PrintError(vm, VCORE_NONE, "Failed to initialize modified_pages bit vector");
-	V3_Free(m);
+    // num_workers marks a region that has not been placed yet
+    for (i = 0; i < num_regions; i++) {
+	assignment[i] = num_workers;
     }
 
-    // We assume that the migrator has already verified that all cores are
-    // using the identical model (shadow or nested)
-    // This must not change over the execution of the migration
+    for (n = 0; n < num_regions; n++) {
+	int next = -1;
 
-    if (vm->cores[0].shdw_pg_mode==SHADOW_PAGING) { 
-      v3_register_shadow_paging_event_callback(vm,shadow_paging_callback,m);
+	for (i = 0; i < num_regions; i++) {
+	    if ((assignment[i] == num_workers) && 
+		((next == -1) || (regions[i].numa_id < regions[next].numa_id))) {
+		next = i;
+	    }
+	}
 
-      for (i=0;i<vm->num_cores;i++) {
-	v3_invalidate_shadow_pts(&(vm->cores[i]));
-      }
-    } else if (vm->cores[0].shdw_pg_mode==NESTED_PAGING) { 
-	//v3_register_nested_paging_event_callback(vm,nested_paging_callback,m);
-      
-      for (i=0;i<vm->num_cores;i++) {
-	//v3_invalidate_nested_addr_range(&(vm->cores[i]),0,vm->mem_size-1);
-      }
-    } else {
-      PrintError(vm, VCORE_NONE, "Unsupported paging mode\n");
-      v3_bitmap_deinit(&(m->modified_pages));
-      V3_Free(m);
-      return 0;
+	assignment[next] = (n * num_workers) / num_regions;
     }
-    
-    // and now we should get callbacks as writes happen
-
-    return m;
 }
 
-static void stop_page_tracking(struct mem_migration_state *m)
-{
-  if (m->vm->cores[0].shdw_pg_mode==SHADOW_PAGING) { 
-    v3_unregister_shadow_paging_event_callback(m->vm,shadow_paging_callback,m);
-  } else {
-    //v3_unregister_nested_paging_event_callback(m->vm,nested_paging_callback,m);
-  }
-    
-  v3_bitmap_deinit(&(m->modified_pages));
-  
-  V3_Free(m);
-}
 
-	    
-		
-							    
+static int mem_worker(void * arg) {
+    struct mem_worker * w = arg;
+    struct mem_worker_group * g = w->group;
+    struct v3_vm_info * vm = g->vm;
+    extern uint64_t v3_mem_block_size;
+    char buf[128];
+    int rc = 0;
+    int i = 0;
 
+    for (i = 0; i < vm->mem_map.num_base_regions; i++) {
+	void * guest_mem_base = NULL;
 
-//
-// Returns
-//  negative: error
-//  zero: done with this round
-static int save_inc_memory(struct v3_vm_info * vm, 
-                           struct v3_bitmap * mod_pgs_to_send, 
-                           struct v3_chkpt * chkpt) {
-    int page_size_bytes = 1 << 12; // assuming 4k pages right now
-    void * ctx = NULL;
-    int i = 0; 
-    int bitmap_num_bytes = (mod_pgs_to_send->num_bits / 8) 
-                           + ((mod_pgs_to_send->num_bits % 8) > 0);
+	if (g->assignment[i] != w->id) {
+	    continue;
+	}
 
-   
-    PrintDebug(vm, VCORE_NONE, "Saving incremental memory.\n");
+	guest_mem_base = V3_VAddr((void *)vm->mem_map.base_regions[i].host_addr);
+	sprintf(buf, "memory_img%d", i);
 
-    ctx = v3_chkpt_open_ctx(chkpt,"memory_bitmap_bits");
+	if (w->pages) {
+	    uint64_t first_page = vm->mem_map.base_regions[i].guest_start >> 12;
 
-    if (!ctx) { 
-	PrintError(vm, VCORE_NONE, "Cannot open context for dirty memory bitmap\n");
-	return -1;
-    }
-	
+	    if (g->mode == SAVE) {
+		rc = v3_chkpt_pages_save(&(w->ctx), w->pages, buf, first_page, v3_mem_block_size >> 12, guest_mem_base);
+	    } else {
+		rc = v3_chkpt_pages_load(&(w->ctx), w->pages, buf, first_page, v3_mem_block_size >> 12, guest_mem_base);
+	    }
+	} else if (g->mode == SAVE) {
+	    rc = v3_chkpt_save(&(w->ctx), buf, v3_mem_block_size, guest_mem_base);
+	} else {
+	    rc = v3_chkpt_load(&(w->ctx), buf, v3_mem_block_size, guest_mem_base);
+	}
 
-    if (v3_chkpt_save(ctx,
-		      "memory_bitmap_bits",
-		      bitmap_num_bytes,
-		      mod_pgs_to_send->bits)) {
-	PrintError(vm, VCORE_NONE, "Unable to write all of the dirty memory bitmap\n");
-	v3_chkpt_close_ctx(ctx);
-	return -1;
+	if (rc) {
+	    PrintError(vm, VCORE_NONE, "Memory worker %u unable to %s region %d\n", 
+		       w->id, (g->mode == SAVE) ? "save" : "load", i);
+	    break;
+	}
     }
 
-    v3_chkpt_close_ctx(ctx);
+    w->rc = rc;
+
+    // The waiter may free w as soon as it sees done, so this is our last touch of it
+    __asm__ __volatile__ ("" : : : "memory");
+    w->done = 1;
+
+    return rc;
+}
+
+
+// Contexts are opened and closed here, on the calling thread, as stores
+// are not expected to do that concurrently. Only the transfers overlap.
+static int run_mem_worker_batch(struct mem_worker_group * g, uint32_t first, uint32_t last, int parallel) {
+    struct v3_chkpt * chkpt = g->chkpt;
+    uint32_t i = 0;
+    int rc = 0;
+
+    // workers we fail to start count as done
+    for (i = first; i < last; i++) {
+	g->workers[i].group = g;
+	g->workers[i].id = i;
+	g->workers[i].done = 1;
+	g->workers[i].rc = 0;
+    }
+
+    for (i = first; i < last; i++) {
+	struct mem_worker * w = &(g->workers[i]);
+	char name[32];
+	int node = -1;
+	int j = 0;
+
+	w->ctx.chkpt = chkpt;
+	w->ctx.sub = 1;
+
+	if (chkpt->codec) {
+	    // codec state holds scratch buffers, so each worker needs its own
+	    w->ctx.codec = v3_chkpt_codec_init(chkpt->codec->codec);
+
+	    if (!w->ctx.codec) {
+		PrintError(g->vm, VCORE_NONE, "Cannot initialize codec for memory worker %u\n", i);
+		rc = -1;
+		break;
+	    }
+	}
+
+	if (chkpt->pages) {
+	    // duplicates may only refer to pages of the same worker
+	    w->pages = v3_chkpt_pages_init(g->vm, chkpt->pages->allow_dups);
+
+	    if (!w->pages) {
+		PrintError(g->vm, VCORE_NONE, "Cannot initialize page elision for memory worker %u\n", i);
+		rc = -1;
+		break;
+	    }
+	}
+
+	sprintf(name, "memory_img_worker%u", i);
+
+	w->ctx.store_ctx = chkpt->interface->open_ctx(chkpt->store_data, name);
+
+	if (!w->ctx.store_ctx) {
+	    PrintError(g->vm, VCORE_NONE, "Cannot open context %s\n", name);
+	    rc = -1;
+	    break;
+	}
+
+	// run on the node of the worker's first region
+	for (j = 0; j < g->vm->mem_map.num_base_regions; j++) {
+	    if (g->assignment[j] == i) {
+		node = g->vm->mem_map.base_regions[j].numa_id;
+		break;
+	    }
+	}
+
+	w->cpu = pick_cpu(node, i);
+	w->done = 0;
+
+	if (parallel) {
+	    sprintf(name, "v3-chkpt-mem%u", i);
+
+	    if (!V3_CREATE_THREAD_ON_CPU(w->cpu, mem_worker, w, name, 0)) {
+		PrintError(g->vm, VCORE_NONE, "Cannot start memory worker %u, running it here\n", i);
+		mem_worker(w);
+	    }
+	} else {
+	    mem_worker(w);
+
+	    // one context at a time
+	    if (chkpt->interface->close_ctx(chkpt->store_data, w->ctx.store_ctx)) {
+		w->rc = -1;
+	    }
+	    w->ctx.store_ctx = NULL;
+	}
+    }
+
+    for (i = first; i < last; i++) {
+	struct mem_worker * w = &(g->workers[i]);
+
+	while (!w->done) {
+	    V3_Yield();
+	}
+
+	if (w->ctx.store_ctx && chkpt->interface->close_ctx(chkpt->store_data, w->ctx.store_ctx)) {
+	    PrintError(g->vm, VCORE_NONE, "Memory worker %u could not close its context\n", i);
+	    w->rc = -1;
+	}
+
+	if (w->ctx.codec) {
+	    v3_chkpt_codec_merge_stats(chkpt->codec, w->ctx.codec);
+	    v3_chkpt_codec_deinit(w->ctx.codec);
+	}
+
+	if (w->pages) {
+	    v3_chkpt_pages_merge_stats(chkpt->pages, w->pages);
+	    v3_chkpt_pages_deinit(w->pages);
+	}
+
+	if (w->rc) {
+	    rc = -1;
+	}
+    }
+
+    return rc;
+}
+
+
+static int run_mem_workers(struct mem_worker_group * g, int parallel) {
+    uint32_t first = 0;
+
+    for (first = 0; first < g->num_workers; first += CHKPT_MAX_THREADS) {
+	uint32_t last = first + CHKPT_MAX_THREADS;
+
+	if (last > g->num_workers) {
+	    last = g->num_workers;
+	}
+
+	if (run_mem_worker_batch(g, first, last, parallel)) {
+	    return -1;
+	}
+    }
+
+    return 0;
+}
+
+
+static int parallel_memory(struct v3_vm_info * vm, struct v3_chkpt * chkpt, chkpt_mode_t mode, int parallel) {
+    struct mem_worker_group * g = NULL;
+    void * ctx = NULL;
+    uint64_t block_size = 0;
+    uint32_t num_regions = vm->mem_map.num_base_regions;
+    uint32_t i = 0;
+    int ret = -1;
+    extern uint64_t v3_mem_block_size;
+
+    g = V3_Malloc(sizeof(struct mem_worker_group));
+
+    if (!g) {
+	PrintError(vm, VCORE_NONE, "Cannot allocate memory worker state\n");
+	return -1;
+    }
+
+    memset(g, 0, sizeof(struct mem_worker_group));
+
+    g->vm = vm;
+    g->chkpt = chkpt;
+    g->mode = mode;
+
+    g->assignment = V3_Malloc(sizeof(uint32_t) * num_regions);
+
+    if (!g->assignment) {
+	PrintError(vm, VCORE_NONE, "Cannot allocate memory worker assignment\n");
+	V3_Free(g);
+	return -1;
+    }
+
+    ctx = v3_chkpt_open_ctx(chkpt, "memory_img");
+
+    if (!ctx) {
+	PrintError(vm, VCORE_NONE, "Unable to open context for memory\n");
+	goto out;
+    }
+
+    if (mode == SAVE) {
+	g->num_workers = (num_regions < CHKPT_MAX_THREADS) ? num_regions : CHKPT_MAX_THREADS;
+
+	assign_regions(vm, g->num_workers, g->assignment);
+
+	if (V3_CHKPT_SAVE(ctx, "region_size", v3_mem_block_size) ||
+	    V3_CHKPT_SAVE(ctx, "num_regions", num_regions) ||
+	    V3_CHKPT_SAVE(ctx, "num_workers", g->num_workers) ||
+	    v3_chkpt_save(ctx, "assignment", sizeof(uint32_t) * num_regions, g->assignment)) {
+	    PrintError(vm, VCORE_NONE, "Unable to save memory layout\n");
+	    v3_chkpt_close_ctx(ctx);
+	    goto out;
+	}
+    } else {
+	if (V3_CHKPT_LOAD(ctx, "region_size", block_size) ||
+	    V3_CHKPT_LOAD(ctx, "num_regions", i)) {
+	    PrintError(vm, VCORE_NONE, "Unable to load memory layout\n");
+	    v3_chkpt_close_ctx(ctx);
+	    goto out;
+	}
+
+	if ((block_size != v3_mem_block_size) || (i != num_regions)) {
+	    PrintError(vm, VCORE_NONE, "Unable to load as memory layout differs (block size %llu, %u regions)\n",
+		       block_size, i);
+	    v3_chkpt_close_ctx(ctx);
+	    goto out;
+	}
+
+	if (V3_CHKPT_LOAD(ctx, "num_workers", g->num_workers) ||
+	    v3_chkpt_load(ctx, "assignment", sizeof(uint32_t) * num_regions, g->assignment)) {
+	    PrintError(vm, VCORE_NONE, "Unable to load memory worker assignment\n");
+	    v3_chkpt_close_ctx(ctx);
+	    goto out;
+	}
+
+	if ((g->num_workers == 0) || (g->num_workers > num_regions)) {
+	    PrintError(vm, VCORE_NONE, "Checkpoint uses %u memory workers for %u regions\n", 
+		       g->num_workers, num_regions);
+	    v3_chkpt_close_ctx(ctx);
+	    goto out;
+	}
+
+	for (i = 0; i < num_regions; i++) {
+	    if (g->assignment[i] >= g->num_workers) {
+		PrintError(vm, VCORE_NONE, "Region %u assigned to invalid worker %u\n", i, g->assignment[i]);
+		v3_chkpt_close_ctx(ctx);
+		goto out;
+	    }
+	}
+    }
+
+    v3_chkpt_close_ctx(ctx);
+
+    g->workers = V3_Malloc(sizeof(struct mem_worker) * g->num_workers);
+
+    if (!g->workers) {
+	PrintError(vm, VCORE_NONE, "Cannot allocate %u memory workers\n", g->num_workers);
+	goto out;
+    }
+
+    memset(g->workers, 0, sizeof(struct mem_worker) * g->num_workers);
+
+    ret = run_mem_workers(g, parallel);
+
+ out:
+    if (g->workers) {
+	V3_Free(g->workers);
+    }
+
+    V3_Free(g->assignment);
+    V3_Free(g);
+
+    return ret;
+}
+
+
+/*
+ * Deferred memory (struct v3_postcopy_state)
+ *
+ * Both post-copy migration and lazy restore let the VM run before its
+ * memory is in place. Memory is tracked in chunks. A base region lookup
+ * for a chunk that is not present yet posts it as wanted and waits for
+ * it (v3_postcopy_wait). A single thread owns the checkpoint and fills
+ * in the chunks, taking wanted chunks first when its source allows it.
+ */
+
+static void * postcopy_chunk_addr(struct v3_vm_info * vm, uint64_t chunk_size, uint64_t chunk) {
+    extern uint64_t v3_mem_block_size;
+    uint64_t gpa = chunk * chunk_size;
+    struct v3_mem_region * reg = &(vm->mem_map.base_regions[gpa / v3_mem_block_size]);
+
+    return V3_VAddr((void *)reg->host_addr) + (gpa % v3_mem_block_size);
+}
+
+
+static uint64_t postcopy_chunk_size(void) {
+    extern uint64_t v3_mem_block_size;
+
+    return (v3_mem_block_size < V3_POSTCOPY_CHUNK_SIZE) ? v3_mem_block_size : V3_POSTCOPY_CHUNK_SIZE;
+}
+
+
+// Marks all memory absent. The VM must be stopped or behind a barrier.
+static int postcopy_start(struct v3_vm_info * vm, uint64_t chunk_size, uint64_t num_chunks) {
+    struct v3_postcopy_state * pc = &(vm->postcopy);
+    v3_lock_t lock = pc->lock;
+    int i = 0;
+
+    if (pc->present) {
+	// left over from an earlier transfer
+	V3_VFree((void *)pc->present);
+    }
+
+    memset(pc, 0, sizeof(struct v3_postcopy_state));
+
+    pc->lock = lock;
+
+    pc->present = V3_VMalloc(num_chunks);
+
+    if (!pc->present) {
+	PrintError(vm, VCORE_NONE, "Cannot allocate chunk map for deferred memory\n");
+	return -1;
+    }
+
+    memset((void *)pc->present, 0, num_chunks);
+
+    pc->chunk_size = chunk_size;
+    pc->num_chunks = num_chunks;
+    pc->wanted = -1;
+    pc->active = 1;
+
+    // Nothing may stay mapped from before, every access has to go through a lookup
+    for (i = 0; i < vm->num_cores; i++) {
+	struct guest_info * core = &(vm->cores[i]);
+	addr_t start = 0;
+	addr_t end = 0;
+
+	if (core->shdw_pg_mode == SHADOW_PAGING) {
+	    v3_invalidate_shadow_pts(core);
+	    v3_invalidate_passthrough_addr_range(core, 0, vm->mem_size - 1, &start, &end);
+	} else {
+	    v3_invalidate_nested_addr_range(core, 0, vm->mem_size - 1, &start, &end);
+	}
+    }
+
+    return 0;
+}
+
+
+int v3_postcopy_wait(struct v3_vm_info * vm, addr_t gpa) {
+    struct v3_postcopy_state * pc = &(vm->postcopy);
+    uint64_t chunk = gpa / pc->chunk_size;
+    uint64_t start = 0;
+    uint64_t end = 0;
+
+    if (chunk >= pc->num_chunks) {
+	return 0;
+    }
+
+    rdtscll(start);
+
+    while (!pc->present[chunk]) {
+	if (pc->failed) {
+	    return -1;
+	}
+
+	// the loader takes one wanted chunk at a time, keep asking until ours is taken
+	if (pc->wanted < 0) {
+	    pc->wanted = chunk;
+	}
+
+	V3_Yield();
+    }
+
+    rdtscll(end);
+
+    pc->fault_waits++;
+    pc->fault_wait_cycles += end - start;
+
+    return 0;
+}
+
+
+int v3_init_postcopy(struct v3_vm_info * vm) {
+    struct v3_postcopy_state * pc = &(vm->postcopy);
+
+    memset(pc, 0, sizeof(struct v3_postcopy_state));
+
+    return v3_lock_init(&(pc->lock));
+}
+
+
+void v3_deinit_postcopy(struct v3_vm_info * vm) {
+    struct v3_postcopy_state * pc = &(vm->postcopy);
+    struct v3_chkpt * chkpt = NULL;
+
+    if (pc->present) {
+	pc->abort = 1;
+
+	// The loader may be blocked in the store on a peer that is gone,
+	// so break its stream. It cannot close the checkpoint meanwhile.
+	v3_lock(pc->lock);
+	chkpt = pc->chkpt;
+	pc->aborting = (chkpt != NULL);
+	v3_unlock(pc->lock);
+
+	if (chkpt) {
+	    if (chkpt->interface->abort) {
+		chkpt->interface->abort(chkpt->store_data);
+	    }
+
+	    pc->aborting = 0;
+	}
+
+	while (!pc->done) {
+	    V3_Yield();
+	}
+
+	V3_VFree((void *)pc->present);
+	pc->present = NULL;
+	pc->active = 0;
+    }
+
+    v3_lock_deinit(&(pc->lock));
+}
+
+
+/*
+ * Lazy memory (V3_CHKPT_OPT_LAZY_MEM)
+ *
+ * A save writes a "memory_lazy" context with the chunk size and count,
+ * and then each chunk in a context of its own ("memory_chunk<n>", tag
+ * "chunk"), so that any chunk can be read without reading the others.
+ * With the file keyed stream, each context is a file in the checkpoint
+ * directory, which serves as the index.
+ *
+ * A load restores everything but memory, starts a loader thread, and
+ * returns. The loader brings in wanted chunks first, and prefetches
+ * the rest in address order in between.
+ */
+
+static int save_lazy_chunk(struct v3_vm_info * vm, struct v3_chkpt * chkpt, uint64_t chunk_size, uint64_t chunk) {
+    void * addr = postcopy_chunk_addr(vm, chunk_size, chunk);
+    void * ctx = NULL;
+    char name[32];
+    int rc = 0;
+
+    sprintf(name, "memory_chunk%llu", chunk);
+
+    ctx = v3_chkpt_open_ctx(chkpt, name);
+
+    if (!ctx) {
+	PrintError(vm, VCORE_NONE, "Unable to open context %s\n", name);
+	return -1;
+    }
+
+    if (chkpt->pages) {
+	// each chunk must load on its own
+	v3_chkpt_pages_reset(chkpt->pages);
+	rc = v3_chkpt_pages_save(ctx, chkpt->pages, "chunk", (chunk * chunk_size) >> 12, chunk_size >> 12, addr);
+    } else {
+	rc = v3_chkpt_save(ctx, "chunk", chunk_size, addr);
+    }
+
+    v3_chkpt_close_ctx(ctx);
+
+    if (rc) {
+	PrintError(vm, VCORE_NONE, "Unable to save memory chunk %llu\n", chunk);
+	return -1;
+    }
+
+    return 0;
+}
+
+
+static int save_lazy_memory(struct v3_vm_info * vm, struct v3_chkpt * chkpt) {
+    extern uint64_t v3_mem_block_size;
+    uint64_t chunk_size = postcopy_chunk_size();
+    uint64_t num_chunks = (vm->mem_map.num_base_regions * v3_mem_block_size) / chunk_size;
+    void * ctx = NULL;
+    uint64_t i = 0;
+
+    if (v3_mem_block_size % chunk_size) { 
+	PrintError(vm, VCORE_NONE, "Lazy memory needs a memory block size that is a multiple of %llu\n", chunk_size);
+	return -1;
+    }
+
+    ctx = v3_chkpt_open_ctx(chkpt, "memory_lazy");
+
+    if (!ctx) {
+	PrintError(vm, VCORE_NONE, "Unable to open context to save memory\n");
+	return -1;
+    }
+
+    if (V3_CHKPT_SAVE(ctx, "chunk_size", chunk_size) ||
+	V3_CHKPT_SAVE(ctx, "num_chunks", num_chunks)) {
+	PrintError(vm, VCORE_NONE, "Unable to save memory layout\n");
+	v3_chkpt_close_ctx(ctx);
+	return -1;
+    }
+
+    v3_chkpt_close_ctx(ctx);
+
+    for (i = 0; i < num_chunks; i++) {
+	if (save_lazy_chunk(vm, chkpt, chunk_size, i)) {
+	    return -1;
+	}
+    }
+
+    return 0;
+}
+
+
+static int load_lazy_chunk(struct v3_vm_info * vm, struct v3_chkpt * chkpt, uint64_t chunk) {
+    struct v3_postcopy_state * pc = &(vm->postcopy);
+    void * addr = postcopy_chunk_addr(vm, pc->chunk_size, chunk);
+    void * ctx = NULL;
+    char name[32];
+    int rc = 0;
+
+    sprintf(name, "memory_chunk%llu", chunk);
+
+    ctx = v3_chkpt_open_ctx(chkpt, name);
+
+    if (!ctx) {
+	PrintError(vm, VCORE_NONE, "Unable to open context %s\n", name);
+	return -1;
+    }
+
+    if (chkpt->pages) {
+	rc = v3_chkpt_pages_load(ctx, chkpt->pages, "chunk", (chunk * pc->chunk_size) >> 12, pc->chunk_size >> 12, addr);
+    } else {
+	rc = v3_chkpt_load(ctx, "chunk", pc->chunk_size, addr);
+    }
+
+    v3_chkpt_close_ctx(ctx);
+
+    return rc;
+}
+
+
+static int lazy_loader(void * arg) {
+    struct v3_chkpt * chkpt = arg;
+    struct v3_vm_info * vm = chkpt->vm;
+    struct v3_postcopy_state * pc = &(vm->postcopy);
+    uint64_t next = 0;
+    uint64_t start = 0;
+    uint64_t end = 0;
+
+    rdtscll(start);
+
+    while (pc->chunks_received < pc->num_chunks) {
+	sint64_t wanted = pc->wanted;
+	uint64_t chunk = 0;
+
+	if (pc->abort) {
+	    pc->failed = 1;
+	    break;
+	}
+
+	if ((wanted >= 0) && (wanted < pc->num_chunks) && !pc->present[wanted]) {
+	    chunk = wanted;
+	    pc->demand_loads++;
+	} else {
+	    while (pc->present[next]) {
+		next++;
+	    }
+
+	    chunk = next;
+	}
+
+	if (load_lazy_chunk(vm, chkpt, chunk)) {
+	    PrintError(vm, VCORE_NONE, "%s of memory chunk %llu failed\n", 
+		       pc->migration ? "Post-copy" : "Lazy load", chunk);
+	    pc->failed = 1;
+	    break;
+	}
+
+	// the contents must be in place before anyone sees the chunk as present
+	__asm__ __volatile__ ("" : : : "memory");
+
+	pc->present[chunk] = 1;
+	pc->chunks_received++;
+
+	if (pc->wanted == chunk) {
+	    pc->wanted = -1;
+	}
+    }
+
+    rdtscll(end);
+
+    v3_lock(pc->lock);
+    pc->chkpt = NULL;
+    v3_unlock(pc->lock);
+
+    // v3_deinit_postcopy may still be aborting the store
+    while (pc->aborting) {
+	V3_Yield();
+    }
+
+    chkpt_close(chkpt);
+
+    if (!pc->failed) {
+	pc->active = 0;
+
+	V3_Print(vm, VCORE_NONE, "%s complete: %llu chunks in %llu cycles, %llu on demand, %llu lookups waited (%llu cycles)\n",
+		 pc->migration ? "Post-copy" : "Lazy load",
+		 pc->chunks_received, end - start, pc->demand_loads, pc->fault_waits, pc->fault_wait_cycles);
+    }
+
+    pc->done = 1;
+
+    return 0;
+}
+
+
+// On success the loader thread owns the checkpoint and closes it
+static int load_lazy_memory(struct v3_vm_info * vm, struct v3_chkpt * chkpt) {
+    extern uint64_t v3_mem_block_size;
+    struct v3_postcopy_state * pc = &(vm->postcopy);
+    void * ctx = NULL;
+    uint64_t chunk_size = 0;
+    uint64_t num_chunks = 0;
+
+    if (pc->active) {
+	PrintError(vm, VCORE_NONE, "Memory of this VM is still arriving from an earlier post-copy or lazy load\n");
+	return -1;
+    }
+
+    ctx = v3_chkpt_open_ctx(chkpt, "memory_lazy");
+
+    if (!ctx) {
+	PrintError(vm, VCORE_NONE, "Unable to open context for memory load\n");
+	return -1;
+    }
+
+    if (V3_CHKPT_LOAD(ctx, "chunk_size", chunk_size) ||
+	V3_CHKPT_LOAD(ctx, "num_chunks", num_chunks)) {
+	PrintError(vm, VCORE_NONE, "Unable to load memory layout\n");
+	v3_chkpt_close_ctx(ctx);
+	return -1;
+    }
+
+    v3_chkpt_close_ctx(ctx);
+
+    if ((chunk_size == 0) || (v3_mem_block_size % chunk_size) || 
+	(num_chunks != (vm->mem_map.num_base_regions * v3_mem_block_size) / chunk_size)) {
+	PrintError(vm, VCORE_NONE, "Memory layout (%llu chunks of %llu bytes) does not match this VM\n",
+		   num_chunks, chunk_size);
+	return -1;
+    }
+
+    if (postcopy_start(vm, chunk_size, num_chunks) == -1) {
+	return -1;
+    }
+
+    pc->chkpt = chkpt;
+
+    if (!V3_CREATE_AND_START_THREAD(lazy_loader, chkpt, "v3-lazy-mem", 0)) {
+	PrintError(vm, VCORE_NONE, "Cannot start lazy memory loader\n");
+	pc->chkpt = NULL;
+	pc->active = 0;
+	pc->done = 1;
+	return -1;
+    }
+
+    PrintDebug(vm, VCORE_NONE, "Memory will be loaded lazily, %llu chunks\n", num_chunks);
+
+    return 0;
+}
+
+
+#ifdef V3_CONFIG_LIVE_MIGRATION
+
+struct mem_migration_state {
+    struct v3_vm_info *vm;
+    struct v3_bitmap  modified_pages; 
+};
+
+static int shadow_paging_callback(struct guest_info *core, 
+				  struct v3_shdw_pg_event *event,
+				  void      *priv_data)
+{
+    struct mem_migration_state *m = (struct mem_migration_state *)priv_data;
+    
+    if (event->event_type==SHADOW_PAGEFAULT &&
+	event->event_order==SHADOW_PREIMPL &&
+	event->error_code.write) { // Note, assumes VTLB behavior where we will see the write even if preceded by a read
+	addr_t gpa;
+	if (!v3_gva_to_gpa(core,event->gva,&gpa)) {
+	    // write to this page
+	    v3_bitmap_set(&(m->modified_pages),gpa>>12);
+	} else {
+	    // no worries, this isn't physical memory
+	}
+    } else {
+	// we don't care about other events
+    }
+    
+    return 0;
+}
+
+
+/*
+static int nested_paging_callback(struct guest_info *core, 
+				  struct v3_nested_pg_event *event,
+				  void      *priv_data)
+{
+    struct mem_migration_state *m = (struct mem_migration_state *)priv_data;
+    
+    if (event->event_type==NESTED_PAGEFAULT &&
+	event->event_order==NESTED_PREIMPL &&
+	event->error_code.write) { // Assumes we will see a write after reads
+	if (event->gpa<core->vm_info->mem_size) { 
+	  v3_bitmap_set(&(m->modified_pages),(event->gpa)>>12);
+	} else {
+	  // no worries, this isn't physical memory
+	}
+    } else {
+      // we don't care about other events
+    }
+    
+    return 0;
+}
+*/	
+
+
+static struct mem_migration_state *start_page_tracking(struct v3_vm_info *vm)
+{
+    struct mem_migration_state *m;
+    int i;
+
+    m = (struct mem_migration_state *)V3_Malloc(sizeof(struct mem_migration_state));
+
+    if (!m) { 
+	PrintError(vm, VCORE_NONE, "Cannot allocate\n");
+	return NULL;
+    }
+
+    m->vm=vm;
+    
+    if (v3_bitmap_init(&(m->modified_pages),vm->mem_size >> 12) == -1) { 
+	PrintError(vm, VCORE_NONE, "Failed to initialize modified_pages bit vector");
+	V3_Free(m);
+    }
+
+    // We assume that the migrator has already verified that all cores are
+    // using the identical model (shadow or nested)
+    // This must not change over the execution of the migration
+
+    if (vm->cores[0].shdw_pg_mode==SHADOW_PAGING) { 
+      v3_register_shadow_paging_event_callback(vm,shadow_paging_callback,m);
+
+      for (i=0;i<vm->num_cores;i++) {
+	v3_invalidate_shadow_pts(&(vm->cores[i]));
+      }
+    } else if (vm->cores[0].shdw_pg_mode==NESTED_PAGING) { 
+	//v3_register_nested_paging_event_callback(vm,nested_paging_callback,m);
+      
+      for (i=0;i<vm->num_cores;i++) {
+	//v3_invalidate_nested_addr_range(&(vm->cores[i]),0,vm->mem_size-1);
+      }
+    } else {
+      PrintError(vm, VCORE_NONE, "Unsupported paging mode\n");
+      v3_bitmap_deinit(&(m->modified_pages));
+      V3_Free(m);
+      return 0;
+    }
+    
+    // and now we should get callbacks as writes happen
+
+    return m;
+}
+
+static void stop_page_tracking(struct mem_migration_state *m)
+{
+  if (m->vm->cores[0].shdw_pg_mode==SHADOW_PAGING) { 
+    v3_unregister_shadow_paging_event_callback(m->vm,shadow_paging_callback,m);
+  } else {
+    //v3_unregister_nested_paging_event_callback(m->vm,nested_paging_callback,m);
+  }
+    
+  v3_bitmap_deinit(&(m->modified_pages));
+  
+  V3_Free(m);
+}
+
+	    
+		
+							    
+
+
+//
+// Find the next run of dirty pages at or after *page
+// Returns
+//  negative: error
+//  zero: run found in [*page, *page + *num_pages), backed by *host_addr
+//  positive: no more dirty pages
+static int next_dirty_run(struct v3_vm_info * vm, 
+			  struct v3_bitmap * bitmap, 
+			  uint64_t * page,
+			  uint64_t * num_pages,
+			  addr_t * host_addr) {
+    int page_size_bytes = 1 << 12; // assuming 4k pages right now
+    struct v3_mem_region * region = NULL;
+    uint64_t i = *page;
+    uint64_t end = 0;
+
+    // find the start, skipping clean bytes a byte at a time
+    while (i < bitmap->num_bits) {
+	if (((i % 8) == 0) && (bitmap->bits[i / 8] == 0)) {
+	    i += 8;
+	    continue;
+	}
+
+	if (v3_bitmap_check(bitmap, i)) {
+	    break;
+	}
+
+	i++;
+    }
+
+    if (i >= bitmap->num_bits) {
+	return 1;
+    }
+
+    region = v3_get_base_region(vm, page_size_bytes * i);
+
+    if (!region) { 
+	PrintError(vm, VCORE_NONE, "Failed to find base region for page %llu\n", i);
+	return -1;
+    }
+
+    // extend it while pages are dirty and in the same region
+    end = i + 1;
+
+    while ((end < bitmap->num_bits) && 
+	   ((end - i) < INC_MAX_RUN_PAGES) &&
+	   ((end * page_size_bytes) < region->guest_end) &&
+	   v3_bitmap_check(bitmap, end)) {
+	end++;
+    }
+
+    *page = i;
+    *num_pages = end - i;
+    *host_addr = (addr_t)V3_VAddr((void *)region->host_addr) + (page_size_bytes * i) - region->guest_start;
+
+    return 0;
+}
+
+
+static int save_xbzrle_run(struct v3_chkpt_ctx * ctx, struct v3_chkpt_xbzrle * x, char * tag,
+			   uint64_t page, uint64_t num_pages, void * host_addr) {
+    sint64_t enc_len = v3_chkpt_xbzrle_encode(x, page, num_pages, host_addr);
+    uint64_t len = enc_len;
+    char len_tag[40];
+
+    if (enc_len < 0) {
+	return -1;
+    }
+
+    sprintf(len_tag, "%s.len", tag);
+
+    if (V3_CHKPT_SAVE(ctx, len_tag, len) ||
+	v3_chkpt_save(ctx, tag, len, x->buf)) {
+	return -1;
+    }
+
+    return 0;
+}
+
+
+static int load_xbzrle_run(struct v3_chkpt_ctx * ctx, struct v3_chkpt_xbzrle * x, char * tag,
+			   uint64_t num_pages, void * host_addr) {
+    uint64_t len = 0;
+    char len_tag[40];
+
+    sprintf(len_tag, "%s.len", tag);
+
+    if (V3_CHKPT_LOAD(ctx, len_tag, len)) {
+	return -1;
+    }
+
+    if (len > x->buf_len) {
+	PrintError(VM_NONE, VCORE_NONE, "Delta encoded run %s is too long (%llu bytes)\n", tag, len);
+	return -1;
+    }
+
+    if (v3_chkpt_load(ctx, tag, len, x->buf)) {
+	return -1;
+    }
+
+    return v3_chkpt_xbzrle_decode(x, num_pages, host_addr, len);
+}
+
+
+//
+// Returns
+//  negative: error
+//  zero: done with this round
+static int save_inc_memory(struct v3_vm_info * vm, 
+                           struct v3_bitmap * mod_pgs_to_send, 
+                           struct v3_chkpt * chkpt,
+			   int round) {
+    int page_size_bytes = 1 << 12; // assuming 4k pages right now
+    void * ctx = NULL;
+    uint32_t version = INC_MEM_VERSION;
+    uint64_t page = 0;
+    uint64_t num_pages = 0;
+    addr_t host_addr = 0;
+    char name[32];
+    int bitmap_num_bytes = (mod_pgs_to_send->num_bits / 8) 
+                           + ((mod_pgs_to_send->num_bits % 8) > 0);
+    int rc = 0;
+
+   
+    PrintDebug(vm, VCORE_NONE, "Saving incremental memory.\n");
+
+    sprintf(name, "memory_inc%d", round);
+
+    ctx = v3_chkpt_open_ctx(chkpt, name);
+
+    if (!ctx) { 
+	PrintError(vm, VCORE_NONE, "Cannot open context for incremental memory\n");
+	return -1;
+    }
+
+    if (V3_CHKPT_SAVE(ctx, "version", version)) {
+	PrintError(vm, VCORE_NONE, "Unable to write incremental memory version\n");
+	v3_chkpt_close_ctx(ctx);
+	return -1;
+    }
+
+    if (v3_chkpt_save(ctx,
+		      "memory_bitmap_bits",
+		      bitmap_num_bytes,
+		      mod_pgs_to_send->bits)) {
+	PrintError(vm, VCORE_NONE, "Unable to write all of the dirty memory bitmap\n");
+	v3_chkpt_close_ctx(ctx);
+	return -1;
+    }
 
     PrintDebug(vm, VCORE_NONE, "Sent bitmap bits.\n");
 
-    // Dirty memory pages are sent in bitmap order
-    for (i = 0; i < mod_pgs_to_send->num_bits; i++) {
-        if (v3_bitmap_check(mod_pgs_to_send, i)) {
-	    struct v3_mem_region *region = v3_get_base_region(vm,page_size_bytes * i);
-	    if (!region) { 
-		PrintError(vm, VCORE_NONE, "Failed to find base region for page %d\n",i);
-		return -1;
-	    }
-	    // PrintDebug(vm, VCORE_NONE, "Sending memory page %d.\n",i);
-            ctx = v3_chkpt_open_ctx(chkpt, "memory_page");
-	    if (!ctx) { 
-		PrintError(vm, VCORE_NONE, "Unable to open context to send memory page\n");
-		return -1;
-	    }
-            if (v3_chkpt_save(ctx, 
-			      "memory_page", 
-			      page_size_bytes,
-			      (void*)(region->host_addr + page_size_bytes * i - region->guest_start))) {
-		PrintError(vm, VCORE_NONE, "Unable to send a memory page\n");
-		v3_chkpt_close_ctx(ctx);
-		return -1;
-	    }
-	    
-            v3_chkpt_close_ctx(ctx);
-        }
+    if (chkpt->pages) {
+	// pages sent in earlier rounds may have changed since
+	v3_chkpt_pages_reset(chkpt->pages);
+    }
+
+    // Dirty memory pages are sent in bitmap order, a run at a time
+    while ((rc = next_dirty_run(vm, mod_pgs_to_send, &page, &num_pages, &host_addr)) == 0) {
+
+	sprintf(name, "run%llu", page);
+
+	if (chkpt->xbzrle) {
+	    rc = save_xbzrle_run(ctx, chkpt->xbzrle, name, page, num_pages, (void *)host_addr);
+	} else if (chkpt->pages) {
+	    rc = v3_chkpt_pages_save(ctx, chkpt->pages, name, page, num_pages, (void *)host_addr);
+	} else {
+	    rc = v3_chkpt_save(ctx, name, num_pages * page_size_bytes, (void *)host_addr);
+	}
+
+	if (rc) {
+	    PrintError(vm, VCORE_NONE, "Unable to send memory pages %llu-%llu\n", page, page + num_pages - 1);
+	    v3_chkpt_close_ctx(ctx);
+	    return -1;
+	}
+
+	page += num_pages;
     } 
+
+    v3_chkpt_close_ctx(ctx);
     
-    return 0;
+    return (rc < 0) ? -1 : 0;
 }
 
 
@@ -604,19 +1760,40 @@ static int save_inc_memory(struct v3_vm_info * vm,
 //  positive: ok, and also done
 static int load_inc_memory(struct v3_vm_info * vm, 
                            struct v3_bitmap * mod_pgs,
-                           struct v3_chkpt * chkpt) {
+                           struct v3_chkpt * chkpt,
+			   int round) {
     int page_size_bytes = 1 << 12; // assuming 4k pages right now
     void * ctx = NULL;
-    int i = 0; 
+    uint32_t version = 0;
+    uint64_t page = 0;
+    uint64_t num_pages = 0;
+    addr_t host_addr = 0;
+    char name[32];
     bool empty_bitmap = true;
     int bitmap_num_bytes = (mod_pgs->num_bits / 8) 
                            + ((mod_pgs->num_bits % 8) > 0);
+    int rc = 0;
+
 
+    sprintf(name, "memory_inc%d", round);
 
-    ctx = v3_chkpt_open_ctx(chkpt, "memory_bitmap_bits");
+    ctx = v3_chkpt_open_ctx(chkpt, name);
 
     if (!ctx) { 
-	PrintError(vm, VCORE_NONE, "Cannot open context to receive memory bitmap\n");
+	PrintError(vm, VCORE_NONE, "Cannot open context to receive incremental memory\n");
+	return -1;
+    }
+
+    if (V3_CHKPT_LOAD(ctx, "version", version)) {
+	PrintError(vm, VCORE_NONE, "Did not receive incremental memory version\n");
+	v3_chkpt_close_ctx(ctx);
+	return -1;
+    }
+
+    if (version != INC_MEM_VERSION) {
+	PrintError(vm, VCORE_NONE, "Incremental memory version %u is not supported (expected %u)\n", 
+		   version, INC_MEM_VERSION);
+	v3_chkpt_close_ctx(ctx);
 	return -1;
     }
 
@@ -629,45 +1806,315 @@ static int load_inc_memory(struct v3_vm_info * vm,
 	return -1;
     }
     
+    if (chkpt->pages) {
+	v3_chkpt_pages_reset(chkpt->pages);
+    }
+
+    // Receive also follows bitmap order
+    while ((rc = next_dirty_run(vm, mod_pgs, &page, &num_pages, &host_addr)) == 0) {
+	empty_bitmap = false;
+
+	sprintf(name, "run%llu", page);
+
+	if (chkpt->xbzrle) {
+	    rc = load_xbzrle_run(ctx, chkpt->xbzrle, name, num_pages, (void *)host_addr);
+	} else if (chkpt->pages) {
+	    rc = v3_chkpt_pages_load(ctx, chkpt->pages, name, page, num_pages, (void *)host_addr);
+	} else {
+	    rc = v3_chkpt_load(ctx, name, num_pages * page_size_bytes, (void *)host_addr);
+	}
+
+	if (rc) {
+	    PrintError(vm, VCORE_NONE, "Did not receive memory pages %llu-%llu\n", page, page + num_pages - 1);
+	    v3_chkpt_close_ctx(ctx);
+	    return -1;
+	}
+
+	page += num_pages;
+    } 
+
+    v3_chkpt_close_ctx(ctx);
+
+    if (rc < 0) {
+	return -1;
+    }
+    
+    if (empty_bitmap) {
+        // signal end of receiving pages
+        PrintDebug(vm, VCORE_NONE, "Finished receiving pages.\n");
+	return 1;
+    } else {
+	// need to run again
+	return 0;
+    }
+
+}
+
+
+/*
+ * Incremental checkpoints (V3_CHKPT_OPT_INCREMENTAL)
+ *
+ * The first incremental save of a VM writes all of its memory and starts
+ * page tracking. Each later one writes only the pages dirtied since the
+ * previous save, in the incremental memory format ("memory_inc0"), and
+ * restarts tracking. A "chain" context records the generation (0 for a
+ * full save) and the URL of the previous checkpoint of the chain.
+ *
+ * Loading follows the parents back to the base, loads its memory, applies
+ * the deltas oldest first, and then loads everything else from the newest.
+ * All checkpoints of a chain must be in the same store. 
+ *
+ * Tracking relies on shadow paging events, so with nested paging every
+ * save is a full one. Any load of memory ends the chain.
+ */
+#define CHAIN_MAX_DEPTH  64
+#define CHAIN_MAX_URL    256
+
+struct chkpt_chain {
+    struct mem_migration_state * track;   // NULL if the next save must be full
+    uint64_t generation;                  // of the last save
+    char url[CHAIN_MAX_URL];              // of the last save
+};
+
+
+static void reset_chain(struct v3_vm_info * vm) {
+    struct chkpt_chain * c = vm->chkpt_chain;
+
+    if (!c) {
+	return;
+    }
+
+    if (c->track) {
+	stop_page_tracking(c->track);
+	c->track = NULL;
+    }
+
+    c->generation = 0;
+    c->url[0] = 0;
+}
+
+
+void v3_chkpt_free_chain(struct v3_vm_info * vm) {
+    reset_chain(vm);
+
+    if (vm->chkpt_chain) {
+	V3_Free(vm->chkpt_chain);
+	vm->chkpt_chain = NULL;
+    }
+}
+
+
+static int save_chain(struct v3_chkpt * chkpt, uint64_t generation, char * parent) {
+    uint32_t parent_len = strlen(parent) + 1;
+    void * ctx = NULL;
+    int rc = 0;
+
+    ctx = v3_chkpt_open_ctx(chkpt, "chain");
+
+    if (!ctx) {
+	PrintError(chkpt->vm, VCORE_NONE, "Unable to open context to save checkpoint chain\n");
+	return -1;
+    }
+
+    if (V3_CHKPT_SAVE(ctx, "generation", generation) ||
+	V3_CHKPT_SAVE(ctx, "parent_len", parent_len) ||
+	v3_chkpt_save(ctx, "parent", parent_len, parent)) {
+	PrintError(chkpt->vm, VCORE_NONE, "Unable to save checkpoint chain\n");
+	rc = -1;
+    }
+
+    v3_chkpt_close_ctx(ctx);
+
+    return rc;
+}
+
+
+// parent must hold CHAIN_MAX_URL bytes
+static int load_chain(struct v3_chkpt * chkpt, uint64_t * generation, char * parent) {
+    uint32_t parent_len = 0;
+    void * ctx = NULL;
+    int rc = 0;
+
+    ctx = v3_chkpt_open_ctx(chkpt, "chain");
+
+    if (!ctx) {
+	PrintError(chkpt->vm, VCORE_NONE, "Unable to open checkpoint chain, was this an incremental save?\n");
+	return -1;
+    }
+
+    if (V3_CHKPT_LOAD(ctx, "generation", *generation) ||
+	V3_CHKPT_LOAD(ctx, "parent_len", parent_len) ||
+	(parent_len == 0) || (parent_len > CHAIN_MAX_URL) ||
+	v3_chkpt_load(ctx, "parent", parent_len, parent)) {
+	PrintError(chkpt->vm, VCORE_NONE, "Unable to load checkpoint chain\n");
+	rc = -1;
+    }
+
+    parent[CHAIN_MAX_URL - 1] = 0;
+
     v3_chkpt_close_ctx(ctx);
 
-    // Receive also follows bitmap order
-    for (i = 0; i < mod_pgs->num_bits; i ++) {
-        if (v3_bitmap_check(mod_pgs, i)) {
-	    struct v3_mem_region *region = v3_get_base_region(vm,page_size_bytes * i);
-	    if (!region) { 
-		PrintError(vm, VCORE_NONE, "Failed to find base region for page %d\n",i);
-		return -1;
-	    }
-            //PrintDebug(vm, VCORE_NONE, "Loading page %d\n", i);
-            empty_bitmap = false;
-            ctx = v3_chkpt_open_ctx(chkpt, "memory_page");
-	    if (!ctx) { 
-		PrintError(vm, VCORE_NONE, "Cannot open context to receive memory page\n");
-		return -1;
-	    }
-	    
-            if (v3_chkpt_load(ctx, 
-			      "memory_page", 
-			      page_size_bytes,
-			      (void*)(region->host_addr + page_size_bytes * i - region->guest_start))) {
-		PrintError(vm, VCORE_NONE, "Did not receive all of memory page\n");
-		v3_chkpt_close_ctx(ctx);
-		return -1;
-	    }
-            v3_chkpt_close_ctx(ctx);
-        }
-    } 
-    
-    if (empty_bitmap) {
-        // signal end of receiving pages
-        PrintDebug(vm, VCORE_NONE, "Finished receiving pages.\n");
-	return 1;
-    } else {
-	// need to run again
-	return 0;
+    return rc;
+}
+
+
+static int save_chain_memory(struct v3_vm_info * vm, struct v3_chkpt * chkpt, char * url) {
+    struct chkpt_chain * c = vm->chkpt_chain;
+    uint64_t generation = 0;
+    int full = 0;
+    int rc = 0;
+    int i = 0;
+
+    if (strlen(url) >= CHAIN_MAX_URL) {
+	PrintError(vm, VCORE_NONE, "URL %s is too long for an incremental checkpoint\n", url);
+	return -1;
+    }
+
+    if (!c) {
+	c = V3_Malloc(sizeof(struct chkpt_chain));
+
+	if (!c) {
+	    PrintError(vm, VCORE_NONE, "Cannot allocate checkpoint chain\n");
+	    return -1;
+	}
+
+	memset(c, 0, sizeof(struct chkpt_chain));
+	vm->chkpt_chain = c;
+    }
+
+    // Saving over the parent leaves nothing to be incremental against
+    full = (c->track == NULL) || (c->generation + 1 >= CHAIN_MAX_DEPTH) || 
+	(strcmp(url, c->url) == 0);
+
+    if (full) {
+	rc = save_memory(vm, chkpt);
+    } else {
+	generation = c->generation + 1;
+	rc = save_inc_memory(vm, &(c->track->modified_pages), chkpt, 0);
+    }
+
+    PrintDebug(vm, VCORE_NONE, "Incremental checkpoint %s: generation %llu, %d dirty pages\n", url, generation, 
+	       full ? -1 : v3_bitmap_count(&(c->track->modified_pages)));
+
+    if ((rc == -1) || (save_chain(chkpt, generation, full ? "" : c->url) == -1)) {
+	PrintError(vm, VCORE_NONE, "Unable to save incremental memory, the next save will be full\n");
+	reset_chain(vm);
+	return -1;
+    }
+
+    if (c->track) {
+	stop_page_tracking(c->track);
+	c->track = NULL;
+    }
+
+    // The VM is stopped, so nothing is written before tracking restarts
+    for (i = 0; i < vm->num_cores; i++) {
+	if (vm->cores[i].shdw_pg_mode != SHADOW_PAGING) {
+	    break;
+	}
+    }
+
+    if (i == vm->num_cores) {
+	c->track = start_page_tracking(vm);
+    }
+
+    c->generation = generation;
+    strcpy(c->url, url);
+
+    return 0;
+}
+
+
+static int load_chain_memory(struct v3_vm_info * vm, struct v3_chkpt * chkpt, 
+			     char * store, char * url, v3_chkpt_options_t opts) {
+    char (*urls)[CHAIN_MAX_URL] = NULL;
+    struct v3_chkpt * link = NULL;
+    struct v3_bitmap mod_pgs;
+    uint64_t generation = 0;
+    uint64_t expected = 0;
+    int depth = 0;
+    int ret = -1;
+    int i = 0;
+
+    urls = V3_Malloc(CHAIN_MAX_DEPTH * CHAIN_MAX_URL);
+
+    if (!urls) {
+	PrintError(vm, VCORE_NONE, "Cannot allocate checkpoint chain\n");
+	return -1;
+    }
+
+    if (v3_bitmap_init(&mod_pgs, vm->mem_size >> 12) == -1) {
+	PrintError(vm, VCORE_NONE, "Could not intialize bitmap.\n");
+	V3_Free(urls);
+	return -1;
+    }
+
+    // urls[i] is the parent of urls[i - 1]
+    strncpy(urls[0], url, CHAIN_MAX_URL - 1);
+    urls[0][CHAIN_MAX_URL - 1] = 0;
+
+    if (load_chain(chkpt, &generation, urls[1]) == -1) {
+	goto out;
+    }
+
+    while (generation > 0) {
+	depth++;
+	expected = generation - 1;
+
+	if (depth >= CHAIN_MAX_DEPTH - 1) {
+	    PrintError(vm, VCORE_NONE, "Checkpoint chain of %s is too long\n", url);
+	    goto out;
+	}
+
+	if (!(link = chkpt_open(vm, store, urls[depth], LOAD, opts))) {
+	    PrintError(vm, VCORE_NONE, "Cannot open checkpoint %s of the chain\n", urls[depth]);
+	    goto out;
+	}
+
+	ret = load_chain(link, &generation, urls[depth + 1]);
+
+	chkpt_close(link);
+
+	if ((ret == -1) || (generation != expected)) {
+	    PrintError(vm, VCORE_NONE, "Checkpoint %s is not generation %llu of the chain\n", urls[depth], expected);
+	    ret = -1;
+	    goto out;
+	}
+    }
+
+    PrintDebug(vm, VCORE_NONE, "Loading %d deltas on top of base %s\n", depth, urls[depth]);
+
+    // base first, then deltas towards the newest, which is already open
+    for (i = depth; i >= 0; i--) {
+	link = (i == 0) ? chkpt : chkpt_open(vm, store, urls[i], LOAD, opts);
+
+	if (!link) {
+	    PrintError(vm, VCORE_NONE, "Cannot open checkpoint %s of the chain\n", urls[i]);
+	    ret = -1;
+	    goto out;
+	}
+
+	if (i == depth) {
+	    ret = load_memory(vm, link);
+	} else {
+	    ret = (load_inc_memory(vm, &mod_pgs, link, 0) < 0) ? -1 : 0;
+	}
+
+	if (link != chkpt) {
+	    chkpt_close(link);
+	}
+
+	if (ret == -1) {
+	    PrintError(vm, VCORE_NONE, "Unable to load memory of %s\n", urls[i]);
+	    goto out;
+	}
     }
 
+ out:
+    v3_bitmap_deinit(&mod_pgs);
+    V3_Free(urls);
+
+    return ret;
 }
 
 #endif
@@ -1143,7 +2590,7 @@ int v3_chkpt_save_vm(struct v3_vm_info * vm, char * store, char * url, v3_chkpt_
     int i = 0;
 
 
-    chkpt = chkpt_open(vm, store, url, SAVE);
+    chkpt = chkpt_open(vm, store, url, SAVE, opts);
 
     if (chkpt == NULL) {
 	PrintError(vm, VCORE_NONE, "Error creating checkpoint store for url %s\n",url);
@@ -1156,7 +2603,22 @@ int v3_chkpt_save_vm(struct v3_vm_info * vm, char * store, char * url, v3_chkpt_
     }
 
     if (!(opts & V3_CHKPT_OPT_SKIP_MEM)) {
-      if ((ret = save_memory(vm, chkpt)) == -1) {
+      if (opts & V3_CHKPT_OPT_INCREMENTAL) {
+#ifdef V3_CONFIG_LIVE_MIGRATION
+	ret = save_chain_memory(vm, chkpt, url);
+#else
+	PrintError(vm, VCORE_NONE, "Incremental checkpoints need page tracking (LIVE_MIGRATION)\n");
+	ret = -1;
+#endif
+      } else if (opts & V3_CHKPT_OPT_LAZY_MEM) {
+	ret = save_lazy_memory(vm, chkpt);
+      } else if (opts & V3_CHKPT_OPT_PARALLEL_MEM) {
+	ret = parallel_memory(vm, chkpt, SAVE, store_allows_parallel(store, url));
+      } else {
+	ret = save_memory(vm, chkpt);
+      }
+
+      if (ret == -1) {
 	PrintError(vm, VCORE_NONE, "Unable to save memory\n");
 	goto out;
       }
@@ -1191,7 +2653,10 @@ int v3_chkpt_save_vm(struct v3_vm_info * vm, char * store, char * url, v3_chkpt_
 	v3_lower_barrier(vm);
     }
 
-    chkpt_close(chkpt);
+    // buffered data may only fail to reach the store here
+    if (chkpt_close(chkpt) == -1) {
+	ret = -1;
+    }
 
     return ret;
 
@@ -1199,10 +2664,17 @@ int v3_chkpt_save_vm(struct v3_vm_info * vm, char * store, char * url, v3_chkpt_
 
 int v3_chkpt_load_vm(struct v3_vm_info * vm, char * store, char * url, v3_chkpt_options_t opts) {
     struct v3_chkpt * chkpt = NULL;
+    int lazy = (opts & V3_CHKPT_OPT_LAZY_MEM) && !(opts & V3_CHKPT_OPT_SKIP_MEM);
     int i = 0;
     int ret = 0;
+
+    // the loader will open chunk contexts in whatever order they are wanted
+    if (lazy && !store_allows_parallel(store, url)) {
+	PrintError(vm, VCORE_NONE, "Store %s cannot load memory lazily\n", store);
+	return -1;
+    }
     
-    chkpt = chkpt_open(vm, store, url, LOAD);
+    chkpt = chkpt_open(vm, store, url, LOAD, opts);
 
     if (chkpt == NULL) {
 	PrintError(vm, VCORE_NONE, "Error creating checkpoint store\n");
@@ -1214,8 +2686,28 @@ int v3_chkpt_load_vm(struct v3_vm_info * vm, char * store, char * url, v3_chkpt_
 	while (v3_raise_barrier(vm, NULL) == -1);
     }
 
+#ifdef V3_CONFIG_LIVE_MIGRATION
     if (!(opts & V3_CHKPT_OPT_SKIP_MEM)) {
-      if ((ret = load_memory(vm, chkpt)) == -1) {
+      // memory is about to change behind the tracking
+      reset_chain(vm);
+    }
+#endif
+
+    if (!(opts & V3_CHKPT_OPT_SKIP_MEM) && !lazy) {
+      if (opts & V3_CHKPT_OPT_INCREMENTAL) {
+#ifdef V3_CONFIG_LIVE_MIGRATION
+	ret = load_chain_memory(vm, chkpt, store, url, opts);
+#else
+	PrintError(vm, VCORE_NONE, "Incremental checkpoints need page tracking (LIVE_MIGRATION)\n");
+	ret = -1;
+#endif
+      } else if (opts & V3_CHKPT_OPT_PARALLEL_MEM) {
+	ret = parallel_memory(vm, chkpt, LOAD, store_allows_parallel(store, url));
+      } else {
+	ret = load_memory(vm, chkpt);
+      }
+
+      if (ret == -1) {
 	PrintError(vm, VCORE_NONE, "Unable to load memory\n");
 	goto out;
       }
@@ -1244,6 +2736,16 @@ int v3_chkpt_load_vm(struct v3_vm_info * vm, char * store, char * url, v3_chkpt_
       }
     }
 
+    if (lazy) {
+      // memory last, as from here on the loader owns the checkpoint
+      if ((ret = load_lazy_memory(vm, chkpt)) == -1) {
+	PrintError(vm, VCORE_NONE, "Unable to start lazy memory load\n");
+	goto out;
+      }
+
+      chkpt = NULL;
+    }
+
  out:
 
     /* Resume the guest if it was running and we didn't just trash the state*/
@@ -1259,7 +2761,9 @@ int v3_chkpt_load_vm(struct v3_vm_info * vm, char * store, char * url, v3_chkpt_
 	v3_lower_barrier(vm);
     }
 
-    chkpt_close(chkpt);
+    if (chkpt) {
+	chkpt_close(chkpt);
+    }
 
     return ret;
 
@@ -1271,6 +2775,321 @@ int v3_chkpt_load_vm(struct v3_vm_info * vm, char * store, char * url, v3_chkpt_
 #define MOD_THRESHOLD   200  // pages below which we declare victory
 #define ITER_THRESHOLD  32   // iters below which we declare victory
 
+/*
+ * Auto-converge
+ *
+ * Each round measures how fast the guest dirtied pages while the previous
+ * round was in flight and how fast we managed to send them. The final
+ * (paused) round starts once the remaining pages can be sent within
+ * V3_CONFIG_LIVE_MIGRATION_MAX_DOWNTIME at the transfer rate. If a round
+ * does not shrink the dirty set, every vcore is made to give up a
+ * growing share of its time on exit (v3_chkpt_throttle_core).
+ */
+#define CONVERGE_PCT          90     // a round keeping more than this % of the last is not shrinking
+#define THROTTLE_INITIAL_PCT  20
+#define THROTTLE_STEP_PCT     10
+#define THROTTLE_MAX_PCT      99
+#define THROTTLE_SLICE_US     10000  // vcore time is given up in this granularity
+
+
+void v3_chkpt_throttle_core(struct guest_info * core) {
+    uint32_t pct = core->vm_info->migrate_throttle_pct;
+    uint64_t run_cycles = (((uint64_t)V3_CPU_KHZ() * THROTTLE_SLICE_US) / 1000) * (100 - pct) / 100;
+    uint64_t now = 0;
+
+    rdtscll(now);
+
+    if (now - core->migrate_throttle_tsc < run_cycles) {
+	return;
+    }
+
+    v3_yield(core, (THROTTLE_SLICE_US * pct) / 100);
+
+    rdtscll(core->migrate_throttle_tsc);
+}
+
+// pages per second
+static uint64_t page_rate(uint64_t pages, uint64_t cycles) {
+    if (cycles == 0) {
+	return 0;
+    }
+
+    return (pages * V3_CPU_KHZ() * 1000) / cycles;
+}
+
+
+/*
+ * Post-copy migration (V3_CHKPT_OPT_POSTCOPY)
+ *
+ * The sender pauses the VM and sends devices, header, and cores first,
+ * followed by a "postcopy_mem" context holding the chunk size and the
+ * chunk count.
+ *
+ * The receiver loads the state, marks every chunk not present, and
+ * hands the stream to the lazy loader, so the VM can be started right
+ * away. The loader opens chunks just as it would in a lazy checkpoint
+ * ("memory_chunk<n>"), wanted chunks first and the rest in address
+ * order. The opens travel back to the sender as requests (keyed stream
+ * next_request), and the sender serves each requested chunk as soon as
+ * it reads it, so a base region lookup waiting on a chunk
+ * (v3_postcopy_wait) waits for about one round trip, not for the
+ * chunks before it. This needs a store that carries requests back,
+ * which today means a "pnet:" keyed stream.
+ */
+
+// chunk number from a context name the receiver asked for, -1 if it is not a chunk
+static sint64_t postcopy_requested_chunk(char * name, uint64_t num_chunks) {
+    char * prefix = "memory_chunk";
+    uint64_t chunk = 0;
+    int i = 0;
+
+    if (strncmp(name, prefix, strlen(prefix)) != 0) {
+	return -1;
+    }
+
+    name += strlen(prefix);
+
+    if (*name == 0) {
+	return -1;
+    }
+
+    for (i = 0; name[i] != 0; i++) {
+	if ((name[i] < '0') || (name[i] > '9') || (chunk >= num_chunks)) {
+	    return -1;
+	}
+
+	chunk = (chunk * 10) + (name[i] - '0');
+    }
+
+    if (chunk >= num_chunks) {
+	return -1;
+    }
+
+    return chunk;
+}
+
+
+static int postcopy_send(struct v3_vm_info * vm, struct v3_chkpt * chkpt, v3_chkpt_options_t opts) {
+    extern uint64_t v3_mem_block_size;
+    uint64_t chunk_size = postcopy_chunk_size();
+    uint64_t num_chunks = (vm->mem_map.num_base_regions * v3_mem_block_size) / chunk_size;
+    uint8_t * sent = NULL;
+    uint64_t num_sent = 0;
+    void * ctx = NULL;
+    char name[32];
+    uint64_t i = 0;
+    int ret = 0;
+
+    if (v3_mem_block_size % chunk_size) { 
+	PrintError(vm, VCORE_NONE, "Post-copy needs a memory block size that is a multiple of %llu\n", chunk_size);
+	return -1;
+    }
+
+    if (!chkpt->interface->next_request || 
+	chkpt->interface->next_request(chkpt->store_data, NULL, 0)) {
+	PrintError(vm, VCORE_NONE, "Post-copy needs a store that carries requests back from the receiver (pnet: keyed stream)\n");
+	return -1;
+    }
+
+    sent = V3_VMalloc(num_chunks);
+
+    if (!sent) {
+	PrintError(vm, VCORE_NONE, "Cannot allocate chunk map for post-copy\n");
+	return -1;
+    }
+
+    memset(sent, 0, num_chunks);
+
+    // The VM stays paused here, as after the last round of a pre-copy migration
+    if (v3_pause_vm(vm) == -1) {
+	PrintError(vm, VCORE_NONE, "Could not pause VM\n");
+	ret = -1;
+	goto out;
+    }
+
+    if (!(opts & V3_CHKPT_OPT_SKIP_DEVS)) {
+	if ((ret = v3_save_vm_devices(vm, chkpt)) == -1) {
+	    PrintError(vm, VCORE_NONE, "Unable to save devices\n");
+	    goto out;
+	}
+    }
+
+    if ((ret = save_header(vm, chkpt)) == -1) {
+	PrintError(vm, VCORE_NONE, "Unable to save header\n");
+	goto out;
+    }
+    
+    if (!(opts & V3_CHKPT_OPT_SKIP_CORES)) {
+	for (i = 0; i < vm->num_cores; i++){
+	    if ((ret = save_core(&(vm->cores[i]), chkpt, opts)) == -1) {
+		PrintError(vm, VCORE_NONE, "chkpt of core %llu failed\n", i);
+		goto out;
+	    }
+	}
+    }
+
+    ctx = v3_chkpt_open_ctx(chkpt, "postcopy_mem");
+
+    if (!ctx) {
+	PrintError(vm, VCORE_NONE, "Unable to open context for post-copy memory\n");
+	ret = -1;
+	goto out;
+    }
+
+    if (V3_CHKPT_SAVE(ctx, "chunk_size", chunk_size) ||
+	V3_CHKPT_SAVE(ctx, "num_chunks", num_chunks)) {
+	PrintError(vm, VCORE_NONE, "Unable to save post-copy memory layout\n");
+	v3_chkpt_close_ctx(ctx);
+	ret = -1;
+	goto out;
+    }
+
+    v3_chkpt_close_ctx(ctx);
+
+    PrintDebug(vm, VCORE_NONE, "Post-copy state sent, serving %llu chunks of memory on request\n", num_chunks);
+
+    while (num_sent < num_chunks) {
+	sint64_t chunk = 0;
+
+	if (chkpt->interface->next_request(chkpt->store_data, name, sizeof(name))) {
+	    PrintError(vm, VCORE_NONE, "Post-copy lost the receiver with %llu of %llu chunks sent\n", 
+		       num_sent, num_chunks);
+	    ret = -1;
+	    goto out;
+	}
+
+	chunk = postcopy_requested_chunk(name, num_chunks);
+
+	// requests for the state contexts arrive too, and are already served
+	if (chunk < 0) {
+	    continue;
+	}
+
+	if (save_lazy_chunk(vm, chkpt, chunk_size, chunk)) {
+	    ret = -1;
+	    goto out;
+	}
+
+	if (!sent[chunk]) {
+	    sent[chunk] = 1;
+	    num_sent++;
+	}
+    }
+
+ out:
+    V3_VFree(sent);
+
+    return ret;
+}
+
+
+// On success the loader thread owns the checkpoint and closes it
+static int postcopy_receive(struct v3_vm_info * vm, struct v3_chkpt * chkpt, v3_chkpt_options_t opts) {
+    extern uint64_t v3_mem_block_size;
+    struct v3_postcopy_state * pc = &(vm->postcopy);
+    struct v3_chkpt_ctx * ctx = NULL;
+    uint64_t chunk_size = 0;
+    uint64_t num_chunks = 0;
+    int i = 0;
+
+    if (pc->active) {
+	PrintError(vm, VCORE_NONE, "Memory of this VM is still arriving from an earlier post-copy or lazy load\n");
+	return -1;
+    }
+
+    /* If this guest is running we need to block it while the checkpoint occurs */
+    if (vm->run_state == VM_RUNNING) {
+	while (v3_raise_barrier(vm, NULL) == -1);
+    }
+
+    reset_chain(vm);
+    
+    if (!(opts & V3_CHKPT_OPT_SKIP_DEVS)) { 
+	if (v3_load_vm_devices(vm, chkpt) == -1) {
+	    PrintError(vm, VCORE_NONE, "Unable to load devices\n");
+	    goto fail;
+	}
+    }
+    
+    if (load_header(vm, chkpt) == -1) {
+	PrintError(vm, VCORE_NONE, "Unable to load header\n");
+	goto fail;
+    }
+    
+    if (!(opts & V3_CHKPT_OPT_SKIP_CORES)) {
+	for (i = 0; i < vm->num_cores; i++) {
+	    if (load_core(&(vm->cores[i]), chkpt, opts) == -1) {
+		PrintError(vm, VCORE_NONE, "Error loading core state (core=%d)\n", i);
+		goto fail;
+	    }
+	}
+    }
+
+    ctx = v3_chkpt_open_ctx(chkpt, "postcopy_mem");
+
+    if (!ctx) {
+	PrintError(vm, VCORE_NONE, "Unable to open context for post-copy memory\n");
+	goto fail;
+    }
+
+    if (V3_CHKPT_LOAD(ctx, "chunk_size", chunk_size) ||
+	V3_CHKPT_LOAD(ctx, "num_chunks", num_chunks)) {
+	PrintError(vm, VCORE_NONE, "Unable to load post-copy memory layout\n");
+	goto fail;
+    }
+
+    v3_chkpt_close_ctx(ctx);
+    ctx = NULL;
+
+    if ((chunk_size == 0) || (v3_mem_block_size % chunk_size) || 
+	(num_chunks != (vm->mem_map.num_base_regions * v3_mem_block_size) / chunk_size)) {
+	PrintError(vm, VCORE_NONE, "Post-copy memory layout (%llu chunks of %llu bytes) does not match this VM\n",
+		   num_chunks, chunk_size);
+	goto fail;
+    }
+
+    if (postcopy_start(vm, chunk_size, num_chunks) == -1) {
+	goto fail;
+    }
+
+    pc->migration = 1;
+    pc->chkpt = chkpt;
+
+    if (!V3_CREATE_AND_START_THREAD(lazy_loader, chkpt, "v3-postcopy", 0)) {
+	PrintError(vm, VCORE_NONE, "Cannot start post-copy loader\n");
+	pc->chkpt = NULL;
+	pc->active = 0;
+	pc->done = 1;
+	goto fail;
+    }
+
+    if (vm->run_state == VM_RUNNING) {
+	v3_lower_barrier(vm);
+    }
+
+    PrintDebug(vm, VCORE_NONE, "Post-copy state received, %llu chunks to follow\n", num_chunks);
+
+    return 0;
+
+ fail:
+    if (ctx) {
+	v3_chkpt_close_ctx(ctx);
+    }
+
+    chkpt_close(chkpt);
+
+    if (vm->run_state == VM_RUNNING) {
+	PrintError(vm, VCORE_NONE, "VM was previously running.  It is now borked.  Pausing it. \n");
+	vm->run_state = VM_STOPPED;
+	v3_lower_barrier(vm);
+    }
+
+    return -1;
+}
+
+
+
+
 
 
 int v3_chkpt_send_vm(struct v3_vm_info * vm, char * store, char * url, v3_chkpt_options_t opts) {
@@ -1283,7 +3102,31 @@ int v3_chkpt_send_vm(struct v3_vm_info * vm, char * store, char * url, v3_chkpt_
     uint64_t stop_time;
     int num_mod_pages=0;
     struct mem_migration_state *mm_state;
+    int round=0;
     int i;
+    uint64_t max_downtime_us = V3_CONFIG_LIVE_MIGRATION_MAX_DOWNTIME * 1000ULL;
+    uint64_t round_start_tsc = 0;
+    uint64_t xfer_start_tsc = 0;
+    uint64_t now_tsc = 0;
+    uint64_t dirty_rate = 0;    // pages/s the guest dirtied during the last round
+    uint64_t xfer_rate = 0;     // pages/s we sent during the last round
+    uint64_t est_downtime_us = 0;
+    int prev_mod_pages = 0;
+
+    if ((opts & V3_CHKPT_OPT_POSTCOPY) && !(opts & V3_CHKPT_OPT_SKIP_MEM)) {
+	if (!(chkpt = chkpt_open(vm, store, url, SAVE, opts))) {
+	    PrintError(vm, VCORE_NONE, "Error creating checkpoint store\n");
+	    return -1;
+	}
+
+	ret = postcopy_send(vm, chkpt, opts);
+
+	if (chkpt_close(chkpt) == -1) {
+	    ret = -1;
+	}
+
+	return ret;
+    }
 
     // Cores must all be in the same mode
     // or we must be skipping mmeory
@@ -1298,7 +3141,7 @@ int v3_chkpt_send_vm(struct v3_vm_info * vm, char * store, char * url, v3_chkpt_
     }
     
     
-    chkpt = chkpt_open(vm, store, url, SAVE);
+    chkpt = chkpt_open(vm, store, url, SAVE, opts);
     
     if (chkpt == NULL) {
 	PrintError(vm, VCORE_NONE, "Error creating checkpoint store\n");
@@ -1353,13 +3196,44 @@ int v3_chkpt_send_vm(struct v3_vm_info * vm, char * store, char * url, v3_chkpt_
 
 	// are we done? (note that we are still paused)
         num_mod_pages = v3_bitmap_count(&modified_pages_to_send);
-	if (num_mod_pages<MOD_THRESHOLD || iter>ITER_THRESHOLD) {
+
+	if (iter > 0) { 
+	    rdtscll(now_tsc);
+	    dirty_rate = page_rate(num_mod_pages, now_tsc - round_start_tsc);
+	}
+
+	est_downtime_us = xfer_rate ? (num_mod_pages * 1000000ULL) / xfer_rate : -1ULL;
+
+	PrintDebug(vm, VCORE_NONE, "Round %d: %d dirty pages, dirty rate %llu pages/s, transfer rate %llu pages/s, est. downtime %llu us, throttle %u%%\n",
+		   iter, num_mod_pages, dirty_rate, xfer_rate, est_downtime_us, vm->migrate_throttle_pct);
+
+	if (num_mod_pages<MOD_THRESHOLD || iter>ITER_THRESHOLD || est_downtime_us <= max_downtime_us) {
 	    // we are done, so we will not restart page tracking
 	    // the vm is paused, and so we should be able
 	    // to just send the data
             PrintDebug(vm, VCORE_NONE, "Last modified memory page iteration.\n");
             last_modpage_iteration = true;
+	    vm->migrate_throttle_pct = 0;
 	} else {
+	    // The first round sends everything, so only later rounds
+	    // tell us whether the guest is outrunning us
+	    if ((iter > 1) && ((uint64_t)num_mod_pages * 100 >= (uint64_t)prev_mod_pages * CONVERGE_PCT)) {
+		uint32_t pct = vm->migrate_throttle_pct;
+
+		pct = (pct == 0) ? THROTTLE_INITIAL_PCT : pct + THROTTLE_STEP_PCT;
+
+		if (pct > THROTTLE_MAX_PCT) {
+		    pct = THROTTLE_MAX_PCT;
+		}
+
+		PrintDebug(vm, VCORE_NONE, "Dirty set is not shrinking (%d -> %d pages), throttling vcores to %u%%\n",
+			   prev_mod_pages, num_mod_pages, pct);
+
+		vm->migrate_throttle_pct = pct;
+	    }
+
+	    prev_mod_pages = num_mod_pages;
+
 	    // we are not done, so we will restart page tracking
 	    // to prepare for a second round of pages
 	    // we will resume the VM as this happens
@@ -1377,18 +3251,31 @@ int v3_chkpt_send_vm(struct v3_vm_info * vm, char * store, char * url, v3_chkpt_
 	    
             stop_time = v3_get_host_time(&(vm->cores[0].time_state));
             PrintDebug(vm, VCORE_NONE, "num_mod_pages=%d\ndowntime=%llu\n",num_mod_pages,stop_time-start_time);
+
+	    rdtscll(round_start_tsc);
         }
 	
 
 	// At this point, we are either paused and about to copy
 	// the last chunk, or we are running, and will copy the last
 	// round in parallel with current execution
+	if (chkpt->pages) {
+	    // a running guest could change a page after it was sent,
+	    // and then a duplicate of it would be restored wrongly
+	    chkpt->pages->allow_dups = last_modpage_iteration;
+	}
+
 	if (num_mod_pages>0) { 
-	    if (save_inc_memory(vm, &modified_pages_to_send, chkpt) == -1) {
+	    rdtscll(xfer_start_tsc);
+
+	    if (save_inc_memory(vm, &modified_pages_to_send, chkpt, round++) == -1) {
 		PrintError(vm, VCORE_NONE, "Error sending incremental memory.\n");
 		ret = -1;
 		goto out;
 	    }
+
+	    rdtscll(now_tsc);
+	    xfer_rate = page_rate(num_mod_pages, now_tsc - xfer_start_tsc);
 	} // we don't want to copy an empty bitmap here
 	
 	iter++;
@@ -1401,7 +3288,7 @@ int v3_chkpt_send_vm(struct v3_vm_info * vm, char * store, char * url, v3_chkpt_
     }    
     
     // send bitmap of 0s to signal end of modpages
-    if (save_inc_memory(vm, &modified_pages_to_send, chkpt) == -1) {
+    if (save_inc_memory(vm, &modified_pages_to_send, chkpt, round++) == -1) {
         PrintError(vm, VCORE_NONE, "Error sending incremental memory.\n");
         ret = -1;
         goto out;
@@ -1435,10 +3322,13 @@ int v3_chkpt_send_vm(struct v3_vm_info * vm, char * store, char * url, v3_chkpt_
       PrintDebug(vm, VCORE_NONE, "num_mod_pages=%d\ndowntime=%llu\n",num_mod_pages,stop_time-start_time);
       PrintDebug(vm, VCORE_NONE, "Done sending VM!\n"); 
     out:
+      vm->migrate_throttle_pct = 0;
       v3_bitmap_deinit(&modified_pages_to_send);
     }
 
-    chkpt_close(chkpt);
+    if (chkpt_close(chkpt) == -1) {
+	ret = -1;
+    }
     
     return ret;
 
@@ -1449,6 +3339,16 @@ int v3_chkpt_receive_vm(struct v3_vm_info * vm, char * store, char * url, v3_chk
     int i = 0;
     int ret = 0;
     struct v3_bitmap mod_pgs;
+
+    if ((opts & V3_CHKPT_OPT_POSTCOPY) && !(opts & V3_CHKPT_OPT_SKIP_MEM)) {
+	if (!(chkpt = chkpt_open(vm, store, url, LOAD, opts))) {
+	    PrintError(vm, VCORE_NONE, "Error creating checkpoint store\n");
+	    return -1;
+	}
+
+	// memory keeps arriving after we return
+	return postcopy_receive(vm, chkpt, opts);
+    }
  
     // Currently will work only for shadow paging
     for (i=0;i<vm->num_cores;i++) { 
@@ -1458,7 +3358,7 @@ int v3_chkpt_receive_vm(struct v3_vm_info * vm, char * store, char * url, v3_chk
       }
     }
     
-    chkpt = chkpt_open(vm, store, url, LOAD);
+    chkpt = chkpt_open(vm, store, url, LOAD, opts);
     
     if (chkpt == NULL) {
 	PrintError(vm, VCORE_NONE, "Error creating checkpoint store\n");
@@ -1481,13 +3381,16 @@ int v3_chkpt_receive_vm(struct v3_vm_info * vm, char * store, char * url, v3_chk
     if (vm->run_state == VM_RUNNING) {
 	while (v3_raise_barrier(vm, NULL) == -1);
     }
+
+    // memory is about to change behind the tracking
+    reset_chain(vm);
     
     i = 0;
     while(true) {
         // 1. Receive copy of bitmap
         // 2. Receive pages
-        PrintDebug(vm, VCORE_NONE, "Memory page iteration %d\n",i++);
-        int retval = load_inc_memory(vm, &mod_pgs, chkpt);
+        PrintDebug(vm, VCORE_NONE, "Memory page iteration %d\n",i);
+        int retval = load_inc_memory(vm, &mod_pgs, chkpt, i++);
         if (retval == 1) {
             // end of receiving memory pages
             break;        
@@ -0,0 +1,510 @@
+/*
+ * This file is part of the Palacios Virtual Machine Monitor developed
+ * by the V3VEE Project with funding from the United States National
+ * Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  You can find out more at
+ * http://www.v3vee.org
+ *
+ * Copyright (c) 2026, The V3VEE Project <http://www.v3vee.org>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "V3VEE_LICENSE".
+ */
+
+#include <palacios/vmm.h>
+#include <palacios/vmm_chkpt_codec.h>
+
+
+struct chkpt_codec {
+    char * name;
+
+    // return encoded length, or -1 if the output would reach max
+    int (*encode)(struct v3_chkpt_codec_state * state, uint8_t * in, uint32_t len, uint8_t * out, uint32_t max);
+
+    // return decoded length, or -1 on corrupt input
+    int (*decode)(uint8_t * in, uint32_t len, uint8_t * out, uint32_t max);
+};
+
+
+static inline uint32_t read32(uint8_t * p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline void write32(uint8_t * p, uint32_t v) {
+    memcpy(p, &v, 4);
+}
+
+
+
+/*
+ * ZRLE
+ *
+ * A sequence of ops:
+ *    ZRLE_REPEAT [len:4] [byte]        len copies of byte
+ *    ZRLE_LITERAL [len:4] [len bytes]
+ *
+ * Zero pages and pages of a repeated fill become a handful of bytes,
+ * anything else passes through with 5 bytes of overhead per literal.
+ */
+#define ZRLE_REPEAT   1
+#define ZRLE_LITERAL  2
+#define ZRLE_MIN_RUN  16
+
+
+static uint32_t zrle_run(uint8_t * in, uint32_t pos, uint32_t len) {
+    uint8_t b = in[pos];
+    uint64_t pattern = 0x0101010101010101ULL * b;
+    uint32_t i = pos + 1;
+
+    while ((i < len) && (i % 8)) {
+	if (in[i] != b) {
+	    return i - pos;
+	}
+	i++;
+    }
+
+    while (((i + 8) <= len) && (*(uint64_t *)(in + i) == pattern)) {
+	i += 8;
+    }
+
+    while ((i < len) && (in[i] == b)) {
+	i++;
+    }
+
+    return i - pos;
+}
+
+static int zrle_encode(struct v3_chkpt_codec_state * state, uint8_t * in, uint32_t len, uint8_t * out, uint32_t max) {
+    uint32_t ip = 0;
+    uint32_t op = 0;
+    uint32_t anchor = 0;
+
+    while (ip <= len) {
+	uint32_t run = (ip < len) ? zrle_run(in, ip, len) : 0;
+
+	if ((run >= ZRLE_MIN_RUN) || (ip == len)) {
+	    uint32_t lit = ip - anchor;
+
+	    if (lit) {
+		if ((op + 5 + lit) >= max) {
+		    return -1;
+		}
+
+		out[op] = ZRLE_LITERAL;
+		write32(out + op + 1, lit);
+		memcpy(out + op + 5, in + anchor, lit);
+		op += 5 + lit;
+	    }
+
+	    if (ip == len) {
+		break;
+	    }
+
+	    if ((op + 6) >= max) {
+		return -1;
+	    }
+
+	    out[op] = ZRLE_REPEAT;
+	    write32(out + op + 1, run);
+	    out[op + 5] = in[ip];
+	    op += 6;
+
+	    anchor = ip + run;
+	}
+
+	ip += run;
+    }
+
+    return op;
+}
+
+static int zrle_decode(uint8_t * in, uint32_t len, uint8_t * out, uint32_t max) {
+    uint32_t ip = 0;
+    uint32_t op = 0;
+
+    while (ip < len) {
+	uint32_t n = 0;
+
+	if ((ip + 5) > len) {
+	    return -1;
+	}
+
+	n = read32(in + ip + 1);
+
+	if (n > (max - op)) {
+	    return -1;
+	}
+
+	if (in[ip] == ZRLE_REPEAT) {
+	    if ((ip + 6) > len) {
+		return -1;
+	    }
+
+	    memset(out + op, in[ip + 5], n);
+	    ip += 6;
+	} else if (in[ip] == ZRLE_LITERAL) {
+	    if (n > (len - ip - 5)) {
+		return -1;
+	    }
+
+	    memcpy(out + op, in + ip + 5, n);
+	    ip += 5 + n;
+	} else {
+	    return -1;
+	}
+
+	op += n;
+    }
+
+    return op;
+}
+
+
+
+/*
+ * LZ
+ *
+ * LZ4-style sequences:
+ *    [token] [literal length ext] [literals] [offset:2] [match length ext]
+ * The token holds the literal length in its upper nibble and the
+ * match length - LZ_MIN_MATCH in its lower nibble. A nibble of 15 is
+ * followed by extension bytes that are added on until one is not 255.
+ * The last sequence has only literals. Matches are found through a
+ * single-entry hash table of 4 byte prefixes.
+ */
+#define LZ_MIN_MATCH   4
+#define LZ_MAX_OFFSET  65535
+#define LZ_HASH_BITS   12
+#define LZ_HASH_SIZE   (1 << LZ_HASH_BITS)
+
+
+static inline uint32_t lz_hash(uint32_t v) {
+    return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static inline uint32_t lz_put_len(uint8_t * out, uint32_t len) {
+    uint32_t n = 0;
+
+    while (len >= 255) {
+	out[n++] = 255;
+	len -= 255;
+    }
+
+    out[n++] = len;
+
+    return n;
+}
+
+static int lz_emit(uint8_t * out, uint32_t * op, uint32_t max,
+		   uint8_t * lit, uint32_t lit_len,
+		   uint32_t offset, uint32_t match_len) {
+    uint8_t * token = NULL;
+    uint32_t o = *op;
+
+    // worst case for this sequence
+    if ((o + 1 + (lit_len / 255) + 1 + lit_len + 2 + (match_len / 255) + 1) >= max) {
+	return -1;
+    }
+
+    token = out + o;
+    o++;
+
+    if (lit_len >= 15) {
+	*token = 15 << 4;
+	o += lz_put_len(out + o, lit_len - 15);
+    } else {
+	*token = lit_len << 4;
+    }
+
+    memcpy(out + o, lit, lit_len);
+    o += lit_len;
+
+    if (match_len) {
+	uint32_t m = match_len - LZ_MIN_MATCH;
+
+	out[o++] = offset & 0xff;
+	out[o++] = offset >> 8;
+
+	if (m >= 15) {
+	    *token |= 15;
+	    o += lz_put_len(out + o, m - 15);
+	} else {
+	    *token |= m;
+	}
+    }
+
+    *op = o;
+
+    return 0;
+}
+
+static int lz_encode(struct v3_chkpt_codec_state * state, uint8_t * in, uint32_t len, uint8_t * out, uint32_t max) {
+    uint32_t * table = state->lz_table;
+    uint32_t ip = 0;
+    uint32_t op = 0;
+    uint32_t anchor = 0;
+
+    // table entries are position + 1, 0 is empty
+    memset(table, 0, LZ_HASH_SIZE * sizeof(uint32_t));
+
+    while ((ip + LZ_MIN_MATCH) <= len) {
+	uint32_t v = read32(in + ip);
+	uint32_t h = lz_hash(v);
+	uint32_t ref = table[h];
+
+	table[h] = ip + 1;
+
+	if (ref && ((ip - (ref - 1)) <= LZ_MAX_OFFSET) && (read32(in + ref - 1) == v)) {
+	    uint32_t match = ref - 1;
+	    uint32_t mlen = LZ_MIN_MATCH;
+
+	    while (((ip + mlen) < len) && (in[match + mlen] == in[ip + mlen])) {
+		mlen++;
+	    }
+
+	    if (lz_emit(out, &op, max, in + anchor, ip - anchor, ip - match, mlen) == -1) {
+		return -1;
+	    }
+
+	    ip += mlen;
+	    anchor = ip;
+	} else {
+	    ip++;
+	}
+    }
+
+    if (lz_emit(out, &op, max, in + anchor, len - anchor, 0, 0) == -1) {
+	return -1;
+    }
+
+    return op;
+}
+
+static int lz_get_len(uint8_t * in, uint32_t len, uint32_t * ip, uint32_t * val) {
+    uint8_t b = 0;
+
+    do {
+	if (*ip >= len) {
+	    return -1;
+	}
+	b = in[(*ip)++];
+	*val += b;
+    } while (b == 255);
+
+    return 0;
+}
+
+static int lz_decode(uint8_t * in, uint32_t len, uint8_t * out, uint32_t max) {
+    uint32_t ip = 0;
+    uint32_t op = 0;
+
+    while (ip < len) {
+	uint8_t token = in[ip++];
+	uint32_t lit_len = token >> 4;
+	uint32_t match_len = token & 0xf;
+	uint32_t offset = 0;
+	uint32_t i = 0;
+
+	if ((lit_len == 15) && (lz_get_len(in, len, &ip, &lit_len) == -1)) {
+	    return -1;
+	}
+
+	if ((lit_len > (len - ip)) || (lit_len > (max - op))) {
+	    return -1;
+	}
+
+	memcpy(out + op, in + ip, lit_len);
+	ip += lit_len;
+	op += lit_len;
+
+	if (ip == len) {
+	    // last sequence
+	    break;
+	}
+
+	if ((ip + 2) > len) {
+	    return -1;
+	}
+
+	offset = in[ip] | (in[ip + 1] << 8);
+	ip += 2;
+
+	if ((match_len == 15) && (lz_get_len(in, len, &ip, &match_len) == -1)) {
+	    return -1;
+	}
+
+	match_len += LZ_MIN_MATCH;
+
+	if ((offset == 0) || (offset > op) || (match_len > (max - op))) {
+	    return -1;
+	}
+
+	// may overlap, so go a byte at a time
+	for (i = 0; i < match_len; i++) {
+	    out[op + i] = out[op - offset + i];
+	}
+
+	op += match_len;
+    }
+
+    return op;
+}
+
+
+
+static struct chkpt_codec codecs[V3_CHKPT_CODEC_MAX] = {
+    [V3_CHKPT_CODEC_NONE] = { "none", NULL, NULL },
+    [V3_CHKPT_CODEC_ZRLE] = { "zrle", zrle_encode, zrle_decode },
+    [V3_CHKPT_CODEC_LZ]   = { "lz", lz_encode, lz_decode },
+};
+
+
+struct v3_chkpt_codec_state * v3_chkpt_codec_init(uint32_t codec) {
+    struct v3_chkpt_codec_state * state = NULL;
+
+    if (codec >= V3_CHKPT_CODEC_MAX) {
+	PrintError(VM_NONE, VCORE_NONE, "Unknown checkpoint codec %u\n", codec);
+	return NULL;
+    }
+
+    state = V3_Malloc(sizeof(struct v3_chkpt_codec_state));
+
+    if (!state) {
+	PrintError(VM_NONE, VCORE_NONE, "Cannot allocate checkpoint codec state\n");
+	return NULL;
+    }
+
+    memset(state, 0, sizeof(struct v3_chkpt_codec_state));
+
+    state->codec = codec;
+
+    state->scratch = V3_VMalloc(V3_CHKPT_CODEC_CHUNK);
+
+    if (!state->scratch) {
+	PrintError(VM_NONE, VCORE_NONE, "Cannot allocate checkpoint codec buffer\n");
+	V3_Free(state);
+	return NULL;
+    }
+
+    state->lz_table = V3_Malloc(LZ_HASH_SIZE * sizeof(uint32_t));
+
+    if (!state->lz_table) {
+	PrintError(VM_NONE, VCORE_NONE, "Cannot allocate checkpoint codec table\n");
+	V3_VFree(state->scratch);
+	V3_Free(state);
+	return NULL;
+    }
+
+    return state;
+}
+
+
+void v3_chkpt_codec_deinit(struct v3_chkpt_codec_state * state) {
+    V3_Free(state->lz_table);
+    V3_VFree(state->scratch);
+    V3_Free(state);
+}
+
+
+int v3_chkpt_codec_encode(struct v3_chkpt_codec_state * state,
+			  uint8_t * in, uint32_t len,
+			  uint8_t * out, uint32_t * codec_used) {
+    struct chkpt_codec * codec = &(codecs[state->codec]);
+    uint64_t start = 0;
+    uint64_t end = 0;
+    int enc_len = -1;
+
+    rdtscll(start);
+
+    if (codec->encode) {
+	// the output must be strictly smaller than the input to be worth it
+	enc_len = codec->encode(state, in, len, out, len);
+    }
+
+    rdtscll(end);
+
+    state->stats.encode_cycles += end - start;
+    state->stats.raw_bytes += len;
+    state->stats.chunks++;
+
+    if (enc_len < 0) {
+	*codec_used = V3_CHKPT_CODEC_NONE;
+	state->stats.enc_bytes += len;
+	state->stats.raw_chunks++;
+	return len;
+    }
+
+    *codec_used = state->codec;
+    state->stats.enc_bytes += enc_len;
+
+    return enc_len;
+}
+
+
+int v3_chkpt_codec_decode(struct v3_chkpt_codec_state * state, uint32_t codec,
+			  uint8_t * in, uint32_t in_len,
+			  uint8_t * out, uint32_t out_len) {
+    uint64_t start = 0;
+    uint64_t end = 0;
+    int ret = 0;
+
+    if ((codec == V3_CHKPT_CODEC_NONE) || (codec >= V3_CHKPT_CODEC_MAX)) {
+	PrintError(VM_NONE, VCORE_NONE, "Cannot decode with checkpoint codec %u\n", codec);
+	return -1;
+    }
+
+    rdtscll(start);
+
+    ret = codecs[codec].decode(in, in_len, out, out_len);
+
+    rdtscll(end);
+
+    state->stats.decode_cycles += end - start;
+    state->stats.raw_bytes += out_len;
+    state->stats.enc_bytes += in_len;
+    state->stats.chunks++;
+
+    if (ret != out_len) {
+	PrintError(VM_NONE, VCORE_NONE, "Corrupt %s chunk (decoded %d bytes, expected %u)\n",
+		   codecs[codec].name, ret, out_len);
+	return -1;
+    }
+
+    return 0;
+}
+
+
+void v3_chkpt_codec_merge_stats(struct v3_chkpt_codec_state * dst, struct v3_chkpt_codec_state * src) {
+    dst->stats.raw_bytes += src->stats.raw_bytes;
+    dst->stats.enc_bytes += src->stats.enc_bytes;
+    dst->stats.encode_cycles += src->stats.encode_cycles;
+    dst->stats.decode_cycles += src->stats.decode_cycles;
+    dst->stats.chunks += src->stats.chunks;
+    dst->stats.raw_chunks += src->stats.raw_chunks;
+}
+
+
+void v3_chkpt_codec_print_stats(struct v3_chkpt_codec_state * state) {
+    struct v3_chkpt_codec_stats * s = &(state->stats);
+    uint64_t khz = V3_CPU_KHZ();
+    uint64_t cycles = s->encode_cycles + s->decode_cycles;
+
+    if (s->raw_bytes == 0) {
+	return;
+    }
+
+    V3_Print(VM_NONE, VCORE_NONE, "Checkpoint codec %s: %llu bytes -> %llu bytes (%llu%%), %llu of %llu chunks raw\n",
+	     codecs[state->codec].name, s->raw_bytes, s->enc_bytes,
+	     (s->enc_bytes * 100) / s->raw_bytes, s->raw_chunks, s->chunks);
+
+    if (cycles && khz) {
+	// bytes * (cycles/ms) / cycles = bytes/ms, and bytes/ms / 1000 = MB/s
+	V3_Print(VM_NONE, VCORE_NONE, "Checkpoint codec %s: %llu cycles, %llu MB/s\n",
+		 codecs[state->codec].name, cycles, (s->raw_bytes * khz) / (cycles * 1000));
+    }
+}
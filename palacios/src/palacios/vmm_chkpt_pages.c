@@ -0,0 +1,316 @@
+/*
+ * This file is part of the Palacios Virtual Machine Monitor developed
+ * by the V3VEE Project with funding from the United States National
+ * Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  You can find out more at
+ * http://www.v3vee.org
+ *
+ * Copyright (c) 2026, The V3VEE Project <http://www.v3vee.org>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "V3VEE_LICENSE".
+ */
+
+#include <palacios/vmm.h>
+#include <palacios/vm_guest.h>
+#include <palacios/vmm_mem.h>
+#include <palacios/vmm_sprintf.h>
+#include <palacios/vmm_checkpoint.h>
+#include <palacios/vmm_chkpt_pages.h>
+
+
+#define PAGE_BYTES       4096
+#define PAGE_WORDS       (PAGE_BYTES / sizeof(uint64_t))
+
+// Direct mapped, a colliding page simply replaces the older one
+#define PAGE_TABLE_BITS  16
+#define PAGE_TABLE_SIZE  (1 << PAGE_TABLE_BITS)
+
+struct v3_chkpt_page_ent {
+    uint64_t hash;
+    uint32_t page;
+    uint32_t valid;
+};
+
+
+// OR 8 words at a time, which the compiler is free to widen. 
+// The VMM cannot use vector registers itself without saving 
+// the host's FPU state.
+static int page_is_zero(uint64_t * p) {
+    int i = 0;
+
+    for (i = 0; i < PAGE_WORDS; i += 8) {
+	if (p[i] | p[i + 1] | p[i + 2] | p[i + 3] | 
+	    p[i + 4] | p[i + 5] | p[i + 6] | p[i + 7]) {
+	    return 0;
+	}
+    }
+
+    return 1;
+}
+
+
+// FNV-1a over 64 bit words
+static uint64_t page_hash(uint64_t * p) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    int i = 0;
+
+    for (i = 0; i < PAGE_WORDS; i++) {
+	h ^= p[i];
+	h *= 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+
+// Not v3_get_base_region, which would wait for memory that is still being loaded
+static void * page_addr(struct v3_vm_info * vm, uint64_t page) {
+    extern uint64_t v3_mem_block_size;
+    addr_t gpa = page * PAGE_BYTES;
+    struct v3_mem_region * reg = NULL;
+
+    if ((gpa / v3_mem_block_size) >= vm->mem_map.num_base_regions) {
+	return NULL;
+    }
+
+    reg = &(vm->mem_map.base_regions[gpa / v3_mem_block_size]);
+
+    return V3_VAddr((void *)reg->host_addr) + (gpa - reg->guest_start);
+}
+
+
+static int grow_map(struct v3_chkpt_page_scope * scope, uint64_t num_pages) {
+    if (num_pages <= scope->map_pages) {
+	return 0;
+    }
+
+    if (scope->map) {
+	V3_VFree(scope->map);
+    }
+
+    scope->map = V3_VMalloc(num_pages * sizeof(uint32_t));
+
+    if (!scope->map) {
+	PrintError(scope->vm, VCORE_NONE, "Cannot allocate page map for %llu pages\n", num_pages);
+	scope->map_pages = 0;
+	return -1;
+    }
+
+    scope->map_pages = num_pages;
+
+    return 0;
+}
+
+
+struct v3_chkpt_page_scope * v3_chkpt_pages_init(struct v3_vm_info * vm, int allow_dups) {
+    struct v3_chkpt_page_scope * scope = NULL;
+
+    scope = V3_Malloc(sizeof(struct v3_chkpt_page_scope));
+
+    if (!scope) {
+	PrintError(vm, VCORE_NONE, "Cannot allocate checkpoint page scope\n");
+	return NULL;
+    }
+
+    memset(scope, 0, sizeof(struct v3_chkpt_page_scope));
+
+    scope->vm = vm;
+    scope->allow_dups = allow_dups;
+
+    scope->table = V3_VMalloc(PAGE_TABLE_SIZE * sizeof(struct v3_chkpt_page_ent));
+
+    if (!scope->table) {
+	PrintError(vm, VCORE_NONE, "Cannot allocate checkpoint page table\n");
+	V3_Free(scope);
+	return NULL;
+    }
+
+    v3_chkpt_pages_reset(scope);
+
+    return scope;
+}
+
+
+void v3_chkpt_pages_deinit(struct v3_chkpt_page_scope * scope) {
+    if (scope->map) {
+	V3_VFree(scope->map);
+    }
+
+    V3_VFree(scope->table);
+    V3_Free(scope);
+}
+
+
+void v3_chkpt_pages_reset(struct v3_chkpt_page_scope * scope) {
+    memset(scope->table, 0, PAGE_TABLE_SIZE * sizeof(struct v3_chkpt_page_ent));
+}
+
+
+static uint32_t classify_page(struct v3_chkpt_page_scope * scope, uint64_t page, uint64_t * p) {
+    struct v3_chkpt_page_ent * ent = NULL;
+    uint64_t hash = 0;
+    void * old = NULL;
+
+    if (page_is_zero(p)) {
+	scope->stats.zero_pages++;
+	return V3_CHKPT_PAGE_ZERO;
+    }
+
+    if (!scope->allow_dups) {
+	return V3_CHKPT_PAGE_DATA;
+    }
+
+    hash = page_hash(p);
+    ent = &(scope->table[hash & (PAGE_TABLE_SIZE - 1)]);
+
+    if (ent->valid && (ent->hash == hash) && 
+	(old = page_addr(scope->vm, ent->page)) &&
+	(memcmp(old, p, PAGE_BYTES) == 0)) {
+	scope->stats.dup_pages++;
+	return ent->page;
+    }
+
+    ent->hash = hash;
+    ent->page = page;
+    ent->valid = 1;
+
+    return V3_CHKPT_PAGE_DATA;
+}
+
+
+int v3_chkpt_pages_save(struct v3_chkpt_ctx * ctx, struct v3_chkpt_page_scope * scope, char * tag,
+			uint64_t first_page, uint64_t num_pages, void * host_addr) {
+    char name[64];
+    uint64_t start = 0;
+    uint64_t end = 0;
+    uint64_t i = 0;
+    uint64_t j = 0;
+
+    if (grow_map(scope, num_pages)) {
+	return -1;
+    }
+
+    rdtscll(start);
+
+    for (i = 0; i < num_pages; i++) {
+	scope->map[i] = classify_page(scope, first_page + i, host_addr + (i * PAGE_BYTES));
+    }
+
+    rdtscll(end);
+
+    scope->stats.pages += num_pages;
+    scope->stats.classify_cycles += end - start;
+
+    snprintf(name, sizeof(name), "%s.map", tag);
+
+    if (v3_chkpt_save(ctx, name, num_pages * sizeof(uint32_t), scope->map)) {
+	PrintError(scope->vm, VCORE_NONE, "Unable to save page map %s\n", name);
+	return -1;
+    }
+
+    for (i = 0; i < num_pages; i = j) {
+	if (scope->map[i] != V3_CHKPT_PAGE_DATA) {
+	    j = i + 1;
+	    continue;
+	}
+
+	for (j = i + 1; (j < num_pages) && (scope->map[j] == V3_CHKPT_PAGE_DATA); j++);
+
+	snprintf(name, sizeof(name), "%s.%llu", tag, i);
+
+	if (v3_chkpt_save(ctx, name, (j - i) * PAGE_BYTES, host_addr + (i * PAGE_BYTES))) {
+	    PrintError(scope->vm, VCORE_NONE, "Unable to save pages %s\n", name);
+	    return -1;
+	}
+    }
+
+    return 0;
+}
+
+
+int v3_chkpt_pages_load(struct v3_chkpt_ctx * ctx, struct v3_chkpt_page_scope * scope, char * tag,
+			uint64_t first_page, uint64_t num_pages, void * host_addr) {
+    uint64_t guest_pages = scope->vm->mem_size / PAGE_BYTES;
+    char name[64];
+    uint64_t i = 0;
+    uint64_t j = 0;
+
+    if (grow_map(scope, num_pages)) {
+	return -1;
+    }
+
+    snprintf(name, sizeof(name), "%s.map", tag);
+
+    if (v3_chkpt_load(ctx, name, num_pages * sizeof(uint32_t), scope->map)) {
+	PrintError(scope->vm, VCORE_NONE, "Unable to load page map %s\n", name);
+	return -1;
+    }
+
+    // data first, as duplicates may point into this range
+    for (i = 0; i < num_pages; i = j) {
+	if (scope->map[i] != V3_CHKPT_PAGE_DATA) {
+	    j = i + 1;
+	    continue;
+	}
+
+	for (j = i + 1; (j < num_pages) && (scope->map[j] == V3_CHKPT_PAGE_DATA); j++);
+
+	snprintf(name, sizeof(name), "%s.%llu", tag, i);
+
+	if (v3_chkpt_load(ctx, name, (j - i) * PAGE_BYTES, host_addr + (i * PAGE_BYTES))) {
+	    PrintError(scope->vm, VCORE_NONE, "Unable to load pages %s\n", name);
+	    return -1;
+	}
+    }
+
+    for (i = 0; i < num_pages; i++) {
+	uint32_t ent = scope->map[i];
+	void * dst = host_addr + (i * PAGE_BYTES);
+	void * src = NULL;
+
+	if (ent == V3_CHKPT_PAGE_DATA) {
+	    continue;
+	} else if (ent == V3_CHKPT_PAGE_ZERO) {
+	    memset(dst, 0, PAGE_BYTES);
+	    scope->stats.zero_pages++;
+	    continue;
+	}
+
+	if ((ent >= guest_pages) || (ent == first_page + i) || !(src = page_addr(scope->vm, ent))) {
+	    PrintError(scope->vm, VCORE_NONE, "Page %llu of %s refers to invalid page %u\n", first_page + i, tag, ent);
+	    return -1;
+	}
+
+	memcpy(dst, src, PAGE_BYTES);
+	scope->stats.dup_pages++;
+    }
+
+    scope->stats.pages += num_pages;
+
+    return 0;
+}
+
+
+void v3_chkpt_pages_merge_stats(struct v3_chkpt_page_scope * dst, struct v3_chkpt_page_scope * src) {
+    dst->stats.pages += src->stats.pages;
+    dst->stats.zero_pages += src->stats.zero_pages;
+    dst->stats.dup_pages += src->stats.dup_pages;
+    dst->stats.classify_cycles += src->stats.classify_cycles;
+}
+
+
+void v3_chkpt_pages_print_stats(struct v3_chkpt_page_scope * scope) {
+    struct v3_chkpt_page_stats * s = &(scope->stats);
+
+    if (s->pages == 0) {
+	return;
+    }
+
+    V3_Print(scope->vm, VCORE_NONE, "Checkpoint pages: %llu pages, %llu zero, %llu duplicate, %llu sent (%llu%%), %llu cycles classifying\n",
+	     s->pages, s->zero_pages, s->dup_pages, s->pages - s->zero_pages - s->dup_pages,
+	     ((s->pages - s->zero_pages - s->dup_pages) * 100) / s->pages, s->classify_cycles);
+}
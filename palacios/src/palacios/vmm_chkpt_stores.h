@@ -142,9 +142,7 @@ static void * keyed_stream_open_ctx(void * store_data,
 static int keyed_stream_close_ctx(void * store_data, void * ctx) {
     v3_keyed_stream_t stream = store_data;
 
-    v3_keyed_stream_close_key(stream, ctx);
-
-    return 0;
+    return v3_keyed_stream_close_key(stream, ctx);
 }
 
 static int keyed_stream_save(void * store_data, void * ctx, 
@@ -166,6 +164,23 @@ static int keyed_stream_load(void * store_data, void * ctx,
 }
 
 
+static void keyed_stream_preallocate_hint(void * store_data, char * name, uint64_t size) {
+    v3_keyed_stream_preallocate_hint_key(store_data, name, size);
+}
+
+static int keyed_stream_next_request(void * store_data, char * name, int len) {
+    if (v3_keyed_stream_next_request(store_data, name, len) < 0) { 
+	return -1;
+    }
+
+    return 0;
+}
+
+static void keyed_stream_abort(void * store_data) {
+    v3_keyed_stream_abort(store_data);
+}
+
+
 static struct chkpt_interface keyed_stream_store = {
     .name = "KEYED_STREAM",
     .open_chkpt = keyed_stream_open_chkpt,
@@ -173,7 +188,10 @@ static struct chkpt_interface keyed_stream_store = {
     .open_ctx = keyed_stream_open_ctx, 
     .close_ctx = keyed_stream_close_ctx,
     .save = keyed_stream_save,
-    .load = keyed_stream_load
+    .load = keyed_stream_load,
+    .preallocate_hint = keyed_stream_preallocate_hint,
+    .next_request = keyed_stream_next_request,
+    .abort = keyed_stream_abort
 };
 
 register_chkpt_store(keyed_stream_store);
@@ -296,6 +314,645 @@ register_chkpt_store(dir_store);
 
 
 
+/*
+ * Indexed container store
+ *
+ * The whole checkpoint is a single file:
+ *
+ *   [header, IDX_HDR_SIZE bytes]
+ *   [payloads]
+ *   [index: ctx records, entry records, string table]
+ *
+ * The header at offset zero locates the index, which is written when 
+ * the checkpoint is closed, so saves stream straight to the file. The
+ * index maps each (context, tag) to the offset and length of its 
+ * payload. Payloads of a page or more start on a page boundary so they
+ * can be mapped or read directly into guest memory. The header, the 
+ * index, and every payload carry a CRC32.
+ *
+ * A tag saved more than once in a context is loaded in the order it 
+ * was saved. Contexts can be loaded in any order, and several can be 
+ * open at once, which lets the parallel and lazy memory paths use this 
+ * store.
+ */
+#include <palacios/vmm_lock.h>
+#include <palacios/vmm_list.h>
+#include <palacios/vmm_hashtable.h>
+#include <palacios/vmm_ethernet.h>   // v3_crc32
+
+#define IDX_MAGIC       "V3CHKIDX"
+#define IDX_VERSION     1
+#define IDX_HDR_SIZE    4096
+#define IDX_PAGE_ALIGN  4096
+#define IDX_ALIGN       8
+#define IDX_CRC_CHUNK   (1 << 30)
+
+// v3_crc32 takes an int length, so large buffers are fed in pieces
+static uint32_t idx_crc(uint8_t * buf, uint64_t len) {
+    uint32_t crc = 0;
+
+    while (len > 0) {
+	uint32_t n = (len < IDX_CRC_CHUNK) ? len : IDX_CRC_CHUNK;
+
+	crc = v3_crc32(crc, buf, n);
+	buf += n;
+	len -= n;
+    }
+
+    return crc;
+}
+
+struct idx_header {
+    uint8_t  magic[8];
+    uint32_t version;
+    uint32_t num_ctxs;
+    uint32_t num_entries;
+    uint32_t strtab_len;
+    uint64_t index_offset;
+    uint64_t index_len;
+    uint32_t index_crc;
+    uint32_t header_crc;   // computed with this field zero
+} __attribute__((packed));
+
+struct idx_ctx_rec {
+    uint32_t name;         // offset in string table
+    uint32_t first;        // first entry
+    uint32_t count;        // number of entries
+    uint32_t rsvd;
+} __attribute__((packed));
+
+struct idx_entry_rec {
+    uint64_t offset;       // in file
+    uint64_t len;
+    uint32_t tag;          // offset in string table
+    uint32_t crc;          // of the payload
+} __attribute__((packed));
+
+
+struct idx_save_ctx {
+    char * name;
+
+    struct idx_entry_rec * entries;   // tags are offsets in strtab below
+    uint32_t num_entries;
+    uint32_t max_entries;
+
+    char * strtab;
+    uint32_t strtab_len;
+    uint32_t strtab_max;
+
+    struct list_head node;
+};
+
+struct idx_load_ctx {
+    struct idx_ctx_rec * rec;
+    uint32_t cursor;                  // next entry to search from
+};
+
+struct idx_store {
+    v3_file_t file;
+    chkpt_mode_t mode;
+
+    // SAVE
+    v3_lock_t lock;
+    uint64_t next_offset;
+    struct list_head closed_ctxs;
+
+    // LOAD
+    uint64_t file_size;
+    uint8_t * index;
+    struct idx_header hdr;
+    struct idx_ctx_rec * ctxs;
+    struct idx_entry_rec * entries;
+    char * strtab;
+    struct hashtable * ctx_table;     // name -> ctx record
+};
+
+
+static uint64_t idx_align(uint64_t offset, uint64_t len) {
+    uint64_t align = (len >= IDX_PAGE_ALIGN) ? IDX_PAGE_ALIGN : IDX_ALIGN;
+
+    return (offset + align - 1) & ~(align - 1);
+}
+
+// Grow an array to hold at least need elements, doubling
+static int idx_grow(void ** buf, uint32_t * max, uint32_t need, uint32_t elem_size) {
+    uint32_t new_max = (*max) ? (*max) : 16;
+    void * new_buf = NULL;
+
+    if (need <= *max) {
+	return 0;
+    }
+
+    while (new_max < need) {
+	new_max *= 2;
+    }
+
+    new_buf = V3_Malloc(new_max * elem_size);
+
+    if (!new_buf) {
+	PrintError(VM_NONE, VCORE_NONE, "Cannot allocate checkpoint index\n");
+	return -1;
+    }
+
+    if (*buf) {
+	memcpy(new_buf, *buf, (*max) * elem_size);
+	V3_Free(*buf);
+    }
+
+    *buf = new_buf;
+    *max = new_max;
+
+    return 0;
+}
+
+static uint32_t idx_add_string(struct idx_save_ctx * ctx, char * str) {
+    uint32_t len = strlen(str) + 1;
+    uint32_t offset = ctx->strtab_len;
+
+    if (idx_grow((void **)&(ctx->strtab), &(ctx->strtab_max), ctx->strtab_len + len, 1) == -1) {
+	return (uint32_t)-1;
+    }
+
+    memcpy(ctx->strtab + offset, str, len);
+    ctx->strtab_len += len;
+
+    return offset;
+}
+
+static void idx_free_save_ctx(struct idx_save_ctx * ctx) {
+    if (ctx->entries) {
+	V3_Free(ctx->entries);
+    }
+
+    if (ctx->strtab) {
+	V3_Free(ctx->strtab);
+    }
+
+    V3_Free(ctx->name);
+    V3_Free(ctx);
+}
+
+
+static int idx_load_index(struct idx_store * s) {
+    struct idx_header * hdr = &(s->hdr);
+    uint32_t crc = 0;
+    uint64_t recs_len = 0;
+    uint32_t i = 0;
+
+    s->file_size = v3_file_size(s->file);
+
+    if ((s->file_size < IDX_HDR_SIZE) || 
+	(v3_file_read(s->file, (uint8_t *)hdr, sizeof(struct idx_header), 0) != sizeof(struct idx_header))) {
+	PrintError(VM_NONE, VCORE_NONE, "Cannot read checkpoint header\n");
+	return -1;
+    }
+
+    crc = hdr->header_crc;
+    hdr->header_crc = 0;
+
+    if ((memcmp(hdr->magic, IDX_MAGIC, 8) != 0) || 
+	(v3_crc32(0, (uint8_t *)hdr, sizeof(struct idx_header)) != crc)) {
+	PrintError(VM_NONE, VCORE_NONE, "Checkpoint header is corrupt or not an indexed checkpoint\n");
+	return -1;
+    }
+
+    if (hdr->version != IDX_VERSION) {
+	PrintError(VM_NONE, VCORE_NONE, "Unsupported indexed checkpoint version %u\n", hdr->version);
+	return -1;
+    }
+
+    recs_len = (uint64_t)hdr->num_ctxs * sizeof(struct idx_ctx_rec) + 
+	(uint64_t)hdr->num_entries * sizeof(struct idx_entry_rec);
+
+    if ((hdr->index_len != recs_len + hdr->strtab_len) || (hdr->strtab_len == 0) ||
+	(hdr->index_offset < IDX_HDR_SIZE) || (hdr->index_offset + hdr->index_len > s->file_size)) {
+	PrintError(VM_NONE, VCORE_NONE, "Checkpoint index does not fit the file\n");
+	return -1;
+    }
+
+    s->index = V3_VMalloc(hdr->index_len);
+
+    if (!s->index) {
+	PrintError(VM_NONE, VCORE_NONE, "Cannot allocate checkpoint index (%llu bytes)\n", hdr->index_len);
+	return -1;
+    }
+
+    if (v3_file_read(s->file, s->index, hdr->index_len, hdr->index_offset) != hdr->index_len) {
+	PrintError(VM_NONE, VCORE_NONE, "Cannot read checkpoint index\n");
+	return -1;
+    }
+
+    if (idx_crc(s->index, hdr->index_len) != hdr->index_crc) {
+	PrintError(VM_NONE, VCORE_NONE, "Checkpoint index is corrupt\n");
+	return -1;
+    }
+
+    s->ctxs = (struct idx_ctx_rec *)(s->index);
+    s->entries = (struct idx_entry_rec *)(s->ctxs + hdr->num_ctxs);
+    s->strtab = (char *)(s->entries + hdr->num_entries);
+
+    if (s->strtab[hdr->strtab_len - 1] != 0) {
+	PrintError(VM_NONE, VCORE_NONE, "Checkpoint string table is not terminated\n");
+	return -1;
+    }
+
+    for (i = 0; i < hdr->num_entries; i++) {
+	struct idx_entry_rec * e = &(s->entries[i]);
+
+	if ((e->tag >= hdr->strtab_len) || (e->offset + e->len > hdr->index_offset)) {
+	    PrintError(VM_NONE, VCORE_NONE, "Checkpoint index entry %u is invalid\n", i);
+	    return -1;
+	}
+    }
+
+    s->ctx_table = v3_create_htable(0, store_hash_fn, store_eq_fn);
+
+    if (!s->ctx_table) {
+	PrintError(VM_NONE, VCORE_NONE, "Cannot allocate checkpoint context table\n");
+	return -1;
+    }
+
+    for (i = 0; i < hdr->num_ctxs; i++) {
+	struct idx_ctx_rec * c = &(s->ctxs[i]);
+
+	if ((c->name >= hdr->strtab_len) || 
+	    ((uint64_t)c->first + c->count > hdr->num_entries)) {
+	    PrintError(VM_NONE, VCORE_NONE, "Checkpoint context record %u is invalid\n", i);
+	    return -1;
+	}
+
+	// names are unique in a checkpoint, but keep the first if not
+	if (v3_htable_search(s->ctx_table, (addr_t)(s->strtab + c->name))) {
+	    continue;
+	}
+
+	if (v3_htable_insert(s->ctx_table, (addr_t)(s->strtab + c->name), (addr_t)c) == 0) {
+	    PrintError(VM_NONE, VCORE_NONE, "Cannot insert checkpoint context %s\n", s->strtab + c->name);
+	    return -1;
+	}
+    }
+
+    return 0;
+}
+
+
+static int idx_write_index(struct idx_store * s) {
+    struct idx_header hdr;
+    struct idx_save_ctx * ctx = NULL;
+    struct idx_ctx_rec * ctx_recs = NULL;
+    struct idx_entry_rec * entry_recs = NULL;
+    char * strtab = NULL;
+    uint8_t * index = NULL;
+    uint64_t strtab_len = 0;
+    uint64_t num_entries = 0;
+    uint32_t num_ctxs = 0;
+    uint32_t e = 0;
+    uint32_t i = 0;
+    int rc = -1;
+
+    memset(&hdr, 0, sizeof(struct idx_header));
+
+    list_for_each_entry(ctx, &(s->closed_ctxs), node) {
+	num_ctxs++;
+	num_entries += ctx->num_entries;
+	strtab_len += strlen(ctx->name) + 1 + ctx->strtab_len;
+    }
+
+    if (strtab_len == 0) {
+	// keep the string table non-empty
+	strtab_len = 1;
+    }
+
+    if ((num_entries > 0xffffffffULL) || (strtab_len > 0xffffffffULL)) {
+	PrintError(VM_NONE, VCORE_NONE, "Checkpoint too large for index\n");
+	return -1;
+    }
+
+    memcpy(hdr.magic, IDX_MAGIC, 8);
+    hdr.version = IDX_VERSION;
+    hdr.num_ctxs = num_ctxs;
+    hdr.num_entries = num_entries;
+    hdr.strtab_len = strtab_len;
+    hdr.index_offset = idx_align(s->next_offset, 0);
+    hdr.index_len = num_ctxs * sizeof(struct idx_ctx_rec) + 
+	num_entries * sizeof(struct idx_entry_rec) + strtab_len;
+
+    index = V3_VMalloc(hdr.index_len);
+
+    if (!index) {
+	PrintError(VM_NONE, VCORE_NONE, "Cannot allocate checkpoint index (%llu bytes)\n", hdr.index_len);
+	return -1;
+    }
+
+    memset(index, 0, hdr.index_len);
+
+    ctx_recs = (struct idx_ctx_rec *)index;
+    entry_recs = (struct idx_entry_rec *)(ctx_recs + num_ctxs);
+    strtab = (char *)(entry_recs + num_entries);
+    strtab_len = 0;
+
+    list_for_each_entry(ctx, &(s->closed_ctxs), node) {
+	uint32_t base = 0;
+	uint32_t j = 0;
+
+	ctx_recs[i].name = strtab_len;
+	ctx_recs[i].first = e;
+	ctx_recs[i].count = ctx->num_entries;
+
+	memcpy(strtab + strtab_len, ctx->name, strlen(ctx->name) + 1);
+	strtab_len += strlen(ctx->name) + 1;
+
+	base = strtab_len;
+	memcpy(strtab + strtab_len, ctx->strtab, ctx->strtab_len);
+	strtab_len += ctx->strtab_len;
+
+	for (j = 0; j < ctx->num_entries; j++) {
+	    entry_recs[e] = ctx->entries[j];
+	    entry_recs[e].tag += base;
+	    e++;
+	}
+
+	i++;
+    }
+
+    hdr.index_crc = idx_crc(index, hdr.index_len);
+    hdr.header_crc = v3_crc32(0, (uint8_t *)&hdr, sizeof(struct idx_header));
+
+    if (v3_file_write(s->file, index, hdr.index_len, hdr.index_offset) != hdr.index_len) {
+	PrintError(VM_NONE, VCORE_NONE, "Cannot write checkpoint index\n");
+	goto out;
+    }
+
+    // the header goes last, so a checkpoint cut short has none
+    if (v3_file_write(s->file, (uint8_t *)&hdr, sizeof(struct idx_header), 0) != sizeof(struct idx_header)) {
+	PrintError(VM_NONE, VCORE_NONE, "Cannot write checkpoint header\n");
+	goto out;
+    }
+
+    V3_Print(VM_NONE, VCORE_NONE, "Indexed checkpoint: %u contexts, %llu entries, %llu bytes\n",
+	     num_ctxs, num_entries, hdr.index_offset + hdr.index_len);
+
+    rc = 0;
+
+ out:
+    V3_VFree(index);
+    return rc;
+}
+
+
+static int idx_close_chkpt(void * store_data);
+
+static void * idx_open_chkpt(char * url, chkpt_mode_t mode) {
+    struct idx_store * s = NULL;
+    uint8_t zero[sizeof(struct idx_header)];
+
+    s = V3_Malloc(sizeof(struct idx_store));
+
+    if (!s) {
+	PrintError(VM_NONE, VCORE_NONE, "Cannot allocate\n");
+	return NULL;
+    }
+
+    memset(s, 0, sizeof(struct idx_store));
+
+    s->mode = mode;
+    v3_lock_init(&(s->lock));
+    INIT_LIST_HEAD(&(s->closed_ctxs));
+
+    if (mode == SAVE) {
+	// a larger old checkpoint would otherwise leave stale data past the new one
+	s->file = v3_file_open(NULL, url, FILE_OPEN_MODE_READ | FILE_OPEN_MODE_WRITE | 
+			       FILE_OPEN_MODE_CREATE | FILE_OPEN_MODE_TRUNC);
+    } else {
+	s->file = v3_file_open(NULL, url, FILE_OPEN_MODE_READ);
+    }
+
+    if (!s->file) {
+	PrintError(VM_NONE, VCORE_NONE, "Cannot open checkpoint file %s\n", url);
+	v3_lock_deinit(&(s->lock));
+	V3_Free(s);
+	return NULL;
+    }
+
+    if (mode == SAVE) {
+	// the header stays invalid until we close
+	memset(zero, 0, sizeof(zero));
+
+	if (v3_file_write(s->file, zero, sizeof(zero), 0) != sizeof(zero)) {
+	    PrintError(VM_NONE, VCORE_NONE, "Cannot write checkpoint file %s\n", url);
+	    idx_close_chkpt(s);
+	    return NULL;
+	}
+
+	s->next_offset = IDX_HDR_SIZE;
+    } else {
+	if (idx_load_index(s) == -1) {
+	    PrintError(VM_NONE, VCORE_NONE, "Cannot load index of checkpoint file %s\n", url);
+	    idx_close_chkpt(s);
+	    return NULL;
+	}
+    }
+
+    return s;
+}
+
+static int idx_close_chkpt(void * store_data) {
+    struct idx_store * s = store_data;
+    struct idx_save_ctx * ctx = NULL;
+    struct idx_save_ctx * tmp = NULL;
+    int rc = 0;
+
+    if (s->mode == SAVE) {
+	if (s->file) {
+	    rc = idx_write_index(s);
+	}
+
+	list_for_each_entry_safe(ctx, tmp, &(s->closed_ctxs), node) {
+	    list_del(&(ctx->node));
+	    idx_free_save_ctx(ctx);
+	}
+    } else {
+	if (s->ctx_table) {
+	    v3_free_htable(s->ctx_table, 0, 0);
+	}
+
+	if (s->index) {
+	    V3_VFree(s->index);
+	}
+    }
+
+    if (s->file) {
+	v3_file_close(s->file);
+    }
+
+    v3_lock_deinit(&(s->lock));
+    V3_Free(s);
+
+    return rc;
+}
+
+static void * idx_open_ctx(void * store_data, 
+			   char * name) {
+    struct idx_store * s = store_data;
+
+    if (s->mode == SAVE) {
+	struct idx_save_ctx * ctx = V3_Malloc(sizeof(struct idx_save_ctx));
+
+	if (!ctx) {
+	    PrintError(VM_NONE, VCORE_NONE, "Cannot allocate\n");
+	    return NULL;
+	}
+
+	memset(ctx, 0, sizeof(struct idx_save_ctx));
+
+	ctx->name = V3_Malloc(strlen(name) + 1);
+
+	if (!ctx->name) {
+	    PrintError(VM_NONE, VCORE_NONE, "Cannot allocate\n");
+	    V3_Free(ctx);
+	    return NULL;
+	}
+
+	strcpy(ctx->name, name);
+
+	return ctx;
+    } else {
+	struct idx_load_ctx * ctx = NULL;
+	struct idx_ctx_rec * rec = (struct idx_ctx_rec *)v3_htable_search(s->ctx_table, (addr_t)name);
+
+	if (!rec) {
+	    PrintDebug(VM_NONE, VCORE_NONE, "No context %s in checkpoint\n", name);
+	    return NULL;
+	}
+
+	ctx = V3_Malloc(sizeof(struct idx_load_ctx));
+
+	if (!ctx) {
+	    PrintError(VM_NONE, VCORE_NONE, "Cannot allocate\n");
+	    return NULL;
+	}
+
+	ctx->rec = rec;
+	ctx->cursor = 0;
+
+	return ctx;
+    }
+}
+
+static int idx_close_ctx(void * store_data, void * ctx) {
+    struct idx_store * s = store_data;
+
+    if (s->mode == SAVE) {
+	struct idx_save_ctx * save_ctx = ctx;
+
+	v3_lock(s->lock);
+	list_add_tail(&(save_ctx->node), &(s->closed_ctxs));
+	v3_unlock(s->lock);
+    } else {
+	V3_Free(ctx);
+    }
+
+    return 0;
+}
+
+static int idx_save(void * store_data, void * ctx, 
+		    char * tag, uint64_t len, void * buf) {
+    struct idx_store * s = store_data;
+    struct idx_save_ctx * save_ctx = ctx;
+    struct idx_entry_rec * e = NULL;
+    uint32_t tag_offset = 0;
+    uint64_t offset = 0;
+
+    if (idx_grow((void **)&(save_ctx->entries), &(save_ctx->max_entries), 
+		 save_ctx->num_entries + 1, sizeof(struct idx_entry_rec)) == -1) {
+	return -1;
+    }
+
+    tag_offset = idx_add_string(save_ctx, tag);
+
+    if (tag_offset == (uint32_t)-1) {
+	return -1;
+    }
+
+    // only the space is claimed under the lock, contexts write in parallel
+    v3_lock(s->lock);
+    offset = idx_align(s->next_offset, len);
+    s->next_offset = offset + len;
+    v3_unlock(s->lock);
+
+    if (v3_file_write(s->file, buf, len, offset) != len) {
+	PrintError(VM_NONE, VCORE_NONE, "Cannot write %s (%llu bytes) to checkpoint\n", tag, len);
+	return -1;
+    }
+
+    e = &(save_ctx->entries[save_ctx->num_entries++]);
+
+    e->offset = offset;
+    e->len = len;
+    e->tag = tag_offset;
+    e->crc = idx_crc(buf, len);
+
+    return 0;
+}
+
+static int idx_load(void * store_data, void * ctx, 
+		    char * tag, uint64_t len, void * buf) {
+    struct idx_store * s = store_data;
+    struct idx_load_ctx * load_ctx = ctx;
+    struct idx_ctx_rec * rec = load_ctx->rec;
+    struct idx_entry_rec * e = NULL;
+    uint32_t i = 0;
+
+    // usually the very next entry
+    for (i = 0; i < rec->count; i++) {
+	uint32_t n = (load_ctx->cursor + i) % rec->count;
+
+	if (strcmp(s->strtab + s->entries[rec->first + n].tag, tag) == 0) {
+	    e = &(s->entries[rec->first + n]);
+	    load_ctx->cursor = n + 1;
+	    break;
+	}
+    }
+
+    if (!e) {
+	PrintError(VM_NONE, VCORE_NONE, "No tag %s in checkpoint context %s\n", tag, s->strtab + rec->name);
+	return -1;
+    }
+
+    if (e->len != len) {
+	PrintError(VM_NONE, VCORE_NONE, "Tag %s in checkpoint context %s has %llu bytes, expected %llu\n",
+		   tag, s->strtab + rec->name, e->len, len);
+	return -1;
+    }
+
+    if (v3_file_read(s->file, buf, len, e->offset) != len) {
+	PrintError(VM_NONE, VCORE_NONE, "Cannot read %s from checkpoint\n", tag);
+	return -1;
+    }
+
+    if (idx_crc(buf, len) != e->crc) {
+	PrintError(VM_NONE, VCORE_NONE, "Checksum mismatch on %s in checkpoint context %s\n", tag, s->strtab + rec->name);
+	return -1;
+    }
+
+    return 0;
+}
+
+
+static struct chkpt_interface indexed_store = {
+    .name = "INDEXED",
+    .open_chkpt = idx_open_chkpt,
+    .close_chkpt = idx_close_chkpt,
+    .open_ctx = idx_open_ctx, 
+    .close_ctx = idx_close_ctx,
+    .save = idx_save,
+    .load = idx_load
+};
+
+register_chkpt_store(indexed_store);
+
+
+
 #endif
 
 
@@ -0,0 +1,355 @@
+/*
+ * This file is part of the Palacios Virtual Machine Monitor developed
+ * by the V3VEE Project with funding from the United States National
+ * Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  You can find out more at
+ * http://www.v3vee.org
+ *
+ * Copyright (c) 2026, The V3VEE Project <http://www.v3vee.org>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "V3VEE_LICENSE".
+ */
+
+#include <palacios/vmm.h>
+#include <palacios/vmm_chkpt_xbzrle.h>
+
+
+#define PAGE_BYTES   4096
+
+// A delta this long is not worth decoding, the page goes raw
+#define MAX_DELTA    ((PAGE_BYTES * 3) / 4)
+
+// worst case for one page: the type and a raw page
+#define MAX_RECORD   (1 + PAGE_BYTES)
+
+
+static inline uint8_t * put_uleb(uint8_t * out, uint32_t v) {
+    while (v >= 0x80) {
+	*out++ = (v & 0x7f) | 0x80;
+	v >>= 7;
+    }
+
+    *out++ = v;
+
+    return out;
+}
+
+// Returns NULL if the number runs past end
+static inline uint8_t * get_uleb(uint8_t * in, uint8_t * end, uint32_t * v) {
+    int shift = 0;
+
+    *v = 0;
+
+    while ((in < end) && (shift < 21)) {
+	*v |= (uint32_t)(*in & 0x7f) << shift;
+
+	if (!(*in++ & 0x80)) {
+	    return in;
+	}
+
+	shift += 7;
+    }
+
+    return NULL;
+}
+
+
+static int page_is_zero(uint64_t * p) {
+    int i = 0;
+
+    for (i = 0; i < PAGE_BYTES / sizeof(uint64_t); i += 8) {
+	if (p[i] | p[i + 1] | p[i + 2] | p[i + 3] | 
+	    p[i + 4] | p[i + 5] | p[i + 6] | p[i + 7]) {
+	    return 0;
+	}
+    }
+
+    return 1;
+}
+
+
+// Returns the length of the delta, 0 if the pages are equal, or -1 if it exceeds MAX_DELTA
+static int encode_delta(uint8_t * new, uint8_t * old, uint8_t * out) {
+    uint8_t * start = out;
+    uint32_t pos = 0;
+
+    while (pos < PAGE_BYTES) {
+	uint32_t same = pos;
+	uint32_t diff = 0;
+	uint32_t i = 0;
+
+	// skip equal words while we can
+	while (((same % 8) == 0) && ((same + 8) <= PAGE_BYTES) && 
+	       (*(uint64_t *)(new + same) == *(uint64_t *)(old + same))) {
+	    same += 8;
+	}
+
+	while ((same < PAGE_BYTES) && (new[same] == old[same])) {
+	    same++;
+	}
+
+	if (same == PAGE_BYTES) {
+	    break;   // trailing equal bytes are implied
+	}
+
+	for (diff = same; (diff < PAGE_BYTES) && (new[diff] != old[diff]); diff++);
+
+	if ((out - start) + 6 + (diff - same) > MAX_DELTA) {
+	    return -1;
+	}
+
+	out = put_uleb(out, same - pos);
+	out = put_uleb(out, diff - same);
+
+	for (i = same; i < diff; i++) {
+	    *out++ = new[i] ^ old[i];
+	}
+
+	pos = diff;
+    }
+
+    return out - start;
+}
+
+
+static int decode_delta(uint8_t * in, uint32_t len, uint8_t * page) {
+    uint8_t * end = in + len;
+    uint32_t pos = 0;
+
+    while (in < end) {
+	uint32_t same = 0;
+	uint32_t diff = 0;
+	uint32_t i = 0;
+
+	if (!(in = get_uleb(in, end, &same)) || 
+	    !(in = get_uleb(in, end, &diff))) {
+	    return -1;
+	}
+
+	if ((same > PAGE_BYTES - pos) || (diff > PAGE_BYTES - pos - same) || (diff > end - in)) {
+	    return -1;
+	}
+
+	pos += same;
+
+	for (i = 0; i < diff; i++) {
+	    page[pos++] ^= *in++;
+	}
+    }
+
+    return 0;
+}
+
+
+struct v3_chkpt_xbzrle * v3_chkpt_xbzrle_init(struct v3_vm_info * vm, uint64_t cache_bytes, uint64_t max_run_pages) {
+    struct v3_chkpt_xbzrle * x = NULL;
+
+    x = V3_Malloc(sizeof(struct v3_chkpt_xbzrle));
+
+    if (!x) {
+	PrintError(vm, VCORE_NONE, "Cannot allocate delta encoding state\n");
+	return NULL;
+    }
+
+    memset(x, 0, sizeof(struct v3_chkpt_xbzrle));
+
+    x->vm = vm;
+    x->num_slots = cache_bytes / PAGE_BYTES;
+    x->buf_len = max_run_pages * MAX_RECORD;
+
+    x->buf = V3_VMalloc(x->buf_len);
+    x->snap = V3_Malloc(PAGE_BYTES);
+
+    if (!x->buf || !x->snap) {
+	PrintError(vm, VCORE_NONE, "Cannot allocate delta encoding buffers\n");
+	goto fail;
+    }
+
+    if (x->num_slots) {
+	x->tags = V3_VMalloc(x->num_slots * sizeof(uint64_t));
+	x->cache = V3_VMalloc(x->num_slots * PAGE_BYTES);
+
+	if (!x->tags || !x->cache) {
+	    PrintError(vm, VCORE_NONE, "Cannot allocate %llu byte delta encoding cache\n", cache_bytes);
+	    goto fail;
+	}
+
+	memset(x->tags, 0, x->num_slots * sizeof(uint64_t));
+    }
+
+    return x;
+
+ fail:
+    v3_chkpt_xbzrle_deinit(x);
+    return NULL;
+}
+
+
+void v3_chkpt_xbzrle_deinit(struct v3_chkpt_xbzrle * x) {
+    if (x->cache) {
+	V3_VFree(x->cache);
+    }
+
+    if (x->tags) {
+	V3_VFree(x->tags);
+    }
+
+    if (x->buf) {
+	V3_VFree(x->buf);
+    }
+
+    if (x->snap) {
+	V3_Free(x->snap);
+    }
+
+    V3_Free(x);
+}
+
+
+sint64_t v3_chkpt_xbzrle_encode(struct v3_chkpt_xbzrle * x, uint64_t first_page, uint64_t num_pages, void * host_addr) {
+    uint8_t * out = x->buf;
+    uint64_t i = 0;
+
+    if (num_pages * MAX_RECORD > x->buf_len) {
+	PrintError(x->vm, VCORE_NONE, "Run of %llu pages is too long to delta encode\n", num_pages);
+	return -1;
+    }
+
+    for (i = 0; i < num_pages; i++) {
+	uint64_t page = first_page + i;
+	uint8_t * slot = NULL;
+	int len = -1;
+
+	// work from a copy, so the cache matches what was actually sent
+	memcpy(x->snap, host_addr + (i * PAGE_BYTES), PAGE_BYTES);
+
+	if (x->num_slots) {
+	    uint64_t s = page % x->num_slots;
+
+	    slot = x->cache + (s * PAGE_BYTES);
+
+	    if (x->tags[s] == page + 1) {
+		len = encode_delta(x->snap, slot, out + 3);
+	    } else {
+		x->tags[s] = page + 1;
+		x->stats.misses++;
+	    }
+	}
+
+	if (len == 0) {
+	    *out++ = V3_XBZRLE_SAME;
+	    x->stats.same_pages++;
+	} else if (page_is_zero((uint64_t *)x->snap)) {
+	    *out++ = V3_XBZRLE_ZERO;
+	    x->stats.zero_pages++;
+	} else if (len > 0) {
+	    uint16_t len16 = len;
+
+	    out[0] = V3_XBZRLE_DELTA;
+	    memcpy(out + 1, &len16, 2);
+	    out += 3 + len;
+	    x->stats.delta_pages++;
+	} else {
+	    *out++ = V3_XBZRLE_RAW;
+	    memcpy(out, x->snap, PAGE_BYTES);
+	    out += PAGE_BYTES;
+	    x->stats.raw_pages++;
+	}
+
+	if (slot) {
+	    memcpy(slot, x->snap, PAGE_BYTES);
+	}
+    }
+
+    x->stats.pages += num_pages;
+    x->stats.enc_bytes += out - x->buf;
+
+    return out - x->buf;
+}
+
+
+int v3_chkpt_xbzrle_decode(struct v3_chkpt_xbzrle * x, uint64_t num_pages, void * host_addr, uint64_t len) {
+    uint8_t * in = x->buf;
+    uint8_t * end = x->buf + len;
+    uint64_t i = 0;
+
+    if (len > x->buf_len) {
+	PrintError(x->vm, VCORE_NONE, "Delta encoded run of %llu bytes is too long\n", len);
+	return -1;
+    }
+
+    for (i = 0; i < num_pages; i++) {
+	uint8_t * page = host_addr + (i * PAGE_BYTES);
+	uint16_t len16 = 0;
+
+	if (in >= end) {
+	    goto corrupt;
+	}
+
+	switch (*in++) {
+	    case V3_XBZRLE_RAW:
+		if (end - in < PAGE_BYTES) {
+		    goto corrupt;
+		}
+
+		memcpy(page, in, PAGE_BYTES);
+		in += PAGE_BYTES;
+		x->stats.raw_pages++;
+		break;
+
+	    case V3_XBZRLE_ZERO:
+		memset(page, 0, PAGE_BYTES);
+		x->stats.zero_pages++;
+		break;
+
+	    case V3_XBZRLE_SAME:
+		x->stats.same_pages++;
+		break;
+
+	    case V3_XBZRLE_DELTA:
+		if (end - in < 2) {
+		    goto corrupt;
+		}
+
+		memcpy(&len16, in, 2);
+		in += 2;
+
+		if ((len16 > end - in) || decode_delta(in, len16, page)) {
+		    goto corrupt;
+		}
+
+		in += len16;
+		x->stats.delta_pages++;
+		break;
+
+	    default:
+		goto corrupt;
+	}
+    }
+
+    x->stats.pages += num_pages;
+    x->stats.enc_bytes += len;
+
+    return 0;
+
+ corrupt:
+    PrintError(x->vm, VCORE_NONE, "Corrupt delta encoding at page %llu of %llu\n", i, num_pages);
+    return -1;
+}
+
+
+void v3_chkpt_xbzrle_print_stats(struct v3_chkpt_xbzrle * x) {
+    struct v3_chkpt_xbzrle_stats * s = &(x->stats);
+
+    if (s->pages == 0) {
+	return;
+    }
+
+    V3_Print(x->vm, VCORE_NONE, "Delta encoding: %llu pages -> %llu bytes (%llu%%): %llu raw (%llu misses), %llu zero, %llu unchanged, %llu deltas\n",
+	     s->pages, s->enc_bytes, (s->enc_bytes * 100) / (s->pages * PAGE_BYTES),
+	     s->raw_pages, s->misses, s->zero_pages, s->same_pages, s->delta_pages);
+}
@@ -47,6 +47,11 @@
 
 #include <palacios/vmm_host_events.h>
 #include <palacios/vmm_perftune.h>
+#include <palacios/vmm_lowlevel.h>
+
+#ifdef V3_CONFIG_VMX
+#include <palacios/vmx.h>
+#endif
 
 #include "vmm_config_class.h"
 
@@ -287,6 +292,8 @@ static inline uint32_t get_alignment(char * align_str) {
 	    alignment = PAGE_SIZE_2MB;
 	} else if (strcasecmp(align_str, "4MB") == 0) {
 	    alignment = PAGE_SIZE_4MB;
+	} else if (strcasecmp(align_str, "1GB") == 0) {
+	    alignment = PAGE_SIZE_1GB;
 	}
     }
     
@@ -401,6 +408,25 @@ static int pre_config_vm(struct v3_vm_info * vm, v3_cfg_tree_t * vm_cfg) {
 }
 
 
+static int giant_pages_supported(struct guest_info * info) {
+    uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+
+#ifdef V3_CONFIG_VMX
+    extern v3_cpu_arch_t v3_mach_type;
+
+    // EPT advertises its own leaf sizes
+    if ((info->shdw_pg_mode == NESTED_PAGING) && 
+	((v3_mach_type == V3_VMX_EPT_CPU) || (v3_mach_type == V3_VMX_EPT_UG_CPU))) {
+	return v3_vmx_ept_1GB_ok();
+    }
+#endif
+
+    // SVM nested tables and the passthrough tables use the host format
+    v3_cpuid(CPUID_EXT_FEATURE_IDS, &eax, &ebx, &ecx, &edx);
+
+    return (edx & CPUID_EXT_FEATURE_IDS_edx_page1gb) != 0;
+}
+
 static int determine_paging_mode(struct guest_info * info, v3_cfg_tree_t * core_cfg) {
     extern v3_cpu_arch_t v3_mach_type;
 
@@ -442,6 +468,29 @@ static int determine_paging_mode(struct guest_info * info, v3_cfg_tree_t * core_
 	    PrintDebug(info->vm_info, info, "Use of large pages in memory virtualization enabled.\n");
 	}
     }
+
+    if (v3_cfg_val(pg_tree, "giant_pages") != NULL) {
+	if (strcasecmp(v3_cfg_val(pg_tree, "giant_pages"), "true") == 0) {
+	    if (giant_pages_supported(info)) {
+		info->use_giant_pages = 1;
+		PrintDebug(info->vm_info, info, "Use of giant (1GB) pages in memory virtualization enabled.\n");
+	    } else {
+		V3_Print(info->vm_info, info, "Ignoring giant_pages, as this CPU cannot map 1GB pages\n");
+	    }
+	}
+    }
+
+    if (v3_cfg_val(pg_tree, "prepopulate") != NULL) {
+	if (strcasecmp(v3_cfg_val(pg_tree, "prepopulate"), "true") == 0) {
+	    if (info->shdw_pg_mode == NESTED_PAGING) {
+		info->prepopulate_direct_map = 1;
+		PrintDebug(info->vm_info, info, "Nested page tables will be built at launch.\n");
+	    } else {
+		// passthrough tables only serve until the guest turns on paging
+		V3_Print(info->vm_info, info, "Ignoring prepopulate, as it needs nested paging\n");
+	    }
+	}
+    }
     return 0;
 }
 
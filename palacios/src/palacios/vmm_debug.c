@@ -25,6 +25,7 @@
 #include <palacios/vmm_decoder.h>
 #include <palacios/vm_guest_mem.h>
 #include <palacios/vmm_config.h>
+#include <palacios/vmm_direct_paging.h>
 
 #define PRINT_TELEMETRY  1
 #define PRINT_CORE_STATE 2
@@ -32,6 +33,9 @@
 #define PRINT_STACK      4
 #define PRINT_BACKTRACE  5
 
+#define BENCH_IO_MAP     10 // VM wide, ignores the core
+#define BENCH_DIRECT_MAP 11
+
 
 #define PRINT_ALL        100 // Absolutely everything
 #define PRINT_STATE      101 // telemetry, core state, arch state
@@ -78,6 +82,14 @@ static int core_handler(struct guest_info * core, uint32_t cmd) {
 	    v3_lower_barrier(core->vm_info);
 	    break;
 
+	case BENCH_DIRECT_MAP:
+	    v3_raise_barrier(core->vm_info, NULL);
+
+	    v3_bench_direct_map_invalidation(core);
+
+	    v3_lower_barrier(core->vm_info);
+	    break;
+
 	case PRINT_STATE:
 	    v3_raise_barrier(core->vm_info, NULL);
 
@@ -114,6 +126,12 @@ static int evt_handler(struct v3_vm_info * vm, struct v3_debug_event * evt, void
 
     V3_Print(vm, VCORE_NONE,"Debug Event Handler for core %d cmd=%x\n", evt->core_id, evt->cmd);
 
+    switch (evt->cmd) {
+	case BENCH_IO_MAP:
+	    v3_bench_io_map(vm);
+	    return 0;
+    }
+
     if (evt->core_id == -1) {
 	int i = 0;
 	for (i = 0; i < vm->num_cores; i++) {
@@ -113,6 +113,7 @@ static inline int handle_passthrough_pagefault_32pae(struct guest_info * info,
 	    }
 
 	    pte[pte_index].page_base_addr = PAGE_BASE_ADDR(host_addr);
+	    info->direct_map_stats.num_4k++;
             PrintDebug(info->vm_info, info, "PTE mapped to =%p\n", (void *)host_addr);
             PrintDebug(info->vm_info, info, "PTE is =%llx\n", *(uint64_t *)&(pte[pte_index]));
 	} else {
@@ -144,12 +145,8 @@ static inline int invalidate_addr_32pae_internal(struct guest_info * info, addr_
     int pte_index = PTE32PAE_INDEX(inv_addr);
 
     
-    // Lookup the correct PDE address based on the PAGING MODE
-    if (info->shdw_pg_mode == SHADOW_PAGING) {
-	pdpe = CR3_TO_PDPE32PAE_VA(info->ctrl_regs.cr3);
-    } else {
-	pdpe = CR3_TO_PDPE32PAE_VA(info->direct_map_pt);
-    }    
+    // The passthrough tables, as the range path uses, not whatever CR3 holds now
+    pdpe = CR3_TO_PDPE32PAE_VA(info->direct_map_pt);
 
 
     if (pdpe[pdpe_index].present == 0) {
@@ -173,6 +170,10 @@ static inline int invalidate_addr_32pae_internal(struct guest_info * info, addr_
 
     pte = V3_VAddr((void*)BASE_TO_PAGE_ADDR(pde[pde_index].pt_base_addr));
 
+    if (pte[pte_index].present == 1) {
+	info->direct_map_stats.num_4k--;
+    }
+
     pte[pte_index].present = 0;
 
     *actual_start = BASE_TO_PAGE_ADDR_4KB(PAGE_BASE_ADDR_4KB(inv_addr));
@@ -197,29 +198,115 @@ static inline int invalidate_addr_32pae(struct guest_info * core, addr_t inv_add
 
 }
    
+// Account for the mappings in a table being cut out of the map, and orphan it
+static inline void orphan_pt_32pae(struct guest_info * core, pte32pae_t * pte, struct pt_orphans * orphans) {
+    int i;
+
+    for (i = 0; i < MAX_PTE32PAE_ENTRIES; i++) {
+	if (pte[i].present == 1) {
+	    core->direct_map_stats.num_4k--;
+	}
+    }
+
+    orphan_pt_page(orphans, pte);
+}
+
+static inline void orphan_pd_32pae(struct guest_info * core, pde32pae_t * pde, struct pt_orphans * orphans) {
+    int i;
+
+    for (i = 0; i < MAX_PDE32PAE_ENTRIES; i++) {
+	if ((pde[i].present == 0) || (pde[i].large_page == 1)) {
+	    continue;
+	}
+
+	orphan_pt_32pae(core, V3_VAddr((void*)BASE_TO_PAGE_ADDR(pde[i].pt_base_addr)), orphans);
+    }
+
+    orphan_pt_page(orphans, pde);
+}
+
+// One walk over the range.  An entry whose span the range covers is cleared
+// where it is found, and the tables below it are orphaned as a whole
 static inline int invalidate_addr_32pae_range(struct guest_info * core, addr_t inv_addr_start, addr_t inv_addr_end,
 					      addr_t *actual_start, addr_t *actual_end)
 {
-  addr_t next;
-  addr_t start;
-  uint64_t len;
-  int rc;
-  
-  for (next=inv_addr_start; next<=inv_addr_end; ) {
-    rc = invalidate_addr_32pae_internal(core,next,&start, &len);
-    if (next==inv_addr_start) { 
-      // first iteration, capture where we start invalidating
-      *actual_start = start;
-    }
-    if (rc) { 
-      return rc;
+    struct pt_orphans orphans = {0, 0, 0};
+    pdpe32pae_t * pdpe = NULL;
+    addr_t addr = inv_addr_start;
+
+    *actual_start = inv_addr_start;
+    *actual_end = inv_addr_end;
+
+    // Tables are cut out and freed, so this must only ever walk the
+    // passthrough tables, never shadow tables that CR3 may hold
+    pdpe = CR3_TO_PDPE32PAE_VA(core->direct_map_pt);
+
+    // The passthrough map only covers the first 4GB
+    while ((addr <= inv_addr_end) && (addr < 0x100000000ULL)) {
+	int pdpe_index = PDPE32PAE_INDEX(addr);
+	addr_t pdpe_base = BASE_TO_PAGE_ADDR_1GB(PAGE_BASE_ADDR_1GB(addr));
+	addr_t pdpe_limit = pdpe_base + PAGE_SIZE_1GB;
+	pde32pae_t * pde = NULL;
+
+	if (pdpe[pdpe_index].present == 0) {
+	    note_span(pdpe_base, PAGE_SIZE_1GB, actual_start, actual_end);
+	    addr = pdpe_limit;
+	    continue;
+	}
+
+	pde = V3_VAddr((void*)BASE_TO_PAGE_ADDR(pdpe[pdpe_index].pd_base_addr));
+
+	if (span_inside(pdpe_base, PAGE_SIZE_1GB, inv_addr_start, inv_addr_end)) {
+	    orphan_pd_32pae(core, pde, &orphans);
+	    pdpe[pdpe_index].present = 0;
+	    addr = pdpe_limit;
+	    continue;
+	}
+
+	while ((addr <= inv_addr_end) && (addr < pdpe_limit)) {
+	    int pde_index = PDE32PAE_INDEX(addr);
+	    addr_t pde_base = BASE_TO_PAGE_ADDR_2MB(PAGE_BASE_ADDR_2MB(addr));
+	    addr_t pde_limit = pde_base + PAGE_SIZE_2MB;
+	    pte32pae_t * pte = NULL;
+
+	    if (pde[pde_index].present == 0) {
+		note_span(pde_base, PAGE_SIZE_2MB, actual_start, actual_end);
+		addr = pde_limit;
+		continue;
+	    } else if (pde[pde_index].large_page) {
+		pde[pde_index].present = 0;
+		note_span(pde_base, PAGE_SIZE_2MB, actual_start, actual_end);
+		addr = pde_limit;
+		continue;
+	    }
+
+	    pte = V3_VAddr((void*)BASE_TO_PAGE_ADDR(pde[pde_index].pt_base_addr));
+
+	    if (span_inside(pde_base, PAGE_SIZE_2MB, inv_addr_start, inv_addr_end)) {
+		orphan_pt_32pae(core, pte, &orphans);
+		pde[pde_index].present = 0;
+		addr = pde_limit;
+		continue;
+	    }
+
+	    while ((addr <= inv_addr_end) && (addr < pde_limit)) {
+		int pte_index = PTE32PAE_INDEX(addr);
+
+		if (pte[pte_index].present == 1) {
+		    core->direct_map_stats.num_4k--;
+		}
+
+		pte[pte_index].present = 0;
+
+		note_span(PAGE_ADDR_4KB(addr), PAGE_SIZE_4KB, actual_start, actual_end);
+		addr = PAGE_ADDR_4KB(addr) + PAGE_SIZE_4KB;
+	    }
+	}
     }
-    next = start + len;
-    *actual_end = next;
-  }
-  // last iteration, actual_end is off by one
-  (*actual_end)--;
-  return 0;
+
+    queue_direct_map_flush(core, &orphans);
+
+    return 0;
 }
 
 #endif
@@ -35,6 +35,7 @@ static inline int handle_passthrough_pagefault_64(struct guest_info * core, addr
 						  addr_t *actual_start, addr_t *actual_end) {
     pml4e64_t * pml      = NULL;
     pdpe64_t * pdpe      = NULL;
+    pdpe64_1GB_t * pdpe1gb = NULL;
     pde64_t * pde        = NULL;
     pde64_2MB_t * pde2mb = NULL;
     pte64_t * pte        = NULL;
@@ -85,6 +86,55 @@ static inline int handle_passthrough_pagefault_64(struct guest_info * core, addr
 	pdpe = V3_VAddr((void*)BASE_TO_PAGE_ADDR_4KB(pml[pml_index].pdp_base_addr));
     }
 
+    // Smaller pages mapped earlier in this 1GiB keep their tables
+    if ((page_size == PAGE_SIZE_1GB) && 
+	(pdpe[pdpe_index].present == 1) && (pdpe[pdpe_index].large_page == 0)) {
+	page_size = PAGE_SIZE_2MB;
+    }
+
+    // Fix up the 1GiB PDPE and exit here
+    if (page_size == PAGE_SIZE_1GB) {
+	pdpe1gb = (pdpe64_1GB_t *)pdpe;
+
+	*actual_start = BASE_TO_PAGE_ADDR_1GB(PAGE_BASE_ADDR_1GB(fault_addr));
+	*actual_end = BASE_TO_PAGE_ADDR_1GB(PAGE_BASE_ADDR_1GB(fault_addr)+1)-1;
+
+	if (pdpe1gb[pdpe_index].present == 0) {
+	    pdpe1gb[pdpe_index].user_page = 1;
+	    pdpe1gb[pdpe_index].large_page = 1;
+
+	    if ( (region->flags.alloced == 1) && 
+		 (region->flags.read == 1)) {
+		// Full access
+		pdpe1gb[pdpe_index].present = 1;
+
+		if (region->flags.write == 1) {
+		    pdpe1gb[pdpe_index].writable = 1;
+		} else {
+		    pdpe1gb[pdpe_index].writable = 0;
+		}
+
+		if (v3_gpa_to_hpa(core, fault_addr, &host_addr) == -1) {
+		    PrintError(core->vm_info, core, "Error Could not translate fault addr (%p)\n", (void *)fault_addr);
+		    return -1;
+		}
+
+		pdpe1gb[pdpe_index].page_base_addr = PAGE_BASE_ADDR_1GB(host_addr);
+		core->direct_map_stats.num_1g++;
+	    } else {
+		return region->unhandled(core, fault_addr, fault_addr, region, error_code);
+	    }
+	} else {
+	    // We fix all permissions on the first pass, 
+	    // so we only get here if its an unhandled exception
+
+	    return region->unhandled(core, fault_addr, fault_addr, region, error_code);
+	}
+
+	// All done
+	return 0;
+    }
+
     // Fix up the PDPE entry
     if (pdpe[pdpe_index].present == 0) {
 	pde = (pde64_t *)create_generic_pt_page(core);
@@ -93,22 +143,32 @@ static inline int handle_passthrough_pagefault_64(struct guest_info * core, addr
 	pdpe[pdpe_index].present = 1;
 	pdpe[pdpe_index].writable = 1;
 	pdpe[pdpe_index].user_page = 1;
+	pdpe[pdpe_index].large_page = 0;   // may have held an invalidated 1GiB page
 
 	pdpe[pdpe_index].pd_base_addr = PAGE_BASE_ADDR_4KB((addr_t)V3_PAddr(pde));    
+    } else if (pdpe[pdpe_index].large_page == 1) {
+	// already mapped by a 1GiB page, so this is an unhandled exception
+	return region->unhandled(core, fault_addr, fault_addr, region, error_code);
     } else {
 	pde = V3_VAddr((void*)BASE_TO_PAGE_ADDR_4KB(pdpe[pdpe_index].pd_base_addr));
     }
 
+    // 4KiB pages mapped earlier in this 2MiB keep their table
+    if ((page_size == PAGE_SIZE_2MB) && 
+	(pde[pde_index].present == 1) && (pde[pde_index].large_page == 0)) {
+	page_size = PAGE_SIZE_4KB;
+    }
+
     // Fix up the 2MiB PDE and exit here
     if (page_size == PAGE_SIZE_2MB) {
 	pde2mb = (pde64_2MB_t *)pde; // all but these two lines are the same for PTE
-	pde2mb[pde_index].large_page = 1;
 
 	*actual_start = BASE_TO_PAGE_ADDR_2MB(PAGE_BASE_ADDR_2MB(fault_addr));
 	*actual_end = BASE_TO_PAGE_ADDR_2MB(PAGE_BASE_ADDR_2MB(fault_addr)+1)-1;
 
 	if (pde2mb[pde_index].present == 0) {
 	    pde2mb[pde_index].user_page = 1;
+	    pde2mb[pde_index].large_page = 1;
 
 	    if ( (region->flags.alloced == 1) && 
 		 (region->flags.read == 1)) {
@@ -127,6 +187,7 @@ static inline int handle_passthrough_pagefault_64(struct guest_info * core, addr
 		}
 
 		pde2mb[pde_index].page_base_addr = PAGE_BASE_ADDR_2MB(host_addr);
+		core->direct_map_stats.num_2m++;
 	    } else {
 		return region->unhandled(core, fault_addr, fault_addr, region, error_code);
 	    }
@@ -153,8 +214,12 @@ static inline int handle_passthrough_pagefault_64(struct guest_info * core, addr
 	pde[pde_index].present = 1;
 	pde[pde_index].writable = 1;
 	pde[pde_index].user_page = 1;
+	pde[pde_index].large_page = 0;   // may have held an invalidated 2MiB page
 	
 	pde[pde_index].pt_base_addr = PAGE_BASE_ADDR_4KB((addr_t)V3_PAddr(pte));
+    } else if (pde[pde_index].large_page == 1) {
+	// already mapped by a 2MiB page, so this is an unhandled exception
+	return region->unhandled(core, fault_addr, fault_addr, region, error_code);
     } else {
 	pte = V3_VAddr((void*)BASE_TO_PAGE_ADDR_4KB(pde[pde_index].pt_base_addr));
     }
@@ -180,6 +245,7 @@ static inline int handle_passthrough_pagefault_64(struct guest_info * core, addr
    	    }
 
 	    pte[pte_index].page_base_addr = PAGE_BASE_ADDR_4KB(host_addr);
+	    core->direct_map_stats.num_4k++;
 	} else {
 	    return region->unhandled(core, fault_addr, fault_addr, region, error_code);
 	}
@@ -211,12 +277,8 @@ static inline int invalidate_addr_64_internal(struct guest_info * core, addr_t i
     int pte_index = PTE64_INDEX(inv_addr);
 
     
-    // Lookup the correct PDE address based on the PAGING MODE
-    if (core->shdw_pg_mode == SHADOW_PAGING) {
-	pml = CR3_TO_PML4E64_VA(core->ctrl_regs.cr3);
-    } else {
-	pml = CR3_TO_PML4E64_VA(core->direct_map_pt);
-    }
+    // Direct map only, CR3 may hold a shadow table
+    pml = CR3_TO_PML4E64_VA(core->direct_map_pt);
 
     if (pml[pml_index].present == 0) {
         *actual_start = BASE_TO_PAGE_ADDR_512GB(PAGE_BASE_ADDR_512GB(inv_addr));
@@ -231,6 +293,7 @@ static inline int invalidate_addr_64_internal(struct guest_info * core, addr_t i
         *actual_size = PAGE_SIZE_1GB;
 	return 0;
     } else if (pdpe[pdpe_index].large_page == 1) { // 1GiB
+	core->direct_map_stats.num_1g--;
 	pdpe[pdpe_index].present = 0;
 	pdpe[pdpe_index].writable = 0;
 	pdpe[pdpe_index].user_page = 0;
@@ -246,6 +309,7 @@ static inline int invalidate_addr_64_internal(struct guest_info * core, addr_t i
         *actual_size = PAGE_SIZE_2MB;
 	return 0;
     } else if (pde[pde_index].large_page == 1) { // 2MiB
+	core->direct_map_stats.num_2m--;
 	pde[pde_index].present = 0;
 	pde[pde_index].writable = 0;
 	pde[pde_index].user_page = 0;
@@ -256,6 +320,10 @@ static inline int invalidate_addr_64_internal(struct guest_info * core, addr_t i
 
     pte = V3_VAddr((void*)BASE_TO_PAGE_ADDR(pde[pde_index].pt_base_addr));
 
+    if (pte[pte_index].present == 1) {
+	core->direct_map_stats.num_4k--;
+    }
+
     pte[pte_index].present = 0; // 4KiB
     pte[pte_index].writable = 0;
     pte[pte_index].user_page = 0;
@@ -279,31 +347,175 @@ static inline int invalidate_addr_64(struct guest_info * core, addr_t inv_addr,
   return rc;
 }
    
+// Account for the mappings in a table being cut out of the map, and orphan it
+static inline void orphan_pt_64(struct guest_info * core, pte64_t * pte, struct pt_orphans * orphans) {
+    int i;
+
+    for (i = 0; i < MAX_PTE64_ENTRIES; i++) {
+	if (pte[i].present == 1) {
+	    core->direct_map_stats.num_4k--;
+	}
+    }
+
+    orphan_pt_page(orphans, pte);
+}
+
+static inline void orphan_pd_64(struct guest_info * core, pde64_t * pde, struct pt_orphans * orphans) {
+    int i;
+
+    for (i = 0; i < MAX_PDE64_ENTRIES; i++) {
+	if (pde[i].present == 0) {
+	    continue;
+	} else if (pde[i].large_page == 1) {
+	    core->direct_map_stats.num_2m--;
+	    continue;
+	}
+
+	orphan_pt_64(core, V3_VAddr((void*)BASE_TO_PAGE_ADDR(pde[i].pt_base_addr)), orphans);
+    }
+
+    orphan_pt_page(orphans, pde);
+}
+
+static inline void orphan_pdp_64(struct guest_info * core, pdpe64_t * pdpe, struct pt_orphans * orphans) {
+    int i;
+
+    for (i = 0; i < MAX_PDPE64_ENTRIES; i++) {
+	if (pdpe[i].present == 0) {
+	    continue;
+	} else if (pdpe[i].large_page == 1) {
+	    core->direct_map_stats.num_1g--;
+	    continue;
+	}
+
+	orphan_pd_64(core, V3_VAddr((void*)BASE_TO_PAGE_ADDR(pdpe[i].pd_base_addr)), orphans);
+    }
+
+    orphan_pt_page(orphans, pdpe);
+}
+
+// One walk over the range.  An entry whose span the range covers is cleared
+// where it is found, and the tables below it are orphaned as a whole
 static inline int invalidate_addr_64_range(struct guest_info * core, addr_t inv_addr_start, addr_t inv_addr_end, 
 					   addr_t *actual_start, addr_t *actual_end)
 {
-  addr_t next;
-  addr_t start;
-  uint64_t len;
-  int rc;
-  
-  for (next=inv_addr_start; next<=inv_addr_end; ) {
-    rc = invalidate_addr_64_internal(core,next,&start, &len);
-    if (next==inv_addr_start) { 
-      // first iteration, capture where we start invalidating
-      *actual_start = start;
-    }
-    if (rc) { 
-      return rc;
+    struct pt_orphans orphans = {0, 0, 0};
+    pml4e64_t * pml = NULL;
+    addr_t addr = inv_addr_start;
+
+    *actual_start = inv_addr_start;
+    *actual_end = inv_addr_end;
+
+    // Tables are cut out and freed, so never walk from CR3, which may hold a shadow table
+    pml = CR3_TO_PML4E64_VA(core->direct_map_pt);
+
+    while (addr <= inv_addr_end) {
+	int pml_index = PML4E64_INDEX(addr);
+	addr_t pml_base = BASE_TO_PAGE_ADDR_512GB(PAGE_BASE_ADDR_512GB(addr));
+	addr_t pml_limit = pml_base + PAGE_SIZE_512GB;
+	pdpe64_t * pdpe = NULL;
+
+	if (pml[pml_index].present == 0) {
+	    note_span(pml_base, PAGE_SIZE_512GB, actual_start, actual_end);
+	    addr = pml_limit;
+	    continue;
+	}
+
+	pdpe = V3_VAddr((void*)BASE_TO_PAGE_ADDR(pml[pml_index].pdp_base_addr));
+
+	if (span_inside(pml_base, PAGE_SIZE_512GB, inv_addr_start, inv_addr_end)) {
+	    orphan_pdp_64(core, pdpe, &orphans);
+	    pml[pml_index].present = 0;
+	    pml[pml_index].writable = 0;
+	    pml[pml_index].user_page = 0;
+	    addr = pml_limit;
+	    continue;
+	}
+
+	while ((addr <= inv_addr_end) && (addr < pml_limit)) {
+	    int pdpe_index = PDPE64_INDEX(addr);
+	    addr_t pdpe_base = BASE_TO_PAGE_ADDR_1GB(PAGE_BASE_ADDR_1GB(addr));
+	    addr_t pdpe_limit = pdpe_base + PAGE_SIZE_1GB;
+	    pde64_t * pde = NULL;
+
+	    if (pdpe[pdpe_index].present == 0) {
+		note_span(pdpe_base, PAGE_SIZE_1GB, actual_start, actual_end);
+		addr = pdpe_limit;
+		continue;
+	    } else if (pdpe[pdpe_index].large_page == 1) { // 1GiB
+		core->direct_map_stats.num_1g--;
+		pdpe[pdpe_index].present = 0;
+		pdpe[pdpe_index].writable = 0;
+		pdpe[pdpe_index].user_page = 0;
+		note_span(pdpe_base, PAGE_SIZE_1GB, actual_start, actual_end);
+		addr = pdpe_limit;
+		continue;
+	    }
+
+	    pde = V3_VAddr((void*)BASE_TO_PAGE_ADDR(pdpe[pdpe_index].pd_base_addr));
+
+	    if (span_inside(pdpe_base, PAGE_SIZE_1GB, inv_addr_start, inv_addr_end)) {
+		orphan_pd_64(core, pde, &orphans);
+		pdpe[pdpe_index].present = 0;
+		pdpe[pdpe_index].writable = 0;
+		pdpe[pdpe_index].user_page = 0;
+		addr = pdpe_limit;
+		continue;
+	    }
+
+	    while ((addr <= inv_addr_end) && (addr < pdpe_limit)) {
+		int pde_index = PDE64_INDEX(addr);
+		addr_t pde_base = BASE_TO_PAGE_ADDR_2MB(PAGE_BASE_ADDR_2MB(addr));
+		addr_t pde_limit = pde_base + PAGE_SIZE_2MB;
+		pte64_t * pte = NULL;
+
+		if (pde[pde_index].present == 0) {
+		    note_span(pde_base, PAGE_SIZE_2MB, actual_start, actual_end);
+		    addr = pde_limit;
+		    continue;
+		} else if (pde[pde_index].large_page == 1) { // 2MiB
+		    core->direct_map_stats.num_2m--;
+		    pde[pde_index].present = 0;
+		    pde[pde_index].writable = 0;
+		    pde[pde_index].user_page = 0;
+		    note_span(pde_base, PAGE_SIZE_2MB, actual_start, actual_end);
+		    addr = pde_limit;
+		    continue;
+		}
+
+		pte = V3_VAddr((void*)BASE_TO_PAGE_ADDR(pde[pde_index].pt_base_addr));
+
+		if (span_inside(pde_base, PAGE_SIZE_2MB, inv_addr_start, inv_addr_end)) {
+		    orphan_pt_64(core, pte, &orphans);
+		    pde[pde_index].present = 0;
+		    pde[pde_index].writable = 0;
+		    pde[pde_index].user_page = 0;
+		    addr = pde_limit;
+		    continue;
+		}
+
+		while ((addr <= inv_addr_end) && (addr < pde_limit)) {
+		    int pte_index = PTE64_INDEX(addr);
+
+		    if (pte[pte_index].present == 1) {
+			core->direct_map_stats.num_4k--;
+		    }
+
+		    pte[pte_index].present = 0; // 4KiB
+		    pte[pte_index].writable = 0;
+		    pte[pte_index].user_page = 0;
+
+		    note_span(PAGE_ADDR_4KB(addr), PAGE_SIZE_4KB, actual_start, actual_end);
+		    addr = PAGE_ADDR_4KB(addr) + PAGE_SIZE_4KB;
+		}
+	    }
+	}
     }
-    next = start + len;
-    *actual_end = next;
-  }
-  // last iteration, actual_end is off by one
-  (*actual_end)--;
-  return 0;
-}
 
+    queue_direct_map_flush(core, &orphans);
+
+    return 0;
+}
 
 
 #endif
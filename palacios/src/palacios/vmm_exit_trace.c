@@ -0,0 +1,159 @@
+/*
+ * This file is part of the Palacios Virtual Machine Monitor developed
+ * by the V3VEE Project with funding from the United States National 
+ * Science Foundation and the Department of Energy.  
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  You can find out more at 
+ * http://www.v3vee.org
+ *
+ * Copyright (c) 2026, The V3VEE Project <http://www.v3vee.org> 
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "V3VEE_LICENSE".
+ */
+
+#include <palacios/vmm.h>
+#include <palacios/vm_guest.h>
+#include <palacios/vmm_exit_trace.h>
+#include <palacios/vmm_lock.h>
+
+
+#ifdef V3_CONFIG_EXIT_TRACE_RECORDS
+#define EXIT_TRACE_RECORDS V3_CONFIG_EXIT_TRACE_RECORDS
+#else
+#define EXIT_TRACE_RECORDS 8192
+#endif
+
+
+/*
+ * The ring pages can be mapped by the host, and a mapping can outlive 
+ * the VM.  They are therefore owned by a refcounted buffer: the core 
+ * holds one reference and every host connection holds another, and the
+ * pages are freed when the last one is dropped.
+ */
+struct v3_exit_trace_buf {
+    void * ring_pa;
+    uint32_t num_pages;
+    uint32_t refs;
+    v3_lock_t lock;
+};
+
+
+static void put_buf(struct v3_exit_trace_buf * buf) {
+    addr_t flags;
+    uint32_t refs;
+
+    flags = v3_lock_irqsave(buf->lock);
+    refs = --buf->refs;
+    v3_unlock_irqrestore(buf->lock, flags);
+
+    if (refs == 0) {
+	V3_FreePages(buf->ring_pa, buf->num_pages);
+	v3_lock_deinit(&(buf->lock));
+	V3_Free(buf);
+    }
+}
+
+
+int v3_init_core_exit_trace(struct guest_info * core) {
+    struct v3_core_exit_trace * trace = &(core->exit_trace);
+    uint64_t num_recs = EXIT_TRACE_RECORDS;
+    uint64_t bytes = 0;
+    void * ring_pa = NULL;
+
+    trace->ring = NULL;
+    trace->buf = NULL;
+    trace->inject_vector = V3_EXIT_TRACE_NO_INJECT;
+
+    if ((num_recs == 0) || (num_recs & (num_recs - 1))) {
+	PrintError(core->vm_info, core, "Exit trace ring size (%llu) must be a power of 2\n", num_recs);
+	return -1;
+    }
+
+    bytes = sizeof(struct v3_exit_trace_ring) + (num_recs * sizeof(struct v3_exit_trace_rec));
+    trace->num_pages = (bytes + PAGE_SIZE_4KB - 1) / PAGE_SIZE_4KB;
+
+    trace->buf = V3_Malloc(sizeof(struct v3_exit_trace_buf));
+
+    if (!trace->buf) {
+	PrintError(core->vm_info, core, "Cannot allocate exit trace buffer\n");
+	return -1;
+    }
+
+    // Contiguous so that the host can map it in one piece
+    ring_pa = V3_AllocPages(trace->num_pages);
+
+    if (!ring_pa) {
+	PrintError(core->vm_info, core, "Cannot allocate exit trace ring (%u pages)\n", trace->num_pages);
+	V3_Free(trace->buf);
+	trace->buf = NULL;
+	return -1;
+    }
+
+    trace->buf->ring_pa = ring_pa;
+    trace->buf->num_pages = trace->num_pages;
+    trace->buf->refs = 1;
+    v3_lock_init(&(trace->buf->lock));
+
+    trace->ring = V3_VAddr(ring_pa);
+
+    memset(trace->ring, 0, trace->num_pages * PAGE_SIZE_4KB);
+
+    trace->ring->num_recs = num_recs;
+    trace->ring->vcore = core->vcpu_id;
+
+    return 0;
+}
+
+
+int v3_deinit_core_exit_trace(struct guest_info * core) {
+    struct v3_core_exit_trace * trace = &(core->exit_trace);
+
+    trace->ring = NULL;
+
+    // The pages stay around while the host still has the ring open
+    if (trace->buf) {
+	put_buf(trace->buf);
+	trace->buf = NULL;
+    }
+
+    return 0;
+}
+
+
+int v3_exit_trace_get_ring(struct v3_vm_info * vm, int vcore, void ** ring_pa, uint64_t * size,
+			   struct v3_exit_trace_buf ** buf) {
+    struct v3_core_exit_trace * trace = NULL;
+    addr_t flags;
+
+    if ((vcore < 0) || (vcore >= vm->num_cores)) {
+	PrintError(vm, VCORE_NONE, "Invalid core (%d) for exit trace\n", vcore);
+	return -1;
+    }
+
+    trace = &(vm->cores[vcore].exit_trace);
+
+    if (!trace->buf) {
+	PrintError(vm, VCORE_NONE, "No exit trace ring for core %d\n", vcore);
+	return -1;
+    }
+
+    flags = v3_lock_irqsave(trace->buf->lock);
+    trace->buf->refs++;
+    v3_unlock_irqrestore(trace->buf->lock, flags);
+
+    *ring_pa = trace->buf->ring_pa;
+    *size = trace->buf->num_pages * PAGE_SIZE_4KB;
+    *buf = trace->buf;
+
+    return 0;
+}
+
+
+void v3_exit_trace_put_ring(struct v3_exit_trace_buf * buf) {
+    if (buf) {
+	put_buf(buf);
+    }
+}
@@ -41,12 +41,15 @@ void v3_init_io_map(struct v3_vm_info * vm) {
   vm->io_map.arch_data = NULL;
   vm->io_map.update_map = NULL;
 
+  memset(vm->io_map.port_table, 0, sizeof(vm->io_map.port_table));
+
 }
 
 int v3_deinit_io_map(struct v3_vm_info * vm) {
     struct rb_node * node = v3_rb_first(&(vm->io_map.map));
     struct v3_io_hook * hook = NULL;
     struct rb_node * tmp_node = NULL;
+    int i = 0;
 
     while (node) {
 	hook = rb_entry(node, struct v3_io_hook, tree_node);
@@ -56,6 +59,13 @@ int v3_deinit_io_map(struct v3_vm_info * vm) {
 	free_hook(vm, hook);
     }
 
+    for (i = 0; i < V3_IO_NUM_BLOCKS; i++) {
+	if (vm->io_map.port_table[i]) {
+	    V3_Free(vm->io_map.port_table[i]);
+	    vm->io_map.port_table[i] = NULL;
+	}
+    }
+
     return 0;
 }
 
@@ -99,7 +109,7 @@ static inline struct v3_io_hook * insert_io_hook(struct v3_vm_info * vm, struct
 }
 
 
-struct v3_io_hook * v3_get_io_hook(struct v3_vm_info * vm, uint16_t port) {
+static struct v3_io_hook * lookup_io_hook_tree(struct v3_vm_info * vm, uint16_t port) {
   struct rb_node * n = vm->io_map.map.rb_node;
   struct v3_io_hook * hook = NULL;
 
@@ -119,6 +129,44 @@ struct v3_io_hook * v3_get_io_hook(struct v3_vm_info * vm, uint16_t port) {
 }
 
 
+struct v3_io_hook * v3_get_io_hook(struct v3_vm_info * vm, uint16_t port) {
+    struct v3_io_hook ** block = vm->io_map.port_table[port >> V3_IO_BLOCK_SHIFT];
+
+    if (block == NULL) {
+	return NULL;
+    }
+
+    return block[port & (V3_IO_BLOCK_PORTS - 1)];
+}
+
+
+static inline void set_port_table_entry(struct v3_vm_info * vm, uint16_t port, struct v3_io_hook * hook) {
+    struct v3_io_hook ** block = vm->io_map.port_table[port >> V3_IO_BLOCK_SHIFT];
+
+    if (block) {
+	block[port & (V3_IO_BLOCK_PORTS - 1)] = hook;
+    }
+}
+
+
+static int alloc_port_block(struct v3_vm_info * vm, uint16_t port) {
+    struct v3_io_hook *** block = &(vm->io_map.port_table[port >> V3_IO_BLOCK_SHIFT]);
+
+    if (*block) {
+	return 0;
+    }
+
+    *block = V3_Malloc(sizeof(struct v3_io_hook *) * V3_IO_BLOCK_PORTS);
+
+    if (!*block) {
+	return -1;
+    }
+
+    memset(*block, 0, sizeof(struct v3_io_hook *) * V3_IO_BLOCK_PORTS);
+
+    return 0;
+}
+
 
 
 
@@ -150,17 +198,27 @@ int v3_hook_io_port(struct v3_vm_info * vm, uint16_t port,
 
   io_hook->priv_data = priv_data;
 
+  if (alloc_port_block(vm, port) == -1) {
+      PrintError(vm, VCORE_NONE, "Cannot allocate IO port table block for port %u (0x%x)\n", port, port);
+      V3_Free(io_hook);
+      return -1;
+  }
+
   if (insert_io_hook(vm, io_hook)) {
       PrintError(vm, VCORE_NONE, "Could not insert IO hook for port %u (0x%x)\n", port, port);
       V3_Free(io_hook);
       return -1;
   }
 
+  set_port_table_entry(vm, port, io_hook);
+
   if (vm->io_map.update_map) {
       if (vm->io_map.update_map(vm, port, 
 				  ((read == NULL) ? 0 : 1), 
 				  ((write == NULL) ? 0 : 1)) == -1) {
 	  PrintError(vm, VCORE_NONE, "Could not update IO map for port %u (0x%x)\n", port, port);
+	  set_port_table_entry(vm, port, NULL);
+	  v3_rb_erase(&(io_hook->tree_node), &(vm->io_map.map));
 	  V3_Free(io_hook);
 	  return -1;
       }
@@ -171,6 +229,7 @@ int v3_hook_io_port(struct v3_vm_info * vm, uint16_t port,
 
 
 static int free_hook(struct v3_vm_info * vm, struct v3_io_hook * hook) {
+    set_port_table_entry(vm, hook->port, NULL);
     v3_rb_erase(&(hook->tree_node), &(vm->io_map.map));
 
     if (vm->io_map.update_map) {
@@ -236,6 +295,67 @@ void v3_print_io_map(struct v3_vm_info * vm) {
 
 
 
+/* Compares the cost of the port table lookup with the tree walk it replaced,
+ * using the set of ports currently hooked in this VM
+ */
+#define IO_BENCH_ITERS 100000
+
+void v3_bench_io_map(struct v3_vm_info * vm) {
+    struct v3_io_hook * tmp_hook = NULL;
+    uint16_t * ports = NULL;
+    uint64_t start = 0;
+    uint64_t tree_cycles = 0;
+    uint64_t table_cycles = 0;
+    uint64_t found = 0;
+    uint32_t num_ports = 0;
+    uint32_t i = 0;
+
+    v3_rb_for_each_entry(tmp_hook, &(vm->io_map.map), tree_node) {
+	num_ports++;
+    }
+
+    if (num_ports == 0) {
+	V3_Print(vm, VCORE_NONE, "IO map benchmark: no ports hooked\n");
+	return;
+    }
+
+    ports = V3_Malloc(sizeof(uint16_t) * num_ports);
+
+    if (!ports) {
+	PrintError(vm, VCORE_NONE, "Cannot allocate port list for IO map benchmark\n");
+	return;
+    }
+
+    i = 0;
+    v3_rb_for_each_entry(tmp_hook, &(vm->io_map.map), tree_node) {
+	ports[i++] = tmp_hook->port;
+    }
+
+    // Stride through the hooked ports so consecutive lookups do not hit the same node
+    rdtscll(start);
+    for (i = 0; i < IO_BENCH_ITERS; i++) {
+	found += (lookup_io_hook_tree(vm, ports[(i * 7) % num_ports]) != NULL);
+    }
+    rdtscll(tree_cycles);
+    tree_cycles -= start;
+
+    rdtscll(start);
+    for (i = 0; i < IO_BENCH_ITERS; i++) {
+	found += (v3_get_io_hook(vm, ports[(i * 7) % num_ports]) != NULL);
+    }
+    rdtscll(table_cycles);
+    table_cycles -= start;
+
+    V3_Print(vm, VCORE_NONE, "IO map benchmark: %u hooked ports, %d lookups each (found=%llu)\n", 
+	     num_ports, IO_BENCH_ITERS, found);
+    V3_Print(vm, VCORE_NONE, "IO map benchmark: tree=%llu cycles/lookup, table=%llu cycles/lookup\n", 
+	     tree_cycles / IO_BENCH_ITERS, table_cycles / IO_BENCH_ITERS);
+
+    V3_Free(ports);
+}
+
+
+
 /*
  * Write a byte to an I/O port.
  */
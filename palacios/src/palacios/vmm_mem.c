@@ -29,6 +29,10 @@
 
 #include <interfaces/vmm_numa.h>
 
+#ifdef V3_CONFIG_TELEMETRY
+#include <palacios/vmm_telemetry.h>
+#endif
+
 #ifdef V3_CONFIG_SWAPPING
 #include <palacios/vmm_swapping.h>
 #endif
@@ -55,6 +59,13 @@ struct v3_mem_region * v3_get_base_region(struct v3_vm_info * vm, addr_t gpa) {
 
     reg = &(map->base_regions[block_index]);
 
+#ifdef V3_CONFIG_CHECKPOINT
+    if (v3_postcopy_check(&(vm->postcopy), vm, gpa)) {
+	PrintError(vm, VCORE_NONE, "Memory at GPA=%p was lost in post-copy migration or lazy load\n", (void *)gpa);
+	return NULL;
+    }
+#endif
+
 #ifdef V3_CONFIG_SWAPPING
     if(vm->swap_state.enable_swapping) {
 	if (reg->flags.swapped) {
@@ -64,6 +75,12 @@ struct v3_mem_region * v3_get_base_region(struct v3_vm_info * vm, addr_t gpa) {
 		return NULL;
 	    }
 	}
+
+	// swapped in by chunks, and ours may not be there yet
+	if (reg->swap_state.absent && v3_swap_wait(vm,reg,gpa)) { 
+	    PrintError(vm, VCORE_NONE, "Unable to swap in GPA=%p!!!\n",(void*)gpa);
+	    return NULL;
+	}
     }
     v3_touch_region(vm,reg);
 #endif
@@ -162,9 +179,44 @@ static int will_use_shadow_paging(struct v3_vm_info *vm)
 #define CEIL_DIV(x,y) (((x)/(y)) + !!((x)%(y)))
 
 
+// Base regions are backed by blocks aligned to the largest page that fits 
+// in them (or the VM's requested alignment), so they can be mapped with 
+// large pages in the passthrough and nested page tables
+static uint32_t base_region_alignment(struct v3_vm_info * vm) {
+#ifdef V3_CONFIG_ALIGNED_PG_ALLOC
+    uint32_t align = ((v3_mem_block_size >= PAGE_SIZE_1GB) ? PAGE_SIZE_1GB :
+		      (v3_mem_block_size >= PAGE_SIZE_2MB) ? PAGE_SIZE_2MB : 
+		      PAGE_SIZE_4KB);
+
+    if ((vm->mem_align > align) && (vm->mem_align <= v3_mem_block_size)) {
+	align = vm->mem_align;
+    }
+
+    return align;
+#else
+    return PAGE_SIZE_4KB;
+#endif
+}
+
+
+#ifdef V3_CONFIG_TELEMETRY
+static void telemetry_cb(struct v3_vm_info * vm, void * private_data, char * hdr) {
+    int i = 0;
+
+    for (i = 0; i < vm->num_cores; i++) {
+	struct guest_info * core = &(vm->cores[i]);
+
+	V3_Print(vm, core, "%s Mem region cache: hits=%llu misses=%llu\n", hdr, 
+		 core->mem_cache.hits, core->mem_cache.misses);
+    }
+}
+#endif
+
+
 int v3_init_mem_map(struct v3_vm_info * vm) {
     struct v3_mem_map * map = &(vm->mem_map);
     addr_t block_pages = v3_mem_block_size >> 12;
+    uint32_t block_align = base_region_alignment(vm);
     int i = 0;
     uint64_t num_base_regions_host_mem;
 
@@ -176,6 +228,9 @@ int v3_init_mem_map(struct v3_vm_info * vm) {
 
     map->mem_regions.rb_node = NULL;
 
+    // The core caches start zeroed, so they will be flushed on first use
+    map->generation = 1;
+
 #ifdef V3_CONFIG_SWAPPING
     if (vm->swap_state.enable_swapping) {
         num_base_regions_host_mem = CEIL_DIV(vm->swap_state.host_mem_size, v3_mem_block_size);
@@ -184,6 +239,8 @@ int v3_init_mem_map(struct v3_vm_info * vm) {
 
     PrintDebug(VM_NONE, VCORE_NONE, "v3_init_mem_map: %llu base regions will be allocated of %llu base regions in guest\n",
 	       (uint64_t)num_base_regions_host_mem, (uint64_t)map->num_base_regions);
+
+    V3_Print(vm, VCORE_NONE, "Base regions will be aligned to 0x%x\n", block_align);
     
     map->base_regions = V3_VMalloc(sizeof(struct v3_mem_region) * map->num_base_regions);
     if (map->base_regions == NULL) {
@@ -219,7 +276,7 @@ int v3_init_mem_map(struct v3_vm_info * vm) {
 #endif
 
 	    region->host_addr = (addr_t)V3_AllocPagesExtended(block_pages,
-							      PAGE_SIZE_4KB,
+							      block_align,
 							      node_id,
 							      vm->resource_control.pg_filter_func,
 							      vm->resource_control.pg_filter_state);
@@ -228,6 +285,14 @@ int v3_init_mem_map(struct v3_vm_info * vm) {
 		PrintError(vm, VCORE_NONE, "Could not allocate guest memory\n");
 		return -1;
 	    }
+
+	    if (region->host_addr % block_align) { 
+		PrintError(vm, VCORE_NONE, "Host returned guest memory at %p, which is not aligned to 0x%x\n",
+			   (void *)region->host_addr, block_align);
+		V3_FreePages((void *)region->host_addr, block_pages);
+		region->host_addr = 0;
+		return -1;
+	    }
 	    
 	    // Clear the memory...
 	    memset(V3_VAddr((void *)region->host_addr), 0, v3_mem_block_size);
@@ -264,6 +329,10 @@ int v3_init_mem_map(struct v3_vm_info * vm) {
 
     v3_register_hypercall(vm, MEM_OFFSET_HCALL, mem_offset_hypercall, NULL);
 
+#ifdef V3_CONFIG_TELEMETRY
+    v3_add_telemetry_cb(vm, telemetry_cb, NULL);
+#endif
+
     return 0;
 }
 
@@ -408,6 +477,8 @@ int v3_insert_mem_region(struct v3_vm_info * vm, struct v3_mem_region * region)
 
     v3_rb_insert_color(&(region->tree_node), &(vm->mem_map.mem_regions));
 
+    // Must follow the tree update, so a racing lookup cannot cache the old tree under the new generation
+    vm->mem_map.generation++;
 
     rc = 0;
 
@@ -437,7 +508,7 @@ int v3_insert_mem_region(struct v3_vm_info * vm, struct v3_mem_region * region)
 
 
 
-struct v3_mem_region * v3_get_mem_region(struct v3_vm_info * vm, uint16_t core_id, addr_t guest_addr) {
+static struct v3_mem_region * lookup_mem_region(struct v3_vm_info * vm, uint16_t core_id, addr_t guest_addr) {
     struct rb_node * n = vm->mem_map.mem_regions.rb_node;
     struct v3_mem_region * reg = NULL;
 
@@ -469,6 +540,102 @@ struct v3_mem_region * v3_get_mem_region(struct v3_vm_info * vm, uint16_t core_i
 	}
     }
 
+    return NULL;
+}
+
+
+/* Returns 1 if any sub region (for any core) overlaps the given page */
+static int page_has_region(struct v3_vm_info * vm, addr_t page_addr) {
+    struct rb_node * n = vm->mem_map.mem_regions.rb_node;
+    struct v3_mem_region * reg = NULL;
+
+    while (n) {
+	reg = rb_entry(n, struct v3_mem_region, tree_node);
+
+	if (reg->guest_end <= page_addr) {
+	    n = n->rb_right;
+	} else if (reg->guest_start >= page_addr + PAGE_SIZE_4KB) {
+	    n = n->rb_left;
+	} else {
+	    return 1;
+	}
+    }
+
+    return 0;
+}
+
+
+static inline void flush_mem_cache(struct v3_mem_cache * cache, uint64_t generation) {
+    cache->last.valid = 0;
+    memset(cache->entries, 0, sizeof(cache->entries));
+    cache->generation = generation;
+}
+
+
+struct v3_mem_region * v3_get_mem_region(struct v3_vm_info * vm, uint16_t core_id, addr_t guest_addr) {
+    struct v3_mem_cache * cache = NULL;
+    struct v3_mem_cache_entry * entry = NULL;
+    struct v3_mem_region * reg = NULL;
+    addr_t page_addr = PAGE_ADDR_4KB(guest_addr);
+    uint64_t generation = vm->mem_map.generation;
+
+    if (core_id >= vm->num_cores) {
+	// Lookups not tied to a specific core bypass the cache
+	reg = lookup_mem_region(vm, core_id, guest_addr);
+
+	return (reg) ? reg : v3_get_base_region(vm, guest_addr);
+    }
+
+    cache = &(vm->cores[core_id].mem_cache);
+
+    if (cache->generation != generation) {
+	flush_mem_cache(cache, generation);
+    }
+
+    if (cache->last.valid) {
+	if ((cache->last.reg) && 
+	    (guest_addr >= cache->last.reg->guest_start) && 
+	    (guest_addr < cache->last.reg->guest_end)) {
+	    cache->hits++;
+	    return cache->last.reg;
+	} else if ((cache->last.reg == NULL) && (cache->last.page_addr == page_addr)) {
+	    cache->hits++;
+	    return v3_get_base_region(vm, guest_addr);
+	}
+    }
+
+    entry = &(cache->entries[(page_addr >> 12) & (V3_MEM_CACHE_ENTRIES - 1)]);
+
+    if ((entry->valid) && (entry->page_addr == page_addr)) {
+	cache->hits++;
+	cache->last = *entry;
+
+	return (entry->reg) ? entry->reg : v3_get_base_region(vm, guest_addr);
+    }
+
+    cache->misses++;
+
+    reg = lookup_mem_region(vm, core_id, guest_addr);
+
+    // Only cache results that hold for the entire page
+    if (reg) {
+	if ((reg->guest_start <= page_addr) && 
+	    (reg->guest_end >= page_addr + PAGE_SIZE_4KB)) {
+	    entry->page_addr = page_addr;
+	    entry->reg = reg;
+	    entry->valid = 1;
+	    cache->last = *entry;
+	}
+    } else if (page_has_region(vm, page_addr) == 0) {
+	entry->page_addr = page_addr;
+	entry->reg = NULL;
+	entry->valid = 1;
+	cache->last = *entry;
+    }
+
+    if (reg) {
+	return reg;
+    }
 
     // There is not registered region, so we check if its a valid address in the base region
 
@@ -606,6 +773,7 @@ void v3_delete_mem_region(struct v3_vm_info * vm, struct v3_mem_region * reg) {
 
     v3_rb_erase(&(reg->tree_node), &(vm->mem_map.mem_regions));
 
+    vm->mem_map.generation++;
 
 
     // If the guest isn't running then there shouldn't be anything to invalidate. 
@@ -647,6 +815,23 @@ void v3_delete_mem_region(struct v3_vm_info * vm, struct v3_mem_region * reg) {
 }
 
 // Determine if a given address can be handled by a large page of the requested size
+// A region only partially swapped in must be mapped with pages no larger than its chunks
+// Likewise for memory still arriving by post-copy or lazy load, as a lookup only waits 
+// for the chunk holding the address it is given
+static inline int page_size_ok(struct v3_vm_info * vm, struct v3_mem_region * reg, uint32_t page_size) {
+#ifdef V3_CONFIG_CHECKPOINT
+    if (vm->postcopy.active && (page_size > vm->postcopy.chunk_size)) {
+	return 0;
+    }
+#endif
+#ifdef V3_CONFIG_SWAPPING
+    if (vm->swap_state.enable_swapping) {
+	return v3_swap_page_size_ok(vm, reg, page_size);
+    }
+#endif
+    return 1;
+}
+
 uint32_t v3_get_max_page_size(struct guest_info * core, addr_t page_addr, v3_cpu_mode_t mode) {
     addr_t pg_start = 0;
     addr_t pg_end = 0; 
@@ -661,7 +846,8 @@ uint32_t v3_get_max_page_size(struct guest_info * core, addr_t page_addr, v3_cpu
 
 		reg = get_overlapping_region(core->vm_info, core->vcpu_id, pg_start, pg_end); 
 
-		if ((reg) && ((reg->host_addr % PAGE_SIZE_4MB) == 0)) {
+		if ((reg) && ((reg->host_addr % PAGE_SIZE_4MB) == 0) &&
+		    page_size_ok(core->vm_info, reg, PAGE_SIZE_4MB)) {
 		    page_size = PAGE_SIZE_4MB;
 		}
 	    }
@@ -673,7 +859,8 @@ uint32_t v3_get_max_page_size(struct guest_info * core, addr_t page_addr, v3_cpu
 
 		reg = get_overlapping_region(core->vm_info, core->vcpu_id, pg_start, pg_end);
 
-		if ((reg) && ((reg->host_addr % PAGE_SIZE_2MB) == 0)) {
+		if ((reg) && ((reg->host_addr % PAGE_SIZE_2MB) == 0) &&
+		    page_size_ok(core->vm_info, reg, PAGE_SIZE_2MB)) {
 		    page_size = PAGE_SIZE_2MB;
 		}
 	    }
@@ -687,7 +874,8 @@ uint32_t v3_get_max_page_size(struct guest_info * core, addr_t page_addr, v3_cpu
 		
 		reg = get_overlapping_region(core->vm_info, core->vcpu_id, pg_start, pg_end);
 		
-		if ((reg) && ((reg->host_addr % PAGE_SIZE_1GB) == 0)) {
+		if ((reg) && ((reg->host_addr % PAGE_SIZE_1GB) == 0) &&
+		    page_size_ok(core->vm_info, reg, PAGE_SIZE_1GB)) {
 		    page_size = PAGE_SIZE_1GB;
 		    break;
 		}
@@ -699,7 +887,8 @@ uint32_t v3_get_max_page_size(struct guest_info * core, addr_t page_addr, v3_cpu
 
 		reg = get_overlapping_region(core->vm_info, core->vcpu_id, pg_start, pg_end);
 		
-		if ((reg) && ((reg->host_addr % PAGE_SIZE_2MB) == 0)) {
+		if ((reg) && ((reg->host_addr % PAGE_SIZE_2MB) == 0) &&
+		    page_size_ok(core->vm_info, reg, PAGE_SIZE_2MB)) {
 		    page_size = PAGE_SIZE_2MB;
 		}
 	    }
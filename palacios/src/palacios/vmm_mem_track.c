@@ -24,6 +24,10 @@
 #include <palacios/vmm_direct_paging.h>
 #include <palacios/vmm_time.h>
 
+#ifdef V3_CONFIG_SWAPPING
+#include <palacios/vmm_swapping.h>
+#endif
+
 
 #ifndef V3_CONFIG_DEBUG_MEM_TRACK
 #undef PrintDebug
@@ -376,6 +380,11 @@ void v3_mem_track_entry(struct guest_info *core)
 	    PrintDebug(core->vm_info, core, "memtrack: start_time=%llu, period=%llu,  host_time=%llu, diff=%llu\n",
 		       core->memtrack_state.start_time, vm->memtrack_state.period, ht, ht-core->memtrack_state.start_time);
 
+#ifdef V3_CONFIG_SWAPPING
+	    // let the swapper see this period's accesses before they are lost
+	    v3_swap_sample_access(core);
+#endif
+
 	    if (vm->memtrack_state.reset_type==V3_MEM_TRACK_PERIODIC) { 
 		restart(core);
 	    } else {
@@ -24,6 +24,29 @@
 
 static int free_hook(struct v3_vm_info * vm, struct v3_msr_hook * hook);
 
+
+static const uint32_t msr_range_starts[V3_MSR_NUM_RANGES] = {
+    V3_MSR_RANGE_0_START,
+    V3_MSR_RANGE_1_START,
+    V3_MSR_RANGE_2_START
+};
+
+
+// Returns the range index of the MSR, or -1 if it is outside the direct mapped ranges
+static inline int get_msr_range(uint32_t msr) {
+    int i = 0;
+
+    for (i = 0; i < V3_MSR_NUM_RANGES; i++) {
+	// unsigned wrap on subtraction is intentional
+	if ((msr - msr_range_starts[i]) < V3_MSR_RANGE_SIZE) {
+	    return i;
+	}
+    }
+
+    return -1;
+}
+
+
 void v3_init_msr_map(struct v3_vm_info * vm) {
     struct v3_msr_map * msr_map  = &(vm->msr_map);
 
@@ -32,6 +55,9 @@ void v3_init_msr_map(struct v3_vm_info * vm) {
     INIT_LIST_HEAD(&(msr_map->hook_list));
     msr_map->num_hooks = 0;
 
+    memset(msr_map->range_hooks, 0, sizeof(msr_map->range_hooks));
+    memset(msr_map->range_dirty, 0, sizeof(msr_map->range_dirty));
+
     msr_map->arch_data = NULL;
     msr_map->update_map = NULL;
 }
@@ -39,11 +65,19 @@ void v3_init_msr_map(struct v3_vm_info * vm) {
 int v3_deinit_msr_map(struct v3_vm_info * vm) {
     struct v3_msr_hook * hook = NULL;
     struct v3_msr_hook * tmp = NULL;
+    int i = 0;
 
     list_for_each_entry_safe(hook, tmp, &(vm->msr_map.hook_list), link) {
 	free_hook(vm, hook);
     }
 
+    for (i = 0; i < V3_MSR_NUM_RANGES; i++) {
+	if (vm->msr_map.range_hooks[i]) {
+	    V3_VFree(vm->msr_map.range_hooks[i]);
+	    vm->msr_map.range_hooks[i] = NULL;
+	}
+    }
+
     return 0;
 }
 
@@ -132,6 +166,53 @@ int v3_msr_unhandled_write(struct guest_info * core, uint32_t msr, struct v3_msr
 }
 
 
+// Point the direct table entry at the hook and push it to the hardware bitmap if one exists
+static int set_msr_entry(struct v3_vm_info * vm, uint32_t msr, struct v3_msr_hook * hook) {
+    struct v3_msr_map * msr_map = &(vm->msr_map);
+    int range = get_msr_range(msr);
+    uint32_t offset = 0;
+
+    if (range == -1) {
+	// Not covered by the hardware bitmaps, these always exit
+	return 0;
+    }
+
+    offset = msr - msr_range_starts[range];
+
+    if (msr_map->range_hooks[range] == NULL) {
+	if (hook == NULL) {
+	    return 0;
+	}
+
+	msr_map->range_hooks[range] = V3_VMalloc(sizeof(struct v3_msr_hook *) * V3_MSR_RANGE_SIZE);
+
+	if (msr_map->range_hooks[range] == NULL) {
+	    PrintError(vm, VCORE_NONE, "Could not allocate MSR table for range 0x%x\n", msr_range_starts[range]);
+	    return -1;
+	}
+
+	memset(msr_map->range_hooks[range], 0, sizeof(struct v3_msr_hook *) * V3_MSR_RANGE_SIZE);
+    }
+
+    msr_map->range_hooks[range][offset] = hook;
+
+    if (msr_map->update_map) {
+	msr_map->update_map(vm, msr, 
+			    ((hook == NULL) || (hook->read == NULL)) ? 0 : 1,
+			    ((hook == NULL) || (hook->write == NULL)) ? 0 : 1);
+	msr_map->range_dirty[range][offset / 8] &= ~(1 << (offset % 8));
+    } else if (hook) {
+	// picked up by v3_refresh_msr_map() once the backend is in place
+	msr_map->range_dirty[range][offset / 8] |= (1 << (offset % 8));
+    } else {
+	// never reached the backend, so its default entry is still correct
+	msr_map->range_dirty[range][offset / 8] &= ~(1 << (offset % 8));
+    }
+
+    return 0;
+}
+
+
 int v3_hook_msr(struct v3_vm_info * vm, uint32_t msr, 
 		int (*read)(struct guest_info * core, uint32_t msr, struct v3_msr * dst, void * priv_data),
 		int (*write)(struct guest_info * core, uint32_t msr, struct v3_msr src, void * priv_data),
@@ -152,16 +233,16 @@ int v3_hook_msr(struct v3_vm_info * vm, uint32_t msr,
     hook->msr = msr;
     hook->priv_data = priv_data;
 
+    if (set_msr_entry(vm, msr, hook) == -1) {
+	PrintError(vm, VCORE_NONE, "Could not add MSR 0x%x to the MSR table\n", msr);
+	V3_Free(hook);
+	return -1;
+    }
+
     msr_map->num_hooks++;
 
     list_add(&(hook->link), &(msr_map->hook_list));
 
-    if (msr_map->update_map) {
-	msr_map->update_map(vm, msr, 
-			    (read == NULL) ? 0 : 1,
-			    (write == NULL) ? 0 : 1);
-    }
-
     return 0;
 }
 
@@ -169,11 +250,32 @@ int v3_hook_msr(struct v3_vm_info * vm, uint32_t msr,
 
 
 
+static struct v3_msr_hook * find_hook_in_list(struct v3_vm_info * vm, uint32_t msr) {
+    struct v3_msr_hook * hook = NULL;
+
+    list_for_each_entry(hook, &(vm->msr_map.hook_list), link) {
+	if (hook->msr == msr) {
+	    return hook;
+	}
+    }
+
+    return NULL;
+}
+
+
 static int free_hook(struct v3_vm_info * vm, struct v3_msr_hook * hook) {
+    struct v3_msr_hook * prev_hook = NULL;
+
     list_del(&(hook->link));
+    vm->msr_map.num_hooks--;
 
-    if (vm->msr_map.update_map) {
-	vm->msr_map.update_map(vm, hook->msr, 0, 0);
+    // If the MSR was hooked more than once, the older hook becomes visible again
+    prev_hook = find_hook_in_list(vm, hook->msr);
+
+    if (prev_hook) {
+	set_msr_entry(vm, hook->msr, prev_hook);
+    } else {
+	set_msr_entry(vm, hook->msr, NULL);
     }
 
     V3_Free(hook);
@@ -199,32 +301,63 @@ int v3_unhook_msr(struct v3_vm_info * vm, uint32_t msr) {
 
 struct v3_msr_hook * v3_get_msr_hook(struct v3_vm_info * vm, uint32_t msr) {
     struct v3_msr_map * msr_map = &(vm->msr_map);
-    struct v3_msr_hook * hook = NULL;
+    int range = get_msr_range(msr);
 
-    list_for_each_entry(hook, &(msr_map->hook_list), link) {
-	if (hook->msr == msr) {
-	    return hook;
+    if (range != -1) {
+	if (msr_map->range_hooks[range] == NULL) {
+	    return NULL;
 	}
+
+	return msr_map->range_hooks[range][msr - msr_range_starts[range]];
     }
 
-    return NULL;
+    return find_hook_in_list(vm, msr);
 }
 
 
+/* Pushes the MSRs that changed while there was no backend to the hardware bitmap
+ * Entries that were never hooked keep the backend's default (intercepted)
+ */
 void v3_refresh_msr_map(struct v3_vm_info * vm) {
     struct v3_msr_map * msr_map = &(vm->msr_map);
-    struct v3_msr_hook * hook = NULL;
+    int range = 0;
+    uint32_t i = 0;
+    int bit = 0;
 
     if (msr_map->update_map == NULL) {
         PrintError(vm, VCORE_NONE, "Trying to refresh an MSR map with no backend\n");
 	return;
     }
 
-    list_for_each_entry(hook, &(msr_map->hook_list), link) {
-	PrintDebug(vm, VCORE_NONE, "updating MSR map for msr 0x%x\n", hook->msr);
-	msr_map->update_map(vm, hook->msr, 	
-			    (hook->read == NULL) ? 0 : 1,
-			    (hook->write == NULL) ? 0 : 1);
+    for (range = 0; range < V3_MSR_NUM_RANGES; range++) {
+	struct v3_msr_hook ** hooks = msr_map->range_hooks[range];
+
+	for (i = 0; i < (V3_MSR_RANGE_SIZE / 8); i++) {
+	    uint8_t dirty = msr_map->range_dirty[range][i];
+
+	    if (dirty == 0) {
+		continue;
+	    }
+
+	    for (bit = 0; bit < 8; bit++) {
+		uint32_t offset = (i * 8) + bit;
+		uint32_t msr = msr_range_starts[range] + offset;
+		struct v3_msr_hook * hook = NULL;
+
+		if ((dirty & (1 << bit)) == 0) {
+		    continue;
+		}
+
+		hook = (hooks) ? hooks[offset] : NULL;
+
+		PrintDebug(vm, VCORE_NONE, "updating MSR map for msr 0x%x\n", msr);
+		msr_map->update_map(vm, msr, 
+				    ((hook == NULL) || (hook->read == NULL)) ? 0 : 1,
+				    ((hook == NULL) || (hook->write == NULL)) ? 0 : 1);
+	    }
+
+	    msr_map->range_dirty[range][i] = 0;
+	}
     }
 }
 
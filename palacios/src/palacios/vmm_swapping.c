@@ -29,7 +29,12 @@
 #include <palacios/vmm_shadow_paging.h>
 #include <palacios/vmm_direct_paging.h>
 
+#ifdef V3_CONFIG_MEM_TRACK
+#include <palacios/vmm_mem_track.h>
+#endif
+
 #include <palacios/vmm_xml.h>
+#include <palacios/vmm_chkpt_codec.h>
 
 
 /*
@@ -39,9 +44,17 @@
   <swapping enable="y">
      <allocated>M_MB</allocated>   Allocated space (M_MB <= N_MB)
      <file>FILENAME</file>         Where to swap to
-     <strategy>STRATEGY</strategy> Victim picker to use NEXT_FIT, RANDOM (default), LRU, DEFAULT 
+     <strategy>STRATEGY</strategy> Victim picker to use NEXT_FIT, RANDOM (default), LRU, 
+                                   WORKING_SET, DEFAULT 
+     <pool>P_MB</pool>             Compressed RAM tier in front of the file (default none)
+     <codec>CODEC</codec>          Pool compression, LZ (default) or ZRLE
+     <granularity>G</granularity>  Swap in from the file by 4K or 2M chunks,
+                                   on a worker thread (default whole regions)
   </swapping>
 
+  WORKING_SET is fed by memory tracking, if it is running with periodic
+  reset, and otherwise only by the faults that go through v3_get_mem_region.
+
 */
 
 
@@ -101,6 +114,503 @@ static int read_all(v3_file_t fd, void *buf, uint64_t len, uint64_t offset)
 
 #define CEIL_DIV(x,y) (((x)/(y)) + !!((x)%(y)))
 
+
+/*
+  Compressed pool
+
+  A region swapped out is first offered to the pool.  It is compressed
+  in V3_CHKPT_CODEC_CHUNK pieces, and kept if it all fits in what is left
+  of the pool and shrinks to at most POOL_MAX_RATIO of its size, which is
+  checked every POOL_CHECK_CHUNKS along the way.  Otherwise it goes to the
+  swap file as before.  Swapping a region in from the pool
+  is a decompress, and returns its space to the pool.
+*/
+
+#define POOL_MAX_RATIO(x) (((x)*3)/4)
+#define POOL_CHECK_CHUNKS 16
+
+struct v3_swap_zchunk {
+    uint32_t codec;    // V3_CHKPT_CODEC_NONE => stored raw
+    uint32_t len;
+    uint8_t *data;
+};
+
+struct v3_swap_zregion {
+    uint64_t bytes;            // charged to the pool
+    uint64_t num_chunks;
+    struct v3_swap_zchunk chunk[0];
+};
+
+
+static void pool_free_zregion(struct v3_swap_zregion *z)
+{
+    uint64_t i;
+
+    for (i=0;i<z->num_chunks;i++) { 
+	if (z->chunk[i].data) { 
+	    V3_Free(z->chunk[i].data);
+	}
+    }
+
+    V3_VFree(z);
+}
+
+// reserve (or, with a negative amount, return) pool space
+static int pool_charge(struct v3_vm_info *vm, sint64_t bytes)
+{
+    unsigned int flags;
+    int rc = 0;
+
+    flags = v3_lock_irqsave(vm->swap_state.lock);
+
+    if (bytes > 0 && vm->swap_state.pool_used + bytes > vm->swap_state.pool_size) { 
+	rc = -1;
+    } else {
+	vm->swap_state.pool_used += bytes;
+    }
+
+    v3_unlock_irqrestore(vm->swap_state.lock, flags);
+
+    return rc;
+}
+
+// Returns 0 if the region is now in the pool, -1 if it should go to the file
+// region must be pinned by the caller
+static int pool_store(struct v3_vm_info *vm, struct v3_mem_region *region)
+{
+    uint8_t *data = (uint8_t *)V3_VAddr((void *)region->host_addr);
+    uint64_t len = region->guest_end - region->guest_start;
+    uint64_t num_chunks = CEIL_DIV(len, V3_CHKPT_CODEC_CHUNK);
+    struct v3_chkpt_codec_state *codec;
+    struct v3_swap_zregion *z;
+    unsigned int flags;
+    uint64_t i;
+
+    if (!vm->swap_state.pool_size) { 
+	return -1;
+    }
+
+    z = V3_VMalloc(sizeof(struct v3_swap_zregion) + num_chunks * sizeof(struct v3_swap_zchunk));
+
+    if (!z) { 
+	PrintError(vm,VCORE_NONE,"swapper: cannot allocate pool descriptor\n");
+	return -1;
+    }
+
+    memset(z, 0, sizeof(struct v3_swap_zregion) + num_chunks * sizeof(struct v3_swap_zchunk));
+    z->num_chunks = num_chunks;
+
+    // our own codec state, since swaps can run concurrently
+    if (!(codec = v3_chkpt_codec_init(vm->swap_state.codec->codec))) { 
+	V3_VFree(z);
+	return -1;
+    }
+
+    for (i=0;i<num_chunks;i++) { 
+	uint32_t clen = (len - i*V3_CHKPT_CODEC_CHUNK) > V3_CHKPT_CODEC_CHUNK ? 
+	    V3_CHKPT_CODEC_CHUNK : (len - i*V3_CHKPT_CODEC_CHUNK);
+	uint8_t *in = data + i*V3_CHKPT_CODEC_CHUNK;
+	uint32_t codec_used;
+	int enc_len;
+
+	enc_len = v3_chkpt_codec_encode(codec, in, clen, codec->scratch, &codec_used);
+
+	if (pool_charge(vm, enc_len)) { 
+	    PrintDebug(vm,VCORE_NONE,"swapper: region GPA=%p does not fit in the pool\n",
+		       (void*)region->guest_start);
+	    goto fail;
+	}
+
+	z->bytes += enc_len;
+
+	if ((((i+1) % POOL_CHECK_CHUNKS) == 0 || (i+1) == num_chunks) &&
+	    z->bytes > POOL_MAX_RATIO((i*V3_CHKPT_CODEC_CHUNK) + clen)) { 
+	    PrintDebug(vm,VCORE_NONE,"swapper: region GPA=%p does not compress well enough for the pool\n",
+		       (void*)region->guest_start);
+	    goto fail;
+	}
+
+	if (!(z->chunk[i].data = V3_Malloc(enc_len))) { 
+	    PrintError(vm,VCORE_NONE,"swapper: cannot allocate pool chunk\n");
+	    goto fail;
+	}
+
+	memcpy(z->chunk[i].data, codec_used == V3_CHKPT_CODEC_NONE ? in : codec->scratch, enc_len);
+	z->chunk[i].codec = codec_used;
+	z->chunk[i].len = enc_len;
+    }
+
+    flags = v3_lock_irqsave(vm->swap_state.lock);
+    v3_chkpt_codec_merge_stats(vm->swap_state.codec, codec);
+    vm->swap_state.pool_outs++;
+    v3_unlock_irqrestore(vm->swap_state.lock, flags);
+
+    v3_chkpt_codec_deinit(codec);
+
+    region->swap_state.zregion = z;
+
+    PrintDebug(vm,VCORE_NONE,"swapper: region GPA=%p compressed to %llu bytes in pool\n",
+	       (void*)region->guest_start, z->bytes);
+
+    return 0;
+
+ fail:
+    pool_charge(vm, -(sint64_t)z->bytes);
+    pool_free_zregion(z);
+    v3_chkpt_codec_deinit(codec);
+    return -1;
+}
+
+// region must be pinned by the caller, and have its new host memory
+static int pool_load(struct v3_vm_info *vm, struct v3_mem_region *region)
+{
+    struct v3_swap_zregion *z = region->swap_state.zregion;
+    uint8_t *data = (uint8_t *)V3_VAddr((void *)region->host_addr);
+    uint64_t len = region->guest_end - region->guest_start;
+    struct v3_chkpt_codec_state codec;   // only its stats are used in decoding
+    unsigned int flags;
+    uint64_t i;
+
+    memset(&codec, 0, sizeof(codec));
+
+    for (i=0;i<z->num_chunks;i++) { 
+	uint32_t clen = (len - i*V3_CHKPT_CODEC_CHUNK) > V3_CHKPT_CODEC_CHUNK ? 
+	    V3_CHKPT_CODEC_CHUNK : (len - i*V3_CHKPT_CODEC_CHUNK);
+	uint8_t *out = data + i*V3_CHKPT_CODEC_CHUNK;
+
+	if (z->chunk[i].codec == V3_CHKPT_CODEC_NONE) { 
+	    memcpy(out, z->chunk[i].data, clen);
+	} else if (v3_chkpt_codec_decode(&codec, z->chunk[i].codec, z->chunk[i].data, z->chunk[i].len, out, clen)) { 
+	    PrintError(vm,VCORE_NONE,"swapper: corrupt pool data for region GPA=%p\n", (void*)region->guest_start);
+	    return -1;
+	}
+    }
+
+    flags = v3_lock_irqsave(vm->swap_state.lock);
+    v3_chkpt_codec_merge_stats(vm->swap_state.codec, &codec);
+    vm->swap_state.pool_used -= z->bytes;
+    vm->swap_state.pool_ins++;
+    v3_unlock_irqrestore(vm->swap_state.lock, flags);
+
+    region->swap_state.zregion = 0;
+    pool_free_zregion(z);
+
+    return 0;
+}
+
+
+/*
+  Page-granular swap in
+
+  With a granularity set, a region swapped in from the file only takes
+  over its victim's memory, and its chunks are then read in by a worker
+  thread.  A lookup of a chunk that is not present yet posts it as
+  wanted and yields until the worker has read it (v3_swap_wait).  After
+  each wanted chunk the worker reads ahead of it.  The read-ahead window
+  starts at one chunk, and doubles, up to SWAP_RA_MAX_BYTES, each time
+  the next wanted chunk falls just past the last one and no further than
+  the end of the window.  A region swapped out before it is fully
+  present writes back only the chunks it has, as the rest are still
+  current in the file.
+
+  While the worker reads into a region, the region is busy, and will not
+  be chosen as a victim.  Pinning a region reads in the rest of it.
+*/
+
+#define SWAP_RA_MAX_BYTES (8*1024*1024)
+#define SWAP_WORKER_IDLE_USEC 10000
+
+static inline uint64_t region_chunks(struct v3_vm_info *vm, struct v3_mem_region *reg)
+{
+    return CEIL_DIV(reg->guest_end - reg->guest_start, vm->swap_state.granularity);
+}
+
+static inline int chunk_present(struct v3_mem_region *reg, uint64_t chunk)
+{
+    return (reg->swap_state.present[chunk/8] >> (chunk%8)) & 0x1;
+}
+
+// Must be called with the lock held
+static inline void chunk_arrived(struct v3_mem_region *reg, uint64_t chunk)
+{
+    if (!chunk_present(reg,chunk)) { 
+	reg->swap_state.present[chunk/8] |= 1 << (chunk%8);
+	reg->swap_state.absent--;
+    }
+}
+
+// Must be called with the lock held
+static inline int can_evict(struct v3_mem_region *reg)
+{
+    return !(reg->flags.swapped || reg->flags.pinned || reg->swap_state.busy);
+}
+
+static int chunk_io(struct v3_vm_info *vm, struct v3_mem_region *reg, uint64_t chunk, int write)
+{
+    uint64_t offset = chunk * vm->swap_state.granularity;
+    uint64_t len = (reg->guest_end - reg->guest_start) - offset;
+    uint8_t *buf = (uint8_t *)V3_VAddr((void *)reg->host_addr) + offset;
+
+    if (len > vm->swap_state.granularity) { 
+	len = vm->swap_state.granularity;
+    }
+
+    if (write) { 
+	return write_all(vm->swap_state.swapfd, buf, len, reg->guest_start + offset);
+    } else {
+	return read_all(vm->swap_state.swapfd, buf, len, reg->guest_start + offset);
+    }
+}
+
+// Region has taken over its host memory, and will have its chunks read in
+static int swap_in_lazy(struct v3_vm_info *vm, struct v3_mem_region *reg)
+{
+    uint64_t num_chunks = region_chunks(vm, reg);
+
+    if (!reg->swap_state.present) { 
+	if (!(reg->swap_state.present = V3_VMalloc(CEIL_DIV(num_chunks,8)))) { 
+	    PrintError(vm,VCORE_NONE,"swapper: cannot allocate presence bitmap\n");
+	    return -1;
+	}
+    }
+
+    memset(reg->swap_state.present, 0, CEIL_DIV(num_chunks,8));
+    reg->swap_state.absent = num_chunks;
+
+    return 0;
+}
+
+// region must be pinned by the caller
+static int write_present_chunks(struct v3_vm_info *vm, struct v3_mem_region *reg)
+{
+    uint64_t num_chunks = region_chunks(vm, reg);
+    uint64_t i;
+
+    for (i=0;i<num_chunks;i++) { 
+	if (chunk_present(reg,i) && chunk_io(vm, reg, i, 1)) { 
+	    return -1;
+	}
+    }
+
+    return 0;
+}
+
+// region must be pinned by the caller - reads in whatever the worker has not
+static int fill_region(struct v3_vm_info *vm, struct v3_mem_region *reg)
+{
+    uint64_t num_chunks = region_chunks(vm, reg);
+    unsigned int flags;
+    uint64_t i;
+
+    // the worker will not start on a pinned region, but may be finishing a chunk
+    while (reg->swap_state.busy) { 
+	V3_Yield();
+    }
+
+    for (i=0;i<num_chunks && reg->swap_state.absent;i++) { 
+	if (chunk_present(reg,i)) { 
+	    continue;
+	}
+
+	if (chunk_io(vm, reg, i, 0)) { 
+	    PrintError(vm,VCORE_NONE,"swapper: cannot read in chunk %llu of region GPA=%p\n", i, (void*)reg->guest_start);
+	    return -1;
+	}
+
+	flags = v3_lock_irqsave(vm->swap_state.lock);
+	chunk_arrived(reg,i);
+	vm->swap_state.demand_fetches++;
+	v3_unlock_irqrestore(vm->swap_state.lock, flags);
+    }
+
+    return 0;
+}
+
+// Must be called with the lock held
+// Picks the next chunk for the worker, and marks its region busy
+static struct v3_mem_region * choose_chunk(struct v3_vm_info *vm, uint64_t *chunk, int *demand)
+{
+    struct v3_swap_impl_state *s = &(vm->swap_state);
+    struct v3_mem_region *reg;
+    uint64_t ra_max = SWAP_RA_MAX_BYTES / s->granularity;
+
+    if (!ra_max) { 
+	ra_max = 1;
+    }
+
+    reg = s->wanted_region;
+    s->wanted_region = 0;
+
+    if (reg && can_evict(reg) && reg->swap_state.absent && !chunk_present(reg, s->wanted_chunk)) { 
+	uint64_t c = s->wanted_chunk;
+	uint64_t num_chunks = region_chunks(vm, reg);
+
+	if (reg == s->ra_region && c > s->ra_last && c <= s->ra_end) { 
+	    s->ra_window = (2*s->ra_window > ra_max) ? ra_max : 2*s->ra_window;
+	} else {
+	    s->ra_window = 1;
+	}
+
+	s->ra_region = reg;
+	s->ra_last = c;
+	s->ra_next = c + 1;
+	s->ra_end = (c + 1 + s->ra_window > num_chunks) ? num_chunks : c + 1 + s->ra_window;
+
+	*chunk = c;
+	*demand = 1;
+	reg->swap_state.busy = 1;
+	return reg;
+    }
+
+    reg = s->ra_region;
+
+    if (reg && can_evict(reg) && reg->swap_state.absent) { 
+	while (s->ra_next < s->ra_end && chunk_present(reg, s->ra_next)) { 
+	    s->ra_next++;
+	}
+
+	if (s->ra_next < s->ra_end) { 
+	    *chunk = s->ra_next++;
+	    *demand = 0;
+	    reg->swap_state.busy = 1;
+	    return reg;
+	}
+    }
+
+    return 0;
+}
+
+static int swap_worker(void *arg)
+{
+    struct v3_vm_info *vm = (struct v3_vm_info *)arg;
+    struct v3_swap_impl_state *s = &(vm->swap_state);
+    struct v3_mem_region *reg;
+    unsigned int flags;
+    uint64_t chunk;
+    int demand;
+    int rc;
+
+    PrintDebug(vm,VCORE_NONE,"swapper: worker started\n");
+
+    while (!s->worker_abort) { 
+	flags = v3_lock_irqsave(s->lock);
+	reg = choose_chunk(vm, &chunk, &demand);
+	v3_unlock_irqrestore(s->lock, flags);
+
+	if (!reg) { 
+	    // lookups waiting on us wake us up
+	    V3_Sleep(SWAP_WORKER_IDLE_USEC);
+	    continue;
+	}
+
+	rc = chunk_io(vm, reg, chunk, 0);
+
+	flags = v3_lock_irqsave(s->lock);
+	if (!rc) { 
+	    chunk_arrived(reg, chunk);
+	    if (demand) { 
+		s->demand_fetches++;
+	    } else {
+		s->ahead_fetches++;
+	    }
+	}
+	reg->swap_state.busy = 0;
+	v3_unlock_irqrestore(s->lock, flags);
+
+	if (rc) { 
+	    PrintError(vm,VCORE_NONE,"swapper: worker cannot read in chunk %llu of region GPA=%p\n", chunk, (void*)reg->guest_start);
+	    s->worker_failed = 1;
+	    break;
+	}
+    }
+
+    PrintDebug(vm,VCORE_NONE,"swapper: worker exiting\n");
+
+    s->worker_done = 1;
+
+    return 0;
+}
+
+int v3_swap_wait(struct v3_vm_info *vm, struct v3_mem_region *reg, addr_t gpa)
+{
+    struct v3_swap_impl_state *s = &(vm->swap_state);
+    uint64_t chunk = (gpa - reg->guest_start) / s->granularity;
+    unsigned int flags;
+    uint64_t start;
+    uint64_t end;
+
+    rdtscll(start);
+
+    while (1) { 
+	flags = v3_lock_irqsave(s->lock);
+
+	if (reg->flags.swapped) { 
+	    // it was chosen as a victim while we waited
+	    v3_unlock_irqrestore(s->lock, flags);
+	    if (v3_swap_in_region(vm, reg)) { 
+		return -1;
+	    }
+	    continue;
+	}
+
+	if (!reg->swap_state.absent || chunk_present(reg, chunk)) { 
+	    v3_unlock_irqrestore(s->lock, flags);
+	    break;
+	}
+
+	if (s->worker_failed) { 
+	    v3_unlock_irqrestore(s->lock, flags);
+	    return -1;
+	}
+
+	// the worker takes one wanted chunk at a time, keep asking until ours is taken
+	if (!s->wanted_region) { 
+	    s->wanted_region = reg;
+	    s->wanted_chunk = chunk;
+	}
+
+	v3_unlock_irqrestore(s->lock, flags);
+
+	V3_Wakeup(s->worker);
+	v3_yield(NULL, -1);
+    }
+
+    rdtscll(end);
+
+    flags = v3_lock_irqsave(s->lock);
+    s->fault_waits++;
+    s->fault_wait_cycles += end - start;
+    v3_unlock_irqrestore(s->lock, flags);
+
+    return 0;
+}
+
+int v3_swap_page_size_ok(struct v3_vm_info *vm, struct v3_mem_region *region, uint32_t page_size)
+{
+    // a larger page could map chunks that are not there yet
+    return !region->swap_state.absent || page_size <= vm->swap_state.granularity;
+}
+
+static void print_swap_stats(struct v3_vm_info *vm)
+{
+    struct v3_swap_impl_state *s = &(vm->swap_state);
+    uint64_t ins = s->pool_ins + s->file_ins;
+
+    V3_Print(vm,VCORE_NONE,"swapper: %llu swap ins (%llu from pool, %llu%% hit rate), %llu swap outs (%llu to pool)\n",
+	     ins, s->pool_ins, ins ? (s->pool_ins*100)/ins : 0,
+	     s->pool_outs + s->file_outs, s->pool_outs);
+
+    if (s->pool_size) { 
+	V3_Print(vm,VCORE_NONE,"swapper: pool holds %llu of %llu bytes\n", s->pool_used, s->pool_size);
+	v3_chkpt_codec_print_stats(s->codec);
+    }
+
+    if (s->granularity) { 
+	V3_Print(vm,VCORE_NONE,"swapper: %llu chunks read on demand, %llu read ahead, %llu lookups waited (%llu cycles)\n",
+		 s->demand_fetches, s->ahead_fetches, s->fault_waits, s->fault_wait_cycles);
+    }
+}
+
 int v3_init_swapping_vm(struct v3_vm_info *vm, struct v3_xml *config)
 {
     v3_cfg_tree_t *swap_config;
@@ -108,6 +618,9 @@ int v3_init_swapping_vm(struct v3_vm_info *vm, struct v3_xml *config)
     char *allocated;
     char *strategy;
     char *file;
+    char *pool;
+    char *codec;
+    char *gran;
     uint64_t alloc;
     extern uint64_t v3_mem_block_size;
 
@@ -161,18 +674,45 @@ int v3_init_swapping_vm(struct v3_vm_info *vm, struct v3_xml *config)
 	strategy="default";
     }
 
+    pool = v3_cfg_val(swap_config,"pool");
+    codec = v3_cfg_val(swap_config,"codec");
+    if (!codec) { 
+	codec="lz";
+    }
+
+    if (pool && atoi(pool)>0) { 
+	if (!(vm->swap_state.codec = v3_chkpt_codec_init(!strcasecmp(codec,"zrle") ? V3_CHKPT_CODEC_ZRLE : V3_CHKPT_CODEC_LZ))) { 
+	    PrintError(vm,VCORE_NONE,"swapper: cannot set up compression for the pool\n");
+	    return -1;
+	}
+	vm->swap_state.pool_size = ((uint64_t)atoi(pool))*1024*1024;
+    }
+
+    gran = v3_cfg_val(swap_config,"granularity");
+    if (gran) { 
+	if (!strcasecmp(gran,"4k") || !strcasecmp(gran,"4kb")) { 
+	    vm->swap_state.granularity = PAGE_SIZE_4KB;
+	} else if (!strcasecmp(gran,"2m") || !strcasecmp(gran,"2mb")) { 
+	    vm->swap_state.granularity = PAGE_SIZE_2MB;
+	} else if (strcasecmp(gran,"region")) { 
+	    PrintError(vm,VCORE_NONE,"swapper: unknown granularity %s\n", gran);
+	    goto fail_pool;
+	}
+    }
+
     // Can we allocate the file?
 
     if (!(vm->swap_state.swapfd = v3_file_open(vm,file, FILE_OPEN_MODE_READ | FILE_OPEN_MODE_WRITE | FILE_OPEN_MODE_CREATE))) {
 	PrintError(vm,VCORE_NONE,"swapper: cannot open or create swap file\n");
-	return -1;
+	goto fail_pool;
     } else {
 	// Make sure we can write the whole thing
 	uint64_t addr;
 	char *buf = V3_Malloc(PAGE_SIZE_4KB);
 	if (!buf) { 
 	    PrintError(vm,VCORE_NONE,"swapper: unable to allocate space for writing file\n");
-	    return -1;
+	    v3_file_close(vm->swap_state.swapfd);
+	    goto fail_pool;
 	}
 	memset(buf,0,PAGE_SIZE_4KB);
 	for (addr=0;addr<vm->mem_size;addr+=PAGE_SIZE_4KB) { 
@@ -183,12 +723,20 @@ int v3_init_swapping_vm(struct v3_vm_info *vm, struct v3_xml *config)
 		PrintError(vm,VCORE_NONE,"swapper: unable to write initial swap file\n");
 		V3_Free(buf);
 		v3_file_close(vm->swap_state.swapfd);
-		return -1;
+		goto fail_pool;
 	    }
 	}
 	V3_Free(buf);
     }
 
+    if (vm->swap_state.granularity) { 
+	if (!(vm->swap_state.worker = V3_CREATE_AND_START_THREAD(swap_worker, vm, "v3-swap", 0))) { 
+	    PrintError(vm,VCORE_NONE,"swapper: cannot start swap in worker\n");
+	    v3_file_close(vm->swap_state.swapfd);
+	    goto fail_pool;
+	}
+    }
+
     // We are now set - we have space to swap to
     vm->swap_state.enable_swapping=1;
 
@@ -196,24 +744,43 @@ int v3_init_swapping_vm(struct v3_vm_info *vm, struct v3_xml *config)
 	!strcasecmp(strategy,"next_fit") ? V3_SWAP_NEXT_FIT :
 	!strcasecmp(strategy,"random") ? V3_SWAP_RANDOM :
 	!strcasecmp(strategy,"lru") ? V3_SWAP_LRU :
+	!strcasecmp(strategy,"working_set") ? V3_SWAP_WORKING_SET :
 	!strcasecmp(strategy,"default") ? V3_SWAP_RANDOM :  // identical branches for clarity
 	V3_SWAP_RANDOM;
 
     vm->swap_state.host_mem_size=alloc;
     vm->swap_state.swap_count=0;
     vm->swap_state.last_region_used=0;
+    vm->swap_state.clock_hand=0;
     // already have set swapfd
 
 
     V3_Print(vm,VCORE_NONE,"swapper: swapping enabled (%llu allocated of %llu using %s on %s)\n",
 	     (uint64_t)vm->swap_state.host_mem_size, (uint64_t) vm->mem_size, strategy, file);
 
+    if (vm->swap_state.pool_size) { 
+	V3_Print(vm,VCORE_NONE,"swapper: %llu byte %s compressed pool in front of %s\n",
+		 vm->swap_state.pool_size, codec, file);
+    }
+
+    if (vm->swap_state.granularity) { 
+	V3_Print(vm,VCORE_NONE,"swapper: swapping in %llu byte chunks\n", vm->swap_state.granularity);
+    }
+
     if (vm->swap_state.host_mem_size / v3_mem_block_size < REGION_WARN_THRESH) { 
 	V3_Print(vm,VCORE_NONE,"swapper: WARNING: %llu regions is less than threshold of %llu, GUEST MAY FAIL TO MAKE PROGRESS\n",
 		 (uint64_t)vm->swap_state.host_mem_size/v3_mem_block_size, (uint64_t)REGION_WARN_THRESH);
     }
 
     return 0;
+
+ fail_pool:
+    if (vm->swap_state.codec) { 
+	v3_chkpt_codec_deinit(vm->swap_state.codec);
+	vm->swap_state.codec = 0;
+	vm->swap_state.pool_size = 0;
+    }
+    return -1;
     
 }
 
@@ -222,6 +789,33 @@ int v3_deinit_swapping_vm(struct v3_vm_info *vm)
     PrintDebug(vm, VCORE_NONE, "swapper: vm deinit\n");
 
     if (vm->swap_state.enable_swapping) {
+	uint64_t i;
+
+	if (vm->swap_state.worker) { 
+	    vm->swap_state.worker_abort = 1;
+	    while (!vm->swap_state.worker_done) { 
+		V3_Wakeup(vm->swap_state.worker);
+		V3_Yield();
+	    }
+	}
+
+	print_swap_stats(vm);
+
+	for (i=0;i<vm->mem_map.num_base_regions;i++) { 
+	    if (vm->mem_map.base_regions[i].swap_state.zregion) { 
+		pool_free_zregion(vm->mem_map.base_regions[i].swap_state.zregion);
+		vm->mem_map.base_regions[i].swap_state.zregion = 0;
+	    }
+	    if (vm->mem_map.base_regions[i].swap_state.present) { 
+		V3_VFree(vm->mem_map.base_regions[i].swap_state.present);
+		vm->mem_map.base_regions[i].swap_state.present = 0;
+	    }
+	}
+
+	if (vm->swap_state.codec) { 
+	    v3_chkpt_codec_deinit(vm->swap_state.codec);
+	}
+
 	v3_file_close(vm->swap_state.swapfd);
     }
 
@@ -264,6 +858,13 @@ int v3_pin_region(struct v3_vm_info *vm, struct v3_mem_region *region)
     region->flags.pinned=1;
     
     v3_unlock_irqrestore(vm->swap_state.lock, flags);
+
+    // a pinned region must be all there
+    if (region->swap_state.absent && fill_region(vm,region)) { 
+	PrintError(vm,VCORE_NONE,"Cannot read in the rest of the region during a pin operation\n");
+	v3_unpin_region(vm,region);
+	return -1;
+    }
     
     return 0;
 }
@@ -305,8 +906,8 @@ static struct v3_mem_region * choose_random_victim(struct v3_vm_info * vm)
 	
 	reg = &(map->base_regions[thetime % num_base_regions]);
 
-	if (reg->flags.swapped || reg->flags.pinned) { 
-	    // region is already swapped or is pinned - try again
+	if (!can_evict(reg)) { 
+	    // region is already swapped, is pinned, or is being read in - try again
 	    reg = 0;
 	} 
     }
@@ -338,8 +939,8 @@ static struct v3_mem_region * choose_next_victim(struct v3_vm_info * vm)
 
 	reg = &(map->base_regions[i]);
 
-	if (reg->flags.swapped || reg->flags.pinned) { 
-	    // region is already swapped or is pinned - try again
+	if (!can_evict(reg)) { 
+	    // region is already swapped, is pinned, or is being read in - try again
 	    reg = 0;
 	} 
     }
@@ -350,8 +951,8 @@ static struct v3_mem_region * choose_next_victim(struct v3_vm_info * vm)
 	
 	reg = &(map->base_regions[i]);
 
-	if (reg->flags.swapped || reg->flags.pinned) { 
-	    // region is already swapped or is pinned - try again
+	if (!can_evict(reg)) { 
+	    // region is already swapped, is pinned, or is being read in - try again
 	    reg = 0;
 	} 
     }
@@ -384,7 +985,7 @@ static struct v3_mem_region * choose_lru_victim(struct v3_vm_info * vm)
 
 	reg = &(map->base_regions[i]);
 
-	if (reg->flags.swapped || reg->flags.pinned) {
+	if (can_evict(reg)) {
 	    if (!oldest_reg ||
 		reg->swap_state.last_accessed < oldest_time) { 
 
@@ -404,6 +1005,80 @@ static struct v3_mem_region * choose_lru_victim(struct v3_vm_info * vm)
 }
 
 
+/*
+  Working set (CLOCK) victim selection
+
+  A region's referenced count is the number of its pages seen accessed
+  since the clock hand last passed it.  It is fed by the memory tracking
+  bitmaps at the end of each tracking period (v3_swap_sample_access), and
+  set to at least one by v3_touch_region.  As the hand passes a region,
+  it folds the referenced count into the region's hotness, an
+  exponentially decaying fraction of the region in use, and clears it.
+  The first resident, unpinned region that was not referenced and has
+  cooled below WS_COLD is the victim.  Failing that within two turns of
+  the clock, the coldest region seen is.
+*/
+
+#define WS_COLD (V3_SWAP_HOT_MAX/32)
+
+static void ws_age(struct v3_mem_region *reg)
+{
+    uint64_t pages = (reg->guest_end - reg->guest_start) / PAGE_SIZE_4KB;
+    uint64_t sample = pages ? ((uint64_t)reg->swap_state.referenced * V3_SWAP_HOT_MAX) / pages : 0;
+
+    if (sample > V3_SWAP_HOT_MAX) { 
+	sample = V3_SWAP_HOT_MAX;
+    }
+
+    reg->swap_state.hotness = (reg->swap_state.hotness + sample) / 2;
+    reg->swap_state.referenced = 0;
+}
+
+// Must be called with the lock held
+static struct v3_mem_region * choose_working_set_victim(struct v3_vm_info * vm) 
+{
+    struct v3_mem_map * map = &(vm->mem_map);
+    uint64_t num_base_regions = map->num_base_regions;
+    struct v3_mem_region *reg=0;
+    struct v3_mem_region *coldest_reg=0;
+    uint64_t i;
+	
+    PrintDebug(vm, VCORE_NONE, "swapper: choosing working set victim\n");
+
+    for (i=0; i<2*num_base_regions; i++) { 
+
+	reg = &(map->base_regions[vm->swap_state.clock_hand]);
+
+	vm->swap_state.clock_hand = (vm->swap_state.clock_hand + 1) % num_base_regions;
+
+	if (!can_evict(reg)) { 
+	    continue;
+	}
+
+	if (!reg->swap_state.referenced && reg->swap_state.hotness <= WS_COLD) { 
+	    PrintDebug(vm,VCORE_NONE,"swapper: Working set victim GPA=%p to %p (hotness %u)\n", 
+		       (void*)reg->guest_start, (void*)reg->guest_end, reg->swap_state.hotness);
+	    return reg;
+	}
+
+	ws_age(reg);
+
+	if (!coldest_reg || reg->swap_state.hotness < coldest_reg->swap_state.hotness) { 
+	    coldest_reg = reg;
+	}
+    }
+
+    if (!coldest_reg) { 
+	PrintError(vm,VCORE_NONE,"swapper: Unable to find working set victim\n");
+    } else {
+	PrintDebug(vm,VCORE_NONE,"swapper: Coldest victim GPA=%p to %p (hotness %u)\n", 
+		   (void*)coldest_reg->guest_start, (void*)coldest_reg->guest_end, coldest_reg->swap_state.hotness);
+    }
+
+    return coldest_reg;
+}
+
+
 // Must be called with the lock held
 static struct v3_mem_region * choose_victim(struct v3_vm_info * vm) 
 {
@@ -417,6 +1092,9 @@ static struct v3_mem_region * choose_victim(struct v3_vm_info * vm)
 	case V3_SWAP_LRU:
 	    return choose_lru_victim(vm);
 	    break;
+	case V3_SWAP_WORKING_SET:
+	    return choose_working_set_victim(vm);
+	    break;
 	default:
 	    return choose_random_victim(vm);
 	    break;
@@ -440,9 +1118,9 @@ static int swap_out_region_internal(struct v3_vm_info *vm, struct v3_mem_region
 	return 0;
     }
     
-    if (!ignore_pinning && victim->flags.pinned) { 
+    if (!ignore_pinning && (victim->flags.pinned || victim->swap_state.busy)) { 
 	v3_unlock_irqrestore(vm->swap_state.lock,flags);
-	PrintError(vm,VCORE_NONE,"swapper: attempt to swap out pinned region\n");
+	PrintError(vm,VCORE_NONE,"swapper: attempt to swap out pinned or busy region\n");
 	return -1;
     }
 
@@ -453,14 +1131,29 @@ static int swap_out_region_internal(struct v3_vm_info *vm, struct v3_mem_region
     v3_unlock_irqrestore(vm->swap_state.lock,flags);
     
     // do NOT do this without irqs on... 
-    if (write_all(vm->swap_state.swapfd, 
-		  (uint8_t *)V3_VAddr((void *)victim->host_addr), 
-		  victim->guest_end - victim->guest_start, 
-		  victim->guest_start)) {
-	PrintError(vm, VCORE_NONE, "swapper: failed to swap out victim"); //write victim to disk
-	// note write only here - it returns unswapped and unpinned
-	victim->flags.pinned=0;
-	return -1;
+    if (victim->swap_state.absent) { 
+	// partially present, so only what was read in can differ from the file
+	if (write_present_chunks(vm, victim)) { 
+	    PrintError(vm, VCORE_NONE, "swapper: failed to swap out partially present victim\n");
+	    victim->flags.pinned=0;
+	    return -1;
+	}
+	flags = v3_lock_irqsave(vm->swap_state.lock);
+	vm->swap_state.file_outs++;
+	v3_unlock_irqrestore(vm->swap_state.lock,flags);
+    } else if (pool_store(vm, victim)) { 
+	if (write_all(vm->swap_state.swapfd, 
+		      (uint8_t *)V3_VAddr((void *)victim->host_addr), 
+		      victim->guest_end - victim->guest_start, 
+		      victim->guest_start)) {
+	    PrintError(vm, VCORE_NONE, "swapper: failed to swap out victim"); //write victim to disk
+	    // note write only here - it returns unswapped and unpinned
+	    victim->flags.pinned=0;
+	    return -1;
+	}
+	flags = v3_lock_irqsave(vm->swap_state.lock);
+	vm->swap_state.file_outs++;
+	v3_unlock_irqrestore(vm->swap_state.lock,flags);
     }
 
     // Now invalidate it
@@ -491,6 +1184,7 @@ static int swap_out_region_internal(struct v3_vm_info *vm, struct v3_mem_region
 	}
     }
 
+    victim->swap_state.absent=0;
     victim->flags.swapped=1;   // now it is in "swapped + pinned" state, meaning it has been written and is now holding for future use
     
     if (fail) { 
@@ -534,6 +1228,8 @@ int v3_swap_in_region(struct v3_vm_info *vm, struct v3_mem_region *perp)
 {
     unsigned int flags;
     struct v3_mem_region *victim;
+    int rc;
+    int from_file;
 
     flags = v3_lock_irqsave(vm->swap_state.lock);
 
@@ -590,13 +1286,23 @@ int v3_swap_in_region(struct v3_vm_info *vm, struct v3_mem_region *perp)
     victim->flags.pinned=0;
 
 
-    // Now swap in the perp
+    // Now swap in the perp, from the pool if it is there
     
-    if (read_all(vm->swap_state.swapfd, 
-		 (uint8_t *)V3_VAddr((void *)perp->host_addr), 
-		 perp->guest_end - perp->guest_start, 
-		 perp->guest_start)) {
-	
+    from_file = !perp->swap_state.zregion;
+
+    if (!from_file) { 
+	rc = pool_load(vm, perp);
+    } else if (vm->swap_state.granularity) { 
+	// the worker reads it in, as it is wanted
+	rc = swap_in_lazy(vm, perp);
+    } else {
+	rc = read_all(vm->swap_state.swapfd, 
+		      (uint8_t *)V3_VAddr((void *)perp->host_addr), 
+		      perp->guest_end - perp->guest_start, 
+		      perp->guest_start);
+    }
+
+    if (rc) { 
 	PrintError(vm, VCORE_NONE, "swapper: swap in of region failed!\n"); 
 	// leave it swapped, but unpin the memory... 
 	perp->flags.pinned = 0; 
@@ -605,6 +1311,11 @@ int v3_swap_in_region(struct v3_vm_info *vm, struct v3_mem_region *perp)
 	perp->flags.swapped = 0;  // perp is now OK, so release it
 	perp->flags.pinned = 0; 
 	vm->swap_state.swap_count++;
+	if (from_file) { 
+	    flags = v3_lock_irqsave(vm->swap_state.lock);
+	    vm->swap_state.file_ins++;
+	    v3_unlock_irqrestore(vm->swap_state.lock,flags);
+	}
 	return 0;
     }
 }
@@ -613,8 +1324,88 @@ int v3_swap_in_region(struct v3_vm_info *vm, struct v3_mem_region *perp)
 
 void v3_touch_region(struct v3_vm_info *vm, struct v3_mem_region *region)
 {
+    unsigned int flags;
+
     // should be uniform host time, not per core...
     rdtscll(region->swap_state.last_accessed);
+
+    // the lock only when we change it, as this is on every lookup
+    if (!region->swap_state.referenced) { 
+	flags = v3_lock_irqsave(vm->swap_state.lock);
+	if (!region->swap_state.referenced) { 
+	    region->swap_state.referenced = 1;
+	}
+	v3_unlock_irqrestore(vm->swap_state.lock, flags);
+    }
+}
+
+
+#ifdef V3_CONFIG_MEM_TRACK
+
+static uint32_t count_bits(uint8_t *bitmap, uint64_t start, uint64_t end)
+{
+    static const uint8_t nibble[16] = {0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4};
+    uint32_t count = 0;
+    uint64_t i;
+
+    for (i=start; i<end && (i%8); i++) { 
+	count += GET_BIT(bitmap,i);
+    }
+
+    for (; i+8<=end; i+=8) { 
+	uint8_t b = bitmap[i/8];
+	count += nibble[b & 0xf] + nibble[b >> 4];
+    }
+
+    for (; i<end; i++) { 
+	count += GET_BIT(bitmap,i);
+    }
+
+    return count;
 }
 
+// Called from memory tracking, in the core's thread, as it is about 
+// to clear its access bitmap
+void v3_swap_sample_access(struct guest_info *core)
+{
+    struct v3_vm_info *vm = core->vm_info;
+    struct v3_mem_map *map = &(vm->mem_map);
+    uint8_t *bitmap = core->memtrack_state.access_bitmap;
+    uint64_t num_pages = core->memtrack_state.num_pages;
+    unsigned int flags;
+    uint64_t i;
 
+    if (!vm->swap_state.enable_swapping || !bitmap) { 
+	return;
+    }
+
+    for (i=0; i<map->num_base_regions; i++) { 
+	struct v3_mem_region *reg = &(map->base_regions[i]);
+	uint64_t start = reg->guest_start / PAGE_SIZE_4KB;
+	uint64_t end = reg->guest_end / PAGE_SIZE_4KB;
+	uint32_t count;
+
+	if (reg->flags.swapped) { 
+	    continue;
+	}
+
+	if (end > num_pages) { 
+	    end = num_pages;
+	}
+
+	if (start >= end || !(count = count_bits(bitmap, start, end))) { 
+	    continue;
+	}
+
+	flags = v3_lock_irqsave(vm->swap_state.lock);
+
+	// other cores add to this too, so saturate at the region size
+	reg->swap_state.referenced = 
+	    (reg->swap_state.referenced + count > end - start) ? 
+	    (end - start) : reg->swap_state.referenced + count;
+
+	v3_unlock_irqrestore(vm->swap_state.lock, flags);
+    }
+}
+
+#endif
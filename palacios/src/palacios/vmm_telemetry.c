@@ -21,7 +21,6 @@
 #include <palacios/vmm_telemetry.h>
 #include <palacios/svm_handler.h>
 #include <palacios/vmx_handler.h>
-#include <palacios/vmm_rbtree.h>
 #include <palacios/vmm_sprintf.h>
 
 
@@ -43,17 +42,7 @@ struct telemetry_cb {
 };
 
 
-struct exit_event {
-    uint_t exit_code;
-    uint_t cnt;
-    uint64_t handler_time;
-
-    struct rb_node tree_node;
-};
-
-
 static int free_callback(struct v3_vm_info * vm, struct telemetry_cb * cb);
-static int free_exit(struct guest_info * core, struct exit_event * event);
 
 
 void v3_init_telemetry(struct v3_vm_info * vm) {
@@ -79,107 +68,93 @@ void v3_deinit_telemetry(struct v3_vm_info * vm) {
 
 void v3_init_core_telemetry(struct guest_info * core) {
     struct v3_core_telemetry * telemetry = &(core->core_telem);
+    int i = 0;
 
     telemetry->exit_cnt = 0;
     telemetry->vmm_start_tsc = 0;
 
     telemetry->vm_telem = &(core->vm_info->telemetry);
 
-    telemetry->exit_root.rb_node = NULL;
-}
+    // Allocated up front so that the exit path never allocates
+    telemetry->exit_stats = V3_VMalloc(sizeof(struct v3_exit_stats) * V3_TELEMETRY_NUM_EXITS);
 
-void v3_deinit_core_telemetry(struct guest_info * core) {
-    struct rb_node * node = v3_rb_first(&(core->core_telem.exit_root));
-    struct exit_event * evt = NULL;
-
-    while (node) {
-	evt = rb_entry(node, struct exit_event, tree_node);
-	node = v3_rb_next(node);
-
-	free_exit(core, evt);
+    if (!telemetry->exit_stats) {
+	PrintError(core->vm_info, core, "Cannot allocate exit statistics for telemetry\n");
+	return;
     }
-}
 
+    memset(telemetry->exit_stats, 0, sizeof(struct v3_exit_stats) * V3_TELEMETRY_NUM_EXITS);
 
+    for (i = 0; i < V3_TELEMETRY_NUM_EXITS; i++) {
+	telemetry->exit_stats[i].exit_code = i;
+    }
 
-static inline struct exit_event * __insert_event(struct guest_info * info, 
-						 struct exit_event * evt) {
-    struct rb_node ** p = &(info->core_telem.exit_root.rb_node);
-    struct rb_node * parent = NULL;
-    struct exit_event * tmp_evt = NULL;
-
-    while (*p) {
-	parent = *p;
-	tmp_evt = rb_entry(parent, struct exit_event, tree_node);
+    telemetry->exit_stats[V3_TELEMETRY_NPF_SLOT].exit_code = SVM_EXIT_NPF;
+}
 
-	if (evt->exit_code < tmp_evt->exit_code) {
-	    p = &(*p)->rb_left;
-	} else if (evt->exit_code > tmp_evt->exit_code) {
-	    p = &(*p)->rb_right;
-	} else {
-	    return tmp_evt;
-	}
+void v3_deinit_core_telemetry(struct guest_info * core) {
+    if (core->core_telem.exit_stats) {
+	V3_VFree(core->core_telem.exit_stats);
+	core->core_telem.exit_stats = NULL;
     }
-    rb_link_node(&(evt->tree_node), parent, p);
-
-    return NULL;
 }
 
-static inline struct exit_event * insert_event(struct guest_info * info, 
-					       struct exit_event * evt) {
-    struct exit_event * ret;
 
-    if ((ret = __insert_event(info, evt))) {
-	return ret;
+static inline uint32_t get_exit_index(uint_t exit_code) {
+    if (exit_code < V3_TELEMETRY_NPF_SLOT) {
+	return exit_code;
     }
 
-    v3_rb_insert_color(&(evt->tree_node), &(info->core_telem.exit_root));
+    if (exit_code == SVM_EXIT_NPF) {
+	return V3_TELEMETRY_NPF_SLOT;
+    }
 
-    return NULL;
+    return V3_TELEMETRY_NUM_EXITS - 1;
 }
 
 
-static struct exit_event * get_exit(struct guest_info * info, uint_t exit_code) {
-    struct rb_node * n = info->core_telem.exit_root.rb_node;
-    struct exit_event * evt = NULL;
+static inline uint32_t get_hist_bucket(uint64_t cycles) {
+    uint32_t msb = 0;
+    uint32_t bucket = 0;
 
-    while (n) {
-	evt = rb_entry(n, struct exit_event, tree_node);
-    
-	if (exit_code < evt->exit_code) {
-	    n = n->rb_left;
-	} else if (exit_code > evt->exit_code) {
-	    n = n->rb_right;
-	} else {
-	    return evt;
-	}
+    if (cycles < 2) {
+	return cycles;
+    }
+
+    msb = 63 - __builtin_clzll(cycles);
+    bucket = (msb * 2) + ((cycles >> (msb - 1)) & 0x1);
+
+    if (bucket >= V3_TELEMETRY_HIST_BUCKETS) {
+	return V3_TELEMETRY_HIST_BUCKETS - 1;
     }
 
-    return NULL;
+    return bucket;
 }
 
 
-static inline struct exit_event * create_exit(uint_t exit_code) {
-    struct exit_event * evt = V3_Malloc(sizeof(struct exit_event));
+// Returns the upper edge of the bucket containing the requested fraction (in 1/1000ths) of exits
+static uint64_t get_percentile(struct v3_exit_stats * stats, uint32_t per_mille) {
+    uint64_t target = ((stats->cnt * per_mille) + 999) / 1000;
+    uint64_t seen = 0;
+    int i = 0;
 
-    if (!evt) {
-	PrintError(VM_NONE, VCORE_NONE, "Cannot allocate in createing exit in telemetry\n");
-	return NULL;
-    }
+    for (i = 0; i < V3_TELEMETRY_HIST_BUCKETS; i++) {
+	seen += stats->hist[i];
 
-    evt->exit_code = exit_code;
-    evt->cnt = 0;
-    evt->handler_time = 0;
+	if (seen >= target) {
+	    uint64_t edge = 0;
 
-    return evt;
-}
+	    if (i == (V3_TELEMETRY_HIST_BUCKETS - 1)) {
+		return stats->max_time;
+	    }
 
+	    edge = v3_telemetry_bucket_start(i + 1) - 1;
 
+	    return (edge > stats->max_time) ? stats->max_time : edge;
+	}
+    }
 
-static int free_exit(struct guest_info * core, struct exit_event * evt) {
-    v3_rb_erase(&(evt->tree_node), &(core->core_telem.exit_root));
-    V3_Free(evt);
-    return 0;
+    return stats->max_time;
 }
 
 
@@ -190,21 +165,34 @@ void v3_telemetry_start_exit(struct guest_info * info) {
 
 void v3_telemetry_end_exit(struct guest_info * info, uint_t exit_code) {
     struct v3_core_telemetry * telemetry = &(info->core_telem);
-    struct exit_event * evt = NULL;
+    struct v3_exit_stats * stats = NULL;
     uint64_t end_tsc = 0;
+    uint64_t cycles = 0;
 
     rdtscll(end_tsc);
 
-    evt = get_exit(info, exit_code);
+    if (!telemetry->exit_stats) {
+	return;
+    }
+
+    cycles = end_tsc - telemetry->vmm_start_tsc;
+
+    stats = &(telemetry->exit_stats[get_exit_index(exit_code)]);
+
+    stats->exit_code = exit_code;
+    stats->handler_time += cycles;
+
+    if ((stats->cnt == 0) || (cycles < stats->min_time)) {
+	stats->min_time = cycles;
+    }
 
-    if (evt == NULL) {
-	evt = create_exit(exit_code);
-	insert_event(info, evt);
+    if (cycles > stats->max_time) {
+	stats->max_time = cycles;
     }
 
-    evt->handler_time += end_tsc - telemetry->vmm_start_tsc;
+    stats->hist[get_hist_bucket(cycles)]++;
 
-    evt->cnt++;
+    stats->cnt++;
     telemetry->exit_cnt++;
 
 
@@ -216,6 +204,65 @@ void v3_telemetry_end_exit(struct guest_info * info, uint_t exit_code) {
 }
 
 
+v3_telemetry_snapshot * v3_telemetry_take_snapshot(struct v3_vm_info * vm) {
+    v3_telemetry_snapshot * snap = NULL;
+    int i = 0;
+    int j = 0;
+
+    snap = V3_VMalloc(sizeof(v3_telemetry_snapshot) + (sizeof(struct v3_telemetry_core_snap) * vm->num_cores));
+
+    if (!snap) {
+	PrintError(vm, VCORE_NONE, "Cannot allocate telemetry snapshot\n");
+	return NULL;
+    }
+
+    memset(snap, 0, sizeof(v3_telemetry_snapshot) + (sizeof(struct v3_telemetry_core_snap) * vm->num_cores));
+
+    snap->num_cores = vm->num_cores;
+
+    // No locking, the counters may be updated while we copy them
+    for (i = 0; i < vm->num_cores; i++) {
+	struct v3_core_telemetry * telemetry = &(vm->cores[i].core_telem);
+	struct v3_telemetry_core_snap * core_snap = &(snap->core[i]);
+
+	core_snap->vcore = vm->cores[i].vcpu_id;
+	core_snap->exit_cnt = telemetry->exit_cnt;
+
+	if (!telemetry->exit_stats) {
+	    continue;
+	}
+
+	for (j = 0; j < V3_TELEMETRY_NUM_EXITS; j++) {
+	    struct v3_exit_stats * stats = &(telemetry->exit_stats[j]);
+	    struct v3_telemetry_exit_snap * exit_snap = &(core_snap->exits[j]);
+
+	    exit_snap->exit_code = stats->exit_code;
+	    exit_snap->cnt = stats->cnt;
+
+	    if (stats->cnt == 0) {
+		continue;
+	    }
+
+	    exit_snap->total_cycles = stats->handler_time;
+	    exit_snap->min_cycles = stats->min_time;
+	    exit_snap->max_cycles = stats->max_time;
+	    exit_snap->p50_cycles = get_percentile(stats, 500);
+	    exit_snap->p99_cycles = get_percentile(stats, 990);
+	    exit_snap->p999_cycles = get_percentile(stats, 999);
+
+	    memcpy(exit_snap->hist, stats->hist, sizeof(exit_snap->hist));
+	}
+    }
+
+    return snap;
+}
+
+
+void v3_telemetry_free_snapshot(v3_telemetry_snapshot * snap) {
+    V3_VFree(snap);
+}
+
+
 
 
 void v3_add_telemetry_cb(struct v3_vm_info * vm, 
@@ -267,21 +314,25 @@ static void print_telemetry_end(struct v3_vm_info *vm, char *hdr_buf)
 
 static void print_core_telemetry(struct guest_info * core, char *hdr_buf)
 {
-    struct exit_event * evt = NULL;
-    struct rb_node * node = v3_rb_first(&(core->core_telem.exit_root));
+    struct v3_exit_stats * stats = core->core_telem.exit_stats;
+    int printed = 0;
+    int i = 0;
 
     V3_Print(core->vm_info, core, "Exit information for Core %d\n", core->vcpu_id);
     
-    if (!node) { 
+    if (!stats) { 
     	V3_Print(core->vm_info, core, "No information yet for this core\n");
     	return;
     }
 
-    do {
+    for (i = 0; i < V3_TELEMETRY_NUM_EXITS; i++) {
 	extern v3_cpu_arch_t v3_mach_type;
 	const char * code_str = NULL;
-	
-	evt = rb_entry(node, struct exit_event, tree_node);
+	struct v3_exit_stats * evt = &(stats[i]);
+
+	if (evt->cnt == 0) {
+	    continue;
+	}
 
 	switch (v3_mach_type) {
 	    case V3_SVM_CPU:
@@ -299,13 +350,25 @@ static void print_core_telemetry(struct guest_info * core, char *hdr_buf)
 		continue;
 	}
 
-	V3_Print(core->vm_info, core, "%s%s:%sCnt=%u,%sAvg. Time=%u\n", 
+	V3_Print(core->vm_info, core, "%s%s:%sCnt=%llu,%sAvg. Time=%u,\tMin=%llu,\tMax=%llu,\tp50=%llu,\tp99=%llu,\tp999=%llu\n", 
 		 hdr_buf, code_str,
 		 (strlen(code_str) > 13) ? "\t" : "\t\t",
 		 evt->cnt,
 		 (evt->cnt >= 100) ? "\t" : "\t\t",
-		 (uint32_t)(evt->handler_time / evt->cnt));
-    } while ((node = v3_rb_next(node)));
+		 (uint32_t)(evt->handler_time / evt->cnt),
+		 evt->min_time, 
+		 evt->max_time,
+		 get_percentile(evt, 500),
+		 get_percentile(evt, 990),
+		 get_percentile(evt, 999));
+
+	printed++;
+    }
+
+    if (!printed) { 
+    	V3_Print(core->vm_info, core, "No information yet for this core\n");
+    }
+
     return;
 }
 
@@ -986,6 +986,8 @@ int v3_vmx_enter(struct guest_info * info) {
     struct vmx_exit_info exit_info;
     struct vmx_data * vmx_info = (struct vmx_data *)(info->vmm_data);
     uint64_t guest_cycles = 0;
+    uint64_t entry_tsc = 0;
+    uint64_t exit_tsc = 0;
 
     // Conditionally yield the CPU if the timeslice has expired
     v3_schedule(info);
@@ -1005,6 +1007,11 @@ int v3_vmx_enter(struct guest_info * info) {
     v3_advance_time(info, NULL);
     v3_update_timers(info);
 
+    // Entries were cleared from the direct map since the last entry
+    if (info->direct_map_flush.pending) {
+	v3_flush_direct_map(info);
+    }
+
     // disable global interrupts for vm state transition
     v3_disable_ints();
 
@@ -1025,6 +1032,21 @@ int v3_vmx_enter(struct guest_info * info) {
     update_irq_entry_state(info);
 #endif
 
+#ifdef V3_CONFIG_EXIT_TRACE
+    {
+	struct vmx_entry_int_info ent_int;
+	addr_t ent_int_val = 0;
+
+	// the field is 32 bits, vmcs_read stores a full addr_t
+	check_vmcs_read(VMCS_ENTRY_INT_INFO, &ent_int_val);
+	ent_int.value = ent_int_val;
+
+	if (ent_int.valid) {
+	    v3_exit_trace_inject(&(info->exit_trace), ent_int.vector);
+	}
+    }
+#endif
+
     {
 	addr_t guest_cr3;
 	vmcs_read(VMCS_GUEST_CR3, &guest_cr3);
@@ -1055,9 +1077,6 @@ int v3_vmx_enter(struct guest_info * info) {
     V3_FP_ENTRY_RESTORE(info);
 
     {	
-	uint64_t entry_tsc = 0;
-	uint64_t exit_tsc = 0;
-
 #ifdef V3_CONFIG_PWRSTAT_TELEMETRY
 	v3_pwrstat_telemetry_enter(info);
 #endif
@@ -1187,12 +1206,30 @@ int v3_vmx_enter(struct guest_info * info) {
 
     // Conditionally yield the CPU if the timeslice has expired
     v3_schedule(info);
+
+#ifdef V3_CONFIG_LIVE_MIGRATION
+    // Give up part of our time if a migration is waiting for us to converge
+    if (info->vm_info->migrate_throttle_pct) {
+	v3_chkpt_throttle_core(info);
+    }
+#endif
     v3_advance_time(info, NULL);
     v3_update_timers(info);
 
-    if (v3_handle_vmx_exit(info, &exit_info) == -1) {
-	PrintError(info->vm_info, info, "Error in VMX exit handler (Exit reason=%x)\n", exit_info.exit_reason);
-	return -1;
+    {
+#ifdef V3_CONFIG_EXIT_TRACE
+	addr_t exit_rip = info->rip;
+#endif
+
+	if (v3_handle_vmx_exit(info, &exit_info) == -1) {
+	    PrintError(info->vm_info, info, "Error in VMX exit handler (Exit reason=%x)\n", exit_info.exit_reason);
+	    return -1;
+	}
+
+#ifdef V3_CONFIG_EXIT_TRACE
+	v3_exit_trace_record(&(info->exit_trace), exit_info.exit_reason, exit_info.exit_qual, 
+			     exit_rip, entry_tsc, exit_tsc);
+#endif
     }
 
     if (info->timeouts.timeout_active) {
@@ -1397,6 +1434,11 @@ int v3_is_vmx_capable() {
     return 1;
 }
 
+/* Whether EPT can map 1GB leaves, valid once the local cpu is initialized */
+int v3_vmx_ept_1GB_ok() {
+    return hw_info.ept_info.ept_1GB_ok;
+}
+
 
 int v3_reset_vmx_vm_core(struct guest_info * core, addr_t rip) {
     // init vmcs bios
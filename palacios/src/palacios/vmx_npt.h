@@ -53,6 +53,11 @@ static int handle_vmx_invalidate_nested_addr_range(struct guest_info * info,
     PrintError(info->vm_info, info, "Cannot do invalidate nested addr range as VMX is not enabled.\n");
     return -1;
 }
+static int handle_vmx_flush_nested(struct guest_info * info)
+{
+    PrintError(info->vm_info, info, "Cannot flush nested translations as VMX is not enabled.\n");
+    return -1;
+}
 
 #else
 
@@ -157,6 +162,8 @@ static int deinit_ept(struct guest_info * core) {
  
     core->direct_map_pt = 0;
 
+    memset(&(core->direct_map_stats), 0, sizeof(struct v3_direct_map_stats));
+
     return 0;
 }
 
@@ -178,7 +185,7 @@ static int handle_vmx_nested_pagefault(struct guest_info * core, addr_t fault_ad
 {
     struct ept_exit_qual * ept_qual = (struct ept_exit_qual *) pfinfo;
     ept_pml4_t    * pml     = NULL;
-    //    ept_pdp_1GB_t * pdpe1gb = NULL;
+    ept_pdp_1GB_t * pdpe1gb = NULL;
     ept_pdp_t     * pdpe    = NULL;
     ept_pde_2MB_t * pde2mb  = NULL;
     ept_pde_t     * pde     = NULL;
@@ -231,6 +238,56 @@ static int handle_vmx_nested_pagefault(struct guest_info * core, addr_t fault_ad
     }
 
 
+    // Smaller pages mapped earlier in this 1GiB keep their tables
+    if ((page_size == PAGE_SIZE_1GB) && 
+	(pdpe[pdpe_index].read == 1) && (pdpe[pdpe_index].large_page == 0)) {
+	page_size = PAGE_SIZE_2MB;
+    }
+
+    // Fix up the 1GiB PDPE and exit here
+    if (page_size == PAGE_SIZE_1GB) {
+	pdpe1gb = (ept_pdp_1GB_t *)pdpe;
+
+	*actual_start = BASE_TO_PAGE_ADDR_1GB(PAGE_BASE_ADDR_1GB(fault_addr));
+	*actual_end = BASE_TO_PAGE_ADDR_1GB(PAGE_BASE_ADDR_1GB(fault_addr)+1)-1;
+
+	if (pdpe1gb[pdpe_index].read == 0) {
+
+	    if ( (region->flags.alloced == 1) && 
+		 (region->flags.read == 1)) {
+		// Full access
+		pdpe1gb[pdpe_index].large_page = 1;
+		pdpe1gb[pdpe_index].read = 1;
+		pdpe1gb[pdpe_index].exec = 1;
+		pdpe1gb[pdpe_index].ipat = 1;
+		pdpe1gb[pdpe_index].mt = 6;
+
+		if (region->flags.write == 1) {
+		    pdpe1gb[pdpe_index].write = 1;
+		} else {
+		    pdpe1gb[pdpe_index].write = 0;
+		}
+
+		if (v3_gpa_to_hpa(core, fault_addr, &host_addr) == -1) {
+		    PrintError(core->vm_info, core, "Error: Could not translate fault addr (%p)\n", (void *)fault_addr);
+		    return -1;
+		}
+
+		pdpe1gb[pdpe_index].page_base_addr = PAGE_BASE_ADDR_1GB(host_addr);
+		core->direct_map_stats.num_1g++;
+	    } else {
+		return region->unhandled(core, fault_addr, fault_addr, region, error_code);
+	    }
+	} else {
+	    // We fix all permissions on the first pass, 
+	    // so we only get here if its an unhandled exception
+
+	    return region->unhandled(core, fault_addr, fault_addr, region, error_code);
+	}
+
+	return 0;
+    }
+
     // Fix up the PDPE entry
     if (pdpe[pdpe_index].read == 0) {
 	pde = (ept_pde_t *)create_ept_page();
@@ -239,18 +296,26 @@ static int handle_vmx_nested_pagefault(struct guest_info * core, addr_t fault_ad
 	pdpe[pdpe_index].read = 1;
 	pdpe[pdpe_index].write = 1;
 	pdpe[pdpe_index].exec = 1;
+	pdpe[pdpe_index].large_page = 0;   // may have held an invalidated 1GiB page
 
 	pdpe[pdpe_index].pd_base_addr = PAGE_BASE_ADDR_4KB((addr_t)V3_PAddr(pde));
+    } else if (pdpe[pdpe_index].large_page == 1) {
+	// already mapped by a 1GiB page, so this is an unhandled exception
+	return region->unhandled(core, fault_addr, fault_addr, region, error_code);
     } else {
 	pde = V3_VAddr((void *)BASE_TO_PAGE_ADDR_4KB(pdpe[pdpe_index].pd_base_addr));
     }
 
 
+    // 4KiB pages mapped earlier in this 2MiB keep their table
+    if ((page_size == PAGE_SIZE_2MB) && 
+	(pde[pde_index].read == 1) && (pde[pde_index].large_page == 0)) {
+	page_size = PAGE_SIZE_4KB;
+    }
 
     // Fix up the 2MiB PDE and exit here
     if (page_size == PAGE_SIZE_2MB) {
 	pde2mb = (ept_pde_2MB_t *)pde; // all but these two lines are the same for PTE
-	pde2mb[pde_index].large_page = 1;
 
 	*actual_start = BASE_TO_PAGE_ADDR_2MB(PAGE_BASE_ADDR_2MB(fault_addr));
 	*actual_end = BASE_TO_PAGE_ADDR_2MB(PAGE_BASE_ADDR_2MB(fault_addr)+1)-1;
@@ -260,6 +325,7 @@ static int handle_vmx_nested_pagefault(struct guest_info * core, addr_t fault_ad
 	    if ( (region->flags.alloced == 1) && 
 		 (region->flags.read == 1)) {
 		// Full access
+		pde2mb[pde_index].large_page = 1;
 		pde2mb[pde_index].read = 1;
 		pde2mb[pde_index].exec = 1;
 		pde2mb[pde_index].ipat = 1;
@@ -277,6 +343,7 @@ static int handle_vmx_nested_pagefault(struct guest_info * core, addr_t fault_ad
 		}
 
 		pde2mb[pde_index].page_base_addr = PAGE_BASE_ADDR_2MB(host_addr);
+		core->direct_map_stats.num_2m++;
 	    } else {
 		return region->unhandled(core, fault_addr, fault_addr, region, error_code);
 	    }
@@ -300,8 +367,12 @@ static int handle_vmx_nested_pagefault(struct guest_info * core, addr_t fault_ad
 	pde[pde_index].read = 1;
 	pde[pde_index].write = 1;
 	pde[pde_index].exec = 1;
+	pde[pde_index].large_page = 0;   // may have held an invalidated 2MiB page
 
 	pde[pde_index].pt_base_addr = PAGE_BASE_ADDR_4KB((addr_t)V3_PAddr(pte));
+    } else if (pde[pde_index].large_page == 1) {
+	// already mapped by a 2MiB page, so this is an unhandled exception
+	return region->unhandled(core, fault_addr, fault_addr, region, error_code);
     } else {
 	pte = V3_VAddr((void *)BASE_TO_PAGE_ADDR_4KB(pde[pde_index].pt_base_addr));
     }
@@ -335,6 +406,7 @@ static int handle_vmx_nested_pagefault(struct guest_info * core, addr_t fault_ad
 
 
 	    pte[pte_index].page_base_addr = PAGE_BASE_ADDR_4KB(host_addr);
+	    core->direct_map_stats.num_4k++;
 	} else {
 	    return region->unhandled(core, fault_addr, fault_addr, region, error_code);
 	}
@@ -389,6 +461,7 @@ static int handle_vmx_invalidate_nested_addr_internal(struct guest_info *core, a
     *actual_size = PAGE_SIZE_1GB;
     return 0;
   } else if (pdpe[pdpe_index].large_page == 1) { // 1GiB
+    core->direct_map_stats.num_1g--;
     pdpe[pdpe_index].read = 0;
     pdpe[pdpe_index].write = 0;
     pdpe[pdpe_index].exec = 0;
@@ -405,6 +478,7 @@ static int handle_vmx_invalidate_nested_addr_internal(struct guest_info *core, a
     *actual_size = PAGE_SIZE_2MB;
     return 0;
   } else if (pde[pde_index].large_page == 1) { // 2MiB
+    core->direct_map_stats.num_2m--;
     pde[pde_index].read = 0;
     pde[pde_index].write = 0;
     pde[pde_index].exec = 0;
@@ -415,6 +489,10 @@ static int handle_vmx_invalidate_nested_addr_internal(struct guest_info *core, a
 
   pte = V3_VAddr((void*)BASE_TO_PAGE_ADDR(pde[pde_index].pt_base_addr));
   
+  if (pte[pte_index].read == 1) {
+    core->direct_map_stats.num_4k--;
+  }
+
   pte[pte_index].read = 0; // 4KiB
   pte[pte_index].write = 0;
   pte[pte_index].exec = 0;
@@ -440,29 +518,200 @@ static int handle_vmx_invalidate_nested_addr(struct guest_info *core, addr_t inv
 }
 
 
+// Account for the mappings in a table being cut out of the map, and orphan it
+static void orphan_ept_pt(struct guest_info * core, ept_pte_t * pte, struct pt_orphans * orphans) {
+  int i;
+
+  for (i = 0; i < MAX_PTE64_ENTRIES; i++) {
+    if (pte[i].read == 1) {
+      core->direct_map_stats.num_4k--;
+    }
+  }
+
+  orphan_pt_page(orphans, pte);
+}
+
+static void orphan_ept_pd(struct guest_info * core, ept_pde_t * pde, struct pt_orphans * orphans) {
+  int i;
+
+  for (i = 0; i < MAX_PDE64_ENTRIES; i++) {
+    if (pde[i].read == 0) {
+      continue;
+    } else if (pde[i].large_page == 1) {
+      core->direct_map_stats.num_2m--;
+      continue;
+    }
+
+    orphan_ept_pt(core, V3_VAddr((void*)BASE_TO_PAGE_ADDR(pde[i].pt_base_addr)), orphans);
+  }
+
+  orphan_pt_page(orphans, pde);
+}
+
+static void orphan_ept_pdp(struct guest_info * core, ept_pdp_t * pdpe, struct pt_orphans * orphans) {
+  int i;
+
+  for (i = 0; i < MAX_PDPE64_ENTRIES; i++) {
+    if (pdpe[i].read == 0) {
+      continue;
+    } else if (pdpe[i].large_page == 1) {
+      core->direct_map_stats.num_1g--;
+      continue;
+    }
+
+    orphan_ept_pd(core, V3_VAddr((void*)BASE_TO_PAGE_ADDR(pdpe[i].pd_base_addr)), orphans);
+  }
+
+  orphan_pt_page(orphans, pdpe);
+}
+
+
+// One walk over the range.  An entry whose span the range covers is cleared
+// where it is found, and the tables below it are orphaned as a whole
 static int handle_vmx_invalidate_nested_addr_range(struct guest_info *core, 
 						   addr_t inv_addr_start, addr_t inv_addr_end,
 						   addr_t *actual_start, addr_t *actual_end) 
 {
-  addr_t next;
-  addr_t start;
-  uint64_t len;
-  int rc;
-  
-  for (next=inv_addr_start; next<=inv_addr_end; ) {
-    rc = handle_vmx_invalidate_nested_addr_internal(core,next,&start, &len);
-    if (next==inv_addr_start) { 
-      // first iteration, capture where we start invalidating
-      *actual_start = start;
+  struct pt_orphans orphans = {0, 0, 0};
+  ept_pml4_t * pml = NULL;
+  addr_t addr = inv_addr_start;
+
+  *actual_start = inv_addr_start;
+  *actual_end = inv_addr_end;
+
+  pml = (ept_pml4_t *)CR3_TO_PML4E64_VA(core->direct_map_pt);
+
+  // as elsewhere, the read bit stands in for a present bit
+
+  while (addr <= inv_addr_end) {
+    int pml_index = PML4E64_INDEX(addr);
+    addr_t pml_base = BASE_TO_PAGE_ADDR_512GB(PAGE_BASE_ADDR_512GB(addr));
+    addr_t pml_limit = pml_base + PAGE_SIZE_512GB;
+    ept_pdp_t * pdpe = NULL;
+
+    if (pml[pml_index].read == 0) {
+      note_span(pml_base, PAGE_SIZE_512GB, actual_start, actual_end);
+      addr = pml_limit;
+      continue;
     }
-    if (rc) { 
-      return rc;
+
+    pdpe = V3_VAddr((void*)BASE_TO_PAGE_ADDR(pml[pml_index].pdp_base_addr));
+
+    if (span_inside(pml_base, PAGE_SIZE_512GB, inv_addr_start, inv_addr_end)) {
+      orphan_ept_pdp(core, pdpe, &orphans);
+      pml[pml_index].read = 0;
+      pml[pml_index].write = 0;
+      pml[pml_index].exec = 0;
+      addr = pml_limit;
+      continue;
     }
-    next = start + len;
-    *actual_end = next;
+
+    while ((addr <= inv_addr_end) && (addr < pml_limit)) {
+      int pdpe_index = PDPE64_INDEX(addr);
+      addr_t pdpe_base = BASE_TO_PAGE_ADDR_1GB(PAGE_BASE_ADDR_1GB(addr));
+      addr_t pdpe_limit = pdpe_base + PAGE_SIZE_1GB;
+      ept_pde_t * pde = NULL;
+
+      if (pdpe[pdpe_index].read == 0) {
+	note_span(pdpe_base, PAGE_SIZE_1GB, actual_start, actual_end);
+	addr = pdpe_limit;
+	continue;
+      } else if (pdpe[pdpe_index].large_page == 1) { // 1GiB
+	core->direct_map_stats.num_1g--;
+	pdpe[pdpe_index].read = 0;
+	pdpe[pdpe_index].write = 0;
+	pdpe[pdpe_index].exec = 0;
+	note_span(pdpe_base, PAGE_SIZE_1GB, actual_start, actual_end);
+	addr = pdpe_limit;
+	continue;
+      }
+
+      pde = V3_VAddr((void*)BASE_TO_PAGE_ADDR(pdpe[pdpe_index].pd_base_addr));
+
+      if (span_inside(pdpe_base, PAGE_SIZE_1GB, inv_addr_start, inv_addr_end)) {
+	orphan_ept_pd(core, pde, &orphans);
+	pdpe[pdpe_index].read = 0;
+	pdpe[pdpe_index].write = 0;
+	pdpe[pdpe_index].exec = 0;
+	addr = pdpe_limit;
+	continue;
+      }
+
+      while ((addr <= inv_addr_end) && (addr < pdpe_limit)) {
+	int pde_index = PDE64_INDEX(addr);
+	addr_t pde_base = BASE_TO_PAGE_ADDR_2MB(PAGE_BASE_ADDR_2MB(addr));
+	addr_t pde_limit = pde_base + PAGE_SIZE_2MB;
+	ept_pte_t * pte = NULL;
+
+	if (pde[pde_index].read == 0) {
+	  note_span(pde_base, PAGE_SIZE_2MB, actual_start, actual_end);
+	  addr = pde_limit;
+	  continue;
+	} else if (pde[pde_index].large_page == 1) { // 2MiB
+	  core->direct_map_stats.num_2m--;
+	  pde[pde_index].read = 0;
+	  pde[pde_index].write = 0;
+	  pde[pde_index].exec = 0;
+	  note_span(pde_base, PAGE_SIZE_2MB, actual_start, actual_end);
+	  addr = pde_limit;
+	  continue;
+	}
+
+	pte = V3_VAddr((void*)BASE_TO_PAGE_ADDR(pde[pde_index].pt_base_addr));
+
+	if (span_inside(pde_base, PAGE_SIZE_2MB, inv_addr_start, inv_addr_end)) {
+	  orphan_ept_pt(core, pte, &orphans);
+	  pde[pde_index].read = 0;
+	  pde[pde_index].write = 0;
+	  pde[pde_index].exec = 0;
+	  addr = pde_limit;
+	  continue;
+	}
+
+	while ((addr <= inv_addr_end) && (addr < pde_limit)) {
+	  int pte_index = PTE64_INDEX(addr);
+
+	  if (pte[pte_index].read == 1) {
+	    core->direct_map_stats.num_4k--;
+	  }
+
+	  pte[pte_index].read = 0; // 4KiB
+	  pte[pte_index].write = 0;
+	  pte[pte_index].exec = 0;
+
+	  note_span(PAGE_ADDR_4KB(addr), PAGE_SIZE_4KB, actual_start, actual_end);
+	  addr = PAGE_ADDR_4KB(addr) + PAGE_SIZE_4KB;
+	}
+      }
+    }
+  }
+
+  queue_direct_map_flush(core, &orphans);
+
+  return 0;
+}
+
+
+// Drop this core's cached EPT translations, on the core itself
+static int handle_vmx_flush_nested(struct guest_info * core)
+{
+  int ret = VMX_SUCCESS;
+
+  if (!ept_info || !ept_info->INVEPT_avail) {
+    return 0;
   }
-  // last iteration, actual_end is off by one
-  (*actual_end)--;
+
+  if (ept_info->INVEPT_single_ctx_avail) {
+    ret = vmx_invept(VMX_INVEPT_SINGLE_CONTEXT, core->direct_map_pt);
+  } else if (ept_info->INVEPT_all_ctx_avail) {
+    ret = vmx_invept(VMX_INVEPT_ALL_CONTEXT, 0);
+  }
+
+  if (ret != VMX_SUCCESS) {
+    PrintError(core->vm_info, core, "INVEPT failed (%d)\n", ret);
+    return -1;
+  }
+
   return 0;
 }
 